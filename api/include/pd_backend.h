@@ -10,6 +10,8 @@ extern "C" {
 #endif
 
 struct PDMenu;
+struct PDSaveState;
+struct PDLoadState;
 
 #define PD_BACKEND_API_VERSION "ProDBG Backend 1"
 
@@ -93,6 +95,19 @@ typedef enum PDEventType {
     PDEventType_UpdateRegister,
     PDEventType_UpdatePc,
 
+    // Remote protocol (handled by the remote API so backends never see these)
+
+    // First event of a request stream, tags it with a sequence id ("id", u32). The reply to the stream starts with
+    // the same event (with "cancelled" (u8) set if the request was cancelled before it was processed). Ids start at 1
+    PDEventType_RequestSequence,
+
+    // Cancels requests that the target hasn't processed yet ("ids", u32 array)
+    PDEventType_CancelRequests,
+
+    // Sent by the debugger first on each connection with the features it supports ("compression", u32 mask of
+    // compression methods). The target replies with the same event holding the features it will use
+    PDEventType_RemoteCapabilities,
+
     // End of events
 
     PDEventType_End,
@@ -102,6 +117,12 @@ typedef enum PDEventType {
 
 } PDEventType;
 
+// Bit for an event type in an event mask (see PDViewPlugin::event_mask). Events >= 63 (custom events included) all
+// share the top bit
+
+#define PD_EVENT_MASK(event) (1ULL << ((event) < 63 ? (event) : 63))
+#define PD_EVENT_MASK_ALL (~0ULL)
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 typedef struct PDBackendPlugin {
@@ -112,6 +133,13 @@ typedef struct PDBackendPlugin {
     PDMenuHandle (*register_menu)(void* user_data, PDMenuFuncs* menu_funcs);
     PDDebugState (*update)(void* user_data, PDAction action, PDReader* reader, PDWriter* writer);
 
+    // Optional. Called before the plugin is reloaded (destroy_instance is called right after) with what the new
+    // instance needs to carry on. Live handles (sockets, file descriptors, attached process ids) can be written as
+    // ints and handed over instead of closing them in destroy_instance so the debug session survives the reload
+    int (*save_state)(void* user_data, struct PDSaveState* save_state);
+    // Optional. Called on the reloaded instance (right after create_instance) with what save_state wrote
+    int (*load_state)(void* user_data, struct PDLoadState* load_state);
+
 } PDBackendPlugin;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -28,6 +28,17 @@ typedef struct PDSettingsFuncs {
 	uint32_t (*get_shortcut)(const char* plugin_id, const char* operation);
 } PDSettingsFuncs;
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Event counts, sizes and timings of all sessions. dump_json writes (up to size bytes, zero terminated) the stats as
+// JSON and returns the full size of it (without the terminator) so it can be called with size 0 first
+
+#define PDSESSIONSTATS_GLOBAL "Session Stats 1"
+
+typedef struct PDSessionStatsFuncs {
+	uint32_t (*dump_json)(char* dest, uint32_t size);
+	void (*reset)(void);
+} PDSessionStatsFuncs;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #ifdef __cplusplus
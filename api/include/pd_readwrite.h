@@ -36,7 +36,7 @@ typedef enum PDReadType {
     PDReadType_Double,
     // End of the numberic types
     PDReadType_EndNumericTypes,
-    /// const char* string (null terminated)
+    /// const char* string (null terminated, length stored in the stream)
     PDReadType_String,
     /// data array (void*)
     PDReadType_Data,
@@ -46,6 +46,10 @@ typedef enum PDReadType {
     PDReadType_Array,
     /// Array type
     PDReadType_ArrayEntry,
+    /// Array with a predefined structure (stored column by column)
+    PDReadType_HeaderArray,
+    /// Contiguous array of u32/u64/float values
+    PDReadType_TypedArray,
     /// total count of types
     PDReadType_Count
 } PDReadType;
@@ -116,8 +120,6 @@ typedef struct PDWriter {
     PDWriteStatus (*write_event_end)(struct PDWriter* writer);
 
     /**
-     *
-     * NOTICE THAT THIS IS NOT IMPLEMENTED YET.
      *
      * Begins an table with a predefined structure. This is useful when writing
      * a table where all the entries are the same all the time. So in order to save both
@@ -132,8 +134,13 @@ typedef struct PDWriter {
      * If you are unsure about this it's better to use the regular PDWriter::writeBeginArray
      * instead which is more flexible.
      *
+     * The values are stored column by column in the stream (all addresses, then all codes, etc) with the
+     * ids only written once. The type of each column is decided by the first row and the following rows must use
+     * the same types. PDWriter::write_data is not supported inside a header array.
+     *
      * @param write writer object.
-     * @param ids a list of Ids that is terminated by a null string.
+     * @param name key to associate the table with. Use PDReader::read_find_header_array to find it.
+     * @param ids a list of Ids that is terminated by a null string (max 64 ids).
      *
      * \code
      *
@@ -146,7 +153,7 @@ typedef struct PDWriter {
      *
      * ...
      *
-     * PDWrite_header_array_begin(writer, ids);
+     * PDWrite_header_array_begin(writer, "disassembly", ids);
      *
      * for (i to addressCount)
      * {
@@ -159,11 +166,12 @@ typedef struct PDWriter {
      * \endcode
      *
      */
-    PDWriteStatus (*write_header_array_begin)(struct PDWriter* writer, const char** ids);
+    PDWriteStatus (*write_header_array_begin)(struct PDWriter* writer, const char* name, const char** ids);
 
     /**
      *
      * Ends writing of a predefined structure. See PDWriter::write_header_array_begin for more info
+     * Returns PDWriteStatus_Fail if the last row wasn't complete (the missing values will be zero)
      *
      * @param write writer object.
      *
@@ -378,6 +386,69 @@ typedef struct PDWriter {
      */
     PDWriteStatus (*write_data)(struct PDWriter* writer, const char* id, void* data, unsigned int len);
 
+    /**
+     *
+     * Reserves space for data directly in the writer buffer. This allows a backend to read memory from the target
+     * directly into the outgoing stream instead of first reading it to a temporary buffer and then using
+     * PDWriter::write_data. The data has to be committed with PDWriter::write_data_commit before anything else is
+     * written and the returned pointer is only valid until then.
+     *
+     * @param writer writer object
+     * @param id key to associate the data with
+     * @param size max size in bytes that will be written
+     * @return pointer to write the data to or NULL if the space couldn't be reserved
+     *
+     * \code
+     * uint8_t* data = PDWrite_data_reserve(writer, "data", size);
+     * int readSize = readTargetMemory(data, address, size);
+     * PDWrite_data_commit(writer, readSize);
+     * \endcode
+     *
+     */
+    uint8_t* (*write_data_reserve)(struct PDWriter* writer, const char* id, unsigned int size);
+
+    /**
+     *
+     * Commits data reserved with PDWriter::write_data_reserve
+     *
+     * @param writer writer object
+     * @param size number of bytes actually written. Has to be <= the reserved size
+     *
+     */
+    PDWriteStatus (*write_data_commit)(struct PDWriter* writer, unsigned int size);
+
+    /**
+     *
+     * Writes an array of values as one contiguous block (in the native byte order of the writer). This is much
+     * cheaper than writing an array entry for each value when sending large lists of the same type (addresses,
+     * breakpoints, etc). Use PDReader::read_find_u32_array (etc) to read the values back.
+     *
+     * @param writer writer object
+     * @param id key to associate the values with
+     * @param values values to write
+     * @param count number of values
+     *
+     */
+    ///@{
+    PDWriteStatus (*write_u32_array)(struct PDWriter* writer, const char* id, const uint32_t* values, unsigned int count);
+    PDWriteStatus (*write_u64_array)(struct PDWriter* writer, const char* id, const uint64_t* values, unsigned int count);
+    PDWriteStatus (*write_f32_array)(struct PDWriter* writer, const char* id, const float* values, unsigned int count);
+    ///@}
+
+    /**
+     *
+     * Writes a string with a known length to the writer. The string doesn't need to be null terminated (a
+     * terminator is always added in the stream) but it must be valid UTF-8 as readers are allowed to use it
+     * without validating it (see PDReader::read_find_string_len)
+     *
+     * @param writer writer object
+     * @param id key to associate the value with and must be non-NULL unless inside a writerHeaderScope. See PDWriter::write_header_array_begin
+     * @param v value to write
+     * @param len length of the string in bytes (excluding any null terminator)
+     *
+     */
+    PDWriteStatus (*write_string_len)(struct PDWriter* writer, const char* id, const char* v, unsigned int len);
+
 } PDWriter;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -539,6 +610,117 @@ typedef struct PDReader {
      */
     void (*read_dump_data)(struct PDReader* reader);
 
+    /**
+     *
+     * Finds a header array (see PDWriter::write_header_array_begin) within the current scope.
+     *
+     * @param reader The reader object.
+     * @param arrayIt iterator to the header array used with PDReader::read_header_array_column
+     * @param rowCount number of rows in the header array
+     * @param id name of the header array
+     * @return Same as PDReader::read_find_s8
+     *
+     */
+    uint32_t (*read_find_header_array)(struct PDReader* reader, PDReaderIterator* arrayIt, uint32_t* rowCount,
+                                       const char* id, PDReaderIterator it);
+
+    /**
+     *
+     * Finds a column in a header array. The column iterator can then be used to read the values of each row
+     * without doing any more lookups.
+     *
+     * @param reader The reader object.
+     * @param columnIt iterator to the column
+     * @param id id of the column (as given to PDWriter::write_header_array_begin)
+     * @param arrayIt iterator from PDReader::read_find_header_array
+     * @return Lower 8-bit is the type of the column. Upper 8-bit is the PDReadStatus
+     *
+     * \code
+     * PDReaderIterator arrayIt, addressIt, lineIt;
+     * uint32_t rowCount;
+     *
+     * PDRead_find_header_array(reader, &arrayIt, &rowCount, "disassembly", 0);
+     * PDRead_header_array_column(reader, &addressIt, "address", arrayIt);
+     * PDRead_header_array_column(reader, &lineIt, "line", arrayIt);
+     *
+     * for (uint32_t i = 0; i < rowCount; ++i) {
+     *     uint64_t address;
+     *     const char* line;
+     *     PDRead_column_u64(reader, &address, addressIt, i);
+     *     PDRead_column_string(reader, &line, lineIt, i);
+     * }
+     * \endcode
+     *
+     */
+    uint32_t (*read_header_array_column)(struct PDReader* reader, PDReaderIterator* columnIt, const char* id,
+                                         PDReaderIterator arrayIt);
+
+    /**
+     *
+     * Reads the value at the given row of a header array column. Integer columns (sign extended) can be read
+     * with read_column_u64, float and double columns with read_column_double and string columns with
+     * read_column_string. Reading with a type that doesn't match the column returns PDReadStatus_Converted
+     * (for integer/float conversions) or PDReadStatus_IllegalType.
+     *
+     */
+    ///@{
+    uint32_t (*read_column_u64)(struct PDReader* reader, uint64_t* res, PDReaderIterator columnIt, uint32_t row);
+    uint32_t (*read_column_double)(struct PDReader* reader, double* res, PDReaderIterator columnIt, uint32_t row);
+    uint32_t (*read_column_string)(struct PDReader* reader, const char** res, PDReaderIterator columnIt, uint32_t row);
+    ///@}
+
+    /**
+     *
+     * Finds an array written with PDWriter::write_u32_array (etc). The values points directly into the stream
+     * (aligned to the size of the type) and stays valid until the reader is reset. If the array was written with
+     * a different byte order it will be swapped in place the first time it's found.
+     *
+     * @param reader The reader object.
+     * @param values pointer to the values
+     * @param count number of values
+     * @param id key to search for
+     * @return Same as PDReader::read_find_s8. The type is PDReadType_TypedArray
+     *
+     */
+    ///@{
+    uint32_t (*read_find_u32_array)(struct PDReader* reader, const uint32_t** values, uint32_t* count, const char* id, PDReaderIterator it);
+    uint32_t (*read_find_u64_array)(struct PDReader* reader, const uint64_t** values, uint32_t* count, const char* id, PDReaderIterator it);
+    uint32_t (*read_find_f32_array)(struct PDReader* reader, const float** values, uint32_t* count, const char* id, PDReaderIterator it);
+    ///@}
+
+    /**
+     *
+     * Same as read_find_string and read_column_string but also returns the length of the string (stored in the
+     * stream so no need to call strlen)
+     *
+     * @param reader reader object
+     * @param res pointer to the (null terminated) string
+     * @param length length of the string in bytes
+     * @param isUtf8 set to 1 if the writer guarantees that the string is valid UTF-8 (only for streams written in
+     *        the same process), otherwise 0 (in that case the string may still be valid UTF-8 but it hasn't been
+     *        checked)
+     *
+     */
+    ///@{
+    uint32_t (*read_find_string_len)(struct PDReader* reader, const char** res, uint32_t* length, int* isUtf8, const char* id, PDReaderIterator it);
+    uint32_t (*read_column_string_len)(struct PDReader* reader, const char** res, uint32_t* length, int* isUtf8, PDReaderIterator columnIt, uint32_t row);
+    ///@}
+
+    /**
+     *
+     * Same as the read_find_* functions for numeric types but with the hash of the id already calculated by the
+     * caller so it doesn't need to be done for each lookup (the Rust API uses this for ids created with key!())
+     *
+     * @param reader reader object
+     * @param res pointer to a value of the type given by type
+     * @param type type of res (PDReadType_S8 to PDReadType_Double)
+     * @param id string of the identifier to search for
+     * @param hash 32-bit FNV-1a hash of id (without the null terminator)
+     * @param it iterator to search from (0 to search the current event)
+     *
+     */
+    uint32_t (*read_find_key)(struct PDReader* reader, void* res, uint32_t type, const char* id, uint32_t hash, PDReaderIterator it);
+
 } PDReader;
 
 
@@ -550,7 +732,7 @@ typedef struct PDReader {
 
 #define PDWrite_event_begin(w, e) w->write_event_begin(w, e)
 #define PDWrite_event_end(w) w->write_event_end(w)
-#define PDWrite_header_array_begin(w, ids) w->write_header_array_begin(w, ids)
+#define PDWrite_header_array_begin(w, name, ids) w->write_header_array_begin(w, name, ids)
 #define PDWrite_header_array_end(w) w->write_header_array_end(w)
 #define PDWrite_array_begin(w, name) w->write_array_begin(w, name)
 #define PDWrite_array_end(w) w->write_array_end(w)
@@ -568,6 +750,12 @@ typedef struct PDReader {
 #define PDWrite_double(w, id, v) w->write_double(w, id, v)
 #define PDWrite_string(w, id, v) w->write_string(w, id, v)
 #define PDWrite_data(w, id, data, len) w->write_data(w, id, data, len)
+#define PDWrite_data_reserve(w, id, size) w->write_data_reserve(w, id, size)
+#define PDWrite_data_commit(w, size) w->write_data_commit(w, size)
+#define PDWrite_u32_array(w, id, values, count) w->write_u32_array(w, id, values, count)
+#define PDWrite_u64_array(w, id, values, count) w->write_u64_array(w, id, values, count)
+#define PDWrite_f32_array(w, id, values, count) w->write_f32_array(w, id, values, count)
+#define PDWrite_string_len(w, id, v, len) w->write_string_len(w, id, v, len)
 
 /**
  *
@@ -593,6 +781,17 @@ typedef struct PDReader {
 #define PDRead_find_data(r, res, size, id, it) r->read_find_data(r, res, size, id, it)
 #define PDRead_find_array(r, arrayIt, id, it) r->read_find_array(r, arrayIt, id, it)
 #define PDRead_dump_data(r) r->read_dump_data(r)
+#define PDRead_find_header_array(r, arrayIt, rowCount, id, it) r->read_find_header_array(r, arrayIt, rowCount, id, it)
+#define PDRead_header_array_column(r, columnIt, id, arrayIt) r->read_header_array_column(r, columnIt, id, arrayIt)
+#define PDRead_column_u64(r, res, columnIt, row) r->read_column_u64(r, res, columnIt, row)
+#define PDRead_column_double(r, res, columnIt, row) r->read_column_double(r, res, columnIt, row)
+#define PDRead_column_string(r, res, columnIt, row) r->read_column_string(r, res, columnIt, row)
+#define PDRead_find_u32_array(r, values, count, id, it) r->read_find_u32_array(r, values, count, id, it)
+#define PDRead_find_u64_array(r, values, count, id, it) r->read_find_u64_array(r, values, count, id, it)
+#define PDRead_find_f32_array(r, values, count, id, it) r->read_find_f32_array(r, values, count, id, it)
+#define PDRead_find_string_len(r, res, length, isUtf8, id, it) r->read_find_string_len(r, res, length, isUtf8, id, it)
+#define PDRead_column_string_len(r, res, length, isUtf8, columnIt, row) r->read_column_string_len(r, res, length, isUtf8, columnIt, row)
+#define PDRead_find_key(r, res, type, id, hash, it) r->read_find_key(r, res, type, id, hash, it)
 
 #ifdef __cplusplus
 }
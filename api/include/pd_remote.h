@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 struct PDBackendPlugin;
+struct PDRemoteInstance;
 
 /**
  * \brief Create the listener that is used to connect to ProDBG
@@ -14,6 +15,12 @@ struct PDBackendPlugin;
  * to ProDBG. This needs to be called before any debugging is possible.
  * This code will also verify that @p plugin is valid.
  *
+ * The listener is on port 1340 unless the PDREMOTE_ADDRESS environment variable is set which then selects the
+ * transport (see PDRemote_createInstanceAddress). Local targets can use a Unix domain socket or shared memory
+ * which has less overhead than tcp.
+ *
+ * Large data fields (such as memory) written by the plugin are compressed when the debugger supports it.
+ *
  * \param plugin Pointer to a backend plugin. This needs to be filled in according to the doc of PDBackendPlugin
  * \param waitForConnection Number of seconds to wait for a connection from the Debugger. 0 if no waiting
  * \return returns 1 on success otherwise 0
@@ -53,6 +60,48 @@ int PDRemote_update(int sleepTime);
 
 int PDRemote_isConnected();
 
+/**
+ * \brief Handle the connection on a background thread
+ *
+ * Instead of the target calling PDRemote_update often (which polls the socket) a service thread takes care of the
+ * connection. The thread only receives and sends data: the plugin is still updated on the target thread when it calls
+ * PDRemote_update, which it only needs to do when the pending flag (see PDRemote_getPendingFlag) is set. The target
+ * can check the flag in its execution loop (such as for each emulated instruction) as it's only a memory read.
+ *
+ * When the target is stopped (waiting for the debugger) PDRemote_update(sleepTime) waits until something arrives.
+ *
+ * \return 1 if the thread was started, 0 otherwise (PDRemote_update then works as usual)
+ */
+
+int PDRemote_startServiceThread();
+
+/**
+ * \brief Get the flag that is set when the service thread has received something for the target
+ *
+ * The flag is cleared by PDRemote_update. Check it with PDRemote_isPending:
+ *
+ * \code
+ * const volatile int* pending = PDRemote_getPendingFlag();
+ *
+ * for (;;) {
+ *     executeInstruction();
+ *
+ *     if (PDRemote_isPending(pending))
+ *         PDRemote_update(0);
+ * }
+ * \endcode
+ *
+ * \return pointer to the flag or NULL if there is no service thread
+ */
+
+const volatile int* PDRemote_getPendingFlag();
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PDRemote_isPending(flag) (__atomic_load_n((flag), __ATOMIC_RELAXED) != 0)
+#else
+#define PDRemote_isPending(flag) (*(flag) != 0)
+#endif
+
 /**
  * \brief Destroys the current connection and listener server.
  *
@@ -63,6 +112,72 @@ int PDRemote_isConnected();
 
 void PDRemote_destroy();
 
+/**
+ * \brief Create a target with its own listener
+ *
+ * The functions above handle one target on port 1340. Processes that has several targets (such as a batch of
+ * emulated CPUs) can create one instance for each of them. Instances share no state so different instances can be
+ * updated from different threads (but each instance from only one thread at a time).
+ *
+ * \param plugin Pointer to a backend plugin. This needs to be filled in according to the doc of PDBackendPlugin
+ * \param port The port to listen on for the debugger
+ * \return the new instance or NULL if the listener couldn't be created
+ */
+
+struct PDRemoteInstance* PDRemote_createInstance(struct PDBackendPlugin* plugin, int port);
+
+/**
+ * \brief Create a target with its own listener on the given address
+ *
+ * The address selects the transport:
+ *
+ * "tcp:<port>" (or only "<port>") listens on a tcp port
+ * "unix:<path>" listens on a Unix domain socket (not on Windows)
+ * "shm:<name>" uses a shared memory ring buffer (Linux only). Only for a debugger on the same machine
+ *
+ * The debugger connects using the same address (with the host added for tcp, "tcp:<host>:<port>")
+ *
+ * \return the new instance or NULL if the listener couldn't be created
+ */
+
+struct PDRemoteInstance* PDRemote_createInstanceAddress(struct PDBackendPlugin* plugin, const char* address);
+
+/**
+ * \brief Same as PDRemote_update but for an instance
+ */
+
+int PDRemote_updateInstance(struct PDRemoteInstance* instance, int sleepTime);
+
+/**
+ * \brief Same as PDRemote_isConnected but for an instance
+ */
+
+int PDRemote_isInstanceConnected(struct PDRemoteInstance* instance);
+
+/**
+ * \brief Same as PDRemote_startServiceThread but for an instance
+ */
+
+int PDRemote_startInstanceThread(struct PDRemoteInstance* instance);
+
+/**
+ * \brief Stops the service thread of the instance (PDRemote_updateInstance then handles the connection directly again)
+ */
+
+void PDRemote_stopInstanceThread(struct PDRemoteInstance* instance);
+
+/**
+ * \brief Same as PDRemote_getPendingFlag but for an instance
+ */
+
+const volatile int* PDRemote_getInstancePendingFlag(struct PDRemoteInstance* instance);
+
+/**
+ * \brief Closes the sockets of the instance (stopping its service thread if it has one) and frees it
+ */
+
+void PDRemote_destroyInstance(struct PDRemoteInstance* instance);
+
 #ifdef __cplusplus
 }
 #endif
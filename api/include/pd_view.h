@@ -34,6 +34,10 @@ typedef struct PDViewPlugin {
 	int (*save_state)(void* user_data, struct PDSaveState* save_state);
 	int (*load_state)(void* user_data, struct PDLoadState* load_state);
 
+    // Optional. Returns the events (PD_EVENT_MASK bits) the view handles. Other events are skipped by the reader
+    // passed to update. If not set the view gets all events
+    uint64_t (*event_mask)(void* user_data);
+
 } PDViewPlugin;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
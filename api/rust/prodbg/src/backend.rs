@@ -2,6 +2,7 @@ use read_write::*;
 use service::*;
 use std::os::raw::{c_uchar, c_int, c_void};
 use menu_service::{MenuFuncs, CMenuFuncs1};
+use io::{CPDSaveState, CPDLoadState};
 use std::mem::transmute;
 
 
@@ -60,6 +61,10 @@ pub enum EventType {
     UpdateRegister,
     UpdatePc,
 
+    RequestSequence,
+    CancelRequests,
+    RemoteCapabilities,
+
     // End of events
 
     End,
@@ -88,6 +93,8 @@ pub struct CBackendCallbacks {
                           a: c_int,
                           ra: *mut c_void,
                           wa: *mut c_void)>,
+    pub save_state: Option<fn(*mut c_void, api: *mut CPDSaveState)>,
+    pub load_state: Option<fn(*mut c_void, api: *mut CPDLoadState)>,
 }
 
 unsafe impl Sync for CBackendCallbacks {}
@@ -144,7 +151,9 @@ macro_rules! define_backend_plugin {
             create_instance: Some(prodbg_api::backend::create_backend_instance::<$x>),
             destroy_instance: Some(prodbg_api::backend::destroy_backend_instance::<$x>),
             register_menu: Some(prodbg_api::backend::register_backend_menu::<$x>),
-            update: Some(prodbg_api::backend::update_backend_instance::<$x>)
+            update: Some(prodbg_api::backend::update_backend_instance::<$x>),
+            save_state: None,
+            load_state: None,
         };
     }
 }
@@ -59,3 +59,17 @@ pub const PDEVENT_UPDATE_MEMORY: i32 = 37;
 pub const PDEVENT_UPDATE_REGISTER: i32 = 38;
 pub const PDEVENT_UPDATE_PC: i32 = 39;
 
+pub const EVENT_REQUEST_SEQUENCE: i32 = 40;
+pub const EVENT_CANCEL_REQUESTS: i32 = 41;
+pub const EVENT_REMOTE_CAPABILITIES: i32 = 42;
+
+/// Compression methods for EVENT_REMOTE_CAPABILITIES ("compression")
+pub const REMOTE_COMPRESSION_LZ: u32 = 1;
+
+/// All events (the default for views that doesn't specify an event mask)
+pub const EVENT_MASK_ALL: u64 = !0;
+
+/// Builds an event mask from a list of events. Events >= 63 (custom events included) share the top bit
+pub fn event_mask(events: &[i32]) -> u64 {
+    events.iter().fold(0, |mask, &event| mask | (1u64 << if event < 63 { event } else { 63 }))
+}
@@ -17,6 +17,7 @@ pub struct CPDSaveState {
     pub write_string: fn(priv_data: *mut c_void, data: *const c_char),
 }
 
+#[repr(C)]
 pub struct CPDLoadState {
     pub priv_data: *mut c_void,
     pub read_int: fn(priv_data: *mut c_void, dest: *mut i64) -> LoadState,
@@ -19,6 +19,7 @@ pub mod io;
 pub mod events;
 pub mod capstone_m68k;
 pub mod scintilla;
+pub mod session_stats;
 
 pub use backend::*;
 pub use read_write::*;
@@ -34,4 +35,5 @@ pub use io::*;
 pub use menu_service::*;
 pub use events::*;
 pub use id_register::*;
+pub use session_stats::*;
 
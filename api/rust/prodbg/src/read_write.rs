@@ -2,6 +2,8 @@ use std::mem::transmute;
 use std::slice;
 use std::str;
 use std::os::raw::*;
+use std::ptr;
+use std::sync::atomic::{AtomicUsize, Ordering};
 use CFixedString;
 
 #[repr(C)]
@@ -44,6 +46,29 @@ pub struct CPDReaderAPI {
     pub read_find_array: extern fn(reader: *mut c_void, arrayIt: *mut c_ulonglong, id: *const c_char,
                                    it: c_ulonglong) -> c_uint,
     pub read_dump_data: extern fn(reader: *mut c_void),
+    pub read_find_header_array: extern fn(reader: *mut c_void, arrayIt: *mut c_ulonglong,
+                                          rowCount: *mut c_uint, id: *const c_char,
+                                          it: c_ulonglong) -> c_uint,
+    pub read_header_array_column: extern fn(reader: *mut c_void, columnIt: *mut c_ulonglong,
+                                            id: *const c_char, arrayIt: c_ulonglong) -> c_uint,
+    pub read_column_u64: extern fn(reader: *mut c_void, res: *mut c_ulonglong,
+                                   columnIt: c_ulonglong, row: c_uint) -> c_uint,
+    pub read_column_double: extern fn(reader: *mut c_void, res: *mut c_double,
+                                      columnIt: c_ulonglong, row: c_uint) -> c_uint,
+    pub read_column_string: extern fn(reader: *mut c_void, res: *mut *const c_char,
+                                      columnIt: c_ulonglong, row: c_uint) -> c_uint,
+    pub read_find_u32_array: extern fn(reader: *mut c_void, values: *mut *const c_uint, count: *mut c_uint,
+                                       id: *const c_char, it: c_ulonglong) -> c_uint,
+    pub read_find_u64_array: extern fn(reader: *mut c_void, values: *mut *const c_ulonglong,
+                                       count: *mut c_uint, id: *const c_char, it: c_ulonglong) -> c_uint,
+    pub read_find_f32_array: extern fn(reader: *mut c_void, values: *mut *const c_float, count: *mut c_uint,
+                                       id: *const c_char, it: c_ulonglong) -> c_uint,
+    pub read_find_string_len: extern fn(reader: *mut c_void, res: *mut *const c_char, length: *mut c_uint,
+                                        is_utf8: *mut c_int, id: *const c_char, it: c_ulonglong) -> c_uint,
+    pub read_column_string_len: extern fn(reader: *mut c_void, res: *mut *const c_char, length: *mut c_uint,
+                                          is_utf8: *mut c_int, columnIt: c_ulonglong, row: c_uint) -> c_uint,
+    pub read_find_key: extern fn(reader: *mut c_void, res: *mut c_void, read_type: c_uint, id: *const c_char,
+                                 hash: c_uint, it: c_ulonglong) -> c_uint,
 }
 
 #[repr(C)]
@@ -57,8 +82,8 @@ pub struct CPDWriterAPI {
     private_data: *mut c_void,
     pub write_event_begin: extern "C" fn(writer: *mut c_void, event: c_ushort) -> WriteStatus,
     pub write_event_end: extern fn(writer: *mut c_void) -> WriteStatus,
-    pub write_header_array_begin: extern fn(writer: *mut c_void, ids: *mut *const c_char)
-                                         -> WriteStatus,
+    pub write_header_array_begin: extern fn(writer: *mut c_void, name: *const c_char,
+                                            ids: *mut *const c_char) -> WriteStatus,
     pub write_header_array_end: extern fn(writer: *mut c_void) -> WriteStatus,
     pub write_array_begin: extern fn(writer: *mut c_void, name: *const c_char) -> WriteStatus,
     pub write_array_end: extern fn(writer: *mut c_void) -> WriteStatus,
@@ -78,6 +103,16 @@ pub struct CPDWriterAPI {
                              -> WriteStatus,
     pub write_data: extern fn(w: *mut c_void, id: *const c_char, d: *const c_uchar, l: c_uint)
                             -> WriteStatus,
+    pub write_data_reserve: extern fn(w: *mut c_void, id: *const c_char, size: c_uint) -> *mut c_uchar,
+    pub write_data_commit: extern fn(w: *mut c_void, size: c_uint) -> WriteStatus,
+    pub write_u32_array: extern fn(w: *mut c_void, id: *const c_char, values: *const c_uint, count: c_uint)
+                                 -> WriteStatus,
+    pub write_u64_array: extern fn(w: *mut c_void, id: *const c_char, values: *const c_ulonglong,
+                                   count: c_uint) -> WriteStatus,
+    pub write_f32_array: extern fn(w: *mut c_void, id: *const c_char, values: *const c_float, count: c_uint)
+                                 -> WriteStatus,
+    pub write_string_len: extern fn(w: *mut c_void, id: *const c_char, v: *const c_char, len: c_uint)
+                                  -> WriteStatus,
 }
 
 pub struct Reader {
@@ -108,6 +143,8 @@ pub enum ReadType {
     Event,
     Array,
     ArrayEntry,
+    HeaderArray,
+    TypedArray,
     Count,
 }
 
@@ -130,6 +167,19 @@ pub struct EventIter {
     reader: Reader,
 }
 
+/// Table written with Writer::header_array_begin. Values are stored per column so look up the columns once
+/// and then read the rows from them.
+pub struct HeaderArray {
+    reader: Reader,
+    it: u64,
+    rows: u32,
+}
+
+pub struct Column {
+    reader: Reader,
+    it: u64,
+}
+
 impl Clone for Reader {
     fn clone(&self) -> Self {
         return Reader {
@@ -139,6 +189,100 @@ impl Clone for Reader {
     }
 }
 
+/// Id created with the key! macro. The id is stored with a null terminator and the hash the reader uses for lookups
+/// is calculated once (on first use) so keys can be used in hot loops without any string conversion per call.
+pub struct StreamKey {
+    #[doc(hidden)]
+    pub id: &'static str,
+    #[doc(hidden)]
+    pub hash: AtomicUsize,
+}
+
+/// Creates a static StreamKey from a string literal
+///
+/// ```ignore
+/// for entry in reader.find_array("disassembly") {
+///     let address = entry.find_u64(key!("address"));
+/// }
+/// ```
+#[macro_export]
+macro_rules! key {
+    ($id:expr) => {{
+        #[allow(deprecated)]
+        static KEY: $crate::read_write::StreamKey = $crate::read_write::StreamKey {
+            id: concat!($id, "\0"),
+            hash: ::std::sync::atomic::ATOMIC_USIZE_INIT,
+        };
+        &KEY
+    }}
+}
+
+impl StreamKey {
+    pub fn as_str(&self) -> &str {
+        &self.id[..self.id.len() - 1]
+    }
+
+    pub fn hash(&self) -> u32 {
+        let hash = self.hash.load(Ordering::Relaxed);
+
+        if hash != 0 {
+            return hash as u32;
+        }
+
+        let hash = hash_id(self.as_str());
+        self.hash.store(hash as usize, Ordering::Relaxed);
+        hash
+    }
+}
+
+/// FNV-1a (has to match the hash used by the reader in pd_binary_reader.c)
+fn hash_id(id: &str) -> u32 {
+    let mut hash = 2166136261u32;
+
+    for b in id.bytes() {
+        hash ^= b as u32;
+        hash = hash.wrapping_mul(16777619);
+    }
+
+    hash
+}
+
+/// Ids for the find/write functions can either be a &str (converted to a C string on each call) or a
+/// StreamKey created with key!
+pub trait StreamId {
+    #[doc(hidden)]
+    fn with_id<R, F: FnOnce(*const c_char, u32) -> R>(&self, f: F) -> R;
+}
+
+impl<'a> StreamId for &'a str {
+    #[inline]
+    fn with_id<R, F: FnOnce(*const c_char, u32) -> R>(&self, f: F) -> R {
+        let s = CFixedString::from_str(*self);
+        f(s.as_ptr(), 0)
+    }
+}
+
+impl<'a> StreamId for &'a StreamKey {
+    #[inline]
+    fn with_id<R, F: FnOnce(*const c_char, u32) -> R>(&self, f: F) -> R {
+        f(self.id.as_ptr() as *const c_char, self.hash())
+    }
+}
+
+/// Strings are stored with their length so no need to scan for the terminator. Strings the writer knows are
+/// UTF-8 (all strings written from Rust and ASCII strings from C) are returned without validating them again but
+/// only if the stream was written in this process (is_utf8 is never set for streams from a remote target or a
+/// capture, see pd_binary_reader_set_trust_utf8).
+unsafe fn str_from_stream<'a>(s: *const c_char, length: u32, is_utf8: c_int) -> Option<&'a str> {
+    let slice = slice::from_raw_parts(s as *const u8, length as usize);
+
+    if is_utf8 != 0 {
+        Some(str::from_utf8_unchecked(slice))
+    } else {
+        str::from_utf8(slice).ok()
+    }
+}
+
 fn status_res<T>(res: T, s: u32) -> Result<T, ReadStatus> {
     match (s >> 8) & 0xff {
         1...2 => Ok(res),
@@ -148,21 +292,45 @@ fn status_res<T>(res: T, s: u32) -> Result<T, ReadStatus> {
 }
 
 macro_rules! find_fun {
-    ($c_name:ident, $name:ident, $data_type:ident) => {
-        pub fn $name(&self, id: &str) -> Result<$data_type, ReadStatus> {
-            let s = CFixedString::from_str(id).as_ptr();
+    ($c_name:ident, $name:ident, $data_type:ident, $read_type:expr) => {
+        pub fn $name<I: StreamId>(&self, id: I) -> Result<$data_type, ReadStatus> {
             let mut res = 0 as $data_type;
-            let ret;
 
-            unsafe {
-                ret = ((*self.api).$c_name)(transmute(self.api), &mut res, s, self.it);
-            }
+            let ret = id.with_id(|s, hash| unsafe {
+                if hash != 0 {
+                    ((*self.api).read_find_key)(transmute(self.api), &mut res as *mut $data_type as *mut c_void,
+                                                $read_type as u32, s, hash, self.it)
+                } else {
+                    ((*self.api).$c_name)(transmute(self.api), &mut res, s, self.it)
+                }
+            });
 
             return status_res(res, ret);
         }
     }
 }
 
+macro_rules! find_array_fun {
+    ($c_name:ident, $name:ident, $data_type:ident) => {
+        pub fn $name<I: StreamId>(&self, id: I) -> Result<&[$data_type], ReadStatus> {
+            let mut values = 0 as *const $data_type;
+            let mut count = 0u32;
+
+            unsafe {
+                let ret = id.with_id(|s, _| {
+                    ((*self.api).$c_name)(transmute(self.api), &mut values, &mut count, s, self.it)
+                });
+
+                if (ret >> 8) & 0xff != 1 {
+                    return status_res(&[][..], ret);
+                }
+
+                status_res(slice::from_raw_parts(values, count as usize), ret)
+            }
+        }
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 impl Reader {
@@ -190,73 +358,146 @@ impl Reader {
         }
     }
 
-    find_fun!(read_find_s8, find_s8, i8);
-    find_fun!(read_find_u8, find_u8, u8);
-    find_fun!(read_find_s16, find_s16, i16);
-    find_fun!(read_find_u16, find_u16, u16);
-    find_fun!(read_find_s32, find_s32, i32);
-    find_fun!(read_find_u32, find_u32, u32);
-    find_fun!(read_find_s64, find_s64, i64);
-    find_fun!(read_find_u64, find_u64, u64);
-    find_fun!(read_find_float, find_float, f32);
-    find_fun!(read_find_double, find_double, f64);
-
-    unsafe fn strlen(t: *const i8) -> usize{
-        // very lange slice so this is kinda hacky but should work
-        let slice = slice::from_raw_parts(t, 16834);
-        let mut count = 0;
-
-        loop {
-            if slice[count] == 0 { break; }
-            count += 1;
-        }
-
-        count
-    }
-
-    pub fn find_string(&self, id: &str) -> Result<&str, ReadStatus> {
-        let s = CFixedString::from_str(id).as_ptr();
+    find_fun!(read_find_s8, find_s8, i8, ReadType::S8);
+    find_fun!(read_find_u8, find_u8, u8, ReadType::U8);
+    find_fun!(read_find_s16, find_s16, i16, ReadType::S16);
+    find_fun!(read_find_u16, find_u16, u16, ReadType::U16);
+    find_fun!(read_find_s32, find_s32, i32, ReadType::S32);
+    find_fun!(read_find_u32, find_u32, u32, ReadType::U32);
+    find_fun!(read_find_s64, find_s64, i64, ReadType::S64);
+    find_fun!(read_find_u64, find_u64, u64, ReadType::U64);
+    find_fun!(read_find_float, find_float, f32, ReadType::Float);
+    find_fun!(read_find_double, find_double, f64, ReadType::Double);
+
+    find_array_fun!(read_find_u32_array, find_u32_array, u32);
+    find_array_fun!(read_find_u64_array, find_u64_array, u64);
+    find_array_fun!(read_find_f32_array, find_f32_array, f32);
+
+    pub fn find_string<I: StreamId>(&self, id: I) -> Result<&str, ReadStatus> {
         let mut temp = 0 as *const c_char;
+        let mut length = 0;
+        let mut is_utf8 = 0;
         let ret;
         let mut res = "";
 
         unsafe {
-            ret = ((*self.api).read_find_string)(transmute(self.api), &mut temp, s, self.it);
-            let t = (ret >> 8) & 0xff;
-            if t == 1 {
-                let slice = slice::from_raw_parts(temp as *const u8, Self::strlen(temp));
-                res = str::from_utf8(slice).unwrap();
+            ret = id.with_id(|s, _| {
+                ((*self.api).read_find_string_len)(transmute(self.api), &mut temp, &mut length, &mut is_utf8, s,
+                                                   self.it)
+            });
+
+            if (ret >> 8) & 0xff == 1 {
+                match str_from_stream(temp, length, is_utf8) {
+                    Some(v) => res = v,
+                    None => return Err(ReadStatus::Fail),
+                }
             }
         }
 
         return status_res(res, ret);
     }
 
-    pub fn find_data(&self, id: &str) -> Result<&[u8], ReadStatus> {
-        let s = CFixedString::from_str(id).as_ptr();
+    pub fn find_data<I: StreamId>(&self, id: I) -> Result<&[u8], ReadStatus> {
         let mut temp = 0 as *mut c_void;
         let mut size = 0 as c_ulonglong;
 
         unsafe {
-            let ret = ((*self.api).read_find_data)(transmute(self.api), &mut temp, &mut size, s, self.it);
+            let ret = id.with_id(|s, _| {
+                ((*self.api).read_find_data)(transmute(self.api), &mut temp, &mut size, s, self.it)
+            });
             let slice = slice::from_raw_parts(temp as *const u8, size as usize);
             status_res(slice, ret)
         }
     }
 
-    pub fn find_array(&self, id: &str) -> ReaderIter {
-        let s = CFixedString::from_str(id).as_ptr();
+    pub fn find_array<I: StreamId>(&self, id: I) -> ReaderIter {
         let mut t = 0u64;
 
-        unsafe {
-            ((*self.api).read_find_array)(transmute(self.api), &mut t, s, 0);
-        }
+        id.with_id(|s, _| unsafe {
+            ((*self.api).read_find_array)(transmute(self.api), &mut t, s, 0)
+        });
 
         ReaderIter {
             reader: self.clone(),
             curr_iter: t,
         }
     }
+
+    pub fn find_header_array(&self, id: &str) -> Option<HeaderArray> {
+        let s = CFixedString::from_str(id);
+        let mut t = 0u64;
+        let mut rows = 0u32;
+
+        let ret = unsafe {
+            ((*self.api).read_find_header_array)(transmute(self.api), &mut t, &mut rows, s.as_ptr(), self.it)
+        };
+
+        match (ret >> 8) & 0xff {
+            1 => Some(HeaderArray { reader: self.clone(), it: t, rows: rows }),
+            _ => None,
+        }
+    }
+}
+
+impl HeaderArray {
+    pub fn rows(&self) -> u32 {
+        self.rows
+    }
+
+    pub fn column(&self, id: &str) -> Option<Column> {
+        let s = CFixedString::from_str(id);
+        let mut t = 0u64;
+
+        let ret = unsafe {
+            ((*self.reader.api).read_header_array_column)(transmute(self.reader.api), &mut t, s.as_ptr(),
+                                                          self.it)
+        };
+
+        match (ret >> 8) & 0xff {
+            1 => Some(Column { reader: self.reader.clone(), it: t }),
+            _ => None,
+        }
+    }
+}
+
+impl Column {
+    pub fn get_u64(&self, row: u32) -> Result<u64, ReadStatus> {
+        let mut res = 0u64;
+        let ret = unsafe {
+            ((*self.reader.api).read_column_u64)(transmute(self.reader.api), &mut res, self.it, row)
+        };
+
+        status_res(res, ret)
+    }
+
+    pub fn get_double(&self, row: u32) -> Result<f64, ReadStatus> {
+        let mut res = 0f64;
+        let ret = unsafe {
+            ((*self.reader.api).read_column_double)(transmute(self.reader.api), &mut res, self.it, row)
+        };
+
+        status_res(res, ret)
+    }
+
+    pub fn get_str(&self, row: u32) -> Result<&str, ReadStatus> {
+        let mut temp = 0 as *const c_char;
+        let mut length = 0;
+        let mut is_utf8 = 0;
+        let mut res = "";
+
+        unsafe {
+            let ret = ((*self.reader.api).read_column_string_len)(transmute(self.reader.api), &mut temp,
+                                                                  &mut length, &mut is_utf8, self.it, row);
+            if (ret >> 8) & 0xff == 1 {
+                match str_from_stream(temp, length, is_utf8) {
+                    Some(v) => res = v,
+                    None => return Err(ReadStatus::Fail),
+                }
+            }
+
+            status_res(res, ret)
+        }
+    }
 }
 
 impl Iterator for ReaderIter {
@@ -284,11 +525,20 @@ impl Iterator for EventIter {
 
 macro_rules! write_fun {
     ($name:ident, $data_type:ident) => {
-        pub fn $name(&mut self, id: &str, v: $data_type) {
-            let s = CFixedString::from_str(id).as_ptr();
-            unsafe {
+        pub fn $name<I: StreamId>(&mut self, id: I, v: $data_type) {
+            id.with_id(|s, _| unsafe {
                 ((*self.api).$name)(transmute(self.api), s, v);
-            }
+            });
+        }
+    }
+}
+
+macro_rules! write_array_fun {
+    ($name:ident, $data_type:ident) => {
+        pub fn $name<I: StreamId>(&mut self, id: I, values: &[$data_type]) {
+            id.with_id(|s, _| unsafe {
+                ((*self.api).$name)(transmute(self.api), s, values.as_ptr(), values.len() as u32);
+            });
         }
     }
 }
@@ -319,6 +569,25 @@ impl Writer {
         }
     }
 
+    /// Values written after this call (until header_array_end) are rows of the table. The ids of the
+    /// write calls are ignored and the values are assigned to the columns in order.
+    pub fn header_array_begin(&mut self, name: &str, ids: &[&str]) {
+        let name = CFixedString::from_str(name);
+        let ids: Vec<CFixedString> = ids.iter().map(|id| CFixedString::from_str(id)).collect();
+        let mut id_ptrs: Vec<*const c_char> = ids.iter().map(|id| id.as_ptr()).collect();
+        id_ptrs.push(ptr::null());
+
+        unsafe {
+            ((*self.api).write_header_array_begin)(transmute(self.api), name.as_ptr(), id_ptrs.as_mut_ptr());
+        }
+    }
+
+    pub fn header_array_end(&mut self) {
+        unsafe {
+            ((*self.api).write_header_array_end)(transmute(self.api));
+        }
+    }
+
     pub fn array_entry_begin(&mut self) {
         unsafe {
             ((*self.api).write_array_entry_begin)(transmute(self.api));
@@ -342,21 +611,44 @@ impl Writer {
     write_fun!(write_float, f32);
     write_fun!(write_double, f64);
 
-    pub fn write_string(&mut self, id: &str, v: &str) {
-        let id_s = CFixedString::from_str(id).as_ptr();
-        let v_s = CFixedString::from_str(v).as_ptr();
-        unsafe {
-            ((*self.api).write_string)(transmute(self.api), id_s, v_s);
-        }
+    write_array_fun!(write_u32_array, u32);
+    write_array_fun!(write_u64_array, u64);
+    write_array_fun!(write_f32_array, f32);
+
+    pub fn write_string<I: StreamId>(&mut self, id: I, v: &str) {
+        id.with_id(|s, _| unsafe {
+            ((*self.api).write_string_len)(transmute(self.api), s, v.as_ptr() as *const c_char, v.len() as u32);
+        });
     }
 
-    pub fn write_data(&mut self, id: &str, data: &[u8]) {
-        let s = CFixedString::from_str(id).as_ptr();
-        unsafe {
+    pub fn write_data<I: StreamId>(&mut self, id: I, data: &[u8]) {
+        id.with_id(|s, _| unsafe {
             ((*self.api).write_data)(transmute(self.api),
                                      s,
                                      data.as_ptr(),
                                      data.len() as u32);
+        });
+    }
+
+    /// Reserves space for data directly in the outgoing stream so it can be filled in without
+    /// an extra copy. write_data_commit has to be called (with the number of bytes used) before
+    /// anything else is written.
+    pub fn write_data_reserve(&mut self, id: &str, size: usize) -> Option<&mut [u8]> {
+        let s = CFixedString::from_str(id);
+        unsafe {
+            let data = ((*self.api).write_data_reserve)(transmute(self.api), s.as_ptr(), size as u32);
+
+            if data.is_null() {
+                None
+            } else {
+                Some(slice::from_raw_parts_mut(data, size))
+            }
+        }
+    }
+
+    pub fn write_data_commit(&mut self, size: usize) {
+        unsafe {
+            ((*self.api).write_data_commit)(transmute(self.api), size as u32);
         }
     }
 }
@@ -10,6 +10,9 @@ use CDialogFuncs1;
 use IdFuncs;
 use CIdFuncs1;
 
+use SessionStats;
+use CSessionStatsFuncs1;
+
 pub struct Service {
     pub service_func: extern "C" fn(data: *const c_uchar) -> *mut c_void,
 }
@@ -38,4 +41,11 @@ impl Service {
             IdFuncs { api: api }
         }
     }
+
+    pub fn get_session_stats(&self) -> SessionStats {
+        unsafe {
+            let api: &mut CSessionStatsFuncs1 = transmute(((*self).service_func)(b"Session Stats 1\0".as_ptr()));
+            SessionStats { api: api }
+        }
+    }
 }
@@ -0,0 +1,33 @@
+use std::os::raw::c_char;
+use std::ptr;
+
+#[repr(C)]
+pub struct CSessionStatsFuncs1 {
+    pub dump_json: extern "C" fn(dest: *mut c_char, size: u32) -> u32,
+    pub reset: extern "C" fn(),
+}
+
+///! Event counts, sizes and timings of the sessions (see PDSessionStatsFuncs in pd_host.h)
+pub struct SessionStats {
+    pub api: *mut CSessionStatsFuncs1,
+}
+
+impl SessionStats {
+    pub fn dump_json(&self) -> String {
+        unsafe {
+            let size = ((*self.api).dump_json)(ptr::null_mut(), 0) as usize;
+            let mut buffer = vec![0u8; size + 1];
+
+            // the stats may have grown since the size was asked for so use what fits
+            ((*self.api).dump_json)(buffer.as_mut_ptr() as *mut c_char, buffer.len() as u32);
+
+            let len = buffer.iter().position(|&c| c == 0).unwrap_or(size);
+            buffer.truncate(len);
+            String::from_utf8_lossy(&buffer).into_owned()
+        }
+    }
+
+    pub fn reset(&self) {
+        unsafe { ((*self.api).reset)() }
+    }
+}
@@ -5,12 +5,18 @@ use ui_ffi::*;
 use std::os::raw::{c_uchar, c_void};
 use std::mem::transmute;
 use io::{CPDSaveState, CPDLoadState};
+use events::EVENT_MASK_ALL;
 
 pub static VIEW_API_VERSION: &'static [u8] = b"ProDBG View 1\0";
 
 pub trait View {
     fn new(ui: &Ui, service: &Service) -> Self;
     fn update(&mut self, ui: &mut Ui, reader: &mut Reader, writer: &mut Writer);
+
+    /// Events this view handles (see events::event_mask), other events are skipped by the reader passed to update
+    fn event_mask(&self) -> u64 {
+        EVENT_MASK_ALL
+    }
 }
 
 #[repr(C)]
@@ -28,6 +34,7 @@ pub struct CViewCallbacks {
 
     pub save_state: Option<fn(*mut c_void, api: *mut CPDSaveState)>,
     pub load_state: Option<fn(*mut c_void, api: *mut CPDLoadState)>,
+    pub event_mask: Option<fn(*mut c_void) -> u64>,
 }
 
 unsafe impl Sync for CViewCallbacks {}
@@ -68,6 +75,11 @@ pub fn update_view_instance<T: View>(ptr: *mut c_void,
     view.update(&mut ui, &mut reader, &mut writer);
 }
 
+pub fn event_mask_view_instance<T: View>(ptr: *mut c_void) -> u64 {
+    let view: &T = unsafe { &*(ptr as *const T) };
+    view.event_mask()
+}
+
 #[macro_export]
 macro_rules! define_view_plugin {
     ($p_name:ident, $name:expr, $x:ty) => {
@@ -77,7 +89,8 @@ macro_rules! define_view_plugin {
                 destroy_instance: Some(prodbg_api::view::destroy_view_instance::<$x>),
                 update: Some(prodbg_api::view::update_view_instance::<$x>),
                 save_state: None,
-                load_state: None
+                load_state: None,
+                event_mask: Some(prodbg_api::view::event_mask_view_instance::<$x>)
         };
     }
 }
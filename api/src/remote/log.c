@@ -8,8 +8,9 @@
 #endif
 
 
-static int s_log_level = 0;
-static int s_old_level = 0;
+// debug output is off by default
+static int s_log_level = LOG_INFO;
+static int s_old_level = LOG_INFO;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
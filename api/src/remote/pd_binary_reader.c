@@ -1,5 +1,7 @@
 #include <pd_readwrite.h>
 #include "pd_readwrite_private.h"
+#include "pd_byte_swap.h"
+#include "pd_compress.h"
 #include "log.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -7,15 +9,87 @@
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Each slot in the key index maps (scope, key) to the offset of the field holding the value. A scope is the start
+// offset of the range a find operates on (the event itself or an array entry) so keys with the same name in
+// different array entries don't clash. All offsets are relative to dataStart and 0 marks an empty slot.
+
+typedef struct KeyIndexEntry {
+    uint32_t hash;
+    uint32_t scope;
+    uint32_t offset;
+} KeyIndexEntry;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The events of a stream are decoded once (on the first get_event after init_stream) into a table that is kept
+// when the reader is reset. This allows several readers of the same frame (one per view) to just walk the table and
+// reuse the key indices that has already been built for the events instead of parsing the stream again.
+
+typedef struct EventInfo {
+    uint32_t offset;            // offset (from dataStart) of the event data (after the event header)
+    uint32_t end;               // offset of the next event
+    uint32_t keyIndexStart;     // start of the key index for this event in the key index pool or KeyIndexNotBuilt
+    uint32_t keyIndexMask;
+    uint64_t keyIndexScale;
+    uint16_t type;
+} EventInfo;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Compressed data fields are decompressed into buffers owned by the reader the first time they are found. The
+// buffers are reused for the next stream so the pointers returned by read_find_data are valid until init_stream.
+
+typedef struct DecompressedData {
+    uint32_t offset;            // offset (from dataStart) of the field
+    uint32_t capacity;
+    uint8_t* data;
+} DecompressedData;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 typedef struct ReaderData {
     uint8_t* data;
     uint8_t* dataStart;
     uint8_t* dataEnd;
     uint8_t* nextEvent;
+    EventInfo* events;
+    uint32_t eventCount;
+    uint32_t eventCapacity;
+    uint32_t eventPos;          // index of the event after the current one in events
+    int eventsBuilt;
+    uint64_t eventMask;         // bit n set if events of type n should be returned (bit 63 for all >= 63)
+    KeyIndexEntry* keyIndexPool;
+    uint32_t keyIndexPoolSize;
+    uint32_t keyIndexPoolCapacity;
+    KeyIndexEntry* keyIndex;    // key index of the current event, 0 if not built
+    uint32_t keyIndexMask;      // capacity - 1 (capacity is always power of two)
+    uint64_t keyIndexScale;     // 32.32 fixed point scale from event offset to slot
+    int useKeyIndex;
+    int swapValues;             // set if the values in the stream are in a different byte order than this machine
+    int trustUtf8;              // set if the UTF-8 flags of the strings can be trusted (see set_trust_utf8)
+    DecompressedData* decompressed;
+    uint32_t decompressedCount; // used for the current stream
+    uint32_t decompressedCapacity;
 } ReaderData;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+enum {
+    // Scopes smaller than this are faster to scan with strcmp than to look up in the index (and keeping them out of
+    // the index keeps it small enough to stay in cache)
+    KeyIndexMinScopeSize = 256,
+
+    KeyIndexNotBuilt = 0xffffffff,
+
+    // Same as the max size of a writer buffer. Compressed data that says it is larger than this is broken
+    MaxBufferSize = 0x3fffffff,
+
+    // Max ratio of LZ4 (each 255 bytes of a match length takes one byte)
+    MaxCompressionRatio = 255,
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 #ifdef _WIN32
 #define inline __inline
 #endif
@@ -58,14 +132,14 @@ static inline uint16_t getU16(const uint8_t* ptr) {
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static inline int32_t getS32(const uint8_t* ptr) {
-    int32_t v = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+    int32_t v = (int32_t)(((uint32_t)ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3]);
     return v;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static inline int32_t getU32(const uint8_t* ptr) {
-    uint32_t v = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+    uint32_t v = ((uint32_t)ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
     return v;
 }
 
@@ -73,7 +147,7 @@ static inline int32_t getU32(const uint8_t* ptr) {
 
 static inline int64_t getS64(const uint8_t* ptr) {
     int64_t v = ((uint64_t)ptr[0] << 56) | ((uint64_t)ptr[1] << 48) | ((uint64_t)ptr[2] << 40) | ((uint64_t)ptr[3] << 32) |
-                (ptr[4] << 24) | (ptr[5] << 16) | (ptr[6] << 8) | ptr[7];
+                ((uint32_t)ptr[4] << 24) | (ptr[5] << 16) | (ptr[6] << 8) | ptr[7];
     return v;
 }
 
@@ -81,7 +155,7 @@ static inline int64_t getS64(const uint8_t* ptr) {
 
 static inline uint64_t getU64(const uint8_t* ptr) {
     uint64_t v = ((uint64_t)ptr[0] << 56) | ((uint64_t)ptr[1] << 48) | ((uint64_t)ptr[2] << 40) | ((uint64_t)ptr[3] << 32) |
-                 (ptr[4] << 24) | (ptr[5] << 16) | (ptr[6] << 8) | ptr[7];
+                 ((uint32_t)ptr[4] << 24) | (ptr[5] << 16) | (ptr[6] << 8) | ptr[7];
     return v;
 }
 
@@ -103,6 +177,64 @@ static inline float getFloat(const uint8_t* ptr) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Values (unlike the structure of the stream) can be stored in either big or little endian depending on the writer
+
+static inline int8_t getValueS8(const ReaderData* rData, const uint8_t* ptr) {
+    (void)rData;
+    return (int8_t)ptr[0];
+}
+
+static inline uint8_t getValueU8(const ReaderData* rData, const uint8_t* ptr) {
+    (void)rData;
+    return ptr[0];
+}
+
+static inline uint16_t getValueU16(const ReaderData* rData, const uint8_t* ptr) {
+    uint16_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return rData->swapValues ? pd_bswap16(v) : v;
+}
+
+static inline int16_t getValueS16(const ReaderData* rData, const uint8_t* ptr) {
+    return (int16_t)getValueU16(rData, ptr);
+}
+
+static inline uint32_t getValueU32(const ReaderData* rData, const uint8_t* ptr) {
+    uint32_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return rData->swapValues ? pd_bswap32(v) : v;
+}
+
+static inline int32_t getValueS32(const ReaderData* rData, const uint8_t* ptr) {
+    return (int32_t)getValueU32(rData, ptr);
+}
+
+static inline uint64_t getValueU64(const ReaderData* rData, const uint8_t* ptr) {
+    uint64_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return rData->swapValues ? pd_bswap64(v) : v;
+}
+
+static inline int64_t getValueS64(const ReaderData* rData, const uint8_t* ptr) {
+    return (int64_t)getValueU64(rData, ptr);
+}
+
+static inline float getValueFloat(const ReaderData* rData, const uint8_t* ptr) {
+    float v;
+    uint32_t t = getValueU32(rData, ptr);
+    memcpy(&v, &t, sizeof(v));
+    return v;
+}
+
+static inline double getValueDouble(const ReaderData* rData, const uint8_t* ptr) {
+    double v;
+    uint64_t t = getValueU64(rData, ptr);
+    memcpy(&v, &t, sizeof(v));
+    return v;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static inline uint64_t getOffsetUpper(ReaderData* readerData, const uint8_t* data) {
     uint64_t t = ((uintptr_t)data - (uintptr_t)readerData->dataStart);
     return t << 32L;
@@ -110,51 +242,98 @@ static inline uint64_t getOffsetUpper(ReaderData* readerData, const uint8_t* dat
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static inline uint64_t eventMaskBit(uint16_t event) {
+    return 1ULL << (event < 63 ? event : 63);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void eventIndexBuild(ReaderData* rData) {
+    uint8_t* data = rData->dataStart;
+
+    rData->eventCount = 0;
+    rData->eventsBuilt = 1;
+
+    while (data < rData->dataEnd) {
+        EventInfo* info;
+        uint32_t size;
+        uint8_t type = *data;
+
+        // Finalized streams are padded with zeros at the end (see pd_binary_writer_finalize) and several streams can
+        // be joined into one by zeroing the headers of the ones after the first (which keeps the typed arrays
+        // aligned) so zeros between the events are skipped
+
+        if (type == PDReadType_None) {
+            data++;
+            continue;
+        }
+
+        if (type != PDReadType_Event) {
+            log_debug("Unable to read event as type is wrong (expected %d but got %d) all read operations will now fail.\n",
+                      PDReadType_Event, type);
+            return;
+        }
+
+        size = getU32(data + 3);
+
+        if (size < 7) {
+            log_debug("Event at %p has invalid size %d\n", data, size);
+            return;
+        }
+
+        if (rData->eventCount == rData->eventCapacity) {
+            rData->eventCapacity = rData->eventCapacity ? rData->eventCapacity * 2 : 32;
+            rData->events = (EventInfo*)realloc(rData->events, rData->eventCapacity * sizeof(EventInfo));
+        }
+
+        info = &rData->events[rData->eventCount++];
+        info->offset = (uint32_t)(uintptr_t)(data + 7 - rData->dataStart);
+        info->end = (uint32_t)(uintptr_t)(data + size - rData->dataStart);
+        info->keyIndexStart = KeyIndexNotBuilt;
+        info->keyIndexMask = 0;
+        info->keyIndexScale = 0;
+        info->type = getU16(data + 1);
+
+        data += size;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static uint32_t read_get_event(struct PDReader* reader) {
     ReaderData* rData = (ReaderData*)reader->data;
-    uint16_t event;
-    uint8_t type;
-    uint8_t* data;
 
     if (!rData->data) {
         //log_debug("no data");
         return 0;
     }
 
-    if (rData->nextEvent >= rData->dataEnd) {
-        log_debug("rData->nextEvent %p >= rData->dataEnd %p\n", rData->nextEvent, rData->dataEnd);
-        return 0;
-    }
+    if (!rData->eventsBuilt)
+        eventIndexBuild(rData);
 
-    // if this is not set we expect this to be the first event and just read from data
+    while (rData->eventPos < rData->eventCount) {
+        EventInfo* info = &rData->events[rData->eventPos++];
 
-    if (!rData->nextEvent)
-        data = rData->data;
-    else
-        data = rData->nextEvent;
+        if (!(rData->eventMask & eventMaskBit(info->type)))
+            continue;
 
-    // make sure we actually have some data to process
+        rData->data = rData->dataStart + info->offset;  // points to the next of data in the stream
+        rData->nextEvent = rData->dataStart + info->end;
 
-    if (data >= rData->dataEnd) {
-        log_debug("data %p >= rData->dataEnd %p\n", data, rData->dataEnd);
-        return 0;
-    }
+        if (info->keyIndexStart != KeyIndexNotBuilt) {
+            rData->keyIndex = rData->keyIndexPool + info->keyIndexStart;
+            rData->keyIndexMask = info->keyIndexMask;
+            rData->keyIndexScale = info->keyIndexScale;
+        } else {
+            rData->keyIndex = 0;
+        }
 
-    type = *data;
+        log_debug("returing with event %d\n", info->type);
 
-    if (type != PDReadType_Event) {
-        log_debug("Unable to read event as type is wrong (expected %d but got %d) all read operations will now fail.\n",
-                  PDReadType_Event, type);
-        return 0;
+        return info->type;
     }
 
-    event = getU16(data + 1);
-    rData->nextEvent = data + getU32(data + 3);
-    rData->data = data + 7; // points to the next of data in the stream
-
-    log_debug("returing with event %d\n", event);
-
-    return event;
+    return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -178,35 +357,45 @@ static const char* typeTable[] =
     "PDReadType_Event",
     "PDReadType_Array",
     "PDReadType_ArrayEntry",
+    "PDReadType_HeaderArray",
+    "PDReadType_TypedArray",
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static uint8_t* findIdByRange(const char* id, uint8_t* start, uint8_t* end) {
-    while (start < end) {
-        uint32_t size;
-        uint8_t typeId = getU8(start);
+// Returns the type of the field at ptr without the flags
 
-        ///if (typeId <PDReadType_Count)
-        //	log_debug("typeId %s\n", typeTable[typeId]);
-        //else
-        //	log_debug("typeId %d (outside valid range)\n", typeId);
+static inline uint8_t getFieldType(const uint8_t* ptr) {
+    return getU8(ptr) & ~PDFieldFlag_Compressed;
+}
 
-        // data is a special case as it has 32-bit size instead of 64k
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-        if (typeId == PDReadType_Data || typeId == PDReadType_Array) {
-            size = getU32(start + 1);
+// Returns the total size of the field at ptr and the key it's stored with. Data and arrays are special cases as
+// they have 32-bit size instead of 64k
 
-            if (!strcmp((char*)start + 5, id))
-                return start;
-        }else {
-            size = getU16(start + 1);
+static inline uint32_t getFieldInfo(const uint8_t* ptr, const char** id) {
+    uint8_t typeId = getU8(ptr) & ~PDFieldFlag_Compressed;
 
-            //log_debug("current string - %s searching for - %s\n", (char*)start + 3, id);
+    if (typeId == PDReadType_Data || typeId == PDReadType_Array || typeId == PDReadType_HeaderArray ||
+        typeId == PDReadType_TypedArray) {
+        *id = (const char*)ptr + 5;
+        return getU32(ptr + 1);
+    }
 
-            if (!strcmp((char*)start + 3, id))
-                return start;
-        }
+    *id = (const char*)ptr + 3;
+    return getU16(ptr + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t* findIdByRange(const char* id, uint8_t* start, uint8_t* end) {
+    while (start < end) {
+        const char* fieldId;
+        uint32_t size = getFieldInfo(start, &fieldId);
+
+        if (!strcmp(fieldId, id))
+            return start;
 
         start += size;
     }
@@ -218,38 +407,237 @@ static uint8_t* findIdByRange(const char* id, uint8_t* start, uint8_t* end) {
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FNV-1a
 
-static uint8_t* findId(struct PDReader* reader, const char* id, PDReaderIterator it) {
+static inline uint32_t hashId(const char* id) {
+    uint32_t hash = 2166136261u;
+
+    while (*id) {
+        hash ^= (uint8_t)*id++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The keys of a scope are hashed into a window of the table that is placed (and sized) relative to where the
+// scope is in the event. The same keys are repeated in every array entry so this keeps them out of each others
+// probe chains and as entries are usually read in order the lookups walk the table mostly linearly.
+
+static inline uint32_t keyIndexSlot(ReaderData* rData, uint32_t hash, uint32_t scope, uint32_t scopeSize) {
+    uint32_t eventOffset = (uint32_t)(uintptr_t)(rData->data - rData->dataStart);
+    uint64_t base = ((uint64_t)(scope - eventOffset) * rData->keyIndexScale) >> 32;
+    uint64_t window = ((uint64_t)scopeSize * rData->keyIndexScale) >> 32;
+
+    if (window == 0)
+        window = 1;
+
+    return (uint32_t)(base + (((uint64_t)hash * window) >> 32)) & rData->keyIndexMask;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void keyIndexInsert(ReaderData* rData, uint32_t scope, uint32_t scopeSize, uint8_t* field, const char* id) {
+    uint32_t hash = hashId(id);
+    uint32_t i = keyIndexSlot(rData, hash, scope, scopeSize);
+
+    for (;;) {
+        KeyIndexEntry* entry = &rData->keyIndex[i];
+
+        if (entry->offset == 0) {
+            entry->hash = hash;
+            entry->scope = scope;
+            entry->offset = (uint32_t)(uintptr_t)(field - rData->dataStart);
+            return;
+        }
+
+        // keep the first occurrence of a key within a scope to match what a linear search would return
+
+        if (entry->hash == hash && entry->scope == scope) {
+            const char* entryId;
+            getFieldInfo(rData->dataStart + entry->offset, &entryId);
+
+            if (!strcmp(entryId, id))
+                return;
+        }
+
+        i = (i + 1) & rData->keyIndexMask;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Walks all fields in the range (and arrays inside it) and either counts (if insert is 0) or inserts the keys
+// of the scopes that are large enough to be indexed. Returns the number of keys found.
+
+static uint32_t keyIndexRange(ReaderData* rData, uint8_t* start, uint8_t* end, int insert) {
+    uint32_t count = 0;
+    uint32_t scope = (uint32_t)(uintptr_t)(start - rData->dataStart);
+    uint32_t scopeSize = (uint32_t)(uintptr_t)(end - start);
+    int indexScope = scopeSize >= KeyIndexMinScopeSize;
+
+    while (start < end) {
+        const char* id;
+        uint32_t size = getFieldInfo(start, &id);
+
+        if (size == 0)
+            break;
+
+        if (indexScope) {
+            if (insert)
+                keyIndexInsert(rData, scope, scopeSize, start, id);
+
+            count++;
+        }
+
+        if (getU8(start) == PDReadType_Array) {
+            uint8_t* entry = (uint8_t*)id + strlen(id) + 1;
+            uint8_t* arrayEnd = start + size;
+
+            while (entry < arrayEnd && getU8(entry) == PDReadType_ArrayEntry) {
+                uint32_t entrySize = getU32(entry + 1);
+
+                if (entrySize < 7)
+                    break;
+
+                count += keyIndexRange(rData, entry + 7, entry + entrySize, insert);
+                entry += entrySize;
+            }
+        }
+
+        start += size;
+    }
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Builds the key index for the current event. The index is placed in the pool (shared by all events in the stream)
+// so it's still around when the reader is reset and the event is read again.
+
+static void keyIndexBuild(ReaderData* rData) {
+    EventInfo* info = &rData->events[rData->eventPos - 1];
+    uint32_t count = keyIndexRange(rData, rData->data, rData->nextEvent, 0);
+    uint32_t capacity = 16;
+
+    // keep the load factor below 0.5
+
+    while (capacity < count * 2)
+        capacity *= 2;
+
+    if (rData->keyIndexPoolSize + capacity > rData->keyIndexPoolCapacity) {
+        uint32_t poolCapacity = rData->keyIndexPoolCapacity ? rData->keyIndexPoolCapacity : 256;
+
+        while (poolCapacity < rData->keyIndexPoolSize + capacity)
+            poolCapacity *= 2;
+
+        rData->keyIndexPool = (KeyIndexEntry*)realloc(rData->keyIndexPool, poolCapacity * sizeof(KeyIndexEntry));
+        rData->keyIndexPoolCapacity = poolCapacity;
+    }
+
+    rData->keyIndex = rData->keyIndexPool + rData->keyIndexPoolSize;
+    rData->keyIndexMask = capacity - 1;
+    rData->keyIndexScale = ((uint64_t)capacity << 32) / (uint64_t)(rData->nextEvent - rData->data);
+
+    memset(rData->keyIndex, 0, capacity * sizeof(KeyIndexEntry));
+
+    keyIndexRange(rData, rData->data, rData->nextEvent, 1);
+
+    info->keyIndexStart = rData->keyIndexPoolSize;
+    info->keyIndexMask = rData->keyIndexMask;
+    info->keyIndexScale = rData->keyIndexScale;
+
+    rData->keyIndexPoolSize += capacity;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t* findIdByIndex(ReaderData* rData, const char* id, uint32_t hash, uint8_t* start, uint8_t* end) {
+    uint32_t scope = (uint32_t)(uintptr_t)(start - rData->dataStart);
+    uint32_t i = keyIndexSlot(rData, hash, scope, (uint32_t)(uintptr_t)(end - start));
+
+    for (;;) {
+        KeyIndexEntry* entry = &rData->keyIndex[i];
+
+        if (entry->offset == 0)
+            return 0;
+
+        if (entry->hash == hash && entry->scope == scope) {
+            const char* entryId;
+            uint8_t* field = rData->dataStart + entry->offset;
+
+            getFieldInfo(field, &entryId);
+
+            if (!strcmp(entryId, id))
+                return field;
+        }
+
+        i = (i + 1) & rData->keyIndexMask;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// hash is the (FNV-1a) hash of the id if the caller has it already or 0 to calculate it here if needed
+
+static uint8_t* findIdInScope(ReaderData* rData, const char* id, uint32_t hash, uint8_t* start, uint8_t* end) {
+    // Only use the index for large scopes that are within the current event (an iterator may still point into an
+    // older event in which case we fall back to a regular search)
+
+    if (!rData->useKeyIndex || (end - start) < KeyIndexMinScopeSize ||
+        start < rData->data || end > rData->nextEvent) {
+        return findIdByRange(id, start, end);
+    }
+
+    if (!rData->keyIndex)
+        keyIndexBuild(rData);
+
+    return findIdByIndex(rData, id, hash ? hash : hashId(id), start, end);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t* findIdHashed(struct PDReader* reader, const char* id, uint32_t hash, PDReaderIterator it) {
     ReaderData* rData = (ReaderData*)reader->data;
 
     // if iterator is 0 we search the event stream,
 
     if (it == 0) {
         // if no iterater we will just search the whole event
-        return findIdByRange(id, rData->data, rData->nextEvent);
+        return findIdInScope(rData, id, hash, rData->data, rData->nextEvent);
     }else {
         // serach within the event but skip 7 bytes ahead to not read the event itself
         uint32_t dataOffset = it >> 32LL;
         uint32_t size = it & 0xffffffffLL;
         uint8_t* start = rData->dataStart + dataOffset;
         uint8_t* end = start + size;
-        return findIdByRange(id, start, end);
+        return findIdInScope(rData, id, hash, start, end);
     }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#define findValue(inType, realType, getFunc) \
+static uint8_t* findId(struct PDReader* reader, const char* id, PDReaderIterator it) {
+    return findIdHashed(reader, id, 0, it);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Reads the value of a field found with findId (converting it if needed)
+
+#define readValueFunc(name, inType, realType, getFunc) \
+static uint32_t name(const ReaderData* rData, const uint8_t* dataPtr, realType* res) { \
     uint8_t type; \
     size_t offset; \
-    const uint8_t* dataPtr = findId(reader, id, it); \
     if (!dataPtr) \
         return PDReadStatus_NotFound; \
-    type = *dataPtr; \
+    type = getFieldType(dataPtr); \
     offset = getU16(dataPtr + 1) - (sizeof(realType)); \
     if (type == inType) \
     { \
-        *res = getFunc(dataPtr + offset); \
+        *res = getFunc(rData, dataPtr + offset); \
         return PDReadStatus_Ok | inType; \
     } \
     if (type < PDReadType_EndNumericTypes) \
@@ -258,117 +646,246 @@ static uint8_t* findId(struct PDReader* reader, const char* id, PDReaderIterator
         switch (type) \
         { \
             case PDReadType_S8: \
-                *res = (realType)getS8(dataPtr + offset); return PDReadType_S8 | PDReadStatus_Converted; \
+                *res = (realType)getValueS8(rData, dataPtr + offset); return PDReadType_S8 | PDReadStatus_Converted; \
             case PDReadType_U8: \
-                *res = (realType)getU8(dataPtr + offset); return PDReadType_U8 | PDReadStatus_Converted;  \
+                *res = (realType)getValueU8(rData, dataPtr + offset); return PDReadType_U8 | PDReadStatus_Converted;  \
             case PDReadType_S16: \
-                *res = (realType)getU16(dataPtr + offset); return PDReadType_S16 | PDReadStatus_Converted; \
+                *res = (realType)getValueU16(rData, dataPtr + offset); return PDReadType_S16 | PDReadStatus_Converted; \
             case PDReadType_U16: \
-                *res = (realType)getU16(dataPtr + offset); return PDReadType_U16 | PDReadStatus_Converted; \
+                *res = (realType)getValueU16(rData, dataPtr + offset); return PDReadType_U16 | PDReadStatus_Converted; \
             case PDReadType_S32: \
-                *res = (realType)getU32(dataPtr + offset); return PDReadType_S32 | PDReadStatus_Converted; \
+                *res = (realType)getValueU32(rData, dataPtr + offset); return PDReadType_S32 | PDReadStatus_Converted; \
             case PDReadType_U32: \
-                *res = (realType)getU32(dataPtr + offset); return PDReadType_U32 | PDReadStatus_Converted; \
+                *res = (realType)getValueU32(rData, dataPtr + offset); return PDReadType_U32 | PDReadStatus_Converted; \
             case PDReadType_S64: \
-                *res = (realType)getU64(dataPtr + offset); return PDReadType_S64 | PDReadStatus_Converted; \
+                *res = (realType)getValueU64(rData, dataPtr + offset); return PDReadType_S64 | PDReadStatus_Converted; \
             case PDReadType_U64: \
-                *res = (realType)getU64(dataPtr + offset); return PDReadType_U64 | PDReadStatus_Converted; \
+                *res = (realType)getValueU64(rData, dataPtr + offset); return PDReadType_U64 | PDReadStatus_Converted; \
             case PDReadType_Float: \
-                *res = (realType)getFloat(dataPtr + offset); return PDReadType_Float | PDReadStatus_Converted; \
+                *res = (realType)getValueFloat(rData, dataPtr + offset); return PDReadType_Float | PDReadStatus_Converted; \
             case PDReadType_Double: \
-                *res = (realType)getDouble(dataPtr + offset); return PDReadType_Float | PDReadStatus_Converted; \
+                *res = (realType)getValueDouble(rData, dataPtr + offset); return PDReadType_Float | PDReadStatus_Converted; \
         } \
     } \
-    return (PDReadType)type | PDReadStatus_IllegalType
+    return (PDReadType)type | PDReadStatus_IllegalType; \
+}
+
+readValueFunc(readValueS8, PDReadType_S8, int8_t, getValueS8)
+readValueFunc(readValueU8, PDReadType_U8, uint8_t, getValueU8)
+readValueFunc(readValueS16, PDReadType_S16, int16_t, getValueS16)
+readValueFunc(readValueU16, PDReadType_U16, uint16_t, getValueU16)
+readValueFunc(readValueS32, PDReadType_S32, int32_t, getValueS32)
+readValueFunc(readValueU32, PDReadType_U32, uint32_t, getValueU32)
+readValueFunc(readValueS64, PDReadType_S64, int64_t, getValueS64)
+readValueFunc(readValueU64, PDReadType_U64, uint64_t, getValueU64)
+readValueFunc(readValueFloat, PDReadType_Float, float, getValueFloat)
+readValueFunc(readValueDouble, PDReadType_Double, double, getValueDouble)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static uint32_t read_find_s8(struct PDReader* reader, int8_t* res, const char* id, PDReaderIterator it) {
-    findValue(PDReadType_S8, int8_t, getS8);
+    return readValueS8((ReaderData*)reader->data, findId(reader, id, it), res);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static uint32_t read_find_u8(struct PDReader* reader, uint8_t* res, const char* id, PDReaderIterator it) {
-    findValue(PDReadType_U8, uint8_t, getU8);
+    return readValueU8((ReaderData*)reader->data, findId(reader, id, it), res);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static uint32_t read_find_s16(struct PDReader* reader, int16_t* res, const char* id, PDReaderIterator it) {
-    findValue(PDReadType_S16, int16_t, getS16);
+    return readValueS16((ReaderData*)reader->data, findId(reader, id, it), res);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static uint32_t read_find_u16(struct PDReader* reader, uint16_t* res, const char* id, PDReaderIterator it) {
-    findValue(PDReadType_U16, uint16_t, getU16);
+    return readValueU16((ReaderData*)reader->data, findId(reader, id, it), res);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static uint32_t read_find_s32(struct PDReader* reader, int32_t* res, const char* id, PDReaderIterator it) {
-    findValue(PDReadType_S32, int32_t, getS32);
+    return readValueS32((ReaderData*)reader->data, findId(reader, id, it), res);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static uint32_t read_find_u32(struct PDReader* reader, uint32_t* res, const char* id, PDReaderIterator it) {
-    findValue(PDReadType_U32, uint32_t, getU32);
+    return readValueU32((ReaderData*)reader->data, findId(reader, id, it), res);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static uint32_t read_find_s64(struct PDReader* reader, int64_t* res, const char* id, PDReaderIterator it) {
-    findValue(PDReadType_S64, int64_t, getS64);
+    return readValueS64((ReaderData*)reader->data, findId(reader, id, it), res);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static uint32_t read_find_u64(struct PDReader* reader, uint64_t* res, const char* id, PDReaderIterator it) {
-    findValue(PDReadType_U64, uint64_t, getU64);
+    return readValueU64((ReaderData*)reader->data, findId(reader, id, it), res);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static uint32_t read_find_float(struct PDReader* reader, float* res, const char* id, PDReaderIterator it) {
-    findValue(PDReadType_Float, float, getFloat);
+    return readValueFloat((ReaderData*)reader->data, findId(reader, id, it), res);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static uint32_t read_find_double(struct PDReader* reader, double* res, const char* id, PDReaderIterator it) {
-    findValue(PDReadType_Double, double, getDouble);
+    return readValueDouble((ReaderData*)reader->data, findId(reader, id, it), res);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static uint32_t read_find_string(struct PDReader* reader, const char** res, const char* id, PDReaderIterator it) {
+static uint32_t read_find_key(struct PDReader* reader, void* res, uint32_t type, const char* id, uint32_t hash,
+                              PDReaderIterator it) {
+    const ReaderData* rData = (ReaderData*)reader->data;
+    const uint8_t* dataPtr = findIdHashed(reader, id, hash, it);
+
+    switch (type) {
+        case PDReadType_S8: return readValueS8(rData, dataPtr, (int8_t*)res);
+        case PDReadType_U8: return readValueU8(rData, dataPtr, (uint8_t*)res);
+        case PDReadType_S16: return readValueS16(rData, dataPtr, (int16_t*)res);
+        case PDReadType_U16: return readValueU16(rData, dataPtr, (uint16_t*)res);
+        case PDReadType_S32: return readValueS32(rData, dataPtr, (int32_t*)res);
+        case PDReadType_U32: return readValueU32(rData, dataPtr, (uint32_t*)res);
+        case PDReadType_S64: return readValueS64(rData, dataPtr, (int64_t*)res);
+        case PDReadType_U64: return readValueU64(rData, dataPtr, (uint64_t*)res);
+        case PDReadType_Float: return readValueFloat(rData, dataPtr, (float*)res);
+        case PDReadType_Double: return readValueDouble(rData, dataPtr, (double*)res);
+    }
+
+    return PDReadStatus_Fail;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t read_find_string_len(struct PDReader* reader, const char** res, uint32_t* length, int* isUtf8,
+                                     const char* id, PDReaderIterator it) {
     uint8_t type;
-    int len;
+    uint32_t len;
 
     const uint8_t* dataPtr = findId(reader, id, it);
     if (!dataPtr)
         return PDReadStatus_NotFound;
 
-    type = *dataPtr;
+    type = getFieldType(dataPtr);
 
     if (type != PDReadType_String)
         return (PDReadType)type | PDReadStatus_IllegalType;
 
-    // find the offset to the string
+    // the length of the string is stored in the 4 bytes before it
+
+    dataPtr += 3 + strlen((const char*)dataPtr + 3) + 1;
+    len = (uint32_t)getU32(dataPtr);
 
-    len = (int)strlen((const char*)dataPtr + 3);
-    *res = (const char*)dataPtr + 3 + len + 1;
+    *res = (const char*)dataPtr + 4;
+    *length = len & PDStringLengthMask;
+    *isUtf8 = ((ReaderData*)reader->data)->trustUtf8 && (len & PDStringFlag_Utf8);
 
     return (PDReadType)type | PDReadStatus_Ok;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static uint32_t read_find_string(struct PDReader* reader, const char** res, const char* id, PDReaderIterator it) {
+    uint32_t length;
+    int isUtf8;
+
+    return read_find_string_len(reader, res, &length, &isUtf8, id, it);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t* decompressData(ReaderData* rData, const uint8_t* field, const uint8_t* src, uint32_t srcSize,
+                               uint32_t size) {
+    uint32_t offset = (uint32_t)(uintptr_t)(field - rData->dataStart);
+    DecompressedData* entry;
+    uint32_t i;
+
+    // already decompressed for this stream (several views may read the same field)
+
+    for (i = 0; i < rData->decompressedCount; ++i) {
+        if (rData->decompressed[i].offset == offset)
+            return rData->decompressed[i].data;
+    }
+
+    if (rData->decompressedCount == rData->decompressedCapacity) {
+        uint32_t capacity = rData->decompressedCapacity ? rData->decompressedCapacity * 2 : 4;
+        DecompressedData* entries = realloc(rData->decompressed, capacity * sizeof(DecompressedData));
+
+        if (!entries)
+            return 0;
+
+        memset(entries + rData->decompressedCapacity, 0,
+               (capacity - rData->decompressedCapacity) * sizeof(DecompressedData));
+
+        rData->decompressed = entries;
+        rData->decompressedCapacity = capacity;
+    }
+
+    entry = &rData->decompressed[rData->decompressedCount];
+
+    if (entry->capacity < size) {
+        uint8_t* buffer = realloc(entry->data, size);
+
+        if (!buffer)
+            return 0;
+
+        entry->data = buffer;
+        entry->capacity = size;
+    }
+
+    if (pd_decompress(src, (int)srcSize, entry->data, (int)size) != (int)size) {
+        log_debug("Compressed data at %p is corrupt\n", field);
+        return 0;
+    }
+
+    entry->offset = offset;
+    rData->decompressedCount++;
+
+    return entry->data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns the data of a compressed data field (the uncompressed size followed by the compressed data) or 0 if the
+// field is broken
+
+static uint8_t* decompressField(ReaderData* rData, const uint8_t* field, uint32_t* size) {
+    int idLength = (int)strlen((const char*)field + 5) + 1;
+    uint32_t dataSize = (getU32(field + 1) - idLength) - 5;
+    uint32_t uncompressedSize;
+
+    if (dataSize < 4)
+        return 0;
+
+    uncompressedSize = getU32(field + 5 + idLength);
+
+    // the size comes from the stream so check that it's possible before allocating anything for it
+
+    if (uncompressedSize > MaxBufferSize ||
+        (uint64_t)uncompressedSize > (uint64_t)(dataSize - 4) * MaxCompressionRatio) {
+        log_debug("Compressed data at %p has invalid size %u\n", field, uncompressedSize);
+        return 0;
+    }
+
+    *size = uncompressedSize;
+
+    return decompressData(rData, field, field + 5 + idLength + 4, dataSize - 4, uncompressedSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static uint32_t read_find_data(struct PDReader* reader, void** data, uint64_t* size, const char* id, PDReaderIterator it) {
     uint8_t type;
     int idLength;
+    uint32_t dataSize;
 
     uint8_t* dataPtr = findId(reader, id, it);
     if (!dataPtr) {
@@ -376,7 +893,7 @@ static uint32_t read_find_data(struct PDReader* reader, void** data, uint64_t* s
         return PDReadStatus_NotFound;
     }
 
-    type = *dataPtr;
+    type = getFieldType(dataPtr);
 
     if (type != PDReadType_Data)
         return (PDReadType)type | PDReadStatus_IllegalType;
@@ -385,7 +902,22 @@ static uint32_t read_find_data(struct PDReader* reader, void** data, uint64_t* s
 
     // find the offset to the string
 
-    *size = (getU32(dataPtr + 1) - idLength) - 5;   // fix hard-coded values
+    dataSize = (getU32(dataPtr + 1) - idLength) - 5;   // fix hard-coded values
+
+    if (getU8(dataPtr) & PDFieldFlag_Compressed) {
+        uint32_t uncompressedSize = 0;
+        uint8_t* buffer = decompressField((ReaderData*)reader->data, dataPtr, &uncompressedSize);
+
+        if (!buffer)
+            return PDReadType_Data | PDReadStatus_Fail;
+
+        *size = uncompressedSize;
+        *data = buffer;
+
+        return PDReadType_Data | PDReadStatus_Ok;
+    }
+
+    *size = dataSize;
     *data = (void*)(dataPtr + 5 + idLength);
 
     return PDReadType_Data | PDReadStatus_Ok;
@@ -403,7 +935,7 @@ static uint32_t read_find_array(struct PDReader* reader, PDReaderIterator* array
         return PDReadStatus_NotFound;
     }
 
-    type = *dataPtr;
+    type = getFieldType(dataPtr);
 
     if (type != PDReadType_Array)
         return (PDReadType)type | PDReadStatus_IllegalType;
@@ -456,6 +988,262 @@ static int32_t read_next_entry(struct PDReader* reader, PDReaderIterator* arrayI
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static uint32_t read_find_header_array(struct PDReader* reader, PDReaderIterator* arrayIt, uint32_t* rowCount,
+                                       const char* id, PDReaderIterator it) {
+    uint8_t type;
+    int idLength;
+    ReaderData* rData = (ReaderData*)reader->data;
+
+    const uint8_t* dataPtr = findId(reader, id, it);
+    if (!dataPtr)
+        return PDReadStatus_NotFound;
+
+    type = getFieldType(dataPtr);
+
+    if (type != PDReadType_HeaderArray)
+        return (PDReadType)type | PDReadStatus_IllegalType;
+
+    idLength = (int)strlen((const char*)dataPtr + 5) + 1;
+
+    *rowCount = getU32(dataPtr + 5 + idLength);
+    *arrayIt = getOffsetUpper(rData, dataPtr);
+
+    return PDReadType_HeaderArray | PDReadStatus_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Column iterators are stored as offset to the column data (upper 32-bit), type (8-bit) and row count (24-bit)
+
+static uint32_t read_header_array_column(struct PDReader* reader, PDReaderIterator* columnIt, const char* id,
+                                         PDReaderIterator arrayIt) {
+    ReaderData* rData = (ReaderData*)reader->data;
+    uint8_t* arrayStart = rData->dataStart + (arrayIt >> 32);
+    uint8_t* data = arrayStart;
+    uint32_t rowCount;
+    int columnCount;
+
+    if (*arrayStart != PDReadType_HeaderArray)
+        return PDReadStatus_Fail;
+
+    data += 5 + strlen((const char*)data + 5) + 1;
+    rowCount = getU32(data);
+    columnCount = getU8(data + 4);
+    data += 5;
+
+    for (int i = 0; i < columnCount; ++i) {
+        uint8_t type = getU8(data);
+        const char* columnId = (const char*)data + 5;
+
+        if (!strcmp(columnId, id)) {
+            *columnIt = getOffsetUpper(rData, arrayStart + getU32(data + 1)) | ((uint64_t)type << 24) | rowCount;
+            return type | PDReadStatus_Ok;
+        }
+
+        data += 5 + strlen(columnId) + 1;
+    }
+
+    return PDReadStatus_NotFound;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const uint8_t* getColumnValue(ReaderData* rData, uint8_t* type, PDReaderIterator columnIt, uint32_t row) {
+    static const uint8_t typeSizes[] = { 0, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8, 0, 4 };
+    uint32_t rowCount = columnIt & 0xffffff;
+
+    *type = (columnIt >> 24) & 0xff;
+
+    if (row >= rowCount || *type >= sizeof(typeSizes))
+        return 0;
+
+    return rData->dataStart + (columnIt >> 32) + row * typeSizes[*type];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t read_column_u64(struct PDReader* reader, uint64_t* res, PDReaderIterator columnIt, uint32_t row) {
+    uint8_t type;
+    const ReaderData* rData = (ReaderData*)reader->data;
+    const uint8_t* data = getColumnValue((ReaderData*)reader->data, &type, columnIt, row);
+
+    if (!data)
+        return PDReadStatus_NotFound;
+
+    switch (type) {
+        case PDReadType_S8:
+            *res = (uint64_t)(int64_t)getValueS8(rData, data); break;
+        case PDReadType_U8:
+            *res = getValueU8(rData, data); break;
+        case PDReadType_S16:
+            *res = (uint64_t)(int64_t)getValueS16(rData, data); break;
+        case PDReadType_U16:
+            *res = getValueU16(rData, data); break;
+        case PDReadType_S32:
+            *res = (uint64_t)(int64_t)getValueS32(rData, data); break;
+        case PDReadType_U32:
+            *res = getValueU32(rData, data); break;
+        case PDReadType_S64:
+        case PDReadType_U64:
+            *res = getValueU64(rData, data); break;
+        case PDReadType_Float:
+            *res = (uint64_t)getValueFloat(rData, data); return type | PDReadStatus_Converted;
+        case PDReadType_Double:
+            *res = (uint64_t)getValueDouble(rData, data); return type | PDReadStatus_Converted;
+        default:
+            return type | PDReadStatus_IllegalType;
+    }
+
+    return type | (type == PDReadType_U64 ? PDReadStatus_Ok : PDReadStatus_Converted);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t read_column_double(struct PDReader* reader, double* res, PDReaderIterator columnIt, uint32_t row) {
+    uint8_t type;
+    uint64_t v;
+    uint32_t status;
+    const ReaderData* rData = (ReaderData*)reader->data;
+    const uint8_t* data = getColumnValue((ReaderData*)reader->data, &type, columnIt, row);
+
+    if (!data)
+        return PDReadStatus_NotFound;
+
+    if (type == PDReadType_Double) {
+        *res = getValueDouble(rData, data);
+        return type | PDReadStatus_Ok;
+    }
+
+    if (type == PDReadType_Float) {
+        *res = getValueFloat(rData, data);
+        return type | PDReadStatus_Converted;
+    }
+
+    status = read_column_u64(reader, &v, columnIt, row);
+
+    if ((status & ~PDReadStatus_TypeMask) == PDReadStatus_IllegalType)
+        return status;
+
+    if (type == PDReadType_S8 || type == PDReadType_S16 || type == PDReadType_S32 || type == PDReadType_S64)
+        *res = (double)(int64_t)v;
+    else
+        *res = (double)v;
+
+    return type | PDReadStatus_Converted;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t read_column_string_len(struct PDReader* reader, const char** res, uint32_t* length, int* isUtf8,
+                                       PDReaderIterator columnIt, uint32_t row) {
+    uint8_t type;
+    uint32_t len;
+    const ReaderData* rData = (ReaderData*)reader->data;
+    const uint8_t* data = getColumnValue((ReaderData*)reader->data, &type, columnIt, row);
+
+    if (!data)
+        return PDReadStatus_NotFound;
+
+    if (type != PDReadType_String)
+        return type | PDReadStatus_IllegalType;
+
+    // string offsets are relative to the start of the column and the length is stored in the 4 bytes before the string
+
+    data = rData->dataStart + (columnIt >> 32) + getValueU32(rData, data);
+    len = (uint32_t)getU32(data - 4);
+
+    *res = (const char*)data;
+    *length = len & PDStringLengthMask;
+    *isUtf8 = rData->trustUtf8 && (len & PDStringFlag_Utf8);
+
+    return type | PDReadStatus_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t read_column_string(struct PDReader* reader, const char** res, PDReaderIterator columnIt, uint32_t row) {
+    uint32_t length;
+    int isUtf8;
+
+    return read_column_string_len(reader, res, &length, &isUtf8, columnIt, row);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t findTypedArray(struct PDReader* reader, const void** values, uint32_t* count, const char* id,
+                               PDReaderIterator it, uint8_t elementType, uint32_t elementSize) {
+    uint8_t type;
+    uint32_t fieldSize;
+    uint32_t arrayCount;
+    uint64_t end;
+    uint8_t* field = findId(reader, id, it);
+    uint8_t* data;
+
+    if (!field)
+        return PDReadStatus_NotFound;
+
+    type = getFieldType(field);
+
+    if (type != PDReadType_TypedArray)
+        return (PDReadType)type | PDReadStatus_IllegalType;
+
+    fieldSize = (uint32_t)getU32(field + 1);
+    data = field + 5 + strlen((const char*)field + 5) + 1;
+
+    if (data[0] != elementType)
+        return PDReadType_TypedArray | PDReadStatus_IllegalType;
+
+    // the count comes from the stream (possibly from another machine) so the values has to fit in the field before
+    // they are swapped or handed out
+
+    arrayCount = (uint32_t)getU32(data + 2);
+    end = (uint64_t)(data - field) + 7 + data[6] + (uint64_t)arrayCount * elementSize;
+
+    if (end > fieldSize) {
+        log_debug("Typed array %s has %u values which doesn't fit in its field (%u bytes)\n", id, arrayCount,
+                  fieldSize);
+        return PDReadType_TypedArray | PDReadStatus_Fail;
+    }
+
+    *count = arrayCount;
+    *values = data + 7 + data[6];
+
+    // written on a machine with different byte order. Swap the values in the stream so this only happens once
+
+    if (data[1] != pd_native_byte_order()) {
+        if (elementSize == 8)
+            pd_byte_swap_64(data + 7 + data[6], *count);
+        else
+            pd_byte_swap_32(data + 7 + data[6], *count);
+
+        data[1] = pd_native_byte_order();
+    }
+
+    return PDReadType_TypedArray | PDReadStatus_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t read_find_u32_array(struct PDReader* reader, const uint32_t** values, uint32_t* count,
+                                    const char* id, PDReaderIterator it) {
+    return findTypedArray(reader, (const void**)values, count, id, it, PDReadType_U32, sizeof(uint32_t));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t read_find_u64_array(struct PDReader* reader, const uint64_t** values, uint32_t* count,
+                                    const char* id, PDReaderIterator it) {
+    return findTypedArray(reader, (const void**)values, count, id, it, PDReadType_U64, sizeof(uint64_t));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t read_find_f32_array(struct PDReader* reader, const float** values, uint32_t* count,
+                                    const char* id, PDReaderIterator it) {
+    return findTypedArray(reader, (const void**)values, count, id, it, PDReadType_Float, sizeof(float));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static void read_dump_data(struct PDReader* reader) {
     int eventId;
     ReaderData* rData = (ReaderData*)reader->data;
@@ -464,12 +1252,13 @@ static void read_dump_data(struct PDReader* reader) {
         log_info("{ = event %d - (start %p end %p)\n", eventId, rData->data, rData->nextEvent);
 
         while (rData->data < rData->nextEvent) {
-            uint8_t type = *(uint8_t*)rData->data;
+            uint8_t type = getFieldType(rData->data);
             uint32_t size = getU16(rData->data + 1);
             const char* idOffset = (const char*)rData->data + 3;
 
             if (type < PDReadType_Count) {
-                if (type == PDReadType_Array) {
+                if (type == PDReadType_Data || type == PDReadType_Array || type == PDReadType_HeaderArray ||
+                    type == PDReadType_TypedArray) {
                     // need to handle array here, now just grab the correct size and idOffset
 
                     size = getU32(rData->data + 1);
@@ -508,16 +1297,30 @@ void pd_binary_reader_init(PDReader* reader) {
     reader->read_find_data = read_find_data;
     reader->read_find_array = read_find_array;
     reader->read_dump_data = read_dump_data;
+    reader->read_find_header_array = read_find_header_array;
+    reader->read_header_array_column = read_header_array_column;
+    reader->read_column_u64 = read_column_u64;
+    reader->read_column_double = read_column_double;
+    reader->read_column_string = read_column_string;
+    reader->read_find_u32_array = read_find_u32_array;
+    reader->read_find_u64_array = read_find_u64_array;
+    reader->read_find_f32_array = read_find_f32_array;
+    reader->read_find_string_len = read_find_string_len;
+    reader->read_column_string_len = read_column_string_len;
+    reader->read_find_key = read_find_key;
 
     reader->data = malloc(sizeof(ReaderData));
     memset(reader->data, 0, sizeof(ReaderData));
+
+    ((ReaderData*)reader->data)->useKeyIndex = 1;
+    ((ReaderData*)reader->data)->eventMask = ~0ULL;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 PDReader* pd_binary_reader_create() {
     PDReader* reader = malloc(sizeof(PDReader));
-    memset(reader, 0, sizeof(ReaderData));
+    memset(reader, 0, sizeof(PDReader));
 
 	pd_binary_reader_init(reader);
 
@@ -531,7 +1334,20 @@ void pd_binary_reader_init_stream(PDReader* reader, uint8_t* data, unsigned int
     readerData->data = readerData->dataStart = data + 4;    // top 4 bytes for size + 2 bits for info
     readerData->dataEnd = (uint8_t*)data + size;
     readerData->nextEvent = 0;
-    pda_log_set_level(LOG_INFO);
+    readerData->eventPos = 0;
+    readerData->eventsBuilt = 0;
+    readerData->eventMask = ~0ULL;
+    readerData->keyIndex = 0;
+    readerData->keyIndexPoolSize = 0;
+    readerData->swapValues = 0;
+    readerData->trustUtf8 = 0;
+    readerData->decompressedCount = 0;
+
+    if (data && size >= 4) {
+        uint8_t order = data[0] & PDStreamFlag_LittleEndian ? PDByteOrder_Little : PDByteOrder_Big;
+        readerData->swapValues = order != pd_native_byte_order();
+    }
+
     log_debug("InitStream %p - size %d\n", data, size);
 }
 
@@ -541,12 +1357,90 @@ void pd_binary_reader_reset(PDReader* reader) {
     ReaderData* readerData = (ReaderData*)reader->data;
     readerData->data = readerData->dataStart;
     readerData->nextEvent = 0;
+    readerData->eventPos = 0;
+    readerData->keyIndex = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void pd_binary_reader_set_event_mask(PDReader* reader, uint64_t mask) {
+    ReaderData* readerData = (ReaderData*)reader->data;
+    readerData->eventMask = mask;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Only the data fields directly in the events are decompressed here, the ones in arrays are still decompressed when
+// they are read
+
+void pd_binary_reader_prepare(PDReader* reader) {
+    ReaderData* rData = (ReaderData*)reader->data;
+    uint32_t i;
+
+    if (!rData->dataStart)
+        return;
+
+    if (!rData->eventsBuilt)
+        eventIndexBuild(rData);
+
+    for (i = 0; i < rData->eventCount; ++i) {
+        EventInfo* info = &rData->events[i];
+        uint8_t* field = rData->dataStart + info->offset;
+        uint8_t* end = rData->dataStart + info->end;
+
+        // the same as get_event would set up for the event (which the key index is built for)
+
+        rData->eventPos = i + 1;
+        rData->data = field;
+        rData->nextEvent = end;
+
+        if (rData->useKeyIndex && end - field >= KeyIndexMinScopeSize && info->keyIndexStart == KeyIndexNotBuilt)
+            keyIndexBuild(rData);
+
+        while (field < end) {
+            const char* id;
+            uint32_t size = getFieldInfo(field, &id);
+            uint32_t uncompressedSize;
+
+            if (size == 0)
+                break;
+
+            if (getU8(field) == (PDReadType_Data | PDFieldFlag_Compressed))
+                decompressField(rData, field, &uncompressedSize);
+
+            field += size;
+        }
+    }
+
+    pd_binary_reader_reset(reader);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void pd_binary_reader_set_trust_utf8(PDReader* reader, int trust) {
+    ReaderData* readerData = (ReaderData*)reader->data;
+    readerData->trustUtf8 = trust;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void pd_binary_reader_set_key_index(PDReader* reader, int enable) {
+    ReaderData* readerData = (ReaderData*)reader->data;
+    readerData->useKeyIndex = enable;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void pd_binary_reader_destroy(PDReader* reader) {
     ReaderData* readerData = (ReaderData*)reader->data;
+    uint32_t i;
+
+    free(readerData->events);
+    free(readerData->keyIndexPool);
+
+    for (i = 0; i < readerData->decompressedCapacity; ++i)
+        free(readerData->decompressed[i].data);
+
+    free(readerData->decompressed);
     free(readerData);
     free(reader);
 }
@@ -1,23 +1,66 @@
 #include <pd_readwrite.h>
 #include "pd_readwrite_private.h"
+#include "pd_byte_swap.h"
+#include "pd_compress.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+enum {
+    MaxHeaderArrayColumns = 64,
+    MaxHeaderArrayRows = 0xffffff,
+    // the writer starts small and grows when needed
+    InitialBufferSize = 4 * 1024,
+    // top 2 bits of the stream size are used for flags
+    MaxBufferSize = 0x3fffffff,
+    // longest id that fits in a field with a 16-bit size (type, size and null terminator included)
+    MaxIdLength = 0xffff - 4,
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Header arrays are written row by row but stored column by column so the values are kept on the side (as 64-bit
+// slots in row-major order) until PDWrite_header_array_end where they get transposed into the stream.
+
+typedef struct HeaderArrayData {
+    uint64_t*    values;
+    char*        stringPool;
+    unsigned int valueCount;
+    unsigned int valueCapacity;
+    unsigned int stringPoolSize;
+    unsigned int stringPoolCapacity;
+    unsigned int columnCount;
+    unsigned int failed;    // set when a value couldn't be written (header_array_end fails)
+    uint8_t      columnTypes[MaxHeaderArrayColumns];
+} HeaderArrayData;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 typedef struct WriterData {
     uint8_t*     dataStart;
     uint8_t*     data;
     uint8_t*     eventOffset;
     uint8_t*     arrayOffset;
     uint8_t*     entryOffset;
+    uint8_t*     headerArrayOffset;
+    uint8_t*     headerArrayColumns;
+    uint8_t*     reservedData;
     unsigned int writingEvent;
     unsigned int writingArray;
     unsigned int writingArrayEntry;
+    unsigned int writingHeaderArray;
+    unsigned int reservedSize;
+    unsigned int swapValues;   // set if the value byte order differs from this machine
     unsigned int entryCount;
     unsigned int maxSize;
     unsigned int size;
+    unsigned int compressMinSize;   // data fields of this size or larger are compressed (0 = off)
+    unsigned int compressBufferSize;
+    uint8_t*     compressBuffer;     // used when compressing data that is already in the stream
+    HeaderArrayData headerArray;
+    PDWriterAllocator allocator;
+    uint8_t valueOrder;
 } WriterData;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -28,9 +71,94 @@ typedef struct WriterData {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static inline uint8_t* writeIdSize(uint8_t* data, const char* id, uint8_t type, uint16_t typeSize) {
+static void* defaultAlloc(void* userData, void* ptr, size_t oldSize, size_t newSize) {
+    (void)userData;
+    (void)oldSize;
+
+    if (newSize == 0) {
+        free(ptr);
+        return 0;
+    }
+
+    return realloc(ptr, newSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define rebasePointer(ptr, oldStart, newStart) \
+    if (ptr) \
+        ptr = newStart + (ptr - oldStart)
+
+static int growBuffer(WriterData* wData, size_t size) {
+    size_t used = (size_t)(wData->data - wData->dataStart);
+    size_t newSize = wData->maxSize;
+    uint8_t* oldStart = wData->dataStart;
+    uint8_t* newStart;
+
+    if (used + size > MaxBufferSize) {
+        // \todo proper logging here
+        printf("Unable to grow writer buffer to %d bytes (max is %d)\n", (int)(used + size), MaxBufferSize);
+        return 0;
+    }
+
+    while (newSize < used + size)
+        newSize *= 2;
+
+    if (newSize > MaxBufferSize)
+        newSize = MaxBufferSize;
+
+    newStart = (uint8_t*)wData->allocator.alloc(wData->allocator.userData, oldStart, wData->maxSize, newSize);
+
+    if (!newStart) {
+        // \todo proper logging here
+        printf("Unable to grow writer buffer to %d bytes\n", (int)newSize);
+        return 0;
+    }
+
+    // all pointers into the buffer needs to be moved over to the new one
+
+    rebasePointer(wData->data, oldStart, newStart);
+    rebasePointer(wData->eventOffset, oldStart, newStart);
+    rebasePointer(wData->arrayOffset, oldStart, newStart);
+    rebasePointer(wData->entryOffset, oldStart, newStart);
+    rebasePointer(wData->headerArrayOffset, oldStart, newStart);
+    rebasePointer(wData->headerArrayColumns, oldStart, newStart);
+    rebasePointer(wData->reservedData, oldStart, newStart);
+
+    wData->dataStart = newStart;
+    wData->maxSize = (unsigned int)newSize;
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Makes sure there is room for size bytes at wData->data. Returns 0 if the buffer couldn't grow
+
+static inline int ensureSpace(WriterData* wData, size_t size) {
+    if ((size_t)(wData->data - wData->dataStart) + size <= wData->maxSize)
+        return 1;
+
+    return growBuffer(wData, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int writeIdSize(WriterData* wData, const char* id, uint8_t type, size_t typeSize) {
     size_t len = strlen(id);
-    uint16_t totalSize = ((uint16_t)len) + typeSize + 4;    // + 4 for: type (1 byte) size (2 bytes) null term (1 byte)
+    size_t totalSize = len + typeSize + 4;    // + 4 for: type (1 byte) size (2 bytes) null term (1 byte)
+    uint8_t* data;
+
+    if (totalSize > 0xffff) {
+        // \todo proper logging here
+        printf("Unable to write %s as the size (%d) doesn't fit in 16-bit (use write_data instead)\n",
+               id, (int)totalSize);
+        return 0;
+    }
+
+    if (!ensureSpace(wData, totalSize))
+        return 0;
+
+    data = wData->data;
 
     data[0] = type;
     data[1] = (totalSize >> 8) & 0xff;
@@ -38,14 +166,210 @@ static inline uint8_t* writeIdSize(uint8_t* data, const char* id, uint8_t type,
 
     memcpy(data + 3, id, len + 1);
 
-    return data + len + 4;    // size (2) bytes, 1 byte (type), 1 byte (null terminator)
+    wData->data = data + len + 4;    // size (2) bytes, 1 byte (type), 1 byte (null terminator)
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline uint8_t* writeU32(uint8_t* data, uint32_t v) {
+    data[0] = (v >> 24) & 0xff;
+    data[1] = (v >> 16) & 0xff;
+    data[2] = (v >> 8) & 0xff;
+    data[3] = (v >> 0) & 0xff;
+    return data + 4;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes values in the byte order of the stream
+
+static inline uint8_t* writeValueU16(const WriterData* wData, uint8_t* data, uint16_t v) {
+    if (wData->swapValues)
+        v = pd_bswap16(v);
+
+    memcpy(data, &v, sizeof(v));
+    return data + sizeof(v);
+}
+
+static inline uint8_t* writeValueU32(const WriterData* wData, uint8_t* data, uint32_t v) {
+    if (wData->swapValues)
+        v = pd_bswap32(v);
+
+    memcpy(data, &v, sizeof(v));
+    return data + sizeof(v);
+}
+
+static inline uint8_t* writeValueU64(const WriterData* wData, uint8_t* data, uint64_t v) {
+    if (wData->swapValues)
+        v = pd_bswap64(v);
+
+    memcpy(data, &v, sizeof(v));
+    return data + sizeof(v);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The byte order flag is kept up to date in the stream header so readers of non-finalized streams also see it
+
+static void setValueOrder(WriterData* wData, uint8_t order) {
+    wData->valueOrder = order;
+    wData->swapValues = order != pd_native_byte_order();
+
+    if (order == PDByteOrder_Little)
+        wData->dataStart[0] |= PDStreamFlag_LittleEndian;
+    else
+        wData->dataStart[0] &= ~PDStreamFlag_LittleEndian;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Size of a value inside a header array column (strings are stored as offsets into the string pool)
+
+static unsigned int headerArrayTypeSize(uint8_t type) {
+    switch (type) {
+        case PDReadType_S8:
+        case PDReadType_U8:
+            return 1;
+        case PDReadType_S16:
+        case PDReadType_U16:
+            return 2;
+        case PDReadType_S32:
+        case PDReadType_U32:
+        case PDReadType_Float:
+        case PDReadType_String:
+            return 4;
+        case PDReadType_S64:
+        case PDReadType_U64:
+        case PDReadType_Double:
+            return 8;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PDWriteStatus writeHeaderArrayPlaceholder(WriterData* wData);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The first row decides the type of each column. After that all values in a column has to be of the same type
+
+static PDWriteStatus writeHeaderArrayValue(WriterData* wData, uint8_t type, uint64_t v) {
+    HeaderArrayData* header = &wData->headerArray;
+    unsigned int column = header->valueCount % header->columnCount;
+
+    if (header->valueCount < header->columnCount) {
+        header->columnTypes[column] = type;
+    } else if (header->columnTypes[column] != type) {
+        // \todo proper logging here
+        printf("Unable to write header array value of type %d in column %d with type %d\n",
+               type, column, header->columnTypes[column]);
+
+        // an empty value is stored instead so the values after this still end up in the right columns
+
+        writeHeaderArrayPlaceholder(wData);
+        header->failed = 1;
+        return PDWriteStatus_Fail;
+    }
+
+    if (header->valueCount == header->valueCapacity) {
+        unsigned int capacity = header->valueCapacity ? header->valueCapacity * 2 : 1024;
+        uint64_t* values = (uint64_t*)wData->allocator.alloc(wData->allocator.userData, header->values,
+                                                             header->valueCapacity * sizeof(uint64_t),
+                                                             capacity * sizeof(uint64_t));
+
+        if (!values) {
+            header->failed = 1;
+            return PDWriteStatus_Fail;
+        }
+
+        header->values = values;
+        header->valueCapacity = capacity;
+    }
+
+    header->values[header->valueCount++] = v;
+
+    return PDWriteStatus_ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns the length of the string with PDStringFlag_Utf8 set if it's plain ASCII (and thus valid UTF-8)
+
+static uint32_t stringLength(const char* v, size_t len) {
+    uint64_t high = 0;
+    size_t i = 0;
+
+    if (len > PDStringLengthMask)
+        return (uint32_t)len;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t t;
+        memcpy(&t, v + i, 8);
+        high |= t;
+    }
+
+    for (; i < len; ++i)
+        high |= (uint8_t)v[i];
+
+    return (uint32_t)len | ((high & 0x8080808080808080ULL) ? 0 : PDStringFlag_Utf8);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PDWriteStatus writeHeaderArrayString(WriterData* wData, const char* v, uint32_t length) {
+    HeaderArrayData* header = &wData->headerArray;
+    unsigned int len = (length & PDStringLengthMask) + 4 + 1;    // length (4) + null terminator (1)
+    unsigned int offset = header->stringPoolSize + 4;           // offset points to the characters
+
+    if (header->stringPoolSize + len > header->stringPoolCapacity) {
+        unsigned int capacity = header->stringPoolCapacity ? header->stringPoolCapacity : 4096;
+        char* pool;
+
+        while (capacity < header->stringPoolSize + len)
+            capacity *= 2;
+
+        pool = (char*)wData->allocator.alloc(wData->allocator.userData, header->stringPool,
+                                             header->stringPoolCapacity, capacity);
+
+        if (!pool) {
+            header->failed = 1;
+            return PDWriteStatus_Fail;
+        }
+
+        header->stringPool = pool;
+        header->stringPoolCapacity = capacity;
+    }
+
+    writeU32((uint8_t*)header->stringPool + header->stringPoolSize, length);
+    memcpy(header->stringPool + offset, v, len - 5);
+    header->stringPool[offset + len - 5] = 0;
+    header->stringPoolSize += len;
+
+    return writeHeaderArrayValue(wData, PDReadType_String, offset);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes zero (or an empty string) in the next column
+
+static PDWriteStatus writeHeaderArrayPlaceholder(WriterData* wData) {
+    HeaderArrayData* header = &wData->headerArray;
+    uint8_t type = header->columnTypes[header->valueCount % header->columnCount];
+
+    if (type == PDReadType_String)
+        return writeHeaderArrayString(wData, "", 0);
+
+    return writeHeaderArrayValue(wData, type, 0);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static PDWriteStatus write_s8(struct PDWriter* writer, const char* id, int8_t v) {
     WriterData* wData = (WriterData*)writer->data;
-    wData->data = writeIdSize(wData->data, id, PDReadType_S8, sizeof(int8_t));
+
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayValue(wData, PDReadType_S8, (uint64_t)(int64_t)v);
+
+    if (!writeIdSize(wData, id, PDReadType_S8, sizeof(int8_t)))
+        return PDWriteStatus_Fail;
     *wData->data++ = v;
 
     if (wData->writingArrayEntry) {
@@ -59,7 +383,12 @@ static PDWriteStatus write_s8(struct PDWriter* writer, const char* id, int8_t v)
 
 static PDWriteStatus write_u8(struct PDWriter* writer, const char* id, uint8_t v) {
     WriterData* wData = (WriterData*)writer->data;
-    wData->data = writeIdSize(wData->data, id, PDReadType_U8, sizeof(uint8_t));
+
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayValue(wData, PDReadType_U8, v);
+
+    if (!writeIdSize(wData, id, PDReadType_U8, sizeof(uint8_t)))
+        return PDWriteStatus_Fail;
     *wData->data++ = v;
 
     if (wData->writingArrayEntry) {
@@ -73,11 +402,14 @@ static PDWriteStatus write_u8(struct PDWriter* writer, const char* id, uint8_t v
 
 static PDWriteStatus write_s16(struct PDWriter* writer, const char* id, int16_t v) {
     WriterData* wData = (WriterData*)writer->data;
-    wData->data = writeIdSize(wData->data, id, PDReadType_S16, sizeof(int16_t));
 
-    wData->data[0] = (v >> 8) & 0xff;
-    wData->data[1] = (v >> 0) & 0xff;
-    wData->data += 2;
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayValue(wData, PDReadType_S16, (uint64_t)(int64_t)v);
+
+    if (!writeIdSize(wData, id, PDReadType_S16, sizeof(int16_t)))
+        return PDWriteStatus_Fail;
+
+    wData->data = writeValueU16(wData, wData->data, (uint16_t)v);
 
     if (wData->writingArrayEntry) {
         wData->entryCount++;
@@ -90,11 +422,14 @@ static PDWriteStatus write_s16(struct PDWriter* writer, const char* id, int16_t
 
 static PDWriteStatus write_u16(struct PDWriter* writer, const char* id, uint16_t v) {
     WriterData* wData = (WriterData*)writer->data;
-    wData->data = writeIdSize(wData->data, id, PDReadType_U16, sizeof(uint16_t));
 
-    wData->data[0] = (v >> 8) & 0xff;
-    wData->data[1] = (v >> 0) & 0xff;
-    wData->data += 2;
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayValue(wData, PDReadType_U16, v);
+
+    if (!writeIdSize(wData, id, PDReadType_U16, sizeof(uint16_t)))
+        return PDWriteStatus_Fail;
+
+    wData->data = writeValueU16(wData, wData->data, (uint16_t)v);
 
     if (wData->writingArrayEntry) {
         wData->entryCount++;
@@ -107,13 +442,14 @@ static PDWriteStatus write_u16(struct PDWriter* writer, const char* id, uint16_t
 
 static PDWriteStatus write_s32(struct PDWriter* writer, const char* id, int32_t v) {
     WriterData* wData = (WriterData*)writer->data;
-    wData->data = writeIdSize(wData->data, id, PDReadType_S32, sizeof(int32_t));
 
-    wData->data[0] = (v >> 24) & 0xff;
-    wData->data[1] = (v >> 16) & 0xff;
-    wData->data[2] = (v >> 8) & 0xff;
-    wData->data[3] = (v >> 0) & 0xff;
-    wData->data += 4;
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayValue(wData, PDReadType_S32, (uint64_t)(int64_t)v);
+
+    if (!writeIdSize(wData, id, PDReadType_S32, sizeof(int32_t)))
+        return PDWriteStatus_Fail;
+
+    wData->data = writeValueU32(wData, wData->data, (uint32_t)v);
 
     if (wData->writingArrayEntry) {
         wData->entryCount++;
@@ -126,13 +462,14 @@ static PDWriteStatus write_s32(struct PDWriter* writer, const char* id, int32_t
 
 static PDWriteStatus write_u32(struct PDWriter* writer, const char* id, uint32_t v) {
     WriterData* wData = (WriterData*)writer->data;
-    wData->data = writeIdSize(wData->data, id, PDReadType_U32, sizeof(uint32_t));
 
-    wData->data[0] = (v >> 24) & 0xff;
-    wData->data[1] = (v >> 16) & 0xff;
-    wData->data[2] = (v >> 8) & 0xff;
-    wData->data[3] = (v >> 0) & 0xff;
-    wData->data += 4;
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayValue(wData, PDReadType_U32, v);
+
+    if (!writeIdSize(wData, id, PDReadType_U32, sizeof(uint32_t)))
+        return PDWriteStatus_Fail;
+
+    wData->data = writeValueU32(wData, wData->data, (uint32_t)v);
 
     if (wData->writingArrayEntry) {
         wData->entryCount++;
@@ -145,17 +482,14 @@ static PDWriteStatus write_u32(struct PDWriter* writer, const char* id, uint32_t
 
 static PDWriteStatus write_s64(struct PDWriter* writer, const char* id, int64_t v) {
     WriterData* wData = (WriterData*)writer->data;
-    wData->data = writeIdSize(wData->data, id, PDReadType_S64, sizeof(int64_t));
-
-    wData->data[0] = (v >> 56) & 0xff;
-    wData->data[1] = (v >> 48) & 0xff;
-    wData->data[2] = (v >> 40) & 0xff;
-    wData->data[3] = (v >> 32) & 0xff;
-    wData->data[4] = (v >> 24) & 0xff;
-    wData->data[5] = (v >> 16) & 0xff;
-    wData->data[6] = (v >> 8) & 0xff;
-    wData->data[7] = (v >> 0) & 0xff;
-    wData->data += 8;
+
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayValue(wData, PDReadType_S64, (uint64_t)v);
+
+    if (!writeIdSize(wData, id, PDReadType_S64, sizeof(int64_t)))
+        return PDWriteStatus_Fail;
+
+    wData->data = writeValueU64(wData, wData->data, (uint64_t)v);
 
     if (wData->writingArrayEntry) {
         wData->entryCount++;
@@ -168,17 +502,14 @@ static PDWriteStatus write_s64(struct PDWriter* writer, const char* id, int64_t
 
 static PDWriteStatus write_u64(struct PDWriter* writer, const char* id, uint64_t v) {
     WriterData* wData = (WriterData*)writer->data;
-    wData->data = writeIdSize(wData->data, id, PDReadType_U64, sizeof(uint64_t));
-
-    wData->data[0] = (v >> 56) & 0xff;
-    wData->data[1] = (v >> 48) & 0xff;
-    wData->data[2] = (v >> 40) & 0xff;
-    wData->data[3] = (v >> 32) & 0xff;
-    wData->data[4] = (v >> 24) & 0xff;
-    wData->data[5] = (v >> 16) & 0xff;
-    wData->data[6] = (v >> 8) & 0xff;
-    wData->data[7] = (v >> 0) & 0xff;
-    wData->data += 8;
+
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayValue(wData, PDReadType_U64, v);
+
+    if (!writeIdSize(wData, id, PDReadType_U64, sizeof(uint64_t)))
+        return PDWriteStatus_Fail;
+
+    wData->data = writeValueU64(wData, wData->data, (uint64_t)v);
 
     if (wData->writingArrayEntry) {
         wData->entryCount++;
@@ -201,15 +532,16 @@ union Convert {
 static PDWriteStatus write_float(struct PDWriter* writer, const char* id, float v) {
     union Convert c;
     WriterData* wData = (WriterData*)writer->data;
-    wData->data = writeIdSize(wData->data, id, PDReadType_Float, sizeof(uint32_t));
 
     c.fv = v;
 
-    wData->data[0] = (c.u32 >> 24) & 0xff;
-    wData->data[1] = (c.u32 >> 16) & 0xff;
-    wData->data[2] = (c.u32 >> 8) & 0xff;
-    wData->data[3] = (c.u32 >> 0) & 0xff;
-    wData->data += 4;
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayValue(wData, PDReadType_Float, c.u32);
+
+    if (!writeIdSize(wData, id, PDReadType_Float, sizeof(uint32_t)))
+        return PDWriteStatus_Fail;
+
+    wData->data = writeValueU32(wData, wData->data, c.u32);
 
     if (wData->writingArrayEntry) {
         wData->entryCount++;
@@ -223,19 +555,16 @@ static PDWriteStatus write_float(struct PDWriter* writer, const char* id, float
 static PDWriteStatus write_double(struct PDWriter* writer, const char* id, double v) {
     union Convert c;
     WriterData* wData = (WriterData*)writer->data;
-    wData->data = writeIdSize(wData->data, id, PDReadType_Double, sizeof(uint64_t));
 
     c.dv = v;
 
-    wData->data[0] = (c.u64 >> 56) & 0xff;
-    wData->data[1] = (c.u64 >> 48) & 0xff;
-    wData->data[2] = (c.u64 >> 40) & 0xff;
-    wData->data[3] = (c.u64 >> 32) & 0xff;
-    wData->data[4] = (c.u64 >> 24) & 0xff;
-    wData->data[5] = (c.u64 >> 16) & 0xff;
-    wData->data[6] = (c.u64 >> 8) & 0xff;
-    wData->data[7] = (c.u64 >> 0) & 0xff;
-    wData->data += 8;
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayValue(wData, PDReadType_Double, c.u64);
+
+    if (!writeIdSize(wData, id, PDReadType_Double, sizeof(uint64_t)))
+        return PDWriteStatus_Fail;
+
+    wData->data = writeValueU64(wData, wData->data, c.u64);
 
     if (wData->writingArrayEntry) {
         wData->entryCount++;
@@ -246,16 +575,20 @@ static PDWriteStatus write_double(struct PDWriter* writer, const char* id, doubl
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static PDWriteStatus write_string(struct PDWriter* writer, const char* id, const char* v) {
-    size_t len;
-    WriterData* wData = (WriterData*)writer->data;
+static PDWriteStatus writeString(WriterData* wData, const char* id, const char* v, uint32_t length) {
+    size_t len = length & PDStringLengthMask;
+
+    if (wData->writingHeaderArray)
+        return writeHeaderArrayString(wData, v, length);
 
-    len = strlen(v) + 1;
+    if (!writeIdSize(wData, id, PDReadType_String, len + 4 + 1))   // length (4) + null terminator (1)
+        return PDWriteStatus_Fail;
 
-    wData->data = writeIdSize(wData->data, id, PDReadType_String, (uint16_t)len);
+    wData->data = writeU32(wData->data, length);
     memcpy(wData->data, v, len);
+    wData->data[len] = 0;
 
-    wData->data += len;
+    wData->data += len + 1;
 
     if (wData->writingArrayEntry) {
         wData->entryCount++;
@@ -266,22 +599,99 @@ static PDWriteStatus write_string(struct PDWriter* writer, const char* id, const
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static PDWriteStatus write_string(struct PDWriter* writer, const char* id, const char* v) {
+    return writeString((WriterData*)writer->data, id, v, stringLength(v, strlen(v)));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PDWriteStatus write_string_len(struct PDWriter* writer, const char* id, const char* v, unsigned int len) {
+    if (len > PDStringLengthMask) {
+        // \todo proper logging here
+        printf("Unable to write string %s as the length (%u) is too large\n", id ? id : "", len);
+        return PDWriteStatus_Fail;
+    }
+
+    // caller guarantees the string is UTF-8 so no need to check it here
+
+    return writeString((WriterData*)writer->data, id, v, len | PDStringFlag_Utf8);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes the uncompressed size and the compressed data to dest (which needs room for len bytes). Returns the number
+// of bytes written or 0 if the data should be stored as is (too small or it doesn't compress well enough)
+
+static uint32_t compressData(WriterData* wData, uint8_t* dest, const void* src, unsigned int len) {
+    int size;
+
+    if (!wData->compressMinSize || len < wData->compressMinSize || len > MaxBufferSize)
+        return 0;
+
+    // require at least 1/16 to be saved or the reader would spend time decompressing for nothing
+
+    if (!(size = pd_compress((const uint8_t*)src, (int)len, dest + 4, (int)(len - len / 16 - 4))))
+        return 0;
+
+    dest[0] = (len >> 24) & 0xff;
+    dest[1] = (len >> 16) & 0xff;
+    dest[2] = (len >> 8) & 0xff;
+    dest[3] = (len >> 0) & 0xff;
+
+    return (uint32_t)size + 4;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static PDWriteStatus write_data(struct PDWriter* writer, const char* id, void* data, unsigned int len) {
     WriterData* wData = (WriterData*)writer->data;
-    size_t idLen = strlen(id);
+    size_t idLen;
+
+    if (wData->writingHeaderArray) {
+        // \todo proper logging here
+        printf("Unable to write data inside a header array\n");
+        return PDWriteStatus_Fail;
+    }
+
+    idLen = strlen(id);
+
+    if (idLen > MaxIdLength) {
+        // \todo proper logging here
+        printf("Unable to write data as the id length (%d) is larger than %d\n", (int)idLen, MaxIdLength);
+        return PDWriteStatus_Fail;
+    }
 
     // for data we special case a bit with having the size in 32-bit instead to support > 64k size
 
-    uint32_t totalSize = ((uint16_t)idLen) + 4 + 1 + len + 1; // size (4) + type (1) + id_len (+1) null teminator
+    size_t fieldSize = idLen + 4 + 1 + (size_t)len + 1; // size (4) + type (1) + id_len (+1) null teminator
+    uint32_t totalSize;
+    uint32_t compressedSize;
+
+    if (fieldSize > MaxBufferSize) {
+        // \todo proper logging here
+        printf("Unable to write data as the size (%u) is larger than %d\n", len, MaxBufferSize);
+        return PDWriteStatus_Fail;
+    }
+
+    if (!ensureSpace(wData, fieldSize))
+        return PDWriteStatus_Fail;
+
+    totalSize = (uint32_t)fieldSize;
 
     wData->data[0] = PDReadType_Data;
+
+    if ((compressedSize = compressData(wData, wData->data + 5 + idLen + 1, data, len))) {
+        wData->data[0] |= PDFieldFlag_Compressed;
+        totalSize = totalSize - len + compressedSize;
+    } else {
+        memcpy(wData->data + 5 + idLen + 1, data, len);
+    }
+
     wData->data[1] = (totalSize >> 24) & 0xff;
     wData->data[2] = (totalSize >> 16) & 0xff;
     wData->data[3] = (totalSize >> 8) & 0xff;
     wData->data[4] = (totalSize >> 0) & 0xff;
 
     memcpy(wData->data + 5, id, idLen + 1);
-    memcpy(wData->data + 5 + idLen + 1, data, len);
 
     wData->data += totalSize;
 
@@ -292,11 +702,189 @@ static PDWriteStatus write_data(struct PDWriter* writer, const char* id, void* d
     return PDWriteStatus_ok;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The field header is written directly and the data pointer is moved past the reserved size. At commit the size is
+// patched and the data pointer moved back if less than reserved was used.
+
+static uint8_t* write_data_reserve(struct PDWriter* writer, const char* id, unsigned int size) {
+    WriterData* wData = (WriterData*)writer->data;
+    size_t idLen;
+    uint8_t* data;
+
+    if (wData->writingHeaderArray) {
+        // \todo proper logging here
+        printf("Unable to reserve data inside a header array\n");
+        return 0;
+    }
+
+    if (wData->reservedData) {
+        // \todo proper logging here
+        printf("Unable to reserve data as no dataCommit has been called for previous reserve\n");
+        return 0;
+    }
+
+    idLen = strlen(id);
+
+    if (!ensureSpace(wData, idLen + 4 + 1 + 1 + (size_t)size))
+        return 0;
+
+    wData->data[0] = PDReadType_Data;
+    memcpy(wData->data + 5, id, idLen + 1);
+
+    data = wData->data + 5 + idLen + 1;
+
+    wData->reservedData = wData->data;
+    wData->reservedSize = size;
+    wData->data = data + size;
+
+    return data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PDWriteStatus write_data_commit(struct PDWriter* writer, unsigned int size) {
+    WriterData* wData = (WriterData*)writer->data;
+    PDWriteStatus status = PDWriteStatus_ok;
+    uint8_t* fieldStart = wData->reservedData;
+    uint32_t headerSize;
+    uint32_t totalSize;
+
+    if (!fieldStart) {
+        // \todo proper logging here
+        printf("Unable to commit data as no dataReserve has been called before this call\n");
+        return PDWriteStatus_Fail;
+    }
+
+    wData->reservedData = 0;
+    headerSize = (uint32_t)strlen((const char*)fieldStart + 5) + 4 + 1 + 1;
+
+    // if something else has been written after the reserve we can't shrink the data so keep the whole reservation
+
+    if (wData->data != fieldStart + headerSize + wData->reservedSize) {
+        // \todo proper logging here
+        printf("Unable to commit data as other values has been written after dataReserve\n");
+        size = wData->reservedSize;
+        status = PDWriteStatus_Fail;
+    } else if (size > wData->reservedSize) {
+        // \todo proper logging here
+        printf("Unable to commit %d bytes of data as only %d bytes were reserved\n", size, wData->reservedSize);
+        size = wData->reservedSize;
+        status = PDWriteStatus_Fail;
+    }
+
+    // the data is already in the stream so it's compressed to the side and copied back
+
+    if (status == PDWriteStatus_ok && wData->compressMinSize && size >= wData->compressMinSize) {
+        uint32_t compressedSize;
+
+        if (wData->compressBufferSize < size) {
+            uint8_t* buffer = (uint8_t*)wData->allocator.alloc(wData->allocator.userData, wData->compressBuffer,
+                                                               wData->compressBufferSize, size);
+            if (buffer) {
+                wData->compressBuffer = buffer;
+                wData->compressBufferSize = size;
+            }
+        }
+
+        if (wData->compressBufferSize >= size &&
+            (compressedSize = compressData(wData, wData->compressBuffer, fieldStart + headerSize, size))) {
+            memcpy(fieldStart + headerSize, wData->compressBuffer, compressedSize);
+            fieldStart[0] |= PDFieldFlag_Compressed;
+            size = compressedSize;
+        }
+    }
+
+    totalSize = headerSize + size;
+
+    fieldStart[1] = (totalSize >> 24) & 0xff;
+    fieldStart[2] = (totalSize >> 16) & 0xff;
+    fieldStart[3] = (totalSize >> 8) & 0xff;
+    fieldStart[4] = (totalSize >> 0) & 0xff;
+
+    if (status == PDWriteStatus_ok)
+        wData->data = fieldStart + totalSize;
+
+    if (wData->writingArrayEntry) {
+        wData->entryCount++;
+    }
+
+    return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Values are copied as is (native byte order) and aligned so the reader can use them directly from the stream
+
+static PDWriteStatus writeTypedArray(WriterData* wData, const char* id, uint8_t type, const void* values,
+                                     unsigned int elementSize, unsigned int count) {
+    size_t idLen = strlen(id);
+    size_t size = (size_t)elementSize * count;
+    unsigned int padding;
+    uint32_t totalSize;
+    uint8_t* data;
+
+    if (wData->writingHeaderArray) {
+        // \todo proper logging here
+        printf("Unable to write typed array inside a header array\n");
+        return PDWriteStatus_Fail;
+    }
+
+    // header + max padding
+
+    if (!ensureSpace(wData, 5 + idLen + 1 + 7 + 7 + size))
+        return PDWriteStatus_Fail;
+
+    data = wData->data;
+    padding = (unsigned int)(-(intptr_t)(data + 5 + idLen + 1 + 7 - wData->dataStart) & 7);
+    totalSize = (uint32_t)(5 + idLen + 1 + 7 + padding + size);
+
+    data[0] = PDReadType_TypedArray;
+    writeU32(data + 1, totalSize);
+    memcpy(data + 5, id, idLen + 1);
+    data += 5 + idLen + 1;
+
+    data[0] = type;
+    data[1] = pd_native_byte_order();
+    writeU32(data + 2, count);
+    data[6] = (uint8_t)padding;
+    data += 7;
+
+    memset(data, 0, padding);
+    memcpy(data + padding, values, size);
+
+    wData->data += totalSize;
+
+    if (wData->writingArrayEntry) {
+        wData->entryCount++;
+    }
+
+    return PDWriteStatus_ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PDWriteStatus write_u32_array(struct PDWriter* writer, const char* id, const uint32_t* values,
+                                     unsigned int count) {
+    return writeTypedArray((WriterData*)writer->data, id, PDReadType_U32, values, sizeof(uint32_t), count);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PDWriteStatus write_u64_array(struct PDWriter* writer, const char* id, const uint64_t* values,
+                                     unsigned int count) {
+    return writeTypedArray((WriterData*)writer->data, id, PDReadType_U64, values, sizeof(uint64_t), count);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PDWriteStatus write_f32_array(struct PDWriter* writer, const char* id, const float* values,
+                                     unsigned int count) {
+    return writeTypedArray((WriterData*)writer->data, id, PDReadType_Float, values, sizeof(float), count);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static PDWriteStatus write_event_begin(struct PDWriter* writer, uint16_t event) {
     WriterData* wData = (WriterData*)writer->data;
-    wData->eventOffset = wData->data + 3;
 
     if (wData->writingEvent) {
         // \todo proper logging here
@@ -304,6 +892,11 @@ static PDWriteStatus write_event_begin(struct PDWriter* writer, uint16_t event)
         return PDWriteStatus_Fail;
     }
 
+    if (!ensureSpace(wData, 7))
+        return PDWriteStatus_Fail;
+
+    wData->eventOffset = wData->data + 3;
+
     wData->data[0] = PDReadType_Event;
     wData->data[1] = (event >> 8) & 0xff;
     wData->data[2] = (event >> 0) & 0xff;
@@ -327,6 +920,18 @@ static PDWriteStatus write_event_end(struct PDWriter* writer) {
         return PDWriteStatus_Fail;
     }
 
+    if (wData->writingHeaderArray) {
+        // \todo proper logging here
+        printf("Unable to write endEvent as no headerArrayEnd has been called for the current header array\n");
+        return PDWriteStatus_Fail;
+    }
+
+    if (wData->reservedData) {
+        // \todo proper logging here
+        printf("Unable to write endEvent as no dataCommit has been called for the reserved data\n");
+        return PDWriteStatus_Fail;
+    }
+
     // + 3 to include the meta data at the begining with the size
     size = (uint32_t)(uintptr_t)(wData->data - wData->eventOffset) + 3;
     wData->eventOffset[0] = (size >> 24) & 0xff;
@@ -340,24 +945,175 @@ static PDWriteStatus write_event_end(struct PDWriter* writer) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static PDWriteStatus write_header_array_begin(struct PDWriter* writer, const char** ids) {
-    (void)writer;
-    (void)ids;
-    return PDWriteStatus_Fail;
+// Layout of a header array:
+//
+// type (1 byte) | size (4 bytes) | name | row count (4 bytes) | column count (1 byte)
+// column count * { type (1 byte) | offset to column data from start of header array (4 bytes) | id }
+// column count * row count values (packed, fixed size per column)
+// string pool (string values are stored as offsets from the start of their column)
+
+static PDWriteStatus write_header_array_begin(struct PDWriter* writer, const char* name, const char** ids) {
+    WriterData* wData = (WriterData*)writer->data;
+    HeaderArrayData* header = &wData->headerArray;
+    unsigned int columnCount = 0;
+    size_t headerSize;
+    int len;
+
+    if (wData->writingHeaderArray) {
+        // \todo proper logging here
+        printf("Unable to write headerArrayBegin as no headerArrayEnd has been called for previous header array.\n");
+        return PDWriteStatus_Fail;
+    }
+
+    if (!name || !ids || !ids[0])
+        return PDWriteStatus_Fail;
+
+    while (ids[columnCount])
+        columnCount++;
+
+    if (columnCount > MaxHeaderArrayColumns) {
+        // \todo proper logging here
+        printf("Unable to write headerArrayBegin with %d columns (max is %d)\n", columnCount, MaxHeaderArrayColumns);
+        return PDWriteStatus_Fail;
+    }
+
+    len = (int)strlen(name) + 1;
+    headerSize = 5 + len + 5;
+
+    for (unsigned int i = 0; i < columnCount; ++i)
+        headerSize += 5 + strlen(ids[i]) + 1;
+
+    if (!ensureSpace(wData, headerSize))
+        return PDWriteStatus_Fail;
+
+    wData->headerArrayOffset = wData->data;
+    wData->data[0] = PDReadType_HeaderArray;
+
+    // size and row count are written at header_array_end
+
+    memcpy(wData->data + 5, name, len);
+    wData->data += 5 + len + 4;
+    *wData->data++ = (uint8_t)columnCount;
+
+    wData->headerArrayColumns = wData->data;
+
+    for (unsigned int i = 0; i < columnCount; ++i) {
+        len = (int)strlen(ids[i]) + 1;
+
+        // type and offset to the column data is written at header_array_end
+
+        memcpy(wData->data + 5, ids[i], len);
+        wData->data += 5 + len;
+    }
+
+    header->valueCount = 0;
+    header->stringPoolSize = 0;
+    header->columnCount = columnCount;
+    header->failed = 0;
+    memset(header->columnTypes, PDReadType_None, sizeof(header->columnTypes));
+
+    wData->writingHeaderArray = 1;
+
+    return PDWriteStatus_ok;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static PDWriteStatus write_header_array_end(struct PDWriter* writer) {
-    (void)writer;
-    return PDWriteStatus_Fail;
+    WriterData* wData = (WriterData*)writer->data;
+    HeaderArrayData* header = &wData->headerArray;
+    PDWriteStatus status = PDWriteStatus_ok;
+    unsigned int rowCount, columnCount, columnsSize = 0;
+    uint8_t* columnDesc;
+    uint8_t* poolStart;
+
+    if (!wData->writingHeaderArray) {
+        // \todo proper logging here
+        printf("Unable to write headerArrayEnd as no headerArrayBegin has been called before this call\n");
+        return PDWriteStatus_Fail;
+    }
+
+    columnCount = header->columnCount;
+    rowCount = (header->valueCount + columnCount - 1) / columnCount;
+
+    if (rowCount > MaxHeaderArrayRows) {
+        printf("Unable to write headerArrayEnd with %d rows (max is %d)\n", rowCount, MaxHeaderArrayRows);
+        rowCount = 0;
+        status = PDWriteStatus_Fail;
+    }
+
+    if (header->failed)
+        status = PDWriteStatus_Fail;
+
+    // an incomplete last row is filled up with zeros (but is still considered an error)
+
+    while (rowCount && header->valueCount < rowCount * columnCount) {
+        status = PDWriteStatus_Fail;
+
+        if (writeHeaderArrayPlaceholder(wData) != PDWriteStatus_ok) {
+            rowCount = 0;
+            break;
+        }
+    }
+
+    for (unsigned int c = 0; c < columnCount; ++c)
+        columnsSize += headerArrayTypeSize(header->columnTypes[c]) * rowCount;
+
+    // drop the whole table if it doesn't fit
+
+    if (!ensureSpace(wData, (size_t)columnsSize + header->stringPoolSize)) {
+        wData->data = wData->headerArrayOffset;
+        wData->writingHeaderArray = 0;
+        return PDWriteStatus_Fail;
+    }
+
+    poolStart = wData->data + columnsSize;
+    columnDesc = wData->headerArrayColumns;
+
+    for (unsigned int c = 0; c < columnCount; ++c) {
+        uint8_t type = header->columnTypes[c];
+        unsigned int size = headerArrayTypeSize(type);
+        uint8_t* columnStart = wData->data;
+        const uint64_t* values = header->values + c;
+
+        columnDesc[0] = type;
+        writeU32(columnDesc + 1, (uint32_t)(uintptr_t)(columnStart - wData->headerArrayOffset));
+        columnDesc += 5 + strlen((const char*)columnDesc + 5) + 1;
+
+        for (unsigned int r = 0; r < rowCount; ++r, values += columnCount) {
+            uint64_t v = *values;
+
+            if (type == PDReadType_String)
+                v += (uint64_t)(uintptr_t)(poolStart - columnStart);
+
+            switch (size) {
+                case 1: *wData->data++ = (uint8_t)v; break;
+                case 2: wData->data = writeValueU16(wData, wData->data, (uint16_t)v); break;
+                case 4: wData->data = writeValueU32(wData, wData->data, (uint32_t)v); break;
+                case 8: wData->data = writeValueU64(wData, wData->data, v); break;
+            }
+        }
+    }
+
+    memcpy(wData->data, header->stringPool, header->stringPoolSize);
+    wData->data += header->stringPoolSize;
+
+    writeU32(wData->headerArrayOffset + 1, (uint32_t)(uintptr_t)(wData->data - wData->headerArrayOffset));
+    writeU32(wData->headerArrayColumns - 5, rowCount);
+
+    wData->writingHeaderArray = 0;
+
+    if (wData->writingArrayEntry) {
+        wData->entryCount++;
+    }
+
+    return status;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static PDWriteStatus write_array_entry_begin(struct PDWriter* writer) {
     WriterData* wData = (WriterData*)writer->data;
-    wData->entryOffset = wData->data + 1;
 
     if (wData->writingArrayEntry) {
         // \todo proper logging here
@@ -365,6 +1121,11 @@ static PDWriteStatus write_array_entry_begin(struct PDWriter* writer) {
         return PDWriteStatus_Fail;
     }
 
+    if (!ensureSpace(wData, 7))
+        return PDWriteStatus_Fail;
+
+    wData->entryOffset = wData->data + 1;
+
     wData->data[0] = PDReadType_ArrayEntry;
     wData->writingArrayEntry = 1;
     wData->entryCount = 0;
@@ -406,7 +1167,6 @@ static PDWriteStatus write_array_entry_end(struct PDWriter* writer) {
 static PDWriteStatus write_array_begin(struct PDWriter* writer, const char* name) {
     WriterData* wData = (WriterData*)writer->data;
     int len = (int)strlen(name) + 1;
-    wData->arrayOffset = wData->data + 1;
 
     if (wData->writingArray) {
         // \todo proper logging here
@@ -414,6 +1174,11 @@ static PDWriteStatus write_array_begin(struct PDWriter* writer, const char* name
         return PDWriteStatus_Fail;
     }
 
+    if (!ensureSpace(wData, len + 5))
+        return PDWriteStatus_Fail;
+
+    wData->arrayOffset = wData->data + 1;
+
     wData->data[0] = PDReadType_Array;
     memcpy(wData->data + 5, name, len);
     wData->writingArray = 1;
@@ -438,7 +1203,9 @@ static PDWriteStatus write_array_end(struct PDWriter* writer) {
 
     // write an empty arrayEntry to indicate there are no more entries in the array
 
-    write_array_entry_begin(writer);
+    if (write_array_entry_begin(writer) != PDWriteStatus_ok)
+        return PDWriteStatus_Fail;
+
     write_array_entry_end(writer);
 
     // + 1 to include the meta data at the begining with the size
@@ -455,7 +1222,7 @@ static PDWriteStatus write_array_end(struct PDWriter* writer) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void pd_binary_writer_init(PDWriter* writer) {
+void pd_binary_writer_init_with_allocator(PDWriter* writer, const PDWriterAllocator* allocator) {
     WriterData* data;
 
     writer->write_event_begin = write_event_begin;
@@ -478,6 +1245,12 @@ void pd_binary_writer_init(PDWriter* writer) {
     writer->write_double = write_double;
     writer->write_string = write_string;
     writer->write_data = write_data;
+    writer->write_data_reserve = write_data_reserve;
+    writer->write_data_commit = write_data_commit;
+    writer->write_u32_array = write_u32_array;
+    writer->write_u64_array = write_u64_array;
+    writer->write_f32_array = write_f32_array;
+    writer->write_string_len = write_string_len;
 
     //printf("pd_binary_writer_init\n");
 
@@ -486,18 +1259,33 @@ void pd_binary_writer_init(PDWriter* writer) {
 
     data = (WriterData*)writer->data;
 
-    // \todo: Make this tweakble/custom allocator 2 meg should be enough most of the time
+    if (allocator) {
+        data->allocator = *allocator;
+    } else {
+        data->allocator.alloc = defaultAlloc;
+    }
 
-    data->data = data->dataStart = malloc(1024 * 1024 * 2);
+    data->data = data->dataStart = (uint8_t*)data->allocator.alloc(data->allocator.userData, 0, 0, InitialBufferSize);
     // reserve 4 bytes at the start (to be used for size and 2 flags at the top)
     data->data += 4;
-    data->maxSize = 2 * 1024 * 1024;
+    data->maxSize = InitialBufferSize;
+
+    // values are written in big endian by default
+
+    memset(data->dataStart, 0, 4);
+    setValueOrder(data, PDByteOrder_Big);
 
     //printf("data-start %p\n", data->dataStart);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+void pd_binary_writer_init(PDWriter* writer) {
+    pd_binary_writer_init_with_allocator(writer, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 PDWriter* pd_binary_writer_create() {
     PDWriter* writer = malloc(sizeof(PDWriter));
     memset(writer, 0, sizeof(PDWriter));
@@ -519,10 +1307,22 @@ unsigned char* pd_binary_writer_get_data(PDWriter* writer) {
 
 void pd_binary_writer_finalize(PDWriter* writer) {
     WriterData* data = (WriterData*)writer->data;
-    uint8_t* wData = data->dataStart;
     uint32_t v = pd_binary_writer_get_size(writer) + 4;
+    uint32_t padding = (8 - (v & 7)) & 7;
+    uint8_t* wData;
+
+    // Streams that has data are padded with zeros to a multiple of 8 bytes so streams sent back to back over a remote
+    // connection all start at 8 byte aligned offsets (which keeps the typed arrays aligned). The padding is only
+    // included in the size in the header so writing can continue after finalize.
+
+    if (v > 4 && padding && ensureSpace(data, padding)) {
+        memset(data->data, 0, padding);
+        v += padding;
+    }
+
+    wData = data->dataStart;
 
-    wData[0] = (v >> 24) & 0xff;
+    wData[0] = ((v >> 24) & 0x3f) | (wData[0] & PDStreamFlag_LittleEndian);
     wData[1] = (v >> 16) & 0xff;
     wData[2] = (v >> 8) & 0xff;
     wData[3] = (v >> 0) & 0xff;
@@ -540,19 +1340,51 @@ unsigned int pd_binary_writer_get_size(PDWriter* writer) {
 void pd_binary_writer_reset(PDWriter* writer) {
     WriterData* data = (WriterData*)writer->data;
     void* tempData = data->dataStart;
+    unsigned int maxSize = data->maxSize;
+    HeaderArrayData headerArray = data->headerArray;
+    PDWriterAllocator allocator = data->allocator;
+    uint8_t valueOrder = data->valueOrder;
+    unsigned int compressMinSize = data->compressMinSize;
+    unsigned int compressBufferSize = data->compressBufferSize;
+    uint8_t* compressBuffer = data->compressBuffer;
     memset(data, 0, sizeof(WriterData));
     data->data = data->dataStart = tempData;
     data->data += 4;
+    data->maxSize = maxSize;
+    data->compressMinSize = compressMinSize;
+    data->compressBufferSize = compressBufferSize;
+    data->compressBuffer = compressBuffer;
+    data->headerArray = headerArray;
+    data->allocator = allocator;
+    setValueOrder(data, valueOrder);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void pd_binary_writer_set_native_order(PDWriter* writer, int enable) {
+    setValueOrder((WriterData*)writer->data, enable ? pd_native_byte_order() : PDByteOrder_Big);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void pd_binary_writer_set_compression(PDWriter* writer, unsigned int minSize) {
+    WriterData* data = (WriterData*)writer->data;
+    // the uncompressed size is stored in front of the data so smaller sizes could never be saved
+    data->compressMinSize = minSize ? (minSize < 64 ? 64 : minSize) : 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void pd_binary_writer_destroy(PDWriter* writer) {
-    //WriterData* data = (WriterData*)writer->data;
-    // TODO: Skip this free due to bad implementation of reader/writer in fake6502, fix!
-    //free(data->dataStart);
+    WriterData* data = (WriterData*)writer->data;
+    PDWriterAllocator* allocator = &data->allocator;
+
+    allocator->alloc(allocator->userData, data->dataStart, data->maxSize, 0);
+    allocator->alloc(allocator->userData, data->headerArray.values,
+                     data->headerArray.valueCapacity * sizeof(uint64_t), 0);
+    allocator->alloc(allocator->userData, data->headerArray.stringPool, data->headerArray.stringPoolCapacity, 0);
+    allocator->alloc(allocator->userData, data->compressBuffer, data->compressBufferSize, 0);
+
     free(writer->data);
-    //data->dataStart = 0;
     writer->data = 0;
 }
-
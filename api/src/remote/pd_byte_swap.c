@@ -0,0 +1,110 @@
+#include "pd_byte_swap.h"
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PD_BYTE_SWAP_SSE2
+#include <emmintrin.h>
+#if defined(__SSSE3__) || defined(__AVX__)
+#define PD_BYTE_SWAP_SSSE3
+#include <tmmintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PD_BYTE_SWAP_NEON
+#include <arm_neon.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef PD_BYTE_SWAP_SSE2
+
+// Swaps the two bytes in each 16-bit lane
+
+static __inline __m128i swapBytes16(__m128i v) {
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void pd_byte_swap_16(void* data, size_t count) {
+    uint8_t* d = (uint8_t*)data;
+    size_t i = 0;
+
+#if defined(PD_BYTE_SWAP_SSE2)
+    for (; i + 8 <= count; i += 8, d += 16)
+        _mm_storeu_si128((__m128i*)(void*)d, swapBytes16(_mm_loadu_si128((const __m128i*)(const void*)d)));
+#elif defined(PD_BYTE_SWAP_NEON)
+    for (; i + 8 <= count; i += 8, d += 16)
+        vst1q_u8(d, vrev16q_u8(vld1q_u8(d)));
+#endif
+
+    for (; i < count; ++i, d += 2) {
+        uint16_t v;
+        memcpy(&v, d, sizeof(v));
+        v = pd_bswap16(v);
+        memcpy(d, &v, sizeof(v));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void pd_byte_swap_32(void* data, size_t count) {
+    uint8_t* d = (uint8_t*)data;
+    size_t i = 0;
+
+#if defined(PD_BYTE_SWAP_SSSE3)
+    const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    for (; i + 4 <= count; i += 4, d += 16)
+        _mm_storeu_si128((__m128i*)(void*)d, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(const void*)d), mask));
+#elif defined(PD_BYTE_SWAP_SSE2)
+    // swap the 16-bit halves and then the bytes within them
+    for (; i + 4 <= count; i += 4, d += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(const void*)d);
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i*)(void*)d, swapBytes16(v));
+    }
+#elif defined(PD_BYTE_SWAP_NEON)
+    for (; i + 4 <= count; i += 4, d += 16)
+        vst1q_u8(d, vrev32q_u8(vld1q_u8(d)));
+#endif
+
+    for (; i < count; ++i, d += 4) {
+        uint32_t v;
+        memcpy(&v, d, sizeof(v));
+        v = pd_bswap32(v);
+        memcpy(d, &v, sizeof(v));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void pd_byte_swap_64(void* data, size_t count) {
+    uint8_t* d = (uint8_t*)data;
+    size_t i = 0;
+
+#if defined(PD_BYTE_SWAP_SSSE3)
+    const __m128i mask = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (; i + 2 <= count; i += 2, d += 16)
+        _mm_storeu_si128((__m128i*)(void*)d, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(const void*)d), mask));
+#elif defined(PD_BYTE_SWAP_SSE2)
+    // reverse the 16-bit words and then swap the bytes within them
+    for (; i + 2 <= count; i += 2, d += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(const void*)d);
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+        _mm_storeu_si128((__m128i*)(void*)d, swapBytes16(v));
+    }
+#elif defined(PD_BYTE_SWAP_NEON)
+    for (; i + 2 <= count; i += 2, d += 16)
+        vst1q_u8(d, vrev64q_u8(vld1q_u8(d)));
+#endif
+
+    for (; i < count; ++i, d += 8) {
+        uint64_t v;
+        memcpy(&v, d, sizeof(v));
+        v = pd_bswap64(v);
+        memcpy(d, &v, sizeof(v));
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef PDBYTESWAP_H_
+#define PDBYTESWAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Byte swapping of single values
+
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#define pd_bswap16(v) _byteswap_ushort(v)
+#define pd_bswap32(v) _byteswap_ulong(v)
+#define pd_bswap64(v) _byteswap_uint64(v)
+#elif defined(__GNUC__) || defined(__clang__)
+#define pd_bswap16(v) __builtin_bswap16(v)
+#define pd_bswap32(v) __builtin_bswap32(v)
+#define pd_bswap64(v) __builtin_bswap64(v)
+#else
+#define pd_bswap16(v) ((uint16_t)((((uint16_t)(v)) >> 8) | (((uint16_t)(v)) << 8)))
+#define pd_bswap32(v) ((((uint32_t)pd_bswap16((uint16_t)(v))) << 16) | pd_bswap16((uint16_t)((v) >> 16)))
+#define pd_bswap64(v) ((((uint64_t)pd_bswap32((uint32_t)(v))) << 32) | pd_bswap32((uint32_t)((v) >> 32)))
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum {
+    PDByteOrder_Little,
+    PDByteOrder_Big,
+};
+
+#if defined(_MSC_VER)
+static __inline uint8_t pd_native_byte_order() {
+#else
+static inline uint8_t pd_native_byte_order() {
+#endif
+    const uint16_t v = 1;
+    return *(const uint8_t*)&v ? PDByteOrder_Little : PDByteOrder_Big;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Swaps the byte order of count values in place. Uses SSE2/SSSE3/NEON when available
+
+void pd_byte_swap_16(void* data, size_t count);
+void pd_byte_swap_32(void* data, size_t count);
+void pd_byte_swap_64(void* data, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+#include "pd_compress.h"
+#include <string.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The compressed data is a list of sequences. Each sequence is a token (4 bits literal count, 4 bits match length
+// - 4) followed by the literals, a 16-bit little endian offset back to the match and extra length bytes for counts
+// that doesn't fit in the token. The last sequence is only literals.
+
+enum {
+    MinMatch = 4,
+    // matches can't start this close to the end and the last bytes are always literals (same as LZ4 so other
+    // decoders accept the data)
+    MatchStartLimit = 12,
+    LastLiterals = 5,
+    MaxOffset = 65535,
+    HashBits = 12,
+    // the search speeds up after this many bytes without a match (data that doesn't compress is skipped quickly)
+    SkipShift = 6,
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t read32(const uint8_t* ptr) {
+    uint32_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return v;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HashBits);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t* writeLength(uint8_t* op, int length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+
+    *op++ = (uint8_t)length;
+
+    return op;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes one sequence (matchLength is 0 for the last one). Returns 0 if it doesn't fit
+
+static uint8_t* writeSequence(uint8_t* op, uint8_t* opEnd, const uint8_t* literals, int literalCount, int offset,
+                              int matchLength) {
+    uint8_t* token = op;
+
+    // worst case size of the token, lengths, literals and offset
+
+    if ((opEnd - op) < literalCount + literalCount / 255 + matchLength / 255 + 5)
+        return 0;
+
+    op++;
+
+    *token = (uint8_t)((literalCount >= 15 ? 15 : literalCount) << 4);
+
+    if (literalCount >= 15)
+        op = writeLength(op, literalCount - 15);
+
+    memcpy(op, literals, (size_t)literalCount);
+    op += literalCount;
+
+    if (matchLength == 0)
+        return op;
+
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+
+    matchLength -= MinMatch;
+    *token |= (uint8_t)(matchLength >= 15 ? 15 : matchLength);
+
+    if (matchLength >= 15)
+        op = writeLength(op, matchLength - 15);
+
+    return op;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int pd_compress_bound(int srcSize) {
+    return srcSize + srcSize / 255 + 16;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int pd_compress(const uint8_t* src, int srcSize, uint8_t* dst, int dstCapacity) {
+    uint32_t table[1 << HashBits];
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + srcSize;
+    const uint8_t* matchEnd = end - LastLiterals;
+    const uint8_t* searchEnd = end - MatchStartLimit;
+    uint8_t* op = dst;
+    uint8_t* opEnd = dst + dstCapacity;
+
+    if (srcSize > MatchStartLimit) {
+        // positions are stored relative to src, unused entries point at the start which is verified like any match
+
+        memset(table, 0, sizeof(table));
+        ip++;
+
+        while (ip < searchEnd) {
+            uint32_t h = hash32(read32(ip));
+            const uint8_t* match = src + table[h];
+            int length = MinMatch;
+
+            table[h] = (uint32_t)(ip - src);
+
+            if (ip - match > MaxOffset || read32(match) != read32(ip)) {
+                ip += 1 + ((ip - anchor) >> SkipShift);
+                continue;
+            }
+
+            while (ip > anchor && match > src && ip[-1] == match[-1]) {
+                ip--;
+                match--;
+            }
+
+            while (ip + length < matchEnd && ip[length] == match[length])
+                length++;
+
+            if (!(op = writeSequence(op, opEnd, anchor, (int)(ip - anchor), (int)(ip - match), length)))
+                return 0;
+
+            ip += length;
+            anchor = ip;
+
+            // fill in the position before the next search (helps with data that repeats with a short period)
+
+            if (ip < searchEnd)
+                table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
+
+    if (!(op = writeSequence(op, opEnd, anchor, (int)(end - anchor), 0, 0)))
+        return 0;
+
+    return (int)(op - dst);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int readLength(const uint8_t** ip, const uint8_t* ipEnd, int length) {
+    uint8_t v;
+
+    do {
+        if (*ip >= ipEnd)
+            return -1;
+
+        v = *(*ip)++;
+        length += v;
+
+        if (length < 0)
+            return -1;
+    } while (v == 255);
+
+    return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int pd_decompress(const uint8_t* src, int srcSize, uint8_t* dst, int dstSize) {
+    const uint8_t* ip = src;
+    const uint8_t* ipEnd = src + srcSize;
+    uint8_t* op = dst;
+    uint8_t* opEnd = dst + dstSize;
+
+    for (;;) {
+        int literalCount, matchLength, offset;
+        uint8_t token;
+
+        if (ip >= ipEnd)
+            return -1;
+
+        token = *ip++;
+
+        if ((literalCount = token >> 4) == 15 && (literalCount = readLength(&ip, ipEnd, literalCount)) < 0)
+            return -1;
+
+        if (literalCount > ipEnd - ip || literalCount > opEnd - op)
+            return -1;
+
+        memcpy(op, ip, (size_t)literalCount);
+        op += literalCount;
+        ip += literalCount;
+
+        // the last sequence has no match
+
+        if (ip == ipEnd)
+            break;
+
+        if (ipEnd - ip < 2)
+            return -1;
+
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > op - dst)
+            return -1;
+
+        if ((matchLength = token & 15) == 15 && (matchLength = readLength(&ip, ipEnd, matchLength)) < 0)
+            return -1;
+
+        matchLength += MinMatch;
+
+        if (matchLength > opEnd - op)
+            return -1;
+
+        // The match may overlap the output (offset < length repeats the last offset bytes). Each copy only reads
+        // what has already been written so the copied part doubles every time.
+
+        {
+            const uint8_t* match = op - offset;
+
+            while (matchLength > 0) {
+                int count = (int)(op - match) < matchLength ? (int)(op - match) : matchLength;
+
+                memcpy(op, match, (size_t)count);
+                op += count;
+                matchLength -= count;
+            }
+        }
+    }
+
+    return op == opEnd ? dstSize : -1;
+}
@@ -0,0 +1,28 @@
+#ifndef PDCOMPRESS_H_
+#define PDCOMPRESS_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fast block compression used for large data fields on remote connections. The output is the LZ4 block format (a
+// single block without frame header) so it can be inspected with standard tools but no external code is needed.
+
+// Max size of the compressed output for srcSize bytes of input
+int pd_compress_bound(int srcSize);
+
+// Compresses src into dst. Returns the compressed size or 0 if it doesn't fit in dstCapacity
+int pd_compress(const uint8_t* src, int srcSize, uint8_t* dst, int dstCapacity);
+
+// Decompresses src into dst which has to be exactly dstSize (the uncompressed size). Returns dstSize on success or
+// -1 if the data is corrupt
+int pd_decompress(const uint8_t* src, int srcSize, uint8_t* dst, int dstSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
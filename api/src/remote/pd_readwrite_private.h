@@ -1,6 +1,9 @@
 #ifndef PDREADWRITE_PRIVATE_H_
 #define PDREADWRITE_PRIVATE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -10,12 +13,70 @@ struct PDWriter;
 
 // This is a private header. Not to to be used by plugins directly
 
+// Typed arrays (PDWriter::write_u32_array, etc) are stored as:
+// type (1 byte) | size (4 bytes) | id | element type (1 byte) | byte order (1 byte) | count (4 bytes) |
+// padding count (1 byte) | padding | values (aligned to 8 bytes from the start of the stream)
+//
+// The structure of the stream (types, sizes, events, etc) is always big endian but the values are stored in little
+// endian if PDStreamFlag_LittleEndian is set in the first byte of the stream header. Typed arrays have their own
+// byte order flag.
+//
+// Strings (both as fields and in the string pool of header arrays) are stored as:
+// length (4 bytes) | characters | null terminator
+// where the top bit of the length (PDStringFlag_Utf8) is set if the writer knows the string is valid UTF-8
+//
+// Data fields have PDFieldFlag_Compressed set in the type byte when the writer has compression enabled and the
+// data is large enough to be worth it. They are then stored as:
+// type (1 byte) | size (4 bytes) | id | uncompressed size (4 bytes) | compressed bytes (LZ4 block format)
+// The reader decompresses them on read_find_data so plugins never see the difference.
+
+enum {
+    PDStreamFlag_LittleEndian = 1 << 6,
+    PDFieldFlag_Compressed = 1 << 7,
+};
+
+// Compression methods a remote peer supports (sent in PDEventType_RemoteCapabilities)
+
+enum {
+    PDRemoteCompression_Lz = 1 << 0,
+};
+
+#define PDStringFlag_Utf8 0x80000000u
+#define PDStringLengthMask 0x7fffffffu
+
+struct PDReader* pd_binary_reader_create();
 void pd_binary_reader_init(struct PDReader* reader);
 void pd_binary_reader_init_stream(struct PDReader* reader, unsigned char* data, unsigned int size);
 void pd_binary_reader_reset(struct PDReader* reader);
 void pd_binary_reader_destroy(struct PDReader* reader);
 
+// Enables/disables the hashed key index used by the find functions (enabled by default)
+void pd_binary_reader_set_key_index(struct PDReader* reader, int enable);
+
+// Only events with the type bit set in mask are returned by get_event (bit 63 covers all types >= 63, see
+// PD_EVENT_MASK in pd_backend.h). The mask is kept on reset and set back to all events by init_stream
+void pd_binary_reader_set_event_mask(struct PDReader* reader, uint64_t mask);
+
+// Strings written as UTF-8 (or plain ASCII) are flagged by the writer but the flag is only passed on to the caller
+// (isUtf8 of find_string_len) when the stream comes from a writer in this process, a stream from another process
+// could claim anything. Not trusted after init_stream
+void pd_binary_reader_set_trust_utf8(struct PDReader* reader, int trust);
+
+// Does the work the first reads of the stream would do (builds the event and key indexes and decompresses the data
+// fields) so it can be done on another thread than the one reading it. Resets the reader
+void pd_binary_reader_prepare(struct PDReader* reader);
+
+// Allocator used for the writer buffers. alloc works like realloc (ptr is 0 for new allocations) and is called with
+// newSize set to 0 when the memory should be freed
+
+typedef struct PDWriterAllocator {
+    void* (*alloc)(void* userData, void* ptr, size_t oldSize, size_t newSize);
+    void* userData;
+} PDWriterAllocator;
+
+struct PDWriter* pd_binary_writer_create();
 void pd_binary_writer_init(struct PDWriter* writer);
+void pd_binary_writer_init_with_allocator(struct PDWriter* writer, const PDWriterAllocator* allocator);
 void pd_binary_writer_destroy(struct PDWriter* writer);
 void pd_binary_writer_finalize(struct PDWriter* writer);
 void pd_binary_writer_reset(struct PDWriter* writer);
@@ -23,6 +84,14 @@ void pd_binary_writer_reset(struct PDWriter* writer);
 unsigned int pd_binary_writer_get_size(struct PDWriter* writer);
 unsigned char* pd_binary_writer_get_data(struct PDWriter* writer);
 
+// Write values in the byte order of this machine instead of big endian (used when the reader is known to run on a
+// machine with the same byte order, like in-process sessions)
+void pd_binary_writer_set_native_order(struct PDWriter* writer, int enable);
+
+// Compresses data fields of at least minSize bytes (0 disables compression which is the default). Only use this when
+// the reader is known to support it (see PDRemoteCompression_Lz). Kept on reset
+void pd_binary_writer_set_compression(struct PDWriter* writer, unsigned int minSize);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,14 +1,19 @@
 #include "pd_readwrite_private.h"
+#include "pd_byte_swap.h"
 #include "remote_connection.h"
 #include <pd_backend.h>
 #include <pd_remote.h>
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #else
 #define WIN32_LEAN_AND_MEAN
@@ -16,57 +21,172 @@
 #include <Winsock2.h>
 #endif
 
-static struct RemoteConnection* s_conn;
-static struct PDBackendPlugin* s_plugin;
-static void* s_userData;
+enum {
+    // port used by PDRemote_create
+    DefaultPort = 1340,
+    // how often to look for new connections when not connected
+    ListenerPollIntervalMs = 5,
+    // max number of incoming frames (requests) handled in one update
+    MaxFramesPerUpdate = 64,
+    // number of recently cancelled request ids to remember
+    CancelledIdCount = 64,
+    // longest time the service thread waits for the connection (the thread is woken directly when there are replies
+    // to send except on Windows)
+    ServiceWaitMs = 10,
+    // the service thread stops reading from the connection when this much is waiting to be handled by the target
+    ServiceMaxPendingSize = 16 * 1024 * 1024,
+    // data fields smaller than this are sent as is when the debugger supports compression
+    CompressMinSize = 1024,
+};
+
+#if defined(_MSC_VER)
+#define atomicLoad(p) (*(volatile int*)(p))
+#define atomicStore(p, v) InterlockedExchange((volatile LONG*)(p), (LONG)(v))
+#else
+#define atomicLoad(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define atomicStore(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#endif
 
-static PDWriter s_writerData;
-static PDReader s_readerData;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Frames (or reply streams) handed between the service thread and the target. Each frame starts at an 8 byte
+// aligned offset (same as in the receive buffer of the connection) so the typed arrays in them stay aligned.
 
-static PDWriter* s_writer;
-static PDReader* s_reader;
+typedef struct FrameBuffer {
+    uint8_t* data;
+    int size;
+    int capacity;
+} FrameBuffer;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// State for running the connection on its own thread (see PDRemote_startInstanceThread). The service thread does all
+// the I/O and the target only swaps buffers with it (under the mutex) when it updates.
+
+typedef struct ServiceThread {
+#if defined(_WIN32)
+    HANDLE thread;
+    CRITICAL_SECTION mutex;
+    CONDITION_VARIABLE framesArrived;
+#else
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t framesArrived;
+#endif
 
-enum {
-    BlockSize = 1024,
-};
+    FrameBuffer incoming;   // received frames waiting for the target
+    FrameBuffer outgoing;   // replies waiting for the service thread
+    FrameBuffer handling;   // frames being handled by the target (swapped with incoming)
+    FrameBuffer sending;    // replies being sent by the service thread (swapped with outgoing)
+    FrameBuffer received;   // frames read by the service thread but not yet handed to the target
+
+    int running;
+    int connected;
+    int connectionId;       // incremented for each new connection
+} ServiceThread;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// All state for one target. Instances share nothing so each one can be updated from its own thread.
+
+typedef struct PDRemoteInstance {
+    struct RemoteConnection* conn;
+    struct PDBackendPlugin* plugin;
+    void* userData;
+
+    // the reader and writer are kept for the lifetime of the instance and reset for each update
+    PDWriter writer;
+    PDReader* reader;
+
+    uint64_t lastListenerPoll;
+
+    // Requests can be cancelled before they arrive (or before they are processed if several are received at once) so
+    // the last cancelled ids are kept around
+    uint32_t cancelledIds[CancelledIdCount];
+    int cancelledPos;
+
+    // features negotiated with the debugger (PDEventType_RemoteCapabilities) for the current connection
+    uint32_t compression;
+    int sendCapabilities;   // set when the next reply should include the capabilities
+    int connected;          // if the connection was up after the last update
+    int connectionId;       // last connection seen from the service thread
+
+    // only used when the connection is handled by a service thread
+    ServiceThread* service;
+    int pending;            // set by the service thread when there are frames for the target
+} PDRemoteInstance;
+
+// instance used by PDRemote_create, PDRemote_update, etc
+static PDRemoteInstance* s_instance;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void sleepMs(int ms) {
+static uint64_t getTimeMs() {
 #ifdef _MSC_VER
-    Sleep(ms);
+    return GetTickCount64();
 #else
-    usleep((unsigned int)(ms * 1000));
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
 #endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-int PDRemote_create(struct PDBackendPlugin* plugin, int waitForConnection) {
-    s_conn = RemoteConnection_create(RemoteConnectionType_Listener, 1340);
+static PDRemoteInstance* createInstance(struct PDBackendPlugin* plugin, struct RemoteConnection* conn) {
+    PDRemoteInstance* instance;
 
-    if (!s_conn)
+    if (!conn)
         return 0;
 
-    s_writer = &s_writerData;
-    s_reader = &s_readerData;
+    instance = (PDRemoteInstance*)malloc(sizeof(PDRemoteInstance));
+    memset(instance, 0, sizeof(PDRemoteInstance));
+
+    instance->conn = conn;
+    instance->reader = pd_binary_reader_create();
 
-    pd_binary_reader_init(s_reader);
+    pd_binary_writer_init(&instance->writer);
 
     // \todo Verify that this plugin is ok
-    s_plugin = plugin;
-    s_userData = plugin->create_instance(0);
+    instance->plugin = plugin;
+    instance->userData = plugin->create_instance(0);
+
+    return instance;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct PDRemoteInstance* PDRemote_createInstance(struct PDBackendPlugin* plugin, int port) {
+    return createInstance(plugin, RemoteConnection_create(RemoteConnectionType_Listener, port));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct PDRemoteInstance* PDRemote_createInstanceAddress(struct PDBackendPlugin* plugin, const char* address) {
+    return createInstance(plugin, RemoteConnection_createAddress(RemoteConnectionType_Listener, address));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PDRemote_create(struct PDBackendPlugin* plugin, int waitForConnection) {
+    const char* address = getenv("PDREMOTE_ADDRESS");
+
+    if (s_instance)
+        PDRemote_destroy();
+
+    if (address && address[0])
+        s_instance = PDRemote_createInstanceAddress(plugin, address);
+    else
+        s_instance = PDRemote_createInstance(plugin, DefaultPort);
+
+    if (!s_instance)
+        return 0;
 
     // wait for connection if waitForConnecion > 0
 
     waitForConnection *= 1000; // count in ms
 
     while (waitForConnection > 0) {
-        PDRemote_update(100);
+        PDRemote_updateInstance(s_instance, 100);
 
-        if (RemoteConnection_isConnected(s_conn))
+        if (RemoteConnection_isConnected(s_instance->conn))
             break;
 
         waitForConnection -= 100;
@@ -77,71 +197,646 @@ int PDRemote_create(struct PDBackendPlugin* plugin, int waitForConnection) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-int PDRemote_update(int sleepTime) {
-    PDDebugState state;
-    uint8_t* recvData = 0;
-    int recvSize = 0;
-    int action = 0;
-    void* data;
-    uint32_t size;
+static int isCancelled(PDRemoteInstance* instance, uint32_t id) {
+    int i;
 
-    if (sleepTime > 0)
-        sleepMs(sleepTime);
+    // 0 is never used as an id (and is what the unused entries are set to)
+
+    if (id == 0)
+        return 0;
+
+    for (i = 0; i < CancelledIdCount; ++i) {
+        if (instance->cancelledIds[i] == id)
+            return 1;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// A new debugger may not support what the last one did so nothing is used until it has sent its capabilities
+
+static void resetCapabilities(PDRemoteInstance* instance) {
+    instance->compression = 0;
+    instance->sendCapabilities = 0;
+    pd_binary_writer_set_compression(&instance->writer, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Looks for the sequence id of a request and remembers the ids of cancel events (and the capabilities of the
+// debugger). Returns 1 if the stream has a sequence id
 
-    RemoteConnection_updateListner(s_conn);
+static int scanRequest(PDRemoteInstance* instance, const uint8_t* frame, int frameSize, uint32_t* sequence) {
+    PDReader* reader = instance->reader;
+    int hasSequence = 0;
+    uint32_t event;
 
-    // Check if we have some data on the incoming connection
+    pd_binary_reader_init_stream(reader, (uint8_t*)frame, (unsigned int)frameSize);
 
-    if (RemoteConnection_pollRead(s_conn)) {
-        uint8_t cmd[4];
+    while ((event = PDRead_get_event(reader)) != 0) {
+        if (event == PDEventType_RequestSequence) {
+            hasSequence = PDRead_find_u32(reader, sequence, "id", 0) & PDReadStatus_Ok;
+        } else if (event == PDEventType_CancelRequests) {
+            const uint32_t* ids;
+            uint32_t i, count;
 
-        if (RemoteConnection_recv(s_conn, (char*)&cmd, 4, 0)) {
-            if (cmd[0] & (1 << 7)) {
-                action = (cmd[2] << 8) | cmd[3];
-            }else {
-                recvSize  = ((cmd[0] & 0x3f) << 24) | (cmd[1] << 16) | (cmd[2] << 8) | cmd[3];
+            if (!(PDRead_find_u32_array(reader, &ids, &count, "ids", 0) & PDReadStatus_Ok))
+                continue;
 
-                if ((recvData = RemoteConnection_recvStream(s_conn, 0, recvSize)) == 0) {
-                    printf("Unable to get data from stream\n");
-                    free(recvData);
-                    recvData = 0;
-                    recvSize = 0;
-                }
+            for (i = 0; i < count; ++i) {
+                instance->cancelledIds[instance->cancelledPos] = ids[i];
+                instance->cancelledPos = (instance->cancelledPos + 1) % CancelledIdCount;
             }
+        } else if (event == PDEventType_RemoteCapabilities) {
+            uint32_t compression = 0;
+
+            PDRead_find_u32(reader, &compression, "compression", 0);
+
+            instance->compression = compression & PDRemoteCompression_Lz;
+            instance->sendCapabilities = 1;
+
+            pd_binary_writer_set_compression(&instance->writer, instance->compression ? CompressMinSize : 0);
         }
     }
 
-    pd_binary_writer_init(s_writer);
-    pd_binary_reader_init_stream(s_reader, recvData, recvSize);
+    return hasSequence;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int getFrameSize(const uint8_t* frame) {
+    if (frame[0] & (1 << 7))
+        return 4;
+
+    return (int)((((uint32_t)frame[0] & 0x3f) << 24) | ((uint32_t)frame[1] << 16) | ((uint32_t)frame[2] << 8) |
+                 (uint32_t)frame[3]);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The frame is dropped if the buffer can't grow to fit it
 
-    state = s_plugin->update(s_userData, (PDAction)action, s_reader, s_writer);
+static void frameBufferAppend(FrameBuffer* buffer, const uint8_t* data, int size) {
+    int offset = (buffer->size + 7) & ~7;
 
-    //PDWrite_event_begin(s_writer, PDEventType_setStatus);
-    //PDWrite_u32(s_writer, "state", (uint32_t)state);
-    //PDWrite_event_end(s_writer);
+    if ((size_t)offset + (size_t)size > (size_t)buffer->capacity) {
+        size_t capacity = buffer->capacity ? (size_t)buffer->capacity : 64 * 1024;
+        uint8_t* newData;
 
-    pd_binary_writer_finalize(s_writer);
+        while ((size_t)offset + (size_t)size > capacity)
+            capacity *= 2;
 
-    size = pd_binary_writer_get_size(s_writer);
-    data = pd_binary_writer_get_data(s_writer);
+        if (capacity > INT_MAX || !(newData = (uint8_t*)realloc(buffer->data, capacity))) {
+            printf("Unable to grow frame buffer for a %d byte frame, frame dropped\n", size);
+            return;
+        }
+
+        buffer->data = newData;
+        buffer->capacity = (int)capacity;
+    }
+
+    memcpy(buffer->data + offset, data, (size_t)size);
+    buffer->size = offset + size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void frameBufferSwap(FrameBuffer* a, FrameBuffer* b) {
+    FrameBuffer temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void lockService(ServiceThread* service) {
+#if defined(_WIN32)
+    EnterCriticalSection(&service->mutex);
+#else
+    pthread_mutex_lock(&service->mutex);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void unlockService(ServiceThread* service) {
+#if defined(_WIN32)
+    LeaveCriticalSection(&service->mutex);
+#else
+    pthread_mutex_unlock(&service->mutex);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The stream is queued if the socket can't take all of it right now so a large reply doesn't block the target until
+// it's sent. With a service thread the reply is handed to it instead.
+
+static void sendReply(PDRemoteInstance* instance, const uint8_t* data) {
+    ServiceThread* service = instance->service;
+
+    if (!service) {
+        if (RemoteConnection_isConnected(instance->conn))
+            RemoteConnection_sendStream(instance->conn, data);
+
+        return;
+    }
+
+    lockService(service);
+    frameBufferAppend(&service->outgoing, data, getFrameSize(data));
+    unlockService(service);
+
+    RemoteConnection_wake(instance->conn);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Updates the plugin with one incoming stream (or none) and sends the reply. Requests with a sequence id (found by
+// scanRequest) always get a reply (starting with the same id) so the debugger can match it with the request even if
+// it was cancelled. Returns 0 if the plugin wasn't updated (the request was cancelled)
+
+static int updatePlugin(PDRemoteInstance* instance, const uint8_t* frame, int frameSize, int hasSequence,
+                         uint32_t sequence, int action) {
+    PDWriter* writer = &instance->writer;
+    PDReader* reader = instance->reader;
+    int cancelled = 0;
+    uint32_t size;
+    void* data;
+
+    if (frame) {
+        uint8_t order = frame[0] & PDStreamFlag_LittleEndian ? PDByteOrder_Little : PDByteOrder_Big;
+
+        // reply in the same order as the debugger uses (no swapping on either side if both run on the same kind of
+        // machine)
+
+        pd_binary_writer_set_native_order(writer, order == pd_native_byte_order());
+
+        cancelled = hasSequence && isCancelled(instance, sequence);
+    }
+
+    pd_binary_writer_reset(writer);
+
+    if (hasSequence) {
+        PDWrite_event_begin(writer, PDEventType_RequestSequence);
+        PDWrite_u32(writer, "id", sequence);
+
+        if (cancelled)
+            PDWrite_u8(writer, "cancelled", 1);
+
+        PDWrite_event_end(writer);
+    }
+
+    if (instance->sendCapabilities) {
+        PDWrite_event_begin(writer, PDEventType_RemoteCapabilities);
+        PDWrite_u32(writer, "compression", instance->compression);
+        PDWrite_event_end(writer);
+
+        instance->sendCapabilities = 0;
+    }
+
+    if (!cancelled) {
+        pd_binary_reader_init_stream(reader, (uint8_t*)frame, (unsigned int)frameSize);
+        pd_binary_reader_set_event_mask(reader,
+            ~(PD_EVENT_MASK(PDEventType_RequestSequence) | PD_EVENT_MASK(PDEventType_CancelRequests) |
+              PD_EVENT_MASK(PDEventType_RemoteCapabilities)));
+
+        instance->plugin->update(instance->userData, (PDAction)action, reader, writer);
+
+        //PDWrite_event_begin(writer, PDEventType_setStatus);
+        //PDWrite_u32(writer, "state", (uint32_t)state);
+        //PDWrite_event_end(writer);
+    }
+
+    pd_binary_writer_finalize(writer);
+
+    size = pd_binary_writer_get_size(writer);
+    data = pd_binary_writer_get_data(writer);
 
     // make sure to only send data if we have something to send (4 is only the size with no data)
 
-    if (size > 4 && RemoteConnection_isConnected(s_conn)) {
-        RemoteConnection_sendStream(s_conn, data);
+    if (size > 4)
+        sendReply(instance, (const uint8_t*)data);
+
+    return !cancelled;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Updates the plugin with the frames (and remembers the last action for the next frames). Returns the number of
+// times the plugin was updated. An action is kept until the plugin has been updated with it (the stream after it
+// may be a cancelled request) and one after the last stream is left in action for the caller to send.
+
+static int handleFrames(PDRemoteInstance* instance, const uint8_t** frames, const int* frameSizes, int frameCount,
+                        int* action) {
+    uint32_t sequences[MaxFramesPerUpdate];
+    int hasSequence[MaxFramesPerUpdate];
+    int updated = 0;
+    int i;
+
+    // Find the cancelled requests first so requests that have been cancelled by a later frame are skipped. Each
+    // stream is only scanned here, the sequence ids are kept for the replies.
+
+    for (i = 0; i < frameCount; ++i) {
+        if (!(frames[i][0] & (1 << 7)))
+            hasSequence[i] = scanRequest(instance, frames[i], frameSizes[i], &sequences[i]);
+    }
+
+    for (i = 0; i < frameCount; ++i) {
+        if (frames[i][0] & (1 << 7)) {
+            *action = (frames[i][2] << 8) | frames[i][3];
+        } else {
+            if (updatePlugin(instance, frames[i], frameSizes[i], hasSequence[i], sequences[i], *action)) {
+                updated++;
+                *action = 0;
+            }
+        }
+    }
+
+    return updated;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// With a service thread the target only takes the frames that the thread has received (waiting up to sleepTime for
+// them if there are none)
+
+static int updateFromService(PDRemoteInstance* instance, int sleepTime) {
+    ServiceThread* service = instance->service;
+    FrameBuffer* buffer = &service->handling;
+    const uint8_t* frames[MaxFramesPerUpdate];
+    int frameSizes[MaxFramesPerUpdate];
+    int frameCount = 0;
+    int connected;
+    int updated = 0;
+    int action = 0;
+    int offset = 0;
+
+    lockService(service);
+
+    if (service->incoming.size == 0 && sleepTime > 0) {
+#if defined(_WIN32)
+        SleepConditionVariableCS(&service->framesArrived, &service->mutex, (DWORD)sleepTime);
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += sleepTime / 1000;
+        ts.tv_nsec += (sleepTime % 1000) * 1000000;
+
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        pthread_cond_timedwait(&service->framesArrived, &service->mutex, &ts);
+#endif
+    }
+
+    frameBufferSwap(&service->incoming, buffer);
+    atomicStore(&instance->pending, 0);
+    connected = service->connected;
+
+    if (instance->connectionId != service->connectionId) {
+        instance->connectionId = service->connectionId;
+        resetCapabilities(instance);
+    }
+
+    unlockService(service);
+
+    if (!connected && buffer->size == 0)
+        return 0;
+
+    // the same as a direct update but in batches of frames from the buffer
+
+    while (offset < buffer->size) {
+        const uint8_t* frame = buffer->data + offset;
+
+        frames[frameCount] = frame;
+        frameSizes[frameCount] = getFrameSize(frame);
+        offset = (offset + frameSizes[frameCount] + 7) & ~7;
+
+        if (++frameCount == MaxFramesPerUpdate) {
+            updated += handleFrames(instance, frames, frameSizes, frameCount, &action);
+            frameCount = 0;
+        }
+    }
+
+    updated += handleFrames(instance, frames, frameSizes, frameCount, &action);
+
+    if (!updated || action != 0)
+        updatePlugin(instance, 0, 0, 0, 0, action);
+
+    buffer->size = 0;
+
+    return connected;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PDRemote_updateInstance(struct PDRemoteInstance* instance, int sleepTime) {
+    struct RemoteConnection* conn = instance->conn;
+    const uint8_t* frames[MaxFramesPerUpdate];
+    int frameSizes[MaxFramesPerUpdate];
+    int frameCount;
+    int updated = 0;
+    int action = 0;
+
+    if (instance->service)
+        return updateFromService(instance, sleepTime);
+
+    // Instead of just sleeping wait for something to happen on the connection so incoming data (or a new connection)
+    // is handled directly. This also sends data that is still queued from earlier updates
+
+    if (sleepTime > 0)
+        RemoteConnection_wait(conn, sleepTime);
+
+    // Without a debugger connected there can't be any incoming actions or data and nothing we write would be sent
+    // anyway so skip updating the plugin completely. Polling the listener is a syscall so it's only done every few ms
+    // as targets may call this function very often.
+
+    if (!RemoteConnection_isConnected(conn)) {
+        uint64_t time = getTimeMs();
+
+        instance->connected = 0;
+
+        if (sleepTime <= 0 && time - instance->lastListenerPoll < ListenerPollIntervalMs)
+            return 0;
+
+        instance->lastListenerPoll = time;
+
+        RemoteConnection_updateListner(conn);
+
+        if (!RemoteConnection_isConnected(conn))
+            return 0;
     }
 
-    free(recvData);
-    free(data);
+    // a new connection may have been accepted here or by the wait above
 
-    pd_binary_writer_destroy(s_writer);
+    if (!instance->connected)
+        resetCapabilities(instance);
 
-    return PDRemote_isConnected();
+    // Send what is left of earlier replies and get the complete frames on the incoming connection. The frames are
+    // read directly from the receive buffer of the connection and stay valid during this update. The debugger may
+    // send several requests without waiting for the replies so all that has arrived are handled here.
+
+    RemoteConnection_flush(conn);
+
+    frameCount = RemoteConnection_recvFrames(conn, frames, frameSizes, MaxFramesPerUpdate);
+
+    updated = handleFrames(instance, frames, frameSizes, frameCount, &action);
+
+    // The plugin is updated at least once every call (even if there is no data) as the target is driven by it. An
+    // action that came after the last stream is sent on its own.
+
+    if (!updated || action != 0)
+        updatePlugin(instance, 0, 0, 0, 0, action);
+
+    instance->connected = RemoteConnection_isConnected(conn);
+
+    return instance->connected;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// One round of the service thread: send the replies from the target and hand what has arrived to it
+
+static void serviceUpdate(PDRemoteInstance* instance) {
+    ServiceThread* service = instance->service;
+    struct RemoteConnection* conn = instance->conn;
+    int wasConnected = RemoteConnection_isConnected(conn);
+    int pendingSize;
+    int connected;
+    int offset = 0;
+
+    RemoteConnection_wait(conn, ServiceWaitMs);
+
+    lockService(service);
+    frameBufferSwap(&service->outgoing, &service->sending);
+    pendingSize = service->incoming.size;
+    unlockService(service);
+
+    connected = RemoteConnection_isConnected(conn);
+
+    // replies to requests from an earlier connection are of no use to a new one
+
+    if (connected && wasConnected) {
+        while (offset < service->sending.size) {
+            const uint8_t* stream = service->sending.data + offset;
+
+            RemoteConnection_sendStream(conn, stream);
+            offset = (offset + getFrameSize(stream) + 7) & ~7;
+        }
+    }
+
+    service->sending.size = 0;
+
+    // Read everything that is available unless the target has fallen behind (then the data is left in the socket so
+    // the debugger has to wait instead)
+
+    while (connected && pendingSize + service->received.size < ServiceMaxPendingSize) {
+        const uint8_t* frames[MaxFramesPerUpdate];
+        int frameSizes[MaxFramesPerUpdate];
+        int frameCount = RemoteConnection_recvFrames(conn, frames, frameSizes, MaxFramesPerUpdate);
+        int i;
+
+        for (i = 0; i < frameCount; ++i)
+            frameBufferAppend(&service->received, frames[i], frameSizes[i]);
+
+        if (frameCount < MaxFramesPerUpdate)
+            break;
+    }
+
+    connected = RemoteConnection_isConnected(conn);
+
+    lockService(service);
+
+    if (connected && !wasConnected) {
+        service->incoming.size = 0;
+        service->outgoing.size = 0;
+        service->connectionId++;
+    }
+
+    if (service->received.size != 0) {
+        if (service->incoming.size == 0) {
+            frameBufferSwap(&service->incoming, &service->received);
+        } else {
+            frameBufferAppend(&service->incoming, service->received.data, service->received.size);
+        }
+
+        service->received.size = 0;
+
+        atomicStore(&instance->pending, 1);
+
+#if defined(_WIN32)
+        WakeConditionVariable(&service->framesArrived);
+#else
+        pthread_cond_signal(&service->framesArrived);
+#endif
+    }
+
+    atomicStore(&service->connected, connected);
+
+    unlockService(service);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(_WIN32)
+static DWORD WINAPI serviceThread(LPVOID data) {
+#else
+static void* serviceThread(void* data) {
+#endif
+    PDRemoteInstance* instance = (PDRemoteInstance*)data;
+
+    while (atomicLoad(&instance->service->running))
+        serviceUpdate(instance);
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PDRemote_startInstanceThread(struct PDRemoteInstance* instance) {
+    ServiceThread* service;
+
+    if (instance->service)
+        return 1;
+
+    service = (ServiceThread*)malloc(sizeof(ServiceThread));
+    memset(service, 0, sizeof(ServiceThread));
+
+    service->running = 1;
+    service->connected = RemoteConnection_isConnected(instance->conn);
+
+    instance->service = service;
+
+#if defined(_WIN32)
+    InitializeCriticalSection(&service->mutex);
+    InitializeConditionVariable(&service->framesArrived);
+
+    if ((service->thread = CreateThread(NULL, 0, serviceThread, instance, 0, NULL)) != NULL)
+        return 1;
+
+    DeleteCriticalSection(&service->mutex);
+#else
+    pthread_mutex_init(&service->mutex, NULL);
+    pthread_cond_init(&service->framesArrived, NULL);
+
+    if (pthread_create(&service->thread, NULL, serviceThread, instance) == 0)
+        return 1;
+
+    pthread_cond_destroy(&service->framesArrived);
+    pthread_mutex_destroy(&service->mutex);
+#endif
+
+    printf("Unable to start the remote service thread\n");
+
+    instance->service = 0;
+    free(service);
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PDRemote_stopInstanceThread(struct PDRemoteInstance* instance) {
+    ServiceThread* service = instance->service;
+
+    if (!service)
+        return;
+
+    atomicStore(&service->running, 0);
+    RemoteConnection_wake(instance->conn);
+
+#if defined(_WIN32)
+    WaitForSingleObject(service->thread, INFINITE);
+    CloseHandle(service->thread);
+    DeleteCriticalSection(&service->mutex);
+#else
+    pthread_join(service->thread, NULL);
+    pthread_cond_destroy(&service->framesArrived);
+    pthread_mutex_destroy(&service->mutex);
+#endif
+
+    free(service->incoming.data);
+    free(service->outgoing.data);
+    free(service->handling.data);
+    free(service->sending.data);
+    free(service->received.data);
+    free(service);
+
+    instance->service = 0;
+    instance->pending = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const volatile int* PDRemote_getInstancePendingFlag(struct PDRemoteInstance* instance) {
+    return instance->service ? &instance->pending : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PDRemote_startServiceThread() {
+    if (!s_instance)
+        return 0;
+
+    return PDRemote_startInstanceThread(s_instance);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const volatile int* PDRemote_getPendingFlag() {
+    if (!s_instance)
+        return 0;
+
+    return PDRemote_getInstancePendingFlag(s_instance);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PDRemote_update(int sleepTime) {
+    if (!s_instance)
+        return 0;
+
+    return PDRemote_updateInstance(s_instance, sleepTime);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PDRemote_isInstanceConnected(struct PDRemoteInstance* instance) {
+    if (instance->service)
+        return atomicLoad(&instance->service->connected);
+
+    return RemoteConnection_isConnected(instance->conn);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int PDRemote_isConnected() {
-    return RemoteConnection_isConnected(s_conn);
+    if (!s_instance)
+        return 0;
+
+    return PDRemote_isInstanceConnected(s_instance);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PDRemote_destroyInstance(struct PDRemoteInstance* instance) {
+    if (!instance)
+        return;
+
+    PDRemote_stopInstanceThread(instance);
+
+    if (instance->plugin && instance->plugin->destroy_instance)
+        instance->plugin->destroy_instance(instance->userData);
+
+    RemoteConnection_destroy(instance->conn);
+
+    pd_binary_writer_destroy(&instance->writer);
+    pd_binary_reader_destroy(instance->reader);
+
+    free(instance);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PDRemote_destroy() {
+    PDRemote_destroyInstance(s_instance);
+    s_instance = 0;
 }
 
@@ -1,4 +1,5 @@
 #include "remote_connection.h"
+#include "remote_shm.h"
 #include <string.h>
 #include <stdint.h>
 
@@ -14,14 +15,20 @@
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #endif
 
 #if defined(__linux__)
 #include <sys/time.h>
+#include <sys/epoll.h>
 #endif
 
 #include <stdio.h>
@@ -37,6 +44,12 @@
 #define closesocket close
 #endif
 
+#if defined(MSG_NOSIGNAL)
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void sleepMs(int ms) {
@@ -49,32 +62,299 @@ static void sleepMs(int ms) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// All sockets are non-blocking. Data that can't be sent directly (because the socket buffer is full) is put in the
+// send queue and sent when the socket becomes writable again so sending a large stream never blocks the caller.
+// On Linux the sockets are watched with epoll, other platforms use select.
+//
+// Incoming data is read into the receive buffer and handed out (see recvFrame) as complete frames directly from it.
+// The buffer is reused for all frames and only grows if a frame larger than it arrives.
+//
+// Besides TCP the connection can use Unix domain sockets (which only differs in how the sockets are created) or
+// shared memory (see remote_shm.h) which replaces the socket calls with copies to and from a ring buffer.
+
 typedef struct RemoteConnection {
     enum RemoteConnectionType type;
 
     int serverSocket;     // used when having a listener socket
     int socket;
 
+    struct RemoteShm* shm;  // set when using the shared memory transport
+    char* unixPath;       // path of the Unix domain socket listener (removed when destroyed)
+
+#if defined(__linux__)
+    int epollFd;
+    int waitWrite;        // set if EPOLLOUT is enabled for the socket
+#endif
+
+#if !defined(_WIN32)
+    int wakeFds[2];       // pipe written by RemoteConnection_wake to interrupt a wait
+#endif
+
+    uint8_t* sendQueue;
+    int sendQueueSize;
+    int sendQueueOffset;  // start of the data in the queue that hasn't been sent yet
+    int sendQueueCapacity;
+
+    uint8_t* recvBuffer;
+    int recvCapacity;
+    int recvStart;        // start of the data that hasn't been handed out yet
+    int recvEnd;          // end of the received data
+    int recvHandedOut;    // size of the frames returned by the last recvFrames (released on the next call)
+
 } RemoteConnection;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static int socketPoll(int socket) {
-    struct timeval to = { 0, 0 };
-    fd_set fds;
+enum {
+    SendQueueMinCapacity = 64 * 1024,
+    RecvBufferMinCapacity = 64 * 1024,
+    // how long to wait for more data before trying again when the rest of a stream hasn't arrived yet
+    RecvWaitMs = 100,
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    FD_ZERO(&fds);
+#if !defined(__linux__)
 
+static void fdSet(int socket, fd_set* fds) {
 #ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable: 4127)
 #endif
-    FD_SET(socket, &fds);
+    FD_SET(socket, fds);
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int socketWouldBlock() {
+#if defined(_WIN32)
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void setNonBlocking(int socket) {
+#if defined(_WIN32)
+    u_long nonBlocking = 1;
+    ioctlsocket(socket, FIONBIO, &nonBlocking);
+#else
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Setup a connected socket. Nagle is disabled as the protocol is request/reply with small requests and we don't
+// want those to sit in the socket buffer waiting for more data
+
+static void setupSocket(RemoteConnection* conn, int socket) {
+    int yes = 1;
+
+    setNonBlocking(socket);
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&yes, sizeof(int));
+
+#if defined(SO_NOSIGPIPE)
+    setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&yes, sizeof(int));
+#endif
+
+#if defined(__linux__)
+    {
+        struct epoll_event event;
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = socket;
+
+        epoll_ctl(conn->epollFd, EPOLL_CTL_ADD, socket, &event);
+        conn->waitWrite = 0;
+
+        // only one client at a time so stop listening for new ones while connected
+
+        if (conn->serverSocket != INVALID_SOCKET)
+            epoll_ctl(conn->epollFd, EPOLL_CTL_DEL, conn->serverSocket, &event);
+    }
+#else
+    (void)conn;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void watchListener(RemoteConnection* conn) {
+#if defined(__linux__)
+    struct epoll_event event;
+
+    if (conn->serverSocket == INVALID_SOCKET)
+        return;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = conn->serverSocket;
+
+    epoll_ctl(conn->epollFd, EPOLL_CTL_ADD, conn->serverSocket, &event);
+#else
+    (void)conn;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Only ask for writable events while there is something in the send queue (otherwise every wait would return
+// directly as the socket is almost always writable)
+
+static void updateWriteInterest(RemoteConnection* conn) {
+#if defined(__linux__)
+    int waitWrite = conn->sendQueueSize != 0;
+    struct epoll_event event;
 
-    return select(socket + 1, &fds, NULL, NULL, &to) > 0;
+    if (waitWrite == conn->waitWrite || conn->socket == INVALID_SOCKET)
+        return;
+
+    memset(&event, 0, sizeof(event));
+    event.events = waitWrite ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.fd = conn->socket;
+
+    epoll_ctl(conn->epollFd, EPOLL_CTL_MOD, conn->socket, &event);
+    conn->waitWrite = waitWrite;
+#else
+    (void)conn;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sends two buffers (either can be empty) with one call. Returns the number of bytes sent (which can be less than
+// requested if the socket buffer is full) or -1 if the connection is broken
+
+static int sendBuffers(RemoteConnection* conn, const uint8_t* first, int firstSize,
+                       const uint8_t* second, int secondSize) {
+    int ret;
+
+#if defined(_WIN32)
+    WSABUF buffers[2];
+    DWORD sent = 0;
+
+    buffers[0].buf = (char*)first;
+    buffers[0].len = (ULONG)firstSize;
+    buffers[1].buf = (char*)second;
+    buffers[1].len = (ULONG)secondSize;
+
+    ret = WSASend(conn->socket, buffers, 2, &sent, 0, 0, 0) == 0 ? (int)sent : -1;
+#else
+    struct iovec buffers[2];
+    struct msghdr msg;
+
+    buffers[0].iov_base = (void*)first;
+    buffers[0].iov_len = (size_t)firstSize;
+    buffers[1].iov_base = (void*)second;
+    buffers[1].iov_len = (size_t)secondSize;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = buffers;
+    msg.msg_iovlen = 2;
+
+    ret = (int)sendmsg(conn->socket, &msg, SEND_FLAGS);
+#endif
+
+    if (ret < 0)
+        return socketWouldBlock() ? 0 : -1;
+
+    return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int queueAppend(RemoteConnection* conn, const uint8_t* data, int size) {
+    if (size == 0)
+        return 1;
+
+    // move the unsent data to the start of the queue before growing it
+
+    if (conn->sendQueueOffset != 0) {
+        conn->sendQueueSize -= conn->sendQueueOffset;
+        memmove(conn->sendQueue, conn->sendQueue + conn->sendQueueOffset, (size_t)conn->sendQueueSize);
+        conn->sendQueueOffset = 0;
+    }
+
+    if (conn->sendQueueSize + size > conn->sendQueueCapacity) {
+        int capacity = conn->sendQueueCapacity ? conn->sendQueueCapacity : SendQueueMinCapacity;
+        uint8_t* queue;
+
+        while (capacity < conn->sendQueueSize + size)
+            capacity *= 2;
+
+        if (!(queue = (uint8_t*)realloc(conn->sendQueue, (size_t)capacity))) {
+            printf("Unable to grow send queue to %d bytes\n", capacity);
+            return 0;
+        }
+
+        conn->sendQueue = queue;
+        conn->sendQueueCapacity = capacity;
+    }
+
+    memcpy(conn->sendQueue + conn->sendQueueSize, data, (size_t)size);
+    conn->sendQueueSize += size;
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sends what is left in the queue followed by data. Whatever doesn't fit in the socket buffer is queued.
+
+static int queueSend(RemoteConnection* conn, const uint8_t* data, int size) {
+    int pending = conn->sendQueueSize - conn->sendQueueOffset;
+    int sent;
+
+    if (!RemoteConnection_isConnected(conn))
+        return 0;
+
+    if (conn->shm)
+        sent = RemoteShm_write(conn->shm, conn->sendQueue + conn->sendQueueOffset, pending, data, size);
+    else
+        sent = sendBuffers(conn, conn->sendQueue + conn->sendQueueOffset, pending, data, size);
+
+    if (sent < 0) {
+        RemoteConnection_disconnect(conn);
+        return 0;
+    }
+
+    if (sent >= pending) {
+        conn->sendQueueSize = 0;
+        conn->sendQueueOffset = 0;
+        data += sent - pending;
+        size -= sent - pending;
+    } else {
+        conn->sendQueueOffset += sent;
+    }
+
+    if (!queueAppend(conn, data, size)) {
+        RemoteConnection_disconnect(conn);
+        return 0;
+    }
+
+    updateWriteInterest(conn);
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Drops everything queued or received on the last connection
+
+static void resetBuffers(RemoteConnection* conn) {
+    conn->sendQueueSize = 0;
+    conn->sendQueueOffset = 0;
+    conn->recvStart = 0;
+    conn->recvEnd = 0;
+    conn->recvHandedOut = 0;
+
+#if defined(__linux__)
+    conn->waitWrite = 0;
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -112,6 +392,89 @@ static int createListner(RemoteConnection* conn, int port) {
     return 1;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum Transport {
+    TransportTcp,
+    TransportUnix,
+    TransportShm,
+};
+
+// Addresses are "tcp:<address>", "unix:<path>" or "shm:<name>". Addresses without a transport are tcp
+
+static enum Transport parseAddress(const char* address, const char** rest) {
+    if (strncmp(address, "unix:", 5) == 0) {
+        *rest = address + 5;
+        return TransportUnix;
+    }
+
+    if (strncmp(address, "shm:", 4) == 0) {
+        *rest = address + 4;
+        return TransportShm;
+    }
+
+    *rest = strncmp(address, "tcp:", 4) == 0 ? address + 4 : address;
+
+    return TransportTcp;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(_WIN32)
+
+static int fillUnixAddress(struct sockaddr_un* sa, const char* path) {
+    if (strlen(path) >= sizeof(sa->sun_path)) {
+        printf("Unix socket path %s is too long\n", path);
+        return 0;
+    }
+
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    strcpy(sa->sun_path, path);
+
+    return 1;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int createUnixListener(RemoteConnection* conn, const char* path) {
+#if defined(_WIN32)
+    (void)conn;
+    printf("Unable to listen on %s (Unix domain sockets aren't supported on this platform)\n", path);
+    return 0;
+#else
+    struct sockaddr_un sa;
+
+    if (!fillUnixAddress(&sa, path))
+        return 0;
+
+    if ((conn->serverSocket = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET)
+        return 0;
+
+    // a socket file left by a target that didn't shut down properly would make bind fail
+
+    unlink(path);
+
+    if (bind(conn->serverSocket, (struct sockaddr*)&sa, sizeof(sa)) == -1) {
+        perror("bind");
+        return 0;
+    }
+
+    conn->unixPath = strdup(path);
+
+    if (listen(conn->serverSocket, SOMAXCONN) == -1) {
+        perror("listen");
+        return 0;
+    }
+
+    printf("Created listener on %s\n", path);
+
+    return 1;
+#endif
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -126,15 +489,52 @@ struct RemoteConnection* RemoteConnection_create(enum RemoteConnectionType type,
 
     conn = (RemoteConnection*)malloc(sizeof(RemoteConnection));
 
+    memset(conn, 0, sizeof(RemoteConnection));
+
     conn->type = type;
     conn->serverSocket = INVALID_SOCKET;
     conn->socket = INVALID_SOCKET;
 
+#if defined(__linux__)
+    if ((conn->epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("epoll_create1");
+        free(conn);
+        return 0;
+    }
+#endif
+
+#if !defined(_WIN32)
+    if (pipe(conn->wakeFds) == -1) {
+        perror("pipe");
+        conn->wakeFds[0] = conn->wakeFds[1] = -1;
+    } else {
+        setNonBlocking(conn->wakeFds[0]);
+        setNonBlocking(conn->wakeFds[1]);
+        fcntl(conn->wakeFds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(conn->wakeFds[1], F_SETFD, FD_CLOEXEC);
+
+#if defined(__linux__)
+        {
+            struct epoll_event event;
+
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.fd = conn->wakeFds[0];
+
+            epoll_ctl(conn->epollFd, EPOLL_CTL_ADD, conn->wakeFds[0], &event);
+        }
+#endif
+    }
+#endif
+
     if (type == RemoteConnectionType_Listener) {
         if (!createListner(conn, port)) {
-            free(conn);
+            RemoteConnection_destroy(conn);
             return 0;
         }
+
+        setNonBlocking(conn->serverSocket);
+        watchListener(conn);
     }
 
     return conn;
@@ -142,6 +542,133 @@ struct RemoteConnection* RemoteConnection_create(enum RemoteConnectionType type,
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+struct RemoteConnection* RemoteConnection_createAddress(enum RemoteConnectionType type, const char* address) {
+    RemoteConnection* conn;
+    const char* rest;
+
+    if (type != RemoteConnectionType_Listener)
+        return RemoteConnection_create(type, 0);
+
+    switch (parseAddress(address, &rest)) {
+        case TransportTcp:
+            return RemoteConnection_create(type, atoi(rest));
+
+        case TransportUnix:
+        {
+            if (!(conn = RemoteConnection_create(RemoteConnectionType_Connect, 0)))
+                return 0;
+
+            conn->type = type;
+
+            if (!createUnixListener(conn, rest)) {
+                RemoteConnection_destroy(conn);
+                return 0;
+            }
+
+            setNonBlocking(conn->serverSocket);
+            watchListener(conn);
+
+            return conn;
+        }
+
+        case TransportShm:
+        {
+            if (!(conn = RemoteConnection_create(RemoteConnectionType_Connect, 0)))
+                return 0;
+
+            conn->type = type;
+
+            if (!(conn->shm = RemoteShm_create(rest, 1))) {
+                RemoteConnection_destroy(conn);
+                return 0;
+            }
+
+            printf("Created listener on shared memory %s\n", rest);
+
+            return conn;
+        }
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RemoteConnection_connectAddress(RemoteConnection* conn, const char* address) {
+    const char* rest;
+
+    switch (parseAddress(address, &rest)) {
+        case TransportTcp:
+        {
+            char host[256];
+            const char* port = strrchr(rest, ':');
+
+            if (!port || (size_t)(port - rest) >= sizeof(host)) {
+                printf("No port in address %s\n", address);
+                return 0;
+            }
+
+            memcpy(host, rest, (size_t)(port - rest));
+            host[port - rest] = 0;
+
+            return RemoteConnection_connect(conn, host, atoi(port + 1));
+        }
+
+        case TransportUnix:
+        {
+#if defined(_WIN32)
+            printf("Unable to connect to %s (Unix domain sockets aren't supported on this platform)\n", rest);
+            return 0;
+#else
+            struct sockaddr_un sa;
+            int sock;
+
+            if (!fillUnixAddress(&sa, rest))
+                return 0;
+
+            if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET)
+                return 0;
+
+            if (connect(sock, (struct sockaddr*)&sa, sizeof(sa)) == -1) {
+                printf("Unable to connect to %s\n", rest);
+                closesocket(sock);
+                return 0;
+            }
+
+            conn->socket = sock;
+            setupSocket(conn, sock);
+
+            printf("Connected to %s\n", rest);
+
+            return 1;
+#endif
+        }
+
+        case TransportShm:
+        {
+            if (!conn->shm && !(conn->shm = RemoteShm_create(rest, 0)))
+                return 0;
+
+            if (!RemoteShm_connect(conn->shm)) {
+                // the listener may have been restarted (with new shared memory) so map it again on the next try
+                RemoteShm_destroy(conn->shm);
+                conn->shm = 0;
+                return 0;
+            }
+
+            resetBuffers(conn);
+
+            printf("Connected to shared memory %s\n", rest);
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 int RemoteConnection_connect(RemoteConnection* conn, const char* address, int port) {
     struct hostent* he;
     struct sockaddr_in sa;
@@ -185,6 +712,8 @@ int RemoteConnection_connect(RemoteConnection* conn, const char* address, int po
 
     conn->socket = sock;
 
+    setupSocket(conn, sock);
+
     printf("Connected!\n");
 
     return 1;
@@ -199,12 +728,37 @@ void RemoteConnection_destroy(struct RemoteConnection* conn) {
     if (conn->serverSocket != INVALID_SOCKET)
         closesocket(conn->serverSocket);
 
+    RemoteShm_destroy(conn->shm);
+
+#if !defined(_WIN32)
+    if (conn->unixPath)
+        unlink(conn->unixPath);
+#endif
+
+    free(conn->unixPath);
+
+#if defined(__linux__)
+    close(conn->epollFd);
+#endif
+
+#if !defined(_WIN32)
+    if (conn->wakeFds[0] != -1) {
+        close(conn->wakeFds[0]);
+        close(conn->wakeFds[1]);
+    }
+#endif
+
+    free(conn->sendQueue);
+    free(conn->recvBuffer);
     free(conn);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int RemoteConnection_connected(struct RemoteConnection* conn) {
+    if (conn->shm)
+        return RemoteShm_isConnected(conn->shm);
+
     return conn->socket != INVALID_SOCKET;
 }
 
@@ -227,6 +781,8 @@ static int clientConnect(RemoteConnection* conn, struct sockaddr_in* host) {
     if (NULL != host)
         *host = hostTemp;
 
+    setupSocket(conn, conn->socket);
+
     printf("Accept done\n");
 
     return 1;
@@ -235,33 +791,12 @@ static int clientConnect(RemoteConnection* conn, struct sockaddr_in* host) {
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void RemoteConnection_updateListner(RemoteConnection* conn) {
-    struct timeval timeout;
-    struct sockaddr_in client;
-    fd_set fds;
-
-    FD_ZERO(&fds);
-
-#ifdef _MSC_VER
-#pragma warning(push)
-#pragma warning(disable: 4127)
-#endif
-    FD_SET(conn->serverSocket, &fds);
-#ifdef _MSC_VER
-#pragma warning(pop)
-#endif
-
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 0;
-
     if (RemoteConnection_isConnected(conn))
         return;
 
     // look for new clients
 
-    if (select(conn->serverSocket + 1, &fds, NULL, NULL, &timeout) > 0) {
-        if (clientConnect(conn, &client))
-            printf("Connected to %s\n", inet_ntoa(client.sin_addr));
-    }
+    RemoteConnection_wait(conn, 0);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -272,120 +807,447 @@ int RemoteConnection_disconnect(RemoteConnection* conn) {
     if (conn->socket != INVALID_SOCKET)
         closesocket(conn->socket);
 
+    if (conn->shm)
+        RemoteShm_disconnect(conn->shm);
+
     conn->socket = INVALID_SOCKET;
 
+    resetBuffers(conn);
+    watchListener(conn);
+
     return 1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// There are no sockets to wait for with shared memory so the other side wakes us up when it has written or read
+// something (or connected)
 
-int RemoteConnection_recv(RemoteConnection* conn, char* buffer, int length, int flags) {
-    int ret;
+static int shmWait(RemoteConnection* conn, int timeoutMs) {
+    int readable;
+
+    if (conn->type == RemoteConnectionType_Listener && !RemoteShm_isConnected(conn->shm)) {
+        if (!RemoteShm_connect(conn->shm)) {
+            RemoteShm_wait(conn->shm, timeoutMs);
+
+            if (!RemoteShm_connect(conn->shm))
+                return 0;
+
+            timeoutMs = 0;
+        }
+
+        // the last client may have gone away without the connection noticing
+
+        resetBuffers(conn);
+
+        printf("Connected to shared memory client\n");
+    }
+
+    readable = RemoteShm_wait(conn->shm, timeoutMs);
+
+    if (conn->sendQueueSize != 0)
+        RemoteConnection_flush(conn);
+
+    return readable && RemoteShm_isConnected(conn->shm);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Only wakes the wait (the rest of the connection may be in use by the waiting thread)
+
+void RemoteConnection_wake(RemoteConnection* conn) {
+#if !defined(_WIN32)
+    char c = 0;
+
+    if (conn->wakeFds[1] != -1 && write(conn->wakeFds[1], &c, 1) < 0) {
+        // the pipe is full which means that the waiting thread will wake up anyway
+    }
+#endif
+
+    if (conn->shm)
+        RemoteShm_wake(conn->shm);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void clearWake(RemoteConnection* conn) {
+#if !defined(_WIN32)
+    char buffer[64];
+
+    while (read(conn->wakeFds[0], buffer, sizeof(buffer)) > 0)
+        ;
+#else
+    (void)conn;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Waits (up to timeoutMs, 0 to only check) for something to happen on the connection. New clients are accepted and
+// queued data is sent when the socket is writable. Returns 1 if there is data to read.
+
+int RemoteConnection_wait(RemoteConnection* conn, int timeoutMs) {
+    struct sockaddr_in client;
+    int readable = 0;
+    int accept = 0;
+
+    if (conn->shm)
+        return shmWait(conn, timeoutMs);
+
+#if defined(__linux__)
+    struct epoll_event events[3];
+    int i, count;
+
+    count = epoll_wait(conn->epollFd, events, 3, timeoutMs);
+
+    for (i = 0; i < count; ++i) {
+        if (events[i].data.fd == conn->wakeFds[0]) {
+            clearWake(conn);
+        } else if (events[i].data.fd == conn->serverSocket) {
+            accept = 1;
+        } else if (events[i].data.fd == conn->socket) {
+            if (events[i].events & EPOLLOUT)
+                RemoteConnection_flush(conn);
+
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                readable = 1;
+        }
+    }
+#else
+    struct timeval timeout;
+    fd_set readFds;
+    fd_set writeFds;
+    int maxSocket = INVALID_SOCKET;
+
+    FD_ZERO(&readFds);
+    FD_ZERO(&writeFds);
+
+    if (conn->socket != INVALID_SOCKET) {
+        fdSet(conn->socket, &readFds);
+
+        if (conn->sendQueueSize != 0)
+            fdSet(conn->socket, &writeFds);
+
+        maxSocket = conn->socket;
+    } else if (conn->serverSocket != INVALID_SOCKET) {
+        fdSet(conn->serverSocket, &readFds);
+        maxSocket = conn->serverSocket;
+    }
+
+#if !defined(_WIN32)
+    if (conn->wakeFds[0] != -1) {
+        fdSet(conn->wakeFds[0], &readFds);
+
+        if (conn->wakeFds[0] > maxSocket)
+            maxSocket = conn->wakeFds[0];
+    }
+#endif
+
+    if (maxSocket == INVALID_SOCKET) {
+        if (timeoutMs > 0)
+            sleepMs(timeoutMs);
 
-    if (!RemoteConnection_connected(conn))
         return 0;
+    }
 
-    ret = (int)recv(conn->socket, buffer, (size_t)length, flags);
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
 
-    if (ret <= 0) {
-        printf("recv %d %d\n", ret, length);
-        RemoteConnection_disconnect(conn);
+    if (select(maxSocket + 1, &readFds, &writeFds, NULL, timeoutMs < 0 ? NULL : &timeout) <= 0)
         return 0;
+
+#if !defined(_WIN32)
+    if (conn->wakeFds[0] != -1 && FD_ISSET(conn->wakeFds[0], &readFds))
+        clearWake(conn);
+#endif
+
+    if (conn->socket != INVALID_SOCKET) {
+        if (FD_ISSET(conn->socket, &writeFds))
+            RemoteConnection_flush(conn);
+
+        readable = FD_ISSET(conn->socket, &readFds);
+    } else if (conn->serverSocket != INVALID_SOCKET) {
+        accept = FD_ISSET(conn->serverSocket, &readFds);
     }
+#endif
 
-    return ret;
+    if (accept && !RemoteConnection_isConnected(conn)) {
+        if (clientConnect(conn, &client))
+            printf("Connected to %s\n", client.sin_family == AF_INET ? inet_ntoa(client.sin_addr) : "local client");
+    }
+
+    return readable && RemoteConnection_isConnected(conn);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-int RemoteConnection_send(RemoteConnection* conn, const void* buffer, int length, int flags) {
+int RemoteConnection_flush(RemoteConnection* conn) {
+    if (conn->sendQueueSize == 0)
+        return 0;
+
+    queueSend(conn, 0, 0);
+
+    return conn->sendQueueSize - conn->sendQueueOffset;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reads what is available without blocking. Returns the number of bytes read, 0 if there is nothing to read right
+// now or -1 if the connection is closed (or has failed)
+
+static int transportRecv(RemoteConnection* conn, char* buffer, int length, int flags) {
     int ret;
 
-    if (!RemoteConnection_connected(conn))
-        return 0;
+    if (conn->shm)
+        return RemoteShm_read(conn->shm, (uint8_t*)buffer, length);
+
+    ret = (int)recv(conn->socket, buffer, (size_t)length, flags);
+
+    if (ret > 0)
+        return ret;
+
+    return ret < 0 && socketWouldBlock() ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RemoteConnection_recv(RemoteConnection* conn, char* buffer, int length, int flags) {
+    int ret;
 
-    if ((ret = (int)send(conn->socket, buffer, (size_t)length, flags)) != (int)length) {
+    for (;;) {
+        if (!RemoteConnection_connected(conn))
+            return 0;
+
+        ret = transportRecv(conn, buffer, length, flags);
+
+        if (ret > 0)
+            return ret;
+
+        // the socket is non-blocking so wait for the data to arrive (and keep sending queued data meanwhile so two
+        // sides sending large streams at the same time can't deadlock)
+
+        if (ret == 0) {
+            RemoteConnection_wait(conn, RecvWaitMs);
+            continue;
+        }
+
+        printf("recv %d %d\n", ret, length);
         RemoteConnection_disconnect(conn);
         return 0;
     }
+}
 
-    return ret;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RemoteConnection_send(RemoteConnection* conn, const void* buffer, int length, int flags) {
+    (void)flags;
+
+    if (!queueSend(conn, (const uint8_t*)buffer, length))
+        return 0;
+
+    return length;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int RemoteConnection_sendStream(RemoteConnection* conn, const unsigned char* buffer) {
-    int sizeCount = 0;
     // stream has the size at the very start and 2 top bits used for other things
     int32_t size = ((buffer[0] & 0x3f) << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
 
-    //printf("Going to send stream of size %d\n", size);
+    // whatever doesn't fit in the socket buffer now is queued and sent by later updates
 
-    while (size != 0) {
-        uint32_t sizeLeft = size > 1024 ? 1024 : size;
+    if (!queueSend(conn, buffer, size))
+        return 0;
 
-        int sent = RemoteConnection_send(conn, buffer, sizeLeft, 0);
+    return size;
+}
 
-        //printf("sent %d out of %d bytes\n", sent, size);
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-        if (sent == 0)
-            return sizeCount;
+// Frames start with the 4 byte stream header. Actions are only the header (with the top bit set) and for streams the
+// header holds the size of the whole frame (including the header) in the lower 30 bits
 
-        buffer += 1024;
-        size -= sizeLeft;
-        sizeCount += sizeLeft;
-    }
+static int getFrameSize(const uint8_t* header) {
+    if (header[0] & (1 << 7))
+        return 4;
 
-    return sizeCount;
+    return ((header[0] & 0x3f) << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Makes sure that a frame of size bytes starting at recvStart fits in the buffer (by moving the data to the start of
+// the buffer and growing it if needed)
+
+static int recvReserve(RemoteConnection* conn, int size) {
+    int used = conn->recvEnd - conn->recvStart;
+
+    if (conn->recvStart + size <= conn->recvCapacity)
+        return 1;
+
+    if (size > conn->recvCapacity) {
+        int capacity = conn->recvCapacity ? conn->recvCapacity : RecvBufferMinCapacity;
+        uint8_t* buffer;
+
+        while (capacity < size)
+            capacity *= 2;
+
+        if (!(buffer = (uint8_t*)malloc((size_t)capacity))) {
+            printf("Unable to allocate %d bytes for receive buffer\n", capacity);
+            return 0;
+        }
 
-unsigned char* RemoteConnection_recvStream(RemoteConnection* conn, unsigned char* outputBuffer, int size) {
-    uint8_t* retBuffer = outputBuffer;
-    uint8_t ownBuffer = 0;
+        if (used)
+            memcpy(buffer, conn->recvBuffer + conn->recvStart, (size_t)used);
 
-    if (!outputBuffer) {
-        outputBuffer = retBuffer = malloc(size);
-        memset(outputBuffer, 0xcd, size);
-        ownBuffer = 1;
+        free(conn->recvBuffer);
+
+        conn->recvBuffer = buffer;
+        conn->recvCapacity = capacity;
+    } else {
+        memmove(conn->recvBuffer, conn->recvBuffer + conn->recvStart, (size_t)used);
     }
 
-    outputBuffer[0] = (size >> 24) & 0xff;
-    outputBuffer[1] = (size >> 16) & 0xff;
-    outputBuffer[2] = (size >> 8) & 0xff;
-    outputBuffer[3] = (size >> 0) & 0xff;
+    conn->recvStart = 0;
+    conn->recvEnd = used;
 
-    outputBuffer += 4;
-    size -= 4;
+    return 1;
+}
 
-    //printf("about to get data (expected size %d)\n", size);
-    //printf("filling buffer %p\n", outputBuffer);
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    while (size != 0) {
-        uint32_t currSize = size > 1024 ? 1024 : size;
+// Reads what is available on the connection (without blocking)
 
-        int ret = RemoteConnection_recv(conn, (char*)outputBuffer, currSize, 0);
+static int recvFill(RemoteConnection* conn) {
+    for (;;) {
+        int offset = conn->recvStart;
+        int space;
+        int ret;
 
-        //printf("got size %d (%d)\n", ret, currSize);
+        // skip the complete frames to find out how much room the next one needs
 
-        if (ret <= 0) {
-            printf("Lost connection or error :(\n");
+        while (conn->recvEnd - offset >= 4) {
+            int frameSize = getFrameSize(conn->recvBuffer + offset);
 
-            if (ownBuffer)
-                free(outputBuffer);
+            if (frameSize < 4) {
+                printf("Invalid frame size %d\n", frameSize);
+                RemoteConnection_disconnect(conn);
+                return 0;
+            }
 
-            return 0;
+            if (conn->recvEnd - offset < frameSize)
+                break;
+
+            offset += frameSize;
+        }
+
+        if (offset != conn->recvStart) {
+            // there are frames to process already so don't move or grow the buffer for more until they are released
+
+            if (conn->recvEnd == conn->recvCapacity)
+                return 1;
+        } else {
+            int frameSize = RecvBufferMinCapacity;
+
+            if (conn->recvEnd - offset >= 4)
+                frameSize = getFrameSize(conn->recvBuffer + offset);
+
+            if (!recvReserve(conn, frameSize)) {
+                RemoteConnection_disconnect(conn);
+                return 0;
+            }
+        }
+
+        // read as much as there is room for (which may be several frames) to keep the number of calls down
+
+        space = conn->recvCapacity - conn->recvEnd;
+        ret = transportRecv(conn, (char*)conn->recvBuffer + conn->recvEnd, space, 0);
+
+        if (ret > 0) {
+            conn->recvEnd += ret;
+
+            if (ret < space)
+                return 1;
+
+            continue;
         }
 
-        outputBuffer += 1024;
+        if (ret == 0)
+            return 1;
+
+        printf("recv %d\n", ret);
+        RemoteConnection_disconnect(conn);
+        return 0;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int collectFrames(RemoteConnection* conn, const unsigned char** frames, int* sizes, int maxCount) {
+    int offset = conn->recvStart;
+    int count = 0;
+
+    while (count < maxCount && conn->recvEnd - offset >= 4) {
+        int frameSize = getFrameSize(conn->recvBuffer + offset);
 
-        size -= currSize;
+        if (frameSize < 4 || conn->recvEnd - offset < frameSize)
+            break;
+
+        // Frames are handed out 8 byte aligned so the typed arrays in them can be accessed directly. Streams from
+        // pd_binary_writer_finalize are padded so this only happens for streams from other writers, in which case
+        // the rest of the buffer is moved down (after the frames that has already been handed out)
+
+        if (offset & 7) {
+            int aligned = offset & ~7;
+
+            if (count > 0)
+                break;
+
+            memmove(conn->recvBuffer + aligned, conn->recvBuffer + offset, (size_t)(conn->recvEnd - offset));
+            conn->recvEnd -= offset - aligned;
+            conn->recvStart = offset = aligned;
+        }
+
+        frames[count] = conn->recvBuffer + offset;
+        sizes[count] = frameSize;
+        offset += frameSize;
+        count++;
     }
 
-    return retBuffer;
+    conn->recvHandedOut = offset - conn->recvStart;
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RemoteConnection_recvFrames(RemoteConnection* conn, const unsigned char** frames, int* sizes, int maxCount) {
+    int count;
+
+    // release the frames that were handed out by the previous call
+
+    conn->recvStart += conn->recvHandedOut;
+    conn->recvHandedOut = 0;
+
+    if (conn->recvStart == conn->recvEnd)
+        conn->recvStart = conn->recvEnd = 0;
+
+    // only read from the socket if there aren't enough frames buffered already
+
+    if ((count = collectFrames(conn, frames, sizes, maxCount)) == maxCount || !RemoteConnection_isConnected(conn))
+        return count;
+
+    if (!recvFill(conn))
+        return 0;
+
+    return collectFrames(conn, frames, sizes, maxCount);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const unsigned char* RemoteConnection_recvFrame(RemoteConnection* conn, int* size) {
+    const unsigned char* frame = 0;
+
+    if (!RemoteConnection_recvFrames(conn, &frame, size, 1))
+        return 0;
+
+    return frame;
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -393,7 +1255,7 @@ int RemoteConnection_pollRead(RemoteConnection* conn) {
     if (!RemoteConnection_connected(conn))
         return 0;
 
-    return !!socketPoll(conn->socket);
+    return RemoteConnection_wait(conn, 0);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -402,7 +1264,7 @@ int RemoteConnection_isConnected(RemoteConnection* conn) {
     if (conn == NULL)
         return 0;
 
-    return conn->socket != INVALID_SOCKET;
+    return RemoteConnection_connected(conn);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
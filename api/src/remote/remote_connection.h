@@ -19,6 +19,12 @@ enum RemoteConnectionType {
 struct RemoteConnection* RemoteConnection_create(enum RemoteConnectionType type, int port);
 void RemoteConnection_destroy(struct RemoteConnection* connection);
 
+// Addresses select the transport: "tcp:<port>" (or only "<port>"), "unix:<path>" for a Unix domain socket or
+// "shm:<name>" for shared memory (Linux only, see remote_shm.h). Listeners use the address when created and
+// connections when connecting (tcp addresses are then "tcp:<host>:<port>" or "<host>:<port>")
+struct RemoteConnection* RemoteConnection_createAddress(enum RemoteConnectionType type, const char* address);
+int RemoteConnection_connectAddress(struct RemoteConnection* connection, const char* address);
+
 void RemoteConnection_updateListner(struct RemoteConnection* conn);
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -31,11 +37,32 @@ int RemoteConnection_recv(struct RemoteConnection* connection, char* buffer, int
 int RemoteConnection_send(struct RemoteConnection* connection, const void* buffer, int length, int flags);
 int RemoteConnection_pollRead(struct RemoteConnection* connection);
 
+// Waits for data to read (or new clients/writable socket which are handled directly) for up to timeoutMs. Returns
+// 1 if there is data to read
+int RemoteConnection_wait(struct RemoteConnection* connection, int timeoutMs);
+
+// Makes a wait on another thread return directly (or the next wait if there is no wait going on). This is the only
+// function that can be called while another thread uses the connection. Not supported on Windows (where the wait
+// runs until its timeout)
+void RemoteConnection_wake(struct RemoteConnection* connection);
+
+// Sends as much as possible of the data that has been queued by earlier sends and returns the number of bytes that
+// are still waiting to be sent
+int RemoteConnection_flush(struct RemoteConnection* connection);
+
 int RemoteConnection_sendFormat(struct RemoteConnection* conn, const char* format, ...);
 int RemoteConnection_sendFormatRecv(unsigned char* dest, int buferSize, struct RemoteConnection* conn, int timeOut, const char* format, ...);
 
 int RemoteConnection_sendStream(struct RemoteConnection* connection, const unsigned char* buffer);
-unsigned char* RemoteConnection_recvStream(struct RemoteConnection* connection, unsigned char* out, int size);
+
+// Reads the data that is available (without blocking) and returns the next complete frame (a stream or action
+// header) or 0 if there isn't one yet. The frame points into the connection receive buffer and is valid until the
+// next call.
+const unsigned char* RemoteConnection_recvFrame(struct RemoteConnection* connection, int* size);
+
+// Same as recvFrame but returns up to maxCount frames (that are all valid until the next call)
+int RemoteConnection_recvFrames(struct RemoteConnection* connection, const unsigned char** frames, int* sizes,
+                                int maxCount);
 
 #ifdef __cplusplus
 }
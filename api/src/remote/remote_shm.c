@@ -0,0 +1,476 @@
+#include "remote_shm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum {
+    ShmMagic = 0x50444d53,
+    ShmVersion = 1,
+    // size of each ring (has to be a power of two)
+    ShmRingSize = 8 * 1024 * 1024,
+    CacheLineSize = 64,
+    MaxNameLength = 256,
+};
+
+enum {
+    SideListener,
+    SideClient,
+};
+
+// The positions only grow (the ring offset is pos & (ringSize - 1)) so head == tail is empty and tail - head ==
+// ringSize is full. The head is only written by the reader and the tail only by the writer.
+
+typedef struct ShmRing {
+    uint64_t head;
+    uint8_t pad0[CacheLineSize - sizeof(uint64_t)];
+    uint64_t tail;
+    uint8_t pad1[CacheLineSize - sizeof(uint64_t)];
+} ShmRing;
+
+// Start of the shared memory block. The ring data follows directly after the header
+
+typedef struct ShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ringSize;
+    uint32_t listenerAlive;
+    int32_t clientPid;        // 0 when no client is connected
+    uint32_t connection;      // increased for each client that connects
+    uint32_t wake[2];         // futex word for each side, increased by the other side when it writes, reads or connects
+    uint32_t sleeping[2];     // set while the side is waiting on its futex (so the other side only wakes when needed)
+    uint8_t pad[CacheLineSize - 10 * sizeof(uint32_t)];
+    ShmRing rings[2];         // indexed by the side that reads from the ring
+} ShmHeader;
+
+typedef struct RemoteShm {
+    ShmHeader* header;
+    uint8_t* ringData[2];
+    size_t size;
+    int side;
+    int pid;
+    int connected;
+    uint32_t connection;      // the connection (see ShmHeader) this side is part of
+    char name[MaxNameLength];
+} RemoteShm;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void futexWait(uint32_t* address, uint32_t value, int timeoutMs) {
+    struct timespec timeout;
+
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000;
+
+    syscall(SYS_futex, address, FUTEX_WAIT, value, timeoutMs < 0 ? NULL : &timeout, NULL, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void futexWake(uint32_t* address) {
+    syscall(SYS_futex, address, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void wakeOther(RemoteShm* shm) {
+    ShmHeader* header = shm->header;
+    int other = shm->side ^ 1;
+
+    __atomic_add_fetch(&header->wake[other], 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&header->sleeping[other], __ATOMIC_SEQ_CST))
+        futexWake(&header->wake[other]);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int processAlive(int pid) {
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct RemoteShm* RemoteShm_create(const char* name, int isListener) {
+    ShmHeader* header;
+    RemoteShm* shm;
+    struct stat st;
+    size_t size;
+    int fd;
+
+    shm = (RemoteShm*)malloc(sizeof(RemoteShm));
+    memset(shm, 0, sizeof(RemoteShm));
+
+    // shm_open wants the name to start with a slash
+
+    snprintf(shm->name, sizeof(shm->name), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    shm->side = isListener ? SideListener : SideClient;
+    shm->pid = (int)getpid();
+
+    if ((fd = shm_open(shm->name, isListener ? O_CREAT | O_RDWR : O_RDWR, 0600)) == -1) {
+        perror("shm_open");
+        free(shm);
+        return 0;
+    }
+
+    if (isListener) {
+        size = sizeof(ShmHeader) + 2 * (size_t)ShmRingSize;
+
+        if (ftruncate(fd, (off_t)size) == -1) {
+            perror("ftruncate");
+            close(fd);
+            free(shm);
+            return 0;
+        }
+    } else {
+        if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(ShmHeader)) {
+            printf("Shared memory %s is too small\n", shm->name);
+            close(fd);
+            free(shm);
+            return 0;
+        }
+
+        size = (size_t)st.st_size;
+    }
+
+    header = (ShmHeader*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (header == MAP_FAILED) {
+        perror("mmap");
+        free(shm);
+        return 0;
+    }
+
+    if (isListener) {
+        memset(header, 0, sizeof(ShmHeader));
+        header->version = ShmVersion;
+        header->ringSize = ShmRingSize;
+        header->listenerAlive = 1;
+
+        __atomic_store_n(&header->magic, ShmMagic, __ATOMIC_RELEASE);
+    } else {
+        uint32_t ringSize = header->ringSize;
+
+        if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != ShmMagic || header->version != ShmVersion ||
+            (ringSize & (ringSize - 1)) != 0 || size < sizeof(ShmHeader) + 2 * (size_t)ringSize) {
+            printf("Shared memory %s isn't a ProDBG connection (or an incompatible version)\n", shm->name);
+            munmap(header, size);
+            free(shm);
+            return 0;
+        }
+    }
+
+    shm->header = header;
+    shm->size = size;
+    shm->ringData[0] = (uint8_t*)(header + 1);
+    shm->ringData[1] = shm->ringData[0] + header->ringSize;
+
+    return shm;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RemoteShm_destroy(struct RemoteShm* shm) {
+    if (!shm)
+        return;
+
+    if (shm->side == SideListener) {
+        __atomic_store_n(&shm->header->listenerAlive, 0, __ATOMIC_SEQ_CST);
+        wakeOther(shm);
+        shm_unlink(shm->name);
+    } else {
+        RemoteShm_disconnect(shm);
+    }
+
+    munmap(shm->header, shm->size);
+    free(shm);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RemoteShm_isConnected(struct RemoteShm* shm) {
+    ShmHeader* header = shm->header;
+
+    if (!shm->connected)
+        return 0;
+
+    if (__atomic_load_n(&header->connection, __ATOMIC_ACQUIRE) != shm->connection)
+        shm->connected = 0;
+    else if (shm->side == SideListener)
+        shm->connected = __atomic_load_n(&header->clientPid, __ATOMIC_ACQUIRE) != 0;
+    else
+        shm->connected = __atomic_load_n(&header->clientPid, __ATOMIC_ACQUIRE) == shm->pid &&
+                         __atomic_load_n(&header->listenerAlive, __ATOMIC_ACQUIRE);
+
+    return shm->connected;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RemoteShm_connect(struct RemoteShm* shm) {
+    ShmHeader* header = shm->header;
+    int32_t pid;
+
+    if (RemoteShm_isConnected(shm))
+        return 1;
+
+    pid = __atomic_load_n(&header->clientPid, __ATOMIC_ACQUIRE);
+
+    if (shm->side == SideListener) {
+        uint32_t connection = __atomic_load_n(&header->connection, __ATOMIC_ACQUIRE);
+
+        if (pid == 0 || connection == shm->connection)
+            return 0;
+
+        shm->connection = connection;
+        shm->connected = 1;
+
+        return 1;
+    }
+
+    if (!__atomic_load_n(&header->listenerAlive, __ATOMIC_ACQUIRE)) {
+        printf("No listener for shared memory %s\n", shm->name);
+        return 0;
+    }
+
+    // a client that has died without disconnecting is replaced
+
+    if (pid != 0 && pid != shm->pid && processAlive(pid)) {
+        printf("Shared memory %s already has a client\n", shm->name);
+        return 0;
+    }
+
+    // Only the client that wins the race for the slot may touch the rings. They are reset before the listener sees
+    // the new connection so nothing of the last connection is left.
+
+    if (!__atomic_compare_exchange_n(&header->clientPid, &pid, shm->pid, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        return 0;
+
+    memset(header->rings, 0, sizeof(header->rings));
+
+    shm->connection = __atomic_add_fetch(&header->connection, 1, __ATOMIC_SEQ_CST);
+    shm->connected = 1;
+
+    wakeOther(shm);
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RemoteShm_disconnect(struct RemoteShm* shm) {
+    ShmHeader* header = shm->header;
+    int32_t pid;
+
+    if (!RemoteShm_isConnected(shm))
+        return;
+
+    // clearing the client makes the other side see the disconnect (if it's still for this connection)
+
+    pid = __atomic_load_n(&header->clientPid, __ATOMIC_ACQUIRE);
+    __atomic_compare_exchange_n(&header->clientPid, &pid, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+    shm->connected = 0;
+
+    wakeOther(shm);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RemoteShm_write(struct RemoteShm* shm, const uint8_t* first, int firstSize, const uint8_t* second, int secondSize) {
+    ShmRing* ring = &shm->header->rings[shm->side ^ 1];
+    uint8_t* data = shm->ringData[shm->side ^ 1];
+    uint32_t ringSize = shm->header->ringSize;
+    uint64_t tail = ring->tail;
+    uint64_t space;
+    int written = 0;
+    int part;
+
+    if (!RemoteShm_isConnected(shm))
+        return -1;
+
+    space = ringSize - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+
+    for (part = 0; part < 2; ++part) {
+        const uint8_t* src = part == 0 ? first : second;
+        uint64_t size = (uint64_t)(part == 0 ? firstSize : secondSize);
+
+        if (size > space - (uint64_t)written)
+            size = space - (uint64_t)written;
+
+        while (size > 0) {
+            uint32_t offset = (uint32_t)((tail + (uint64_t)written) & (ringSize - 1));
+            uint32_t count = ringSize - offset < size ? ringSize - offset : (uint32_t)size;
+
+            memcpy(data + offset, src, count);
+
+            src += count;
+            size -= count;
+            written += (int)count;
+        }
+    }
+
+    if (written == 0)
+        return 0;
+
+    __atomic_store_n(&ring->tail, tail + (uint64_t)written, __ATOMIC_RELEASE);
+
+    wakeOther(shm);
+
+    return written;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RemoteShm_read(struct RemoteShm* shm, uint8_t* buffer, int size) {
+    ShmRing* ring = &shm->header->rings[shm->side];
+    uint8_t* data = shm->ringData[shm->side];
+    uint32_t ringSize = shm->header->ringSize;
+    uint64_t head = ring->head;
+    uint64_t available;
+    int read = 0;
+
+    if (!RemoteShm_isConnected(shm))
+        return -1;
+
+    available = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - head;
+
+    if ((uint64_t)size > available)
+        size = (int)available;
+
+    while (read < size) {
+        uint32_t offset = (uint32_t)((head + (uint64_t)read) & (ringSize - 1));
+        uint32_t count = ringSize - offset;
+
+        if (count > (uint32_t)(size - read))
+            count = (uint32_t)(size - read);
+
+        memcpy(buffer + read, data + offset, count);
+        read += (int)count;
+    }
+
+    if (read == 0)
+        return 0;
+
+    __atomic_store_n(&ring->head, head + (uint64_t)read, __ATOMIC_RELEASE);
+
+    // the other side may be waiting for room to write
+
+    wakeOther(shm);
+
+    return read;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int readable(RemoteShm* shm) {
+    ShmRing* ring = &shm->header->rings[shm->side];
+    return shm->connected && __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != ring->head;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RemoteShm_wait(struct RemoteShm* shm, int timeoutMs) {
+    ShmHeader* header = shm->header;
+    uint32_t* wake = &header->wake[shm->side];
+    uint32_t value = __atomic_load_n(wake, __ATOMIC_SEQ_CST);
+
+    if (readable(shm) || timeoutMs == 0)
+        return readable(shm);
+
+    // Announce that we are about to sleep and check again so a write that happened in between isn't missed (the
+    // futex returns directly if the value has changed since it was read above)
+
+    __atomic_store_n(&header->sleeping[shm->side], 1, __ATOMIC_SEQ_CST);
+
+    if (!readable(shm) && __atomic_load_n(wake, __ATOMIC_SEQ_CST) == value)
+        futexWait(wake, value, timeoutMs);
+
+    __atomic_store_n(&header->sleeping[shm->side], 0, __ATOMIC_SEQ_CST);
+
+    // Nothing happened at all so make sure the client is still around (it can't tell us if it has crashed)
+
+    if (shm->side == SideListener && shm->connected && __atomic_load_n(wake, __ATOMIC_SEQ_CST) == value) {
+        int32_t pid = __atomic_load_n(&header->clientPid, __ATOMIC_ACQUIRE);
+
+        if (pid != 0 && !processAlive(pid)) {
+            printf("Shared memory client %d has gone away\n", pid);
+            RemoteShm_disconnect(shm);
+        }
+    }
+
+    return readable(shm);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RemoteShm_wake(struct RemoteShm* shm) {
+    ShmHeader* header = shm->header;
+
+    __atomic_add_fetch(&header->wake[shm->side], 1, __ATOMIC_SEQ_CST);
+    futexWake(&header->wake[shm->side]);
+}
+
+#else
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct RemoteShm* RemoteShm_create(const char* name, int isListener) {
+    (void)isListener;
+    printf("Unable to use shared memory %s (not supported on this platform)\n", name);
+    return 0;
+}
+
+void RemoteShm_destroy(struct RemoteShm* shm) {
+    (void)shm;
+}
+
+int RemoteShm_connect(struct RemoteShm* shm) {
+    (void)shm;
+    return 0;
+}
+
+int RemoteShm_isConnected(struct RemoteShm* shm) {
+    (void)shm;
+    return 0;
+}
+
+void RemoteShm_disconnect(struct RemoteShm* shm) {
+    (void)shm;
+}
+
+int RemoteShm_write(struct RemoteShm* shm, const uint8_t* first, int firstSize, const uint8_t* second, int secondSize) {
+    (void)shm; (void)first; (void)firstSize; (void)second; (void)secondSize;
+    return -1;
+}
+
+int RemoteShm_read(struct RemoteShm* shm, uint8_t* buffer, int size) {
+    (void)shm; (void)buffer; (void)size;
+    return -1;
+}
+
+int RemoteShm_wait(struct RemoteShm* shm, int timeoutMs) {
+    (void)shm; (void)timeoutMs;
+    return 0;
+}
+
+void RemoteShm_wake(struct RemoteShm* shm) {
+    (void)shm;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef REMOTESHM_H_
+#define REMOTESHM_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Transport for targets on the same machine as the debugger. The listener creates a named shared memory block with
+// two byte rings (one in each direction) and the client maps the same block. Sending and receiving is a memcpy into
+// or out of the ring and the sides wake each other with a futex only when the other side is waiting.
+//
+// Only one client can be connected at a time. Currently only supported on Linux (create returns NULL elsewhere)
+
+struct RemoteShm;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct RemoteShm* RemoteShm_create(const char* name, int isListener);
+void RemoteShm_destroy(struct RemoteShm* shm);
+
+// Client: connect to the listener. Listener: check if a new client has connected. Returns 1 if connected
+int RemoteShm_connect(struct RemoteShm* shm);
+int RemoteShm_isConnected(struct RemoteShm* shm);
+void RemoteShm_disconnect(struct RemoteShm* shm);
+
+// Writes as much as fits of first + second. Returns the number of bytes written or -1 if not connected
+int RemoteShm_write(struct RemoteShm* shm, const uint8_t* first, int firstSize, const uint8_t* second, int secondSize);
+
+// Reads up to size bytes. Returns the number of bytes read (0 if there is nothing to read) or -1 if not connected
+int RemoteShm_read(struct RemoteShm* shm, uint8_t* buffer, int size);
+
+// Waits up to timeoutMs for the other side to write or read something (or connect). Returns 1 if there is data to read
+int RemoteShm_wait(struct RemoteShm* shm, int timeoutMs);
+
+// Wakes a wait on this side (can be called from another thread)
+void RemoteShm_wake(struct RemoteShm* shm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -951,8 +951,29 @@ void exec6502(uint32_t tickcount) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static const volatile int* s_pendingFlag;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void setPendingFlag(const volatile int* flag)
+{
+    s_pendingFlag = flag;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static void updateDebugger()
 {
+    // with the service thread handling the connection we only need to update when something has arrived
+
+    if (s_pendingFlag)
+    {
+        if (PDRemote_isPending(s_pendingFlag))
+            PDRemote_update(0);
+
+        return;
+    }
+
     // if we aren't connected with the debugger just update the connection every 128 cycles to save some CPU
 
     if (!PDRemote_isConnected())
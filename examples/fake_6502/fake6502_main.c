@@ -22,6 +22,7 @@ extern uint32_t clockgoal6502;
 void exec6502(uint32_t tickcount);
 void step6502();
 extern void disassemble(unsigned short begin, unsigned short end);
+extern void setPendingFlag(const volatile int* flag);
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Read function  for the emulated 6502 CPU
@@ -81,6 +82,10 @@ int main(int argc, const char* argv[])
     {
         printf("Unable to setup debugger connection\n");
     }
+    else if (PDRemote_startServiceThread())
+    {
+        setPendingFlag(PDRemote_getPendingFlag());
+    }
 
     for (;;)    
     {
@@ -117,8 +117,8 @@ impl AmigaUaeBackend {
             for i in insns.iter() {
                 let text = format!("{0: <10} {1: <10}", i.mnemonic().unwrap(), i.op_str().unwrap_or(""));
                 writer.array_entry_begin();
-                writer.write_u32("address", i.address as u32);
-                writer.write_string("line", &text);
+                writer.write_u32(key!("address"), i.address as u32);
+                writer.write_string(key!("line"), &text);
 
                 scratch_string.clear();
 
@@ -130,7 +130,7 @@ impl AmigaUaeBackend {
 
                 if scratch_string.len() > 0 {
                     let t = scratch_string.trim_right();
-                    writer.write_string("registers_read", t);
+                    writer.write_string(key!("registers_read"), t);
                 }
 
                 scratch_string.clear();
@@ -143,7 +143,7 @@ impl AmigaUaeBackend {
 
                 if scratch_string.len() > 0 {
                     let t = scratch_string.trim_right();
-                    writer.write_string("registers_write", t);
+                    writer.write_string(key!("registers_write"), t);
                 }
 
                 writer.array_entry_end();
@@ -48,16 +48,16 @@ impl DisassemblyView {
         self.lines.clear();
 
         for entry in reader.find_array("disassembly") {
-            let address = entry.find_u64("address").ok().unwrap();
-            let line = entry.find_string("line").ok().unwrap();
+            let address = entry.find_u64(key!("address")).ok().unwrap();
+            let line = entry.find_string(key!("line")).ok().unwrap();
             let mut regs_read = String::new();
             let mut regs_write = String::new();
 
-            entry.find_string("registers_read").map(|regs| {
+            entry.find_string(key!("registers_read")).map(|regs| {
                 regs_read = regs.to_owned();
             }).ok();
 
-            entry.find_string("registers_write").map(|regs| {
+            entry.find_string(key!("registers_write")).map(|regs| {
                 regs_write = regs.to_owned();
             }).ok();
 
@@ -318,6 +318,10 @@ impl View for DisassemblyView {
         }
     }
 
+    fn event_mask(&self) -> u64 {
+        event_mask(&[EVENT_SET_EXCEPTION_LOCATION, EVENT_SET_DISASSEMBLY])
+    }
+
     fn update(&mut self, ui: &mut Ui, reader: &mut Reader, writer: &mut Writer) {
         for event in reader.get_events() {
             match event {
@@ -286,6 +286,15 @@ static int loadState(void* user_data, struct PDLoadState* loadState) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static uint64_t eventMask(void* user_data) {
+    (void)user_data;
+
+    return PD_EVENT_MASK(PDEventType_SetMemory) |
+           PD_EVENT_MASK(PDEventType_SetExceptionLocation);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static PDViewPlugin plugin =
 {
     "Hex Memory View",
@@ -294,6 +303,7 @@ static PDViewPlugin plugin =
     update,
     saveState,
     loadState,
+    eventMask,
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
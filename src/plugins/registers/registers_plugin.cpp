@@ -178,12 +178,23 @@ static int update(void* user_data, PDUI* uiFuncs, PDReader* inEvents, PDWriter*
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static uint64_t eventMask(void* user_data) {
+    (void)user_data;
+
+    return PD_EVENT_MASK(PDEventType_SetRegisters);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static PDViewPlugin plugin =
 {
     "Registers View",
     createInstance,
     destroyInstance,
     update,
+    0,
+    0,
+    eventMask,
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
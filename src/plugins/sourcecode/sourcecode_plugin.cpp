@@ -247,12 +247,26 @@ static int update(void* user_data, PDUI* uiFuncs, PDReader* inEvents, PDWriter*
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static uint64_t eventMask(void* user_data) {
+    (void)user_data;
+
+    return PD_EVENT_MASK(PDEventType_SetExceptionLocation) |
+           PD_EVENT_MASK(PDEventType_SetSourceCodeFile) |
+           PD_EVENT_MASK(PDEventType_ToggleBreakpointCurrentLine) |
+           PD_EVENT_MASK(PDEventType_SetSourceFiles);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static PDViewPlugin plugin =
 {
     "Source Code View",
     createInstance,
     destroyInstance,
     update,
+    0,
+    0,
+    eventMask,
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -26,6 +26,7 @@ fn main() {
     	println!("cargo:rustc-flags=-l dylib=X11");
     	println!("cargo:rustc-flags=-l dylib=GL");
     	println!("cargo:rustc-flags=-l dylib=dl");
+    	println!("cargo:rustc-flags=-l dylib=rt");
     }
 }
 
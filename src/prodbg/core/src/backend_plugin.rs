@@ -1,36 +1,43 @@
 use std::os::raw::{c_void};
 use std::rc::Rc;
+use std::sync::{Arc, Mutex};
 use plugin::Plugin;
 use plugins::PluginHandler;
 use prodbg_api::backend::CBackendCallbacks;
 use menus;
 use services;
+use plugin_io;
+use slot_map::SlotMap;
 use Lib;
 use minifb::Menu;
 use std::mem::transmute;
 use std::ptr;
 
 #[derive(PartialEq, Eq, Clone, Copy, Debug)]
-pub struct BackendHandle(pub usize);
+pub struct BackendHandle(pub u64);
 
 pub struct BackendInstance {
     pub plugin_data: *mut c_void,
     pub handle: BackendHandle,
     pub plugin_type: Rc<Plugin>,
     pub menu_id_offset: u32,
+    /// The session updates the backend on its own thread (see BackendThread) so all other calls into the instance
+    /// has to be made with this locked. It's set to false when the instance is unloaded.
+    pub alive: Arc<Mutex<bool>>,
 }
 
 #[derive(Clone)]
 struct ReloadState {
     name: String,
     handle: BackendHandle,
+    // written by save_state before the plugin was unloaded
+    plugin_data: Option<Vec<String>>,
 }
 
 pub struct BackendPlugins {
-    pub instances: Vec<BackendInstance>,
+    pub instances: SlotMap<BackendInstance>,
     plugin_types: Vec<Rc<Plugin>>,
     reload_state: Vec<ReloadState>,
-    handle_counter: BackendHandle,
 }
 
 impl PluginHandler for BackendPlugins {
@@ -45,18 +52,28 @@ impl PluginHandler for BackendPlugins {
 
     fn unload_plugin(&mut self, lib: &Rc<Lib>) {
         self.reload_state.clear();
-        for i in (0..self.instances.len()).rev() {
-            if &self.instances[i].plugin_type.lib == lib {
+        for instance in self.instances.iter() {
+            if &instance.plugin_type.lib == lib {
+                // waits for the backend thread to finish its update (it stops after that)
+                let mut alive = instance.alive.lock().unwrap();
+                *alive = false;
+
+                // The reloaded instance gets the same handle so the sessions using it keeps doing that (and starts
+                // new backend threads for it)
                 let state = ReloadState {
-                    name: self.instances[i].plugin_type.name.clone(),
-                    handle: self.instances[i].handle,
+                    name: instance.plugin_type.name.clone(),
+                    handle: instance.handle,
+                    plugin_data: instance.save_state(),
                 };
 
                 self.reload_state.push(state);
-                self.instances.swap_remove(i);
+
+                instance.destroy();
             }
         }
 
+        self.instances.retain(|instance| &instance.plugin_type.lib != lib);
+
         for i in (0..self.plugin_types.len()).rev() {
             if &self.plugin_types[i].lib == lib {
                 self.plugin_types.swap_remove(i);
@@ -67,7 +84,16 @@ impl PluginHandler for BackendPlugins {
     fn reload_plugin(&mut self) {
         let t = self.reload_state.clone();
         for reload_plugin in &t {
-            Self::create_instance(self, &reload_plugin.name);
+            let index = match self.find_plugin_type(&reload_plugin.name) {
+                Some(index) => index,
+                None => continue,
+            };
+
+            let handle = self.create_instance_from_type(index, Some(reload_plugin.handle));
+
+            if let Some(ref data) = reload_plugin.plugin_data {
+                self.get_backend(handle).map(|instance| instance.load_state(data));
+            }
         }
     }
 
@@ -77,61 +103,61 @@ impl PluginHandler for BackendPlugins {
 impl BackendPlugins {
     pub fn new() -> BackendPlugins {
         BackendPlugins {
-            instances: Vec::new(),
+            instances: SlotMap::new(),
             plugin_types: Vec::new(),
             reload_state: Vec::new(),
-            handle_counter: BackendHandle(0),
         }
     }
 
-    fn create_instance_from_type(&mut self, index: usize) -> Option<BackendHandle> {
+    fn create_instance_from_type(&mut self,
+                                 index: usize,
+                                 backend_handle: Option<BackendHandle>)
+                                 -> Option<BackendHandle> {
+        let handle = backend_handle.unwrap_or(BackendHandle(self.instances.next_key()));
+
+        if self.instances.contains_key(handle.0) {
+            return None;
+        }
+
         let user_data = unsafe {
             let callbacks = self.plugin_types[index].plugin_funcs as *mut CBackendCallbacks;
             (*callbacks).create_instance.unwrap()(services::get_services)
         };
 
-        let handle = self.handle_counter;
-
         let instance = BackendInstance {
             plugin_data: user_data,
             handle: handle,
             plugin_type: self.plugin_types[index].clone(),
             menu_id_offset: 0,
+            alive: Arc::new(Mutex::new(true)),
         };
 
-        self.handle_counter.0 += 1;
-
-        self.instances.push(instance);
-
-        Some(handle)
+        match self.instances.insert_at(handle.0, instance) {
+            Ok(()) => Some(handle),
+            Err(_) => None,
+        }
     }
 
     pub fn create_instance_from_index(mut self, index: usize) -> Option<BackendHandle> {
-        Self::create_instance_from_type(&mut self, index)
+        Self::create_instance_from_type(&mut self, index, None)
     }
 
     pub fn create_instance(&mut self, plugin_type: &String) -> Option<BackendHandle> {
-        for i in 0..self.plugin_types.len() {
-            if self.plugin_types[i].name != *plugin_type {
-                continue;
-            }
-
-            return self.create_instance_from_type(i);
+        match self.find_plugin_type(plugin_type) {
+            Some(index) => self.create_instance_from_type(index, None),
+            None => None,
         }
+    }
 
-        None
+    fn find_plugin_type(&self, plugin_type: &String) -> Option<usize> {
+        self.plugin_types.iter().position(|plugin| plugin.name == *plugin_type)
     }
 
     pub fn get_backend(&mut self, backend_handle: Option<BackendHandle>) -> Option<&mut BackendInstance> {
-        if let Some(handle) = backend_handle {
-            for i in 0..self.instances.len() {
-                if self.instances[i].handle == handle {
-                    return Some(&mut self.instances[i]);
-                }
-            }
+        match backend_handle {
+            Some(handle) => self.instances.get_mut(handle.0),
+            None => None,
         }
-
-        None
     }
 
     pub fn get_menu(&mut self, handle: BackendHandle, menu_id_offset: u32) -> Option<Box<Menu>> {
@@ -142,7 +168,10 @@ impl BackendPlugins {
                 if let Some(register_menu) = (*plugin_funcs).register_menu { 
                     let mut menus_funcs = menus::get_menu_funcs(menu_id_offset); 
                     let funcs: *mut c_void = transmute(&mut menus_funcs);
-                    let menu = register_menu(backend.plugin_data, funcs);
+                    let menu = {
+                        let _alive = backend.alive.lock().unwrap();
+                        register_menu(backend.plugin_data, funcs)
+                    };
                     if menu == ptr::null_mut() {
                         return None;
                     }
@@ -158,3 +187,32 @@ impl BackendPlugins {
         None
     }
 }
+
+impl BackendInstance {
+    // Only called when the backend isn't updated (alive is locked or the instance hasn't been used yet)
+
+    fn save_state(&self) -> Option<Vec<String>> {
+        unsafe {
+            let callbacks = self.plugin_type.plugin_funcs as *mut CBackendCallbacks;
+            (*callbacks).save_state.map(|save_state| plugin_io::save_state(save_state, self.plugin_data))
+        }
+    }
+
+    fn load_state(&mut self, data: &Vec<String>) {
+        unsafe {
+            let callbacks = self.plugin_type.plugin_funcs as *mut CBackendCallbacks;
+            if let Some(load_state) = (*callbacks).load_state {
+                plugin_io::load_state(load_state, self.plugin_data, data);
+            }
+        }
+    }
+
+    fn destroy(&self) {
+        unsafe {
+            let callbacks = self.plugin_type.plugin_funcs as *mut CBackendCallbacks;
+            if let Some(destroy_instance) = (*callbacks).destroy_instance {
+                destroy_instance(self.plugin_data);
+            }
+        }
+    }
+}
@@ -0,0 +1,385 @@
+use std::os::raw::{c_int, c_void};
+use std::sync::{Arc, Mutex};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::thread::{self, JoinHandle};
+use std::time::{Duration, Instant};
+use prodbg_api::read_write::{Reader, Writer};
+use reader_wrapper::{ReaderWrapper, WriterWrapper};
+use remote_connection::{self, RemoteConnection};
+use spsc_queue::SpscQueue;
+use stats::SessionStats;
+use wakeup::Wakeup;
+
+///! Runs the updates of a local backend on its own thread so a backend that blocks (waiting for a debugger event or
+///! a reply from a target) never stalls the UI and a backend isn't limited to one update per UI frame.
+///!
+///! The session and the backend thread exchange the same frames as a remote connection (finalized streams and
+///! action frames) through lock-free queues: the UI thread pushes what the views has written and pops what the
+///! backend has written. The backend is updated once for each stream it gets (with the actions that came before it)
+///! and every IDLE_UPDATE_MS when nothing has arrived so a running target is still polled.
+///!
+
+/// Sends frames to a backend that runs somewhere else (another thread or another process) and receives its replies.
+/// Nothing here waits for the backend.
+pub trait BackendChannel {
+    /// Queues a finalized stream or action frame. If the queue is full the frame is given back.
+    fn send(&self, frame: Vec<u8>) -> Result<(), Vec<u8>>;
+    /// Returns the next stream the backend has written (if any) and when it arrived from the backend (which is earlier
+    /// than the update that takes it)
+    fn recv(&self) -> Option<(Vec<u8>, Instant)>;
+
+    fn send_action(&self, action: i32) -> Result<(), Vec<u8>> {
+        self.send(remote_connection::action_frame(action))
+    }
+}
+
+impl BackendChannel for RemoteConnection {
+    fn send(&self, frame: Vec<u8>) -> Result<(), Vec<u8>> {
+        RemoteConnection::send(self, frame)
+    }
+
+    fn recv(&self) -> Option<(Vec<u8>, Instant)> {
+        RemoteConnection::recv(self)
+    }
+}
+
+/// Same as the update function in CBackendCallbacks
+pub type BackendUpdate = fn(data: *mut c_void, action: c_int, reader: *mut c_void, writer: *mut c_void);
+
+pub struct BackendThread {
+    requests: Arc<SpscQueue<Vec<u8>>>,
+    replies: Arc<SpscQueue<(Vec<u8>, Instant)>>,
+    alive: Arc<Mutex<bool>>,
+    running: Arc<AtomicBool>,
+    thread: Option<JoinHandle<()>>,
+}
+
+// max number of frames waiting in each direction
+const QUEUE_SIZE: usize = 256;
+// how often the backend is updated when there are no requests
+const IDLE_UPDATE_MS: u64 = 4;
+
+// The backend instance is only used on the backend thread while it's running (calls from the UI thread such as
+// register_menu are made with alive locked)
+struct Backend {
+    data: *mut c_void,
+    update: BackendUpdate,
+}
+
+unsafe impl Send for Backend {}
+
+impl BackendThread {
+    /// Starts updating the backend instance (data) on a new thread. Each update is made with alive locked and the
+    /// thread stops when it's false (see BackendInstance::alive). wakeup is notified when the backend has written
+    /// something.
+    pub fn start(data: *mut c_void,
+                 update: BackendUpdate,
+                 alive: Arc<Mutex<bool>>,
+                 stats: Arc<Mutex<SessionStats>>,
+                 wakeup: Wakeup)
+                 -> BackendThread {
+        let requests = Arc::new(SpscQueue::new(QUEUE_SIZE));
+        let replies = Arc::new(SpscQueue::new(QUEUE_SIZE));
+        let running = Arc::new(AtomicBool::new(true));
+        let backend = Backend {
+            data: data,
+            update: update,
+        };
+
+        let thread = {
+            let requests = requests.clone();
+            let replies = replies.clone();
+            let alive = alive.clone();
+            let running = running.clone();
+
+            thread::Builder::new()
+                .name("backend".to_owned())
+                .spawn(move || Self::run(backend, &requests, &replies, &alive, &running, &stats, &wakeup))
+                .ok()
+        };
+
+        BackendThread {
+            requests: requests,
+            replies: replies,
+            alive: alive,
+            running: running,
+            thread: thread,
+        }
+    }
+
+    /// Returns false when the backend has been unloaded (or the thread couldn't be started)
+    pub fn is_alive(&self) -> bool {
+        self.thread.is_some() && *self.alive.lock().unwrap()
+    }
+
+    /// Returns true if this thread updates the backend instance with the alive lock
+    pub fn is_backend(&self, alive: &Arc<Mutex<bool>>) -> bool {
+        Arc::ptr_eq(&self.alive, alive)
+    }
+
+    fn run(backend: Backend,
+           requests: &SpscQueue<Vec<u8>>,
+           replies: &SpscQueue<(Vec<u8>, Instant)>,
+           alive: &Mutex<bool>,
+           running: &AtomicBool,
+           stats: &Mutex<SessionStats>,
+           wakeup: &Wakeup) {
+        let mut reader = ReaderWrapper::create_reader();
+        let mut writer = WriterWrapper::create_writer();
+        let empty = WriterWrapper::create_writer();
+        let mut stream_buffer = Vec::new();
+        let mut action = 0;
+        let mut last_update = Instant::now();
+
+        while running.load(Ordering::Acquire) {
+            // A UI that falls behind slows down the backend instead of losing what it writes
+
+            if replies.len() >= QUEUE_SIZE {
+                thread::park_timeout(Duration::from_millis(1));
+                continue;
+            }
+
+            let mut stream = None;
+
+            while let Some(frame) = requests.pop() {
+                if frame.len() == 4 && frame[0] & (1 << 7) != 0 {
+                    action = ((frame[2] as i32) << 8) | frame[3] as i32;
+                } else {
+                    stream = Some(frame);
+                    break;
+                }
+            }
+
+            if stream.is_none() && action == 0 {
+                let idle = Duration::from_millis(IDLE_UPDATE_MS);
+                let elapsed = last_update.elapsed();
+
+                if elapsed < idle {
+                    thread::park_timeout(idle - elapsed);
+                    continue;
+                }
+            }
+
+            match stream {
+                Some(ref stream) => {
+                    // written by the views in this process
+                    ReaderWrapper::init_from_streams(&mut reader, Some(&stream[..]).into_iter(), &mut stream_buffer);
+                    ReaderWrapper::set_trust_utf8(&mut reader, true);
+                }
+                None => ReaderWrapper::init_from_writer(&mut reader, &empty),
+            }
+
+            ReaderWrapper::reset_writer(&mut writer);
+
+            if !Self::update(&backend, action, &reader, &writer, alive, stats) {
+                break;
+            }
+
+            action = 0;
+            last_update = Instant::now();
+
+            if WriterWrapper::get_size(&writer) > 0 {
+                // only this thread pushes and there was room before the update
+                let _ = replies.push((WriterWrapper::get_stream(&writer).to_vec(), last_update));
+                wakeup.notify();
+            }
+        }
+
+        ReaderWrapper::destroy_reader(reader);
+        WriterWrapper::destroy_writer(writer);
+        WriterWrapper::destroy_writer(empty);
+    }
+
+    fn update(backend: &Backend,
+              action: i32,
+              reader: &Reader,
+              writer: &Writer,
+              alive: &Mutex<bool>,
+              stats: &Mutex<SessionStats>)
+              -> bool {
+        let alive = alive.lock().unwrap();
+
+        if !*alive {
+            return false;
+        }
+
+        let start = Instant::now();
+
+        (backend.update)(backend.data, action, reader.api as *mut c_void, writer.api as *mut c_void);
+
+        stats.lock().unwrap().record_backend_update(start.elapsed());
+
+        true
+    }
+
+    fn wake(&self) {
+        if let Some(ref thread) = self.thread {
+            thread.thread().unpark();
+        }
+    }
+}
+
+impl BackendChannel for BackendThread {
+    fn send(&self, frame: Vec<u8>) -> Result<(), Vec<u8>> {
+        let result = self.requests.push(frame);
+        self.wake();
+        result
+    }
+
+    fn recv(&self) -> Option<(Vec<u8>, Instant)> {
+        let frame = self.replies.pop();
+
+        // the backend may be waiting for room in the queue
+
+        if frame.is_some() {
+            self.wake();
+        }
+
+        frame
+    }
+}
+
+impl Drop for BackendThread {
+    fn drop(&mut self) {
+        self.running.store(false, Ordering::Release);
+        self.wake();
+
+        if let Some(thread) = self.thread.take() {
+            let _ = thread.join();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use prodbg_api::events::*;
+    use prodbg_api::read_write::CPDReaderAPI;
+    use std::ptr;
+    use std::sync::atomic::AtomicUsize;
+
+    // Replies to each EVENT_GET_MEMORY with EVENT_SET_MEMORY (same size) and counts the updates with an action
+    fn echo_update(data: *mut c_void, action: c_int, reader: *mut c_void, writer: *mut c_void) {
+        let actions = unsafe { &*(data as *const AtomicUsize) };
+        let reader = Reader::new(reader as *mut CPDReaderAPI, 0);
+        let mut writer = Writer { api: writer as *mut _ };
+
+        if action != 0 {
+            actions.fetch_add(1, Ordering::SeqCst);
+        }
+
+        for event in reader.get_events() {
+            if event == EVENT_GET_MEMORY {
+                let size = reader.find_u32("size").unwrap_or(0);
+                writer.event_begin(EVENT_SET_MEMORY as u16);
+                writer.write_u32("size", size);
+                writer.event_end();
+            }
+        }
+    }
+
+    fn blocking_update(_: *mut c_void, _: c_int, _: *mut c_void, _: *mut c_void) {
+        thread::sleep(Duration::from_millis(200));
+    }
+
+    fn request(size: u32) -> Vec<u8> {
+        let mut writer = WriterWrapper::create_writer();
+        writer.event_begin(EVENT_GET_MEMORY as u16);
+        writer.write_u32("size", size);
+        writer.event_end();
+        let stream = WriterWrapper::get_stream(&writer).to_vec();
+        WriterWrapper::destroy_writer(writer);
+        stream
+    }
+
+    // Waits for a reply the same way the main loop does
+    fn recv_timeout(backend: &BackendThread, wakeup: &Wakeup) -> Option<Vec<u8>> {
+        let start = Instant::now();
+
+        while start.elapsed() < Duration::from_secs(5) {
+            if let Some((frame, _)) = backend.recv() {
+                return Some(frame);
+            }
+
+            wakeup.wait(Duration::from_secs(1));
+        }
+
+        None
+    }
+
+    #[test]
+    fn request_reply() {
+        let actions = AtomicUsize::new(0);
+        let alive = Arc::new(Mutex::new(true));
+        let stats = Arc::new(Mutex::new(SessionStats::new(0)));
+        let wakeup = Wakeup::new();
+        let backend = BackendThread::start(&actions as *const _ as *mut c_void,
+                                           echo_update,
+                                           alive,
+                                           stats.clone(),
+                                           wakeup.clone());
+        let mut reader = ReaderWrapper::create_reader();
+        let mut buffer = Vec::new();
+
+        for size in 1..101 {
+            backend.send_action(ACTION_STEP).unwrap();
+            backend.send(request(size)).unwrap();
+
+            let reply = recv_timeout(&backend, &wakeup).unwrap();
+
+            ReaderWrapper::init_from_streams(&mut reader, Some(&reply[..]).into_iter(), &mut buffer);
+            assert_eq!(reader.get_event(), Some(EVENT_SET_MEMORY));
+            assert_eq!(reader.find_u32("size").ok(), Some(size));
+        }
+
+        drop(backend);
+
+        assert_eq!(actions.load(Ordering::SeqCst), 100);
+        assert!(stats.lock().unwrap().backend_update_us.count() >= 100);
+
+        ReaderWrapper::destroy_reader(reader);
+    }
+
+    // Replies are stamped when the backend wrote them (so the latency doesn't include the time until the UI takes them)
+    #[test]
+    fn reply_time() {
+        let actions = AtomicUsize::new(0);
+        let alive = Arc::new(Mutex::new(true));
+        let stats = Arc::new(Mutex::new(SessionStats::new(0)));
+        let wakeup = Wakeup::new();
+        let backend = BackendThread::start(&actions as *const _ as *mut c_void,
+                                           echo_update,
+                                           alive,
+                                           stats,
+                                           wakeup.clone());
+
+        backend.send(request(1)).unwrap();
+        wakeup.wait(Duration::from_secs(5));
+
+        thread::sleep(Duration::from_millis(50));
+
+        let (_, time) = backend.recv().unwrap();
+        assert!(time.elapsed() >= Duration::from_millis(50));
+    }
+
+    // The UI side never waits for a backend that is stuck in an update
+    #[test]
+    fn blocking_backend() {
+        let alive = Arc::new(Mutex::new(true));
+        let stats = Arc::new(Mutex::new(SessionStats::new(0)));
+        let backend = BackendThread::start(ptr::null_mut(), blocking_update, alive.clone(), stats, Wakeup::new());
+        let start = Instant::now();
+
+        for _ in 0..10 {
+            backend.send(request(1)).unwrap();
+            assert!(backend.recv().is_none());
+        }
+
+        assert!(start.elapsed() < Duration::from_millis(100));
+        assert!(backend.is_alive());
+
+        // unloading waits for the update to finish and then stops the thread
+        *alive.lock().unwrap() = false;
+        assert!(!backend.is_alive());
+    }
+}
@@ -0,0 +1,388 @@
+use std::fs::File;
+use std::io::{self, BufReader, BufWriter, ErrorKind, Read, Write};
+use std::path::Path;
+use std::time::Instant;
+
+///! Capture files record the frames sent between a session and its backend so they can be replayed later without
+///! the real target (to benchmark views or look at what happened in a session after the fact).
+///!
+///! Frames are stored as they are on a remote connection: finalized streams and 4 byte action frames (top bit set).
+///! The file starts with CAPTURE_MAGIC followed by one record per frame:
+///!
+///! direction (1 byte) | time since the previous record in µs (varint) | size (varint) | frame
+///!
+///! Varints are 7 bits per byte, lowest bits first, with the top bit set on all but the last byte. Records are only
+///! ever appended so a capture that was cut short (say the debugger crashed) can still be replayed up to that point.
+///!
+
+const CAPTURE_MAGIC: &'static [u8; 8] = b"PDCAPT01";
+
+// frames larger than this are treated as a corrupt file
+const MAX_FRAME_SIZE: u64 = 0x3fffffff;
+
+#[derive(PartialEq, Eq, Clone, Copy, Debug)]
+pub enum Direction {
+    /// Written by the views (and the actions) and read by the backend
+    ToBackend = 0,
+    /// Written by the backend
+    FromBackend = 1,
+}
+
+#[derive(Debug)]
+pub struct CaptureFrame {
+    /// Time since the start of the capture
+    pub time_us: u64,
+    pub direction: Direction,
+    pub data: Vec<u8>,
+}
+
+pub struct CaptureWriter {
+    file: BufWriter<File>,
+    start: Instant,
+    last_time_us: u64,
+}
+
+impl CaptureWriter {
+    pub fn create(path: &Path) -> io::Result<CaptureWriter> {
+        let mut file = BufWriter::new(try!(File::create(path)));
+
+        try!(file.write_all(CAPTURE_MAGIC));
+
+        Ok(CaptureWriter {
+            file: file,
+            start: Instant::now(),
+            last_time_us: 0,
+        })
+    }
+
+    pub fn write_frame(&mut self, direction: Direction, frame: &[u8]) -> io::Result<()> {
+        let elapsed = self.start.elapsed();
+        let time_us = elapsed.as_secs() * 1000000 + (elapsed.subsec_nanos() / 1000) as u64;
+
+        try!(self.file.write_all(&[direction as u8]));
+        try!(write_varint(&mut self.file, time_us - self.last_time_us));
+        try!(write_varint(&mut self.file, frame.len() as u64));
+        try!(self.file.write_all(frame));
+
+        self.last_time_us = time_us;
+
+        Ok(())
+    }
+
+    pub fn flush(&mut self) -> io::Result<()> {
+        self.file.flush()
+    }
+}
+
+pub struct CaptureReader {
+    file: BufReader<File>,
+    time_us: u64,
+}
+
+impl CaptureReader {
+    pub fn open(path: &Path) -> io::Result<CaptureReader> {
+        let mut file = BufReader::new(try!(File::open(path)));
+        let mut magic = [0; 8];
+
+        try!(file.read_exact(&mut magic));
+
+        if &magic != CAPTURE_MAGIC {
+            return Err(io::Error::new(ErrorKind::InvalidData, "not a capture file"));
+        }
+
+        Ok(CaptureReader {
+            file: file,
+            time_us: 0,
+        })
+    }
+
+    /// Returns the next frame or None at the end of the file. A record that has only been partly written is
+    /// treated as the end.
+    pub fn read_frame(&mut self) -> io::Result<Option<CaptureFrame>> {
+        let mut direction = [0; 1];
+
+        if try!(self.file.read(&mut direction)) == 0 {
+            return Ok(None);
+        }
+
+        let direction = match direction[0] {
+            0 => Direction::ToBackend,
+            1 => Direction::FromBackend,
+            _ => return Err(io::Error::new(ErrorKind::InvalidData, "invalid frame direction")),
+        };
+
+        match self.read_record() {
+            Ok((delta, data)) => {
+                self.time_us += delta;
+
+                Ok(Some(CaptureFrame {
+                    time_us: self.time_us,
+                    direction: direction,
+                    data: data,
+                }))
+            }
+            Err(ref e) if e.kind() == ErrorKind::UnexpectedEof => Ok(None),
+            Err(e) => Err(e),
+        }
+    }
+
+    fn read_record(&mut self) -> io::Result<(u64, Vec<u8>)> {
+        let delta = try!(read_varint(&mut self.file));
+        let size = try!(read_varint(&mut self.file));
+
+        if size > MAX_FRAME_SIZE {
+            return Err(io::Error::new(ErrorKind::InvalidData, "invalid frame size"));
+        }
+
+        let mut data = vec![0; size as usize];
+        try!(self.file.read_exact(&mut data));
+
+        Ok((delta, data))
+    }
+}
+
+#[derive(PartialEq, Eq, Clone, Copy, Debug)]
+pub enum ReplaySpeed {
+    /// Frames are given to the views at the same pace as they were captured
+    Recorded,
+    /// One frame for each update
+    Max,
+}
+
+///! Plays back the frames the backend sent in a capture. Used by the session in place of a backend
+///! (see Session::start_replay)
+pub struct Replay {
+    reader: CaptureReader,
+    speed: ReplaySpeed,
+    // when the replay started and the capture time of the first backend frame (which is shown directly)
+    start: Option<(Instant, u64)>,
+    next: Option<CaptureFrame>,
+    finished: bool,
+}
+
+impl Replay {
+    pub fn open(path: &Path, speed: ReplaySpeed) -> io::Result<Replay> {
+        Ok(Replay {
+            reader: try!(CaptureReader::open(path)),
+            speed: speed,
+            start: None,
+            next: None,
+            finished: false,
+        })
+    }
+
+    pub fn is_finished(&self) -> bool {
+        self.finished
+    }
+
+    /// Adds the backend frames that are due to frames
+    pub fn update(&mut self, frames: &mut Vec<Vec<u8>>) {
+        let count = frames.len();
+
+        while !self.finished {
+            let time_us = match self.next {
+                Some(ref frame) => frame.time_us,
+                None => {
+                    self.next = self.read_backend_frame();
+                    continue;
+                }
+            };
+
+            let (start, first_us) = *self.start.get_or_insert((Instant::now(), time_us));
+            let elapsed = start.elapsed();
+            let elapsed_us = elapsed.as_secs() * 1000000 + (elapsed.subsec_nanos() / 1000) as u64;
+
+            let due = match self.speed {
+                ReplaySpeed::Recorded => time_us - first_us <= elapsed_us,
+                ReplaySpeed::Max => frames.len() == count,
+            };
+
+            if !due {
+                break;
+            }
+
+            frames.push(self.next.take().unwrap().data);
+        }
+    }
+
+    fn read_backend_frame(&mut self) -> Option<CaptureFrame> {
+        loop {
+            match self.reader.read_frame() {
+                Ok(Some(frame)) => {
+                    if frame.direction != Direction::FromBackend {
+                        continue;
+                    }
+
+                    if is_stream(&frame.data) {
+                        return Some(frame);
+                    }
+
+                    println!("Skipping invalid frame in capture ({} bytes)", frame.data.len());
+                }
+                Ok(None) => break,
+                Err(e) => {
+                    println!("Unable to read capture: {}", e);
+                    break;
+                }
+            }
+        }
+
+        self.finished = true;
+        None
+    }
+}
+
+// Returns true if the frame is a stream with a header that matches its size (the views can't be given anything else)
+fn is_stream(frame: &[u8]) -> bool {
+    if frame.len() < 4 || frame[0] & 0x80 != 0 {
+        return false;
+    }
+
+    let size = ((frame[0] & 0x3f) as usize) << 24 | (frame[1] as usize) << 16 | (frame[2] as usize) << 8 |
+               frame[3] as usize;
+
+    size == frame.len()
+}
+
+fn write_varint<W: Write>(writer: &mut W, mut value: u64) -> io::Result<()> {
+    let mut bytes = [0u8; 10];
+    let mut count = 0;
+
+    loop {
+        let byte = (value & 0x7f) as u8;
+        value >>= 7;
+
+        if value == 0 {
+            bytes[count] = byte;
+            count += 1;
+            break;
+        }
+
+        bytes[count] = byte | 0x80;
+        count += 1;
+    }
+
+    writer.write_all(&bytes[..count])
+}
+
+fn read_varint<R: Read>(reader: &mut R) -> io::Result<u64> {
+    let mut value = 0u64;
+    let mut shift = 0;
+
+    loop {
+        let mut byte = [0; 1];
+
+        try!(reader.read_exact(&mut byte));
+
+        if shift > 63 {
+            return Err(io::Error::new(ErrorKind::InvalidData, "invalid varint"));
+        }
+
+        value |= ((byte[0] & 0x7f) as u64) << shift;
+
+        if byte[0] & 0x80 == 0 {
+            return Ok(value);
+        }
+
+        shift += 7;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use std::fs::{self, OpenOptions};
+    use std::process;
+
+    #[test]
+    fn write_read_frames() {
+        let path = env::temp_dir().join(format!("prodbg_capture_frames_{}.bin", process::id()));
+        let large = (0..100000).map(|i| i as u8).collect::<Vec<u8>>();
+
+        {
+            let mut capture = CaptureWriter::create(&path).unwrap();
+            capture.write_frame(Direction::ToBackend, &[0x80, 0, 0, 3]).unwrap();
+            capture.write_frame(Direction::FromBackend, &large).unwrap();
+            capture.write_frame(Direction::FromBackend, &[]).unwrap();
+            capture.flush().unwrap();
+        }
+
+        // cut the last record in half (as if the capture was stopped while writing it)
+
+        let size = fs::metadata(&path).unwrap().len();
+        OpenOptions::new().append(true).open(&path).unwrap().write_all(&[1, 0, 8, 1, 2]).unwrap();
+
+        let mut reader = CaptureReader::open(&path).unwrap();
+
+        let frame = reader.read_frame().unwrap().unwrap();
+        assert_eq!(frame.direction, Direction::ToBackend);
+        assert_eq!(frame.data, vec![0x80, 0, 0, 3]);
+
+        let frame = reader.read_frame().unwrap().unwrap();
+        assert_eq!(frame.direction, Direction::FromBackend);
+        assert_eq!(frame.data, large);
+
+        let last = reader.read_frame().unwrap().unwrap();
+        assert!(last.data.is_empty());
+        assert!(last.time_us >= frame.time_us);
+
+        assert!(reader.read_frame().unwrap().is_none());
+
+        // the header of a record is only a few bytes
+        assert!(size < (8 + 4 + large.len() + 3 * 8) as u64);
+
+        fs::remove_file(&path).unwrap();
+    }
+
+    // Backend frames that aren't streams (cut short, actions or with the wrong size) are skipped by the replay
+    #[test]
+    fn replay_skips_invalid_frames() {
+        let path = env::temp_dir().join(format!("prodbg_capture_invalid_frames_{}.bin", process::id()));
+        let stream = [0, 0, 0, 8, 1, 2, 3, 4];
+
+        {
+            let mut capture = CaptureWriter::create(&path).unwrap();
+            capture.write_frame(Direction::FromBackend, &[]).unwrap();
+            capture.write_frame(Direction::FromBackend, &[0, 0, 4]).unwrap();
+            capture.write_frame(Direction::FromBackend, &[0x80, 0, 0, 3]).unwrap();
+            capture.write_frame(Direction::FromBackend, &[0, 0, 0, 16, 1, 2, 3, 4]).unwrap();
+            capture.write_frame(Direction::FromBackend, &stream).unwrap();
+            capture.flush().unwrap();
+        }
+
+        let mut replay = Replay::open(&path, ReplaySpeed::Max).unwrap();
+        let mut frames = Vec::new();
+
+        while !replay.is_finished() {
+            replay.update(&mut frames);
+        }
+
+        assert_eq!(frames, vec![stream.to_vec()]);
+
+        fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn varints() {
+        for &value in &[0, 1, 127, 128, 300, 1 << 35, u64::max_value()] {
+            let mut buffer = Vec::new();
+            write_varint(&mut buffer, value).unwrap();
+            assert_eq!(read_varint(&mut &buffer[..]).unwrap(), value);
+        }
+
+        let mut buffer = Vec::new();
+        write_varint(&mut buffer, 127).unwrap();
+        assert_eq!(buffer.len(), 1);
+    }
+
+    #[test]
+    fn not_a_capture() {
+        let path = env::temp_dir().join(format!("prodbg_capture_invalid_{}.bin", process::id()));
+        fs::File::create(&path).unwrap().write_all(b"PDCAPT99").unwrap();
+
+        assert!(CaptureReader::open(&path).is_err());
+
+        fs::remove_file(&path).unwrap();
+    }
+}
@@ -2,6 +2,7 @@ extern crate minifb;
 extern crate notify;
 extern crate dynamic_reload;
 extern crate prodbg_api;
+extern crate num_cpus;
 
 pub mod menus;
 
@@ -11,8 +12,17 @@ pub mod plugins;
 pub mod plugin;
 pub mod view_plugins;
 pub mod backend_plugin;
+pub mod backend_thread;
 pub mod reader_wrapper;
 pub mod session;
+pub mod slot_map;
+pub mod remote_requests;
+pub mod remote_connection;
+pub mod capture;
+pub mod stats;
+pub mod spsc_queue;
+pub mod thread_pool;
+pub mod wakeup;
 pub mod plugin_io;
 
 pub use dynamic_reload::*;
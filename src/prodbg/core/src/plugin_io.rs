@@ -1,6 +1,5 @@
 use std::os::raw::{c_char, c_void};
 use prodbg_api::io::{CPDLoadState, CPDSaveState, LoadState};
-use prodbg_api::cfixed_string::CFixedString;
 use std::ffi::CStr;
 use std::mem::transmute;
 use std::ptr;
@@ -53,43 +52,61 @@ fn write_string(priv_data: *mut c_void, data: *const c_char) {
     }
 }
 
-// TODO: error handling
+// Returns the next saved value. A plugin that has been changed and reloaded may read more than the old version
+// saved so running out of data is reported to the plugin instead of panicking.
+fn next_value(priv_data: *mut c_void) -> Option<String> {
+    let t = unsafe { &mut *(priv_data as *mut WriterData) };
+    let value = t.data.get(t.read_index).cloned();
+
+    if value.is_some() {
+        t.read_index += 1;
+    }
+
+    value
+}
+
 fn read_int(priv_data: *mut c_void, data: *mut i64) -> LoadState {
-    unsafe {
-        let t = priv_data as *mut WriterData;
-        let v = (*t).data[(*t).read_index].parse::<i64>().unwrap();
-        (*t).read_index += 1;
-        *data = v;
-        LoadState::Ok
+    match next_value(priv_data).map(|v| v.parse::<i64>()) {
+        Some(Ok(v)) => {
+            unsafe { *data = v; }
+            LoadState::Ok
+        }
+        Some(Err(_)) => LoadState::Fail,
+        None => LoadState::OutOfData,
     }
 }
 
 fn read_double(priv_data: *mut c_void, data: *mut f64) -> LoadState {
-    unsafe {
-        let t = priv_data as *mut WriterData;
-        let v = (*t).data[(*t).read_index].parse::<f64>().unwrap();
-        (*t).read_index += 1;
-        *data = v;
-        LoadState::Ok
+    match next_value(priv_data).map(|v| v.parse::<f64>()) {
+        Some(Ok(v)) => {
+            unsafe { *data = v; }
+            LoadState::Ok
+        }
+        Some(Err(_)) => LoadState::Fail,
+        None => LoadState::OutOfData,
     }
 }
 
 fn read_string(priv_data: *mut c_void, data: *mut c_char, max_len: i32) -> LoadState {
-    unsafe {
-        let t = priv_data as *mut WriterData;
-        let v = &(*t).data[(*t).read_index];
-        (*t).read_index += 1;
+    let v = match next_value(priv_data) {
+        Some(v) => v,
+        None => return LoadState::OutOfData,
+    };
 
-        let mut len = v.len();
-
-        if len > max_len as usize { len = max_len as usize; }
+    if max_len <= 0 {
+        return LoadState::Truncated;
+    }
 
-        let tstring = CFixedString::from_str(&v);
+    // the string is always terminated
 
-        ptr::copy(tstring.as_ptr(), data as *mut i8, len);
+    let len = v.len().min(max_len as usize - 1);
 
-        LoadState::Ok
+    unsafe {
+        ptr::copy(v.as_ptr() as *const c_char, data, len);
+        *data.offset(len as isize) = 0;
     }
+
+    if len < v.len() { LoadState::Truncated } else { LoadState::Ok }
 }
 
 pub fn get_writer_funcs() -> CPDSaveState {
@@ -115,7 +132,79 @@ pub fn get_loader_funcs(data: &Vec<String>) -> CPDLoadState {
     }
 }
 
+pub fn destroy_loader_funcs(load_state: CPDLoadState) {
+    let _: Box<WriterData> = unsafe { transmute(load_state.priv_data) };
+}
+
+/// Calls the save_state callback of a plugin instance and returns what it wrote
+pub fn save_state(save_state: fn(*mut c_void, *mut CPDSaveState), plugin_data: *mut c_void) -> Vec<String> {
+    let mut writer_funcs = get_writer_funcs();
+    save_state(plugin_data, &mut writer_funcs);
+    get_data(&mut writer_funcs)
+}
+
+/// Calls the load_state callback of a plugin instance with data from save_state
+pub fn load_state(load_state: fn(*mut c_void, *mut CPDLoadState), plugin_data: *mut c_void, data: &Vec<String>) {
+    let mut loader_funcs = get_loader_funcs(data);
+    load_state(plugin_data, &mut loader_funcs);
+    destroy_loader_funcs(loader_funcs);
+}
+
+
 
 
 
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::ffi::CStr;
 
+    fn save(_: *mut c_void, api: *mut CPDSaveState) {
+        let api = unsafe { &*api };
+        (api.write_int)(api.priv_data, -42);
+        (api.write_double)(api.priv_data, 1.5);
+        (api.write_string)(api.priv_data, b"0x1000\0".as_ptr() as *const c_char);
+    }
+
+    // A newer version of the plugin that reads one value more than the old one saved
+    fn load(data: *mut c_void, api: *mut CPDLoadState) {
+        let api = unsafe { &*api };
+        let results = unsafe { &mut *(data as *mut Vec<String>) };
+        let mut int = 0;
+        let mut double = 0.0;
+        let mut text = [0x7f as c_char; 4];
+
+        match (api.read_int)(api.priv_data, &mut int) {
+            LoadState::Ok => results.push(format!("{}", int)),
+            _ => results.push("fail".to_owned()),
+        }
+
+        match (api.read_double)(api.priv_data, &mut double) {
+            LoadState::Ok => results.push(format!("{}", double)),
+            _ => results.push("fail".to_owned()),
+        }
+
+        match (api.read_string)(api.priv_data, text.as_mut_ptr(), text.len() as i32) {
+            LoadState::Truncated => {
+                let text = unsafe { CStr::from_ptr(text.as_ptr()) };
+                results.push(text.to_string_lossy().into_owned())
+            }
+            _ => results.push("fail".to_owned()),
+        }
+
+        match (api.read_int)(api.priv_data, &mut int) {
+            LoadState::OutOfData => results.push("out of data".to_owned()),
+            _ => results.push("fail".to_owned()),
+        }
+    }
+
+    #[test]
+    fn save_and_load_state() {
+        let data = save_state(save, ptr::null_mut());
+        assert_eq!(data, vec!["-42", "1.5", "0x1000"]);
+
+        let mut results: Vec<String> = Vec::new();
+        load_state(load, &mut results as *mut Vec<String> as *mut c_void, &data);
+        assert_eq!(results, vec!["-42", "1.5", "0x1", "out of data"]);
+    }
+}
@@ -28,6 +28,8 @@ pub struct ReloadHandler<'a> {
     pub plugins: &'a mut Plugins,
     pub instance_count: i32,
     pub name: String,
+    /// Set when a plugin has been reloaded (or failed to)
+    pub changed: bool,
 }
 
 pub trait PluginHandler {
@@ -64,6 +66,7 @@ impl<'a> ReloadHandler<'a> {
             plugins: plugins,
             instance_count: 0,
             name: "".to_string(),
+            changed: false,
         }
     }
 
@@ -94,6 +97,8 @@ impl<'a> ReloadHandler<'a> {
     }
 
     fn callback(&mut self, state: UpdateState, lib: Option<&Rc<Lib>>) {
+        self.changed = true;
+
         match state {
             UpdateState::Before => Self::unload_plugins(self, lib.unwrap()),
             UpdateState::After => Self::reload_plugins(self, lib.unwrap()),
@@ -193,9 +198,11 @@ impl Plugins {
     }
 
 
-    pub fn update(&mut self, lib_handler: &mut DynamicReload) {
+    /// Reloads the plugins that has changed. Returns true if any was (or failed to be) reloaded
+    pub fn update(&mut self, lib_handler: &mut DynamicReload) -> bool {
         let mut handler = ReloadHandler::new(self);
         lib_handler.update(ReloadHandler::callback, &mut handler);
+        handler.changed
     }
 
     unsafe fn add_p(&mut self, library: &Rc<Lib>) {
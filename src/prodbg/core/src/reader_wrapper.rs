@@ -1,4 +1,6 @@
-use std::os::raw::c_void;
+use std::os::raw::{c_int, c_void};
+use std::ptr;
+use std::slice;
 
 use prodbg_api::read_write::{CPDReaderAPI, CPDWriterAPI, Reader, Writer};
 
@@ -20,6 +22,59 @@ impl ReaderWrapper {
             let size = pd_binary_writer_get_size(writer.api);
 
             pd_binary_reader_init_stream(reader.api, data, size);
+            pd_binary_reader_set_trust_utf8(reader.api, 1);
+        }
+    }
+
+    /// Inits the reader with a stream without copying it (arrays in it may be byte swapped in place)
+    pub fn init_from_stream(reader: &mut Reader, stream: &mut [u8]) {
+        unsafe {
+            pd_binary_reader_init_stream(reader.api, stream.as_mut_ptr() as *mut c_void, stream.len() as u32);
+        }
+    }
+
+    /// Builds the indexes and decompresses the data of the stream the reader has (see pd_binary_reader_prepare) so
+    /// the views don't have to do it when they read it
+    pub fn prepare(reader: &mut Reader) {
+        unsafe {
+            pd_binary_reader_prepare(reader.api);
+        }
+    }
+
+    /// Joins several finalized streams into one (in buffer) and inits the reader with it. All streams has to use
+    /// the same byte order. Each stream is copied as is to an 8 byte aligned offset (which keeps the typed arrays
+    /// aligned) and the headers of all but the first are cleared, the reader skips the zeros between the events.
+    pub fn init_from_streams<'a, I>(reader: &mut Reader, streams: I, buffer: &mut Vec<u64>)
+        where I: Iterator<Item = &'a [u8]> + Clone
+    {
+        let size = streams.clone().fold(0, |size, stream| ((size + 7) & !7) + stream.len());
+
+        buffer.clear();
+        buffer.resize((size + 7) / 8, 0);
+
+        unsafe {
+            let data = buffer.as_mut_ptr() as *mut u8;
+            let mut offset = 0;
+
+            for stream in streams {
+                offset = (offset + 7) & !7;
+
+                ptr::copy_nonoverlapping(stream.as_ptr(), data.offset(offset as isize), stream.len());
+
+                if offset == 0 {
+                    *data &= !0x3f;
+                    *data.offset(1) = (size >> 16) as u8;
+                    *data.offset(2) = (size >> 8) as u8;
+                    *data.offset(3) = size as u8;
+                    *data |= ((size >> 24) & 0x3f) as u8;
+                } else {
+                    ptr::write_bytes(data.offset(offset as isize), 0, 4);
+                }
+
+                offset += stream.len();
+            }
+
+            pd_binary_reader_init_stream(reader.api, data as *mut c_void, size as u32);
         }
     }
 
@@ -30,20 +85,74 @@ impl ReaderWrapper {
         }
     }
 
+    /// Frees a reader created with create_reader
+    pub fn destroy_reader(reader: Reader) {
+        unsafe {
+            pd_binary_reader_destroy(reader.api);
+        }
+    }
+
     #[inline]
     pub fn reset_reader(reader: &mut Reader) {
         unsafe {
             pd_binary_reader_reset(reader.api);
         }
     }
+
+    /// Set when all streams the reader has been inited with are written in this process so the strings flagged as
+    /// UTF-8 can be used without validating them (see pd_binary_reader_set_trust_utf8). Streams from a remote target
+    /// or a capture are never trusted. Only init_from_writer sets this by itself.
+    #[inline]
+    pub fn set_trust_utf8(reader: &mut Reader, trust: bool) {
+        unsafe {
+            pd_binary_reader_set_trust_utf8(reader.api, trust as c_int);
+        }
+    }
+
+    /// Only events in the mask (see prodbg_api::events::event_mask) are returned by the reader until the next
+    /// init_from_writer
+    #[inline]
+    pub fn set_event_mask(reader: &mut Reader, mask: u64) {
+        unsafe {
+            pd_binary_reader_set_event_mask(reader.api, mask);
+        }
+    }
 }
 
 impl WriterWrapper {
     pub fn create_writer() -> Writer {
         unsafe {
-            Writer {
-                api: pd_binary_writer_create(),
-            }
+            let api = pd_binary_writer_create();
+            // Readers of these streams are always in the same process so skip the byte swapping
+            pd_binary_writer_set_native_order(api, 1);
+            Writer { api: api }
+        }
+    }
+
+    /// Frees a writer created with create_writer
+    pub fn destroy_writer(writer: Writer) {
+        unsafe {
+            pd_binary_writer_destroy(writer.api);
+            free(writer.api as *mut c_void);
+        }
+    }
+
+    /// Returns the number of bytes written (without the stream header and padding). Anything written after this is
+    /// at 4 + the size in the stream
+    pub fn get_size(writer: &Writer) -> usize {
+        unsafe { pd_binary_writer_get_size(writer.api) as usize }
+    }
+
+    /// Finalizes the writer and returns the stream (with the header and padding) that has been written so far
+    pub fn get_stream(writer: &Writer) -> &[u8] {
+        unsafe {
+            pd_binary_writer_finalize(writer.api);
+
+            let data = pd_binary_writer_get_data(writer.api) as *const u8;
+            let size = ((*data as usize & 0x3f) << 24) | ((*data.offset(1) as usize) << 16) |
+                       ((*data.offset(2) as usize) << 8) | (*data.offset(3) as usize);
+
+            slice::from_raw_parts(data, size)
         }
     }
 }
@@ -52,10 +161,18 @@ extern "C" {
     fn pd_binary_writer_finalize(api: *mut CPDWriterAPI);
     fn pd_binary_writer_reset(api: *mut CPDWriterAPI);
     fn pd_binary_writer_create() -> *mut CPDWriterAPI;
+    fn pd_binary_writer_destroy(api: *mut CPDWriterAPI);
     fn pd_binary_writer_get_data(api: *mut CPDWriterAPI) -> *mut c_void;
     fn pd_binary_writer_get_size(api: *mut CPDWriterAPI) -> u32;
+    fn pd_binary_writer_set_native_order(api: *mut CPDWriterAPI, enable: i32);
 
     fn pd_binary_reader_create() -> *mut CPDReaderAPI;
+    fn pd_binary_reader_destroy(api: *mut CPDReaderAPI);
     fn pd_binary_reader_init_stream(api: *mut CPDReaderAPI, data: *mut c_void, size: u32);
     fn pd_binary_reader_reset(api: *mut CPDReaderAPI);
+    fn pd_binary_reader_set_event_mask(api: *mut CPDReaderAPI, mask: u64);
+    fn pd_binary_reader_prepare(api: *mut CPDReaderAPI);
+    fn pd_binary_reader_set_trust_utf8(api: *mut CPDReaderAPI, trust: c_int);
+
+    fn free(ptr: *mut c_void);
 }
@@ -0,0 +1,326 @@
+use std::collections::VecDeque;
+use std::ffi::CString;
+use std::os::raw::{c_char, c_int, c_uchar, c_void};
+use std::ptr;
+use std::slice;
+use std::sync::{Arc, Mutex};
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::thread::{self, JoinHandle};
+use std::time::{Duration, Instant};
+use spsc_queue::SpscQueue;
+use wakeup::Wakeup;
+
+///! Connection to a remote target (a program that uses PDRemote_create such as examples/fake_6502)
+///!
+///! All socket I/O is done on a separate network thread so a slow or stalled connection never stalls the UI. Frames
+///! (streams and actions) are moved between the threads with lock-free queues: the UI thread pushes the frames to
+///! send and pops the frames that has been received. The network thread connects (and reconnects if the connection
+///! is lost) by itself.
+///!
+pub struct RemoteConnection {
+    outgoing: Arc<SpscQueue<Vec<u8>>>,
+    incoming: Arc<SpscQueue<(Vec<u8>, Instant)>>,
+    connected: Arc<AtomicBool>,
+    // incremented each time the network thread has connected
+    epoch: Arc<AtomicUsize>,
+    wake: Arc<Mutex<WakeHandle>>,
+    running: Arc<AtomicBool>,
+    thread: Option<JoinHandle<()>>,
+}
+
+/// Port used by PDRemote_create
+pub const DEFAULT_PORT: u16 = 1340;
+
+// max number of frames waiting in each direction
+const QUEUE_SIZE: usize = 256;
+// max number of frames fetched from the receive buffer at once
+const MAX_RECV_FRAMES: usize = 64;
+// How long the network thread waits for incoming data before looking for frames to send again. Queuing a frame wakes
+// the wait (except for sockets on Windows which can't be woken).
+#[cfg(not(target_os="windows"))]
+const IO_WAIT_MS: c_int = 100;
+#[cfg(target_os="windows")]
+const IO_WAIT_MS: c_int = 1;
+// how long to wait when the UI hasn't taken all the received frames yet (there is no wake for that)
+const BEHIND_WAIT_MS: c_int = 1;
+// time between connection attempts
+const RECONNECT_DELAY_MS: u64 = 100;
+
+// matches RemoteConnectionType_Connect in remote_connection.h
+const CONNECTION_TYPE_CONNECT: c_int = 1;
+
+impl RemoteConnection {
+    /// Starts the network thread which connects to address ("host", "host:port", "unix:<path>" or "shm:<name>").
+    /// hello is a finalized stream that is sent first on each connection (empty to not send anything). wakeup is
+    /// notified when frames has been received.
+    pub fn connect(address: &str, hello: Vec<u8>, wakeup: Wakeup) -> RemoteConnection {
+        let address = Self::parse_address(address);
+
+        let outgoing = Arc::new(SpscQueue::new(QUEUE_SIZE));
+        let incoming = Arc::new(SpscQueue::new(QUEUE_SIZE));
+        let connected = Arc::new(AtomicBool::new(false));
+        let epoch = Arc::new(AtomicUsize::new(0));
+        let wake = Arc::new(Mutex::new(WakeHandle(ptr::null_mut())));
+        let running = Arc::new(AtomicBool::new(true));
+
+        let thread = {
+            let outgoing = outgoing.clone();
+            let incoming = incoming.clone();
+            let connected = connected.clone();
+            let epoch = epoch.clone();
+            let wake = wake.clone();
+            let running = running.clone();
+
+            thread::Builder::new()
+                .name("remote connection".to_owned())
+                .spawn(move || {
+                    Self::run(address,
+                              &hello,
+                              &outgoing,
+                              &incoming,
+                              &connected,
+                              &epoch,
+                              &wake,
+                              &running,
+                              &wakeup)
+                })
+                .ok()
+        };
+
+        RemoteConnection {
+            outgoing: outgoing,
+            incoming: incoming,
+            connected: connected,
+            epoch: epoch,
+            wake: wake,
+            running: running,
+            thread: thread,
+        }
+    }
+
+    pub fn is_connected(&self) -> bool {
+        self.connected.load(Ordering::Acquire)
+    }
+
+    /// Returns how many times the network thread has connected (it reconnects by itself when the connection is
+    /// lost). Requests sent before the last connection will never get replies.
+    pub fn get_epoch(&self) -> usize {
+        self.epoch.load(Ordering::Acquire)
+    }
+
+    /// Queues a finalized stream (or action frame) to be sent. If the network thread has fallen so much behind that
+    /// the queue is full the frame is given back.
+    pub fn send(&self, frame: Vec<u8>) -> Result<(), Vec<u8>> {
+        try!(self.outgoing.push(frame));
+        self.wake();
+        Ok(())
+    }
+
+    /// Queues an action (run, step, etc) to be sent
+    pub fn send_action(&self, action: i32) -> Result<(), Vec<u8>> {
+        self.send(action_frame(action))
+    }
+
+    /// Returns the next stream that has been received (if any) and when the network thread received it
+    pub fn recv(&self) -> Option<(Vec<u8>, Instant)> {
+        self.incoming.pop()
+    }
+
+    // Interrupts the wait of the network thread so it sends the queued frames directly
+    fn wake(&self) {
+        let handle = self.wake.lock().unwrap();
+
+        if !handle.0.is_null() {
+            unsafe {
+                RemoteConnection_wake(handle.0);
+            }
+        }
+    }
+
+    /// Returns the address in the form RemoteConnection_connectAddress expects (the transport is selected by the
+    /// prefix and tcp addresses always have a port)
+    fn parse_address(address: &str) -> CString {
+        let is_local = address.starts_with("unix:") || address.starts_with("shm:");
+        let has_port = match address.rfind(':') {
+            Some(pos) => address[pos + 1..].parse::<u16>().is_ok(),
+            None => false,
+        };
+
+        if is_local || has_port {
+            CString::new(address).unwrap_or_default()
+        } else {
+            CString::new(format!("{}:{}", address, DEFAULT_PORT)).unwrap_or_default()
+        }
+    }
+
+    fn run(address: CString,
+           hello: &[u8],
+           outgoing: &SpscQueue<Vec<u8>>,
+           incoming: &SpscQueue<(Vec<u8>, Instant)>,
+           connected: &AtomicBool,
+           epoch: &AtomicUsize,
+           wake: &Mutex<WakeHandle>,
+           running: &AtomicBool,
+           wakeup: &Wakeup) {
+        let conn = unsafe { RemoteConnection_create(CONNECTION_TYPE_CONNECT, 0) };
+
+        if conn.is_null() {
+            println!("Unable to create remote connection");
+            return;
+        }
+
+        let mut frames = [0 as *const c_uchar; MAX_RECV_FRAMES];
+        let mut sizes = [0 as c_int; MAX_RECV_FRAMES];
+        let mut received = VecDeque::new();
+
+        while running.load(Ordering::Acquire) {
+            if unsafe { RemoteConnection_isConnected(conn) } == 0 {
+                connected.store(false, Ordering::Release);
+
+                // connecting may replace the parts of the connection that the wake uses
+                *wake.lock().unwrap() = WakeHandle(ptr::null_mut());
+
+                if unsafe { RemoteConnection_connectAddress(conn, address.as_ptr()) } == 0 {
+                    thread::sleep(Duration::from_millis(RECONNECT_DELAY_MS));
+                    continue;
+                }
+
+                // whatever was received on the earlier connection is of no use now
+                received.clear();
+
+                if hello.len() > 0 {
+                    unsafe {
+                        RemoteConnection_send(conn, hello.as_ptr() as *const c_void, hello.len() as c_int, 0);
+                    }
+                }
+
+                epoch.fetch_add(1, Ordering::AcqRel);
+                *wake.lock().unwrap() = WakeHandle(conn);
+                connected.store(true, Ordering::Release);
+            }
+
+            // Streams are queued by the connection if the socket can't take them right away and are sent during
+            // the wait below (or the next send)
+
+            while let Some(frame) = outgoing.pop() {
+                unsafe {
+                    RemoteConnection_send(conn, frame.as_ptr() as *const c_void, frame.len() as c_int, 0);
+                }
+            }
+
+            // Only read more data when the UI has taken everything received so far. Otherwise the data stays in the
+            // socket which makes the target wait instead of this buffering without limits
+
+            if received.is_empty() {
+                let count = unsafe {
+                    RemoteConnection_recvFrames(conn,
+                                                frames.as_mut_ptr(),
+                                                sizes.as_mut_ptr(),
+                                                MAX_RECV_FRAMES as c_int)
+                };
+
+                let now = Instant::now();
+
+                for i in 0..count as usize {
+                    let frame = unsafe { slice::from_raw_parts(frames[i], sizes[i] as usize) };
+
+                    // targets only send streams but skip anything else to be safe
+                    if frame[0] & (1 << 7) == 0 {
+                        received.push_back((frame.to_vec(), now));
+                    }
+                }
+            }
+
+            let mut pushed = false;
+
+            while let Some(frame) = received.pop_front() {
+                if let Err(frame) = incoming.push(frame) {
+                    received.push_front(frame);
+                    break;
+                }
+
+                pushed = true;
+            }
+
+            if pushed {
+                wakeup.notify();
+            }
+
+            let wait_ms = if received.is_empty() { IO_WAIT_MS } else { BEHIND_WAIT_MS };
+
+            unsafe {
+                RemoteConnection_wait(conn, wait_ms);
+            }
+        }
+
+        connected.store(false, Ordering::Release);
+        *wake.lock().unwrap() = WakeHandle(ptr::null_mut());
+
+        unsafe {
+            RemoteConnection_destroy(conn);
+        }
+    }
+}
+
+/// Returns the frame that is sent for an action (top bit set and the action in the last two bytes)
+pub fn action_frame(action: i32) -> Vec<u8> {
+    vec![1 << 7, 0, (action >> 8) as u8, action as u8]
+}
+
+impl Drop for RemoteConnection {
+    fn drop(&mut self) {
+        self.running.store(false, Ordering::Release);
+        self.wake();
+
+        if let Some(thread) = self.thread.take() {
+            let _ = thread.join();
+        }
+    }
+}
+
+enum CRemoteConnection {}
+
+// The connection as used by the UI thread to wake the network thread (null when it can't be woken)
+struct WakeHandle(*mut CRemoteConnection);
+
+// RemoteConnection_wake can be called from any thread
+unsafe impl Send for WakeHandle {}
+
+extern "C" {
+    fn RemoteConnection_create(connection_type: c_int, port: c_int) -> *mut CRemoteConnection;
+    fn RemoteConnection_destroy(conn: *mut CRemoteConnection);
+    fn RemoteConnection_connectAddress(conn: *mut CRemoteConnection, address: *const c_char) -> c_int;
+    fn RemoteConnection_isConnected(conn: *mut CRemoteConnection) -> c_int;
+    fn RemoteConnection_send(conn: *mut CRemoteConnection, buffer: *const c_void, length: c_int, flags: c_int)
+                             -> c_int;
+    fn RemoteConnection_wait(conn: *mut CRemoteConnection, timeout_ms: c_int) -> c_int;
+    fn RemoteConnection_wake(conn: *mut CRemoteConnection);
+    fn RemoteConnection_recvFrames(conn: *mut CRemoteConnection,
+                                   frames: *mut *const c_uchar,
+                                   sizes: *mut c_int,
+                                   max_count: c_int)
+                                   -> c_int;
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parse_address() {
+        let address = RemoteConnection::parse_address("127.0.0.1:1341");
+        assert_eq!(address.to_str().unwrap(), "127.0.0.1:1341");
+
+        let address = RemoteConnection::parse_address("localhost");
+        assert_eq!(address.to_str().unwrap(), "localhost:1340");
+
+        let address = RemoteConnection::parse_address("tcp:localhost");
+        assert_eq!(address.to_str().unwrap(), "tcp:localhost:1340");
+
+        let address = RemoteConnection::parse_address("unix:/tmp/target.sock");
+        assert_eq!(address.to_str().unwrap(), "unix:/tmp/target.sock");
+
+        let address = RemoteConnection::parse_address("shm:target");
+        assert_eq!(address.to_str().unwrap(), "shm:target");
+    }
+}
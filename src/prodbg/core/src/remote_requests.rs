@@ -0,0 +1,331 @@
+use prodbg_api::read_write::{Reader, Writer};
+use prodbg_api::events::*;
+use reader_wrapper::WriterWrapper;
+use stats::StreamEvents;
+
+///! Keeps track of the requests that has been sent to a remote target. Each request stream is tagged with a sequence
+///! id (EVENT_REQUEST_SEQUENCE as the first event) and the target starts the reply with the same id. This allows
+///! several requests to be in flight at the same time and the replies to be matched with the requests even if they
+///! arrive in a different order.
+///!
+///! Requests are grouped by a key (say the view and event type that made the request). Starting a new request with
+///! the same key makes the earlier ones stale (such as a memory range the user has already scrolled past) so they are
+///! cancelled. The target skips the cancelled requests it hasn't processed yet and replies to them are dropped here.
+///! Requests with key 0 are never cancelled.
+///!
+#[derive(PartialEq, Eq, Clone, Copy, Debug)]
+pub struct Request {
+    pub id: u32,
+    pub key: u64,
+}
+
+pub struct RequestTracker {
+    next_id: u32,
+    max_in_flight: usize,
+    in_flight: Vec<Request>,
+    cancelled: Vec<u32>,
+}
+
+impl RequestTracker {
+    pub fn new(max_in_flight: usize) -> RequestTracker {
+        RequestTracker {
+            next_id: 1,
+            max_in_flight: max_in_flight,
+            in_flight: Vec::with_capacity(max_in_flight),
+            cancelled: Vec::new(),
+        }
+    }
+
+    /// Returns true if there is room for another request
+    pub fn can_send(&self) -> bool {
+        self.in_flight.len() < self.max_in_flight
+    }
+
+    pub fn in_flight(&self) -> usize {
+        self.in_flight.len()
+    }
+
+    /// Starts a new request and returns the id for it (which has to be written with write_sequence first in the
+    /// request stream). Earlier requests with the same key are cancelled.
+    pub fn start(&mut self, key: u64) -> u32 {
+        if key != 0 {
+            self.cancel(key);
+        }
+
+        let id = self.next_id;
+
+        // 0 is never used as an id
+        self.next_id = self.next_id.wrapping_add(1);
+        if self.next_id == 0 {
+            self.next_id = 1;
+        }
+
+        self.in_flight.push(Request { id: id, key: key });
+
+        id
+    }
+
+    /// Forgets all requests (the target they were sent to will never reply to them). The ids keep counting so late
+    /// replies to the forgotten requests are dropped as unknown.
+    pub fn reset(&mut self) {
+        self.in_flight.clear();
+        self.cancelled.clear();
+    }
+
+    /// Cancels all in flight requests with the key
+    pub fn cancel(&mut self, key: u64) {
+        let cancelled = &mut self.cancelled;
+
+        self.in_flight.retain(|r| {
+            if r.key == key {
+                cancelled.push(r.id);
+                false
+            } else {
+                true
+            }
+        });
+    }
+
+    /// Called when the reply for id has arrived. Returns the key of the request or None if the reply is for a
+    /// request that has been cancelled (or is unknown) and should be ignored.
+    pub fn complete(&mut self, id: u32) -> Option<u64> {
+        match self.in_flight.iter().position(|r| r.id == id) {
+            Some(index) => Some(self.in_flight.remove(index).key),
+            None => None,
+        }
+    }
+
+    /// Writes the ids of the requests that has been cancelled since last call (if any) so the target can skip them
+    pub fn write_cancels(&mut self, writer: &mut Writer) {
+        if self.cancelled.len() == 0 {
+            return;
+        }
+
+        writer.event_begin(EVENT_CANCEL_REQUESTS as u16);
+        writer.write_u32_array("ids", &self.cancelled);
+        writer.event_end();
+
+        self.cancelled.clear();
+    }
+
+    /// Reads the sequence id from the first event of a reply stream. Returns the key of the request if the rest of the
+    /// stream should be used, otherwise None (cancelled, unknown or not a sequenced reply)
+    pub fn read_reply(&mut self, reader: &mut Reader) -> Option<u64> {
+        match read_sequence(reader) {
+            Some((id, false)) => self.complete(id),
+            Some((id, true)) => {
+                self.complete(id);
+                None
+            }
+            None => None,
+        }
+    }
+
+    /// Returns true if a reply stream is for a request that has been cancelled (or is unknown) and should be
+    /// dropped. Streams without a sequence id (sent by the target on its own) are always used.
+    pub fn is_stale_reply(&mut self, reader: &mut Reader) -> bool {
+        match read_sequence(reader) {
+            Some((id, cancelled)) => self.complete(id).is_none() || cancelled,
+            None => false,
+        }
+    }
+
+    /// Returns the request to send for a stream written by the views. It starts with a new sequence id and the ids
+    /// cancelled since the last request followed by the events of the stream. The stream is sent as is (and the
+    /// reply is always used) when too many requests are in flight.
+    pub fn tag_stream(&mut self, stream: &[u8]) -> Vec<u8> {
+        if !self.can_send() {
+            return stream.to_vec();
+        }
+
+        let id = self.start(request_key(stream));
+        let mut writer = WriterWrapper::create_writer();
+
+        write_sequence(&mut writer, id);
+        self.write_cancels(&mut writer);
+
+        let mut request = WriterWrapper::get_stream(&writer).to_vec();
+        WriterWrapper::destroy_writer(writer);
+
+        // Same as the reader does when joining streams: the events start at an 8 byte aligned offset (which keeps
+        // the typed arrays aligned) and the zeros in between are skipped
+
+        let offset = (request.len() + 7) & !7;
+        request.resize(offset + 4, 0);
+        request.extend_from_slice(&stream[4..]);
+
+        let size = request.len();
+        request[0] = (request[0] & !0x3f) | ((size >> 24) & 0x3f) as u8;
+        request[1] = (size >> 16) as u8;
+        request[2] = (size >> 8) as u8;
+        request[3] = size as u8;
+
+        request
+    }
+}
+
+/// Returns the key for a request stream. Streams that only ask for data that a later request of the same kind
+/// makes stale (the memory and disassembly views ask for a new range when they are scrolled) can be cancelled,
+/// anything else gets key 0.
+pub fn request_key(stream: &[u8]) -> u64 {
+    let mut key = 0;
+
+    for (event_type, _) in StreamEvents::new(stream) {
+        match event_type as i32 {
+            EVENT_GET_MEMORY | EVENT_GET_DISASSEMBLY => key |= 1 << event_type,
+            _ => return 0,
+        }
+    }
+
+    key
+}
+
+/// Writes the sequence id of a request. Has to be the first event in the stream
+pub fn write_sequence(writer: &mut Writer, id: u32) {
+    writer.event_begin(EVENT_REQUEST_SEQUENCE as u16);
+    writer.write_u32("id", id);
+    writer.event_end();
+}
+
+/// Writes what this side of the connection supports. Sent first on each connection so the target knows it can use
+/// compression for large data
+pub fn write_capabilities(writer: &mut Writer) {
+    writer.event_begin(EVENT_REMOTE_CAPABILITIES as u16);
+    writer.write_u32("compression", REMOTE_COMPRESSION_LZ);
+    writer.event_end();
+}
+
+/// Reads the sequence id (and if the request was cancelled) from the first event in a reply stream
+pub fn read_sequence(reader: &mut Reader) -> Option<(u32, bool)> {
+    match reader.get_event() {
+        Some(EVENT_REQUEST_SEQUENCE) => {
+            let cancelled = reader.find_u8("cancelled").unwrap_or(0) != 0;
+            reader.find_u32("id").ok().map(|id| (id, cancelled))
+        }
+        _ => None,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn out_of_order_completion() {
+        let mut tracker = RequestTracker::new(8);
+
+        let a = tracker.start(1);
+        let b = tracker.start(2);
+        let c = tracker.start(3);
+
+        assert_eq!(tracker.in_flight(), 3);
+        assert_eq!(tracker.complete(c), Some(3));
+        assert_eq!(tracker.complete(a), Some(1));
+        assert_eq!(tracker.complete(b), Some(2));
+        assert_eq!(tracker.complete(b), None);
+        assert_eq!(tracker.in_flight(), 0);
+    }
+
+    #[test]
+    fn stale_requests_are_cancelled() {
+        let mut tracker = RequestTracker::new(8);
+
+        let first = tracker.start(1);
+        let other = tracker.start(2);
+        let second = tracker.start(1);
+
+        assert_eq!(tracker.cancelled, vec![first]);
+        assert_eq!(tracker.complete(first), None);
+        assert_eq!(tracker.complete(second), Some(1));
+        assert_eq!(tracker.complete(other), Some(2));
+    }
+
+    #[test]
+    fn max_in_flight() {
+        let mut tracker = RequestTracker::new(2);
+
+        let a = tracker.start(1);
+        tracker.start(2);
+
+        assert!(!tracker.can_send());
+        tracker.complete(a);
+        assert!(tracker.can_send());
+    }
+
+    #[test]
+    fn key_zero_is_never_cancelled() {
+        let mut tracker = RequestTracker::new(8);
+
+        let first = tracker.start(0);
+        tracker.start(0);
+
+        assert_eq!(tracker.in_flight(), 2);
+        assert_eq!(tracker.complete(first), Some(0));
+    }
+
+    #[test]
+    fn reset_forgets_requests() {
+        let mut tracker = RequestTracker::new(2);
+
+        let a = tracker.start(1);
+        tracker.start(2);
+        tracker.start(2);
+
+        tracker.reset();
+
+        assert!(tracker.can_send());
+        assert!(tracker.start(3) > a);
+        assert_eq!(tracker.complete(a), None);
+        assert!(tracker.cancelled.is_empty());
+    }
+
+    fn views_stream(events: &[i32]) -> Vec<u8> {
+        let mut writer = WriterWrapper::create_writer();
+
+        for event in events {
+            writer.event_begin(*event as u16);
+            writer.write_u64("address_start", 0x1000);
+            writer.event_end();
+        }
+
+        let stream = WriterWrapper::get_stream(&writer).to_vec();
+        WriterWrapper::destroy_writer(writer);
+        stream
+    }
+
+    #[test]
+    fn request_keys() {
+        let memory = request_key(&views_stream(&[EVENT_GET_MEMORY]));
+
+        assert!(memory != 0);
+        assert_eq!(request_key(&views_stream(&[EVENT_GET_MEMORY, EVENT_GET_MEMORY])), memory);
+        assert!(request_key(&views_stream(&[EVENT_GET_DISASSEMBLY])) != memory);
+        assert_eq!(request_key(&views_stream(&[EVENT_GET_MEMORY, EVENT_SET_BREAKPOINT])), 0);
+    }
+
+    // The views' stream is sent after the sequence id and a later memory request cancels the first one
+    #[test]
+    fn tagged_streams() {
+        let mut tracker = RequestTracker::new(8);
+        let stream = views_stream(&[EVENT_GET_MEMORY]);
+
+        let first = tracker.tag_stream(&stream);
+        let second = tracker.tag_stream(&stream);
+
+        assert_eq!(tracker.in_flight(), 1);
+
+        let events = StreamEvents::new(&second).map(|(event_type, _)| event_type as i32).collect::<Vec<i32>>();
+        assert_eq!(events, vec![EVENT_REQUEST_SEQUENCE, EVENT_CANCEL_REQUESTS, EVENT_GET_MEMORY]);
+        assert_eq!(StreamEvents::new(&first).count(), 2);
+        assert_eq!(&second[second.len() - (stream.len() - 4)..], &stream[4..]);
+    }
+
+    #[test]
+    fn ids_skip_zero() {
+        let mut tracker = RequestTracker::new(4);
+        tracker.next_id = u32::max_value();
+
+        assert_eq!(tracker.start(1), u32::max_value());
+        assert_eq!(tracker.start(2), 1);
+    }
+}
@@ -2,6 +2,7 @@ use std::os::raw::{c_void, c_char, c_uchar};
 use std::ffi::CStr;
 use std::ptr;
 use prodbg_api::id_register;
+use stats;
 
 pub extern "C" fn get_services(type_name: *const c_uchar) -> *mut c_void {
     unsafe {
@@ -10,6 +11,7 @@ pub extern "C" fn get_services(type_name: *const c_uchar) -> *mut c_void {
         match name {
             "Capstone Service 1" => get_capstone_service_1(),
             "IdFuncs 1" => id_register::get_id_register_funcs(),
+            "Session Stats 1" => stats::get_session_stats_funcs(),
             _ =>  ptr::null_mut(),
         }
     }
@@ -1,11 +1,28 @@
 use prodbg_api::read_write::{Reader, Writer};
 use prodbg_api::backend::{CBackendCallbacks};
-use plugins::PluginHandler;
 use reader_wrapper::{ReaderWrapper, WriterWrapper};
 use backend_plugin::{BackendHandle, BackendPlugins};
-use std::os::raw::{c_void};
+use remote_connection::{self, RemoteConnection};
+use remote_requests::{self, RequestTracker};
+use backend_thread::{BackendChannel, BackendThread};
+use capture::{CaptureWriter, Direction, Replay, ReplaySpeed};
+use slot_map::SlotMap;
+use stats::SessionStats;
+use thread_pool::ThreadPool;
+use wakeup::Wakeup;
+use std::collections::VecDeque;
+use std::io;
+use std::path::Path;
+use std::sync::{Arc, Mutex};
+use std::time::Instant;
 use prodbg_api::events::*;
 
+// PDStreamFlag_LittleEndian (set in the first byte of the stream header)
+const PD_STREAM_FLAG_LITTLE_ENDIAN: u8 = 1 << 6;
+
+// requests sent to a remote target without waiting for the replies (after that they are sent without a sequence id)
+const MAX_REQUESTS_IN_FLIGHT: usize = 64;
+
 #[derive(PartialEq, Eq, Clone, Copy, Debug)]
 pub struct SessionHandle(pub u64);
 
@@ -31,9 +48,38 @@ pub struct Session {
     action: i32,
 
     backend: Option<BackendHandle>,
+
+    // set when the backend is running in another process (see start_remote)
+    remote: Option<RemoteConnection>,
+    // the requests sent to the remote target that hasn't been replied to yet
+    requests: RequestTracker,
+    // the connection (see RemoteConnection::get_epoch) the requests has been sent on
+    remote_epoch: usize,
+    // set when the backend is a capture being played back (see start_replay)
+    replay: Option<Replay>,
+    // streams received from the remote target (or replay) that hasn't been given to the views yet
+    remote_frames: VecDeque<Vec<u8>>,
+    // the streams of one update joined together (u64 to keep the stream 8 byte aligned)
+    remote_stream: Vec<u64>,
+
+    // all frames to and from the backend are written here when capturing (see start_capture)
+    capture: Option<CaptureWriter>,
+
+    // set when the local backend is running (see update_backend_thread)
+    backend_thread: Option<BackendThread>,
+
+    // event counts, sizes and timings (see stats::dump_json)
+    stats: Arc<Mutex<SessionStats>>,
+
+    // notified by the backend thread and remote connection when they have received something
+    wakeup: Wakeup,
+    // set when the reader got any events in the last update
+    has_events: bool,
+    // the last stream the views wrote (most views send the same requests every update which isn't anything new)
+    last_view_stream: Vec<u8>,
 }
 
-///! Connection options for Remote connections. Currently just one Ip adderss
+///! Connection options for Remote connections. Currently just one Ip adderss (with an optional :port)
 ///!
 pub struct ConnectionSettings<'a> {
     pub address: &'a str,
@@ -51,19 +97,117 @@ impl Session {
             action: 0,
             current_writer: 0,
             backend: None,
+            remote: None,
+            requests: RequestTracker::new(MAX_REQUESTS_IN_FLIGHT),
+            remote_epoch: 0,
+            replay: None,
+            remote_frames: VecDeque::new(),
+            remote_stream: Vec::new(),
+            capture: None,
+            backend_thread: None,
+            stats: SessionStats::register(handle.0),
+            wakeup: Wakeup::new(),
+            has_events: false,
+            last_view_stream: Vec::new(),
         }
     }
 
+    /// Sets what is notified when the backend has sent something (see Sessions::get_wakeup). Only used for backends
+    /// started after this.
+    pub fn set_wakeup(&mut self, wakeup: Wakeup) {
+        self.wakeup = wakeup;
+    }
+
+    /// Returns true if the views has any events (from the backend or each other) to look at since the last update.
+    /// When no session has the views has nothing new to show. What the views wrote only counts if it differs from
+    /// what they wrote before as some views send the same requests every update.
+    pub fn has_new_events(&self) -> bool {
+        self.has_events
+    }
+
+    pub fn get_stats(&self) -> &Arc<Mutex<SessionStats>> {
+        &self.stats
+    }
+
     pub fn get_current_writer(&mut self) -> &mut Writer {
         &mut self.writers[self.current_writer]
     }
 
-    pub fn start_remote(_plugin_handler: &PluginHandler, _settings: &ConnectionSettings) {}
+    /// Connects to a remote target (see PDRemote_create) and uses that as backend instead of the local one. The
+    /// connection is made on a background thread so this returns directly.
+    pub fn start_remote(&mut self, settings: &ConnectionSettings) {
+        let mut writer = WriterWrapper::create_writer();
+        remote_requests::write_capabilities(&mut writer);
+        let hello = WriterWrapper::get_stream(&writer).to_vec();
+        WriterWrapper::destroy_writer(writer);
+
+        self.remote = Some(RemoteConnection::connect(settings.address, hello, self.wakeup.clone()));
+        self.requests = RequestTracker::new(MAX_REQUESTS_IN_FLIGHT);
+        self.remote_epoch = 0;
+        self.replay = None;
+        self.backend_thread = None;
+        self.remote_frames.clear();
+    }
+
+    /// Uses the backend frames in a capture (see start_capture) instead of a backend. What the views write is
+    /// dropped.
+    pub fn start_replay(&mut self, path: &Path, speed: ReplaySpeed) -> io::Result<()> {
+        self.replay = Some(try!(Replay::open(path, speed)));
+        self.remote = None;
+        self.backend_thread = None;
+        self.remote_frames.clear();
+        Ok(())
+    }
+
+    /// Returns true when a replay has given all frames to the views
+    pub fn is_replay_finished(&self) -> bool {
+        self.replay.as_ref().map_or(false, |replay| replay.is_finished() && self.remote_frames.is_empty())
+    }
+
+    /// Writes all frames sent to and received from the backend to a file (until stop_capture) so they can be
+    /// replayed later
+    pub fn start_capture(&mut self, path: &Path) -> io::Result<()> {
+        self.capture = Some(try!(CaptureWriter::create(path)));
+        Ok(())
+    }
+
+    pub fn stop_capture(&mut self) {
+        if let Some(mut capture) = self.capture.take() {
+            if let Err(e) = capture.flush() {
+                println!("Unable to write capture: {}", e);
+            }
+        }
+    }
+
+    fn capture_frame(&mut self, direction: Direction, frame: &[u8]) {
+        let failed = match self.capture {
+            Some(ref mut capture) => capture.write_frame(direction, frame).is_err(),
+            None => false,
+        };
+
+        if failed {
+            println!("Unable to write capture, capture stopped");
+            self.capture = None;
+        }
+    }
+
+    fn capture_action(&mut self) {
+        let action = self.action;
+
+        if action != 0 {
+            self.capture_frame(Direction::ToBackend, &remote_connection::action_frame(action));
+        }
+    }
+
+    pub fn is_remote_connected(&self) -> bool {
+        self.remote.as_ref().map_or(false, |remote| remote.is_connected())
+    }
 
     pub fn start_local(_: &str, _: usize) {}
 
     pub fn set_backend(&mut self, backend: Option<BackendHandle>) {
-        self.backend = backend
+        self.backend = backend;
+        self.backend_thread = None;
     }
 
     pub fn action_step(&mut self) {
@@ -102,84 +246,332 @@ impl Session {
     // That is to allow the view plugins to send things that other view plugins can listen
     // to and not only get data from the backend.
     pub fn update(&mut self, backend_plugins: &mut BackendPlugins) {
-        // swap the writers
+        self.update_backend_thread(backend_plugins);
+        self.update_frames();
+    }
+
+    /// The part of update that doesn't use the backend plugins. Sessions never share anything so this can be called
+    /// for several sessions in parallel (see Sessions::update). This includes the decoding the views would do on
+    /// their first reads (decompressing data and building the indexes) as they are updated one at a time.
+    pub fn update_frames(&mut self) {
+        if self.replay.is_some() {
+            self.update_replay();
+        } else {
+            self.update_backend();
+        }
+
+        if self.has_events {
+            ReaderWrapper::prepare(&mut self.reader);
+        }
+    }
+
+    /// Starts a thread for the local backend (or a new one if the backend has been changed or reloaded)
+    pub fn update_backend_thread(&mut self, backend_plugins: &mut BackendPlugins) {
+        if self.replay.is_some() || self.remote.is_some() || self.backend.is_none() {
+            return;
+        }
+
+        let backend = backend_plugins.get_backend(self.backend);
+
+        let running = match (backend.as_ref(), self.backend_thread.as_ref()) {
+            (Some(backend), Some(thread)) => thread.is_backend(&backend.alive) && thread.is_alive(),
+            _ => false,
+        };
+
+        if running {
+            return;
+        }
+
+        self.backend_thread = None;
+
+        if let Some(backend) = backend {
+            let plugin_funcs = backend.plugin_type.plugin_funcs as *mut CBackendCallbacks;
+
+            if let Some(update) = unsafe { (*plugin_funcs).update } {
+                self.backend_thread = Some(BackendThread::start(backend.plugin_data,
+                                                                update,
+                                                                backend.alive.clone(),
+                                                                self.stats.clone(),
+                                                                self.wakeup.clone()));
+            }
+        }
+    }
+
+    fn capture_stream(&mut self, direction: Direction, writer: usize) {
+        let stream = WriterWrapper::get_stream(&self.writers[writer]).to_vec();
+
+        if stream.len() > 4 {
+            self.capture_frame(direction, &stream);
+        }
+    }
+
+    // The backend runs on its own thread or in another process. What the views has written is sent to it and the
+    // views gets what they wrote (so they can still talk to each other) together with the replies that has arrived
+    // since last update. This never waits for the backend. Requests to a remote target are tagged with a sequence id
+    // (see remote_requests) so replies to requests that a later one has made stale can be dropped.
+    fn update_backend(&mut self) {
         let c_writer = self.current_writer;
         let n_writer = (self.current_writer + 1) & 1;
+        let received = self.remote_frames.len();
+
+        let channel: Option<&BackendChannel> = match self.remote {
+            Some(ref remote) => Some(remote),
+            None => self.backend_thread.as_ref().map(|thread| thread as &BackendChannel),
+        };
+
+        if let Some(channel) = channel {
+            let stream = WriterWrapper::get_stream(&self.writers[c_writer]);
+            let mut stats = self.stats.lock().unwrap();
+            let now = Instant::now();
+
+            // the requests sent before the target was reconnected will never be replied to
+
+            if let Some(ref remote) = self.remote {
+                let epoch = remote.get_epoch();
+
+                if epoch != self.remote_epoch {
+                    self.remote_epoch = epoch;
+                    self.requests.reset();
+                    stats.clear_pending();
+                }
+            }
+
+            if self.action != 0 && channel.send_action(self.action).is_err() {
+                println!("Backend is falling behind, action dropped");
+                stats.record_dropped();
+            }
+
+            if stream.len() > 4 {
+                let request = match self.remote {
+                    Some(_) => self.requests.tag_stream(stream),
+                    None => stream.to_vec(),
+                };
+
+                stats.record_stream(Direction::ToBackend, &request, now);
+
+                if channel.send(request).is_err() {
+                    println!("Backend is falling behind, request dropped");
+                    stats.record_dropped();
+                }
+            }
+
+            while let Some((mut frame, received_at)) = channel.recv() {
+                stats.record_stream(Direction::FromBackend, &frame, received_at);
+
+                if self.remote.is_some() {
+                    ReaderWrapper::init_from_stream(&mut self.reader, &mut frame);
+
+                    if self.requests.is_stale_reply(&mut self.reader) {
+                        continue;
+                    }
+                }
+
+                self.remote_frames.push_back(frame);
+            }
+        }
+
+        if self.capture.is_some() {
+            let frames: Vec<Vec<u8>> = self.remote_frames.iter().skip(received).cloned().collect();
+
+            self.capture_action();
+            self.capture_stream(Direction::ToBackend, c_writer);
+
+            for frame in frames {
+                self.capture_frame(Direction::FromBackend, &frame);
+            }
+        }
+
+        self.init_reader_from_frames(c_writer);
 
-        ReaderWrapper::init_from_writer(&mut self.reader, &self.writers[c_writer]);
         ReaderWrapper::reset_writer(&mut self.writers[n_writer]);
 
-        if let Some(backend) = backend_plugins.get_backend(self.backend) {
-            unsafe {
-                let plugin_funcs = backend.plugin_type.plugin_funcs as *mut CBackendCallbacks;
-                ((*plugin_funcs).update.unwrap())(backend.plugin_data,
-                                                  self.action,
-                                                  self.reader.api as *mut c_void,
-                                                  self.writers[n_writer].api as *mut c_void);
+        self.action = 0;
+        self.current_writer = n_writer;
+    }
+
+    // Same as update_remote but the backend frames comes from a capture
+    fn update_replay(&mut self) {
+        let c_writer = self.current_writer;
+        let n_writer = (self.current_writer + 1) & 1;
+        let mut frames = Vec::new();
+
+        self.replay.as_mut().unwrap().update(&mut frames);
+
+        {
+            let mut stats = self.stats.lock().unwrap();
+            let now = Instant::now();
+
+            for frame in &frames {
+                stats.record_stream(Direction::FromBackend, frame, now);
             }
         }
 
+        self.remote_frames.extend(frames);
+
+        self.init_reader_from_frames(c_writer);
+
+        ReaderWrapper::reset_writer(&mut self.writers[n_writer]);
+
         self.action = 0;
         self.current_writer = n_writer;
+    }
+
+    // Gives the views what they wrote in the last update together with the backend frames waiting for them
+    fn init_reader_from_frames(&mut self, c_writer: usize) {
+        let views_changed = {
+            let stream = WriterWrapper::get_stream(&self.writers[c_writer]);
+            stream.len() > 4 && stream != &self.last_view_stream[..]
+        };
+
+        if views_changed {
+            self.last_view_stream = WriterWrapper::get_stream(&self.writers[c_writer]).to_vec();
+        }
 
-        //ReaderWrapper::init_from_writer(&mut self.reader, &self.writers[1]);
-        //ReaderWrapper::reset_writer(&mut self.writers[0]);
+        self.has_events = !self.remote_frames.is_empty() || views_changed;
+
+        if self.remote_frames.is_empty() {
+            ReaderWrapper::init_from_writer(&mut self.reader, &self.writers[c_writer]);
+        } else {
+            // Streams can only be joined if they use the same byte order. The target replies in our order (which
+            // the writers use) so this is only needed for streams sent before it got anything from us.
+            let stream = WriterWrapper::get_stream(&self.writers[c_writer]);
+            let order = stream[0] & PD_STREAM_FLAG_LITTLE_ENDIAN;
+            let count = self.remote_frames
+                .iter()
+                .take_while(|frame| frame[0] & PD_STREAM_FLAG_LITTLE_ENDIAN == order)
+                .count();
+
+            if count == 0 {
+                // the views get the next stream on its own (and lose what they wrote this update)
+                let frame = self.remote_frames.pop_front().unwrap();
+                ReaderWrapper::init_from_streams(&mut self.reader,
+                                                 Some(&frame[..]).into_iter(),
+                                                 &mut self.remote_stream);
+            } else {
+                let frames = self.remote_frames.iter().take(count).map(|frame| &frame[..]);
+                ReaderWrapper::init_from_streams(&mut self.reader,
+                                                 Some(stream).into_iter().chain(frames),
+                                                 &mut self.remote_stream);
+
+                self.remote_frames.drain(..count);
+            }
+
+            // only the frames from a local backend are known to be written by this process
+            let local = self.remote.is_none() && self.replay.is_none();
+            ReaderWrapper::set_trust_utf8(&mut self.reader, local);
+        }
     }
 }
 
 
+// The readers and writers are only used by the thread that owns (or updates) the session and the backend runs on
+// its own thread
+unsafe impl Send for Session {}
+
 ///
 /// Sessions handler
 ///
 pub struct Sessions {
-    instances: Vec<Session>,
-    current: usize,
-    session_counter: SessionHandle,
+    instances: SlotMap<Session>,
+    current: SessionHandle,
+    pool: ThreadPool,
+    wakeup: Wakeup,
 }
 
 impl Sessions {
     pub fn new() -> Sessions {
+        Self::with_pool(ThreadPool::with_cpu_count())
+    }
+
+    /// Same as new but the sessions are updated by pool (a pool with one thread updates them one at a time)
+    pub fn with_pool(pool: ThreadPool) -> Sessions {
         Sessions {
-            instances: Vec::new(),
-            current: 0,
-            session_counter: SessionHandle(0),
+            instances: SlotMap::new(),
+            current: SessionHandle(0),
+            pool: pool,
+            wakeup: Wakeup::new(),
         }
     }
 
     pub fn create_instance(&mut self) -> SessionHandle {
-        let s = Session::new(self.session_counter);
-        let handle = s.handle;
-        self.instances.push(s);
-        self.session_counter.0 += 1;
+        let handle = SessionHandle(self.instances.next_key());
+        let mut s = Session::new(handle);
+        s.set_wakeup(self.wakeup.clone());
+        self.instances.insert(s);
         handle
     }
 
+    /// Updates all sessions. The backend plugins are only used on this thread so the backend threads are started
+    /// first and then the sessions are updated in parallel. All sessions are done when this returns.
     pub fn update(&mut self, backend_plugins: &mut BackendPlugins) {
         for session in self.instances.iter_mut() {
-            session.update(backend_plugins);
+            session.update_backend_thread(backend_plugins);
         }
+
+        self.pool.for_each(self.instances.values_mut(), |session| session.update_frames());
+    }
+
+    /// Notified when any session has received something from its backend. The main loop waits for this.
+    pub fn get_wakeup(&self) -> &Wakeup {
+        &self.wakeup
+    }
+
+    /// Returns true if the views of any session has something new to look at (see Session::has_new_events)
+    pub fn has_new_events(&self) -> bool {
+        self.instances.iter().any(|session| session.has_new_events())
     }
 
     pub fn get_current(&mut self) -> &mut Session {
         let current = self.current;
-        &mut self.instances[current]
+        self.instances.get_mut(current.0).unwrap()
     }
 
     pub fn get_session(&mut self, handle: SessionHandle) -> Option<&mut Session> {
-        for i in 0..self.instances.len() {
-            if self.instances[i].handle == handle {
-                return Some(&mut self.instances[i]);
-            }
-        }
-
-        None
+        self.instances.get_mut(handle.0)
     }
 }
 
 #[cfg(test)]
 mod tests {
     //use core::reader_wrapper::{ReaderWrapper};
-    //use super::*;
+    use super::*;
+    use capture::{CaptureReader, CaptureWriter, Direction, ReplaySpeed};
+    use prodbg_api::read_write::{CPDReaderAPI, CPDWriterAPI};
+    use std::env;
+    use std::fs;
+    use std::os::raw::{c_int, c_void};
+    use std::path::{Path, PathBuf};
+    use std::process::{Child, Command};
+    use std::ptr;
+    use std::thread;
+    use std::time::{Duration, Instant};
+
+    struct KillOnDrop(Child);
+
+    impl Drop for KillOnDrop {
+        fn drop(&mut self) {
+            let _ = self.0.kill();
+            let _ = self.0.wait();
+        }
+    }
+
+    // fake6502 is built by tundra so look for it in the output dirs (or where FAKE6502 says)
+    fn find_fake_6502(root: &Path) -> Option<PathBuf> {
+        if let Ok(path) = env::var("FAKE6502") {
+            return Some(PathBuf::from(path));
+        }
+
+        let name = format!("fake6502{}", env::consts::EXE_SUFFIX);
+
+        match fs::read_dir(root.join("t2-output")) {
+            Ok(dirs) => {
+                dirs.filter_map(|entry| entry.ok())
+                    .map(|entry| entry.path().join(&name))
+                    .find(|path| path.exists())
+            }
+            Err(_) => None,
+        }
+    }
 
     #[test]
     fn create_session() {
@@ -199,7 +591,325 @@ mod tests {
         assert_eq!(session.reader.get_event().unwrap(), 0x44);
         */
     }
-}
 
+    fn capture_path(name: &str) -> PathBuf {
+        env::temp_dir().join(format!("prodbg_{}_{}.bin", name, ::std::process::id()))
+    }
+
+    // What the views write and the actions should be captured as frames to the backend
+    #[test]
+    fn capture_session() {
+        let path = capture_path("session_capture");
+        let mut backend_plugins = BackendPlugins::new();
+        let mut session = Session::new(SessionHandle(0));
+
+        session.start_capture(&path).unwrap();
+
+        session.get_current_writer().event_begin(EVENT_GET_MEMORY as u16);
+        session.get_current_writer().write_u32("size", 256);
+        session.get_current_writer().event_end();
+        session.action_step();
+
+        session.update(&mut backend_plugins);
+        session.stop_capture();
+
+        let mut capture = CaptureReader::open(&path).unwrap();
+
+        let action = capture.read_frame().unwrap().unwrap();
+        assert_eq!(action.direction, Direction::ToBackend);
+        assert_eq!(action.data, remote_connection::action_frame(ACTION_STEP));
+
+        let stream = capture.read_frame().unwrap().unwrap();
+        assert_eq!(stream.direction, Direction::ToBackend);
+
+        let mut buffer = Vec::new();
+        ReaderWrapper::init_from_streams(&mut session.reader, Some(&stream.data[..]).into_iter(), &mut buffer);
+        assert_eq!(session.reader.get_event(), Some(EVENT_GET_MEMORY));
+        assert_eq!(session.reader.find_u32("size").ok(), Some(256));
+
+        assert!(capture.read_frame().unwrap().is_none());
+
+        fs::remove_file(&path).unwrap();
+    }
+
+    // At max speed the views should get one backend frame for each update (and nothing of what they sent)
+    #[test]
+    fn replay_max_speed() {
+        let path = capture_path("session_replay");
+        let mut backend_plugins = BackendPlugins::new();
+        let mut session = Session::new(SessionHandle(0));
+
+        {
+            let mut capture = CaptureWriter::create(&path).unwrap();
+            let mut writer = WriterWrapper::create_writer();
+
+            for i in 0..3 {
+                ReaderWrapper::reset_writer(&mut writer);
+                writer.event_begin(EVENT_SET_MEMORY as u16);
+                writer.write_u32("address", i);
+                writer.event_end();
+
+                capture.write_frame(Direction::ToBackend, &remote_connection::action_frame(ACTION_STEP)).unwrap();
+                capture.write_frame(Direction::FromBackend, WriterWrapper::get_stream(&writer)).unwrap();
+            }
+
+            WriterWrapper::destroy_writer(writer);
+        }
+
+        session.start_replay(&path, ReplaySpeed::Max).unwrap();
+
+        for i in 0..3 {
+            assert!(!session.is_replay_finished());
+
+            session.update(&mut backend_plugins);
+
+            let events = session.reader.get_events().collect::<Vec<i32>>();
+            assert_eq!(events, vec![EVENT_SET_MEMORY]);
+
+            ReaderWrapper::reset_reader(&mut session.reader);
+            session.reader.get_event();
+            assert_eq!(session.reader.find_u32("address").ok(), Some(i));
+        }
+
+        session.update(&mut backend_plugins);
+
+        assert!(session.is_replay_finished());
+        assert_eq!(session.reader.get_event(), None);
+
+        fs::remove_file(&path).unwrap();
+    }
+
+    // Runs examples/fake_6502 and talks to it over the loopback interface: break and wait for the state it sends.
+    // Needs fake6502 to be built first so it's only run when asked for:
+    //
+    //   FAKE6502=path/to/fake6502 cargo test remote_fake_6502 -- --ignored
+    //
+    // (FAKE6502 isn't needed if it has been built with tundra)
+    #[test]
+    #[ignore]
+    fn remote_fake_6502() {
+        let root = Path::new(env!("CARGO_MANIFEST_DIR")).join("../../..");
+        let exe = find_fake_6502(&root).expect("fake6502 not found (build it or set FAKE6502)");
+
+        let _target = KillOnDrop(Command::new(exe)
+            .arg("examples/fake_6502/test.bin")
+            .current_dir(&root)
+            .spawn()
+            .unwrap());
+
+        let mut backend_plugins = BackendPlugins::new();
+        let mut session = Session::new(SessionHandle(0));
+        let start = Instant::now();
+        let mut got_location = false;
+
+        session.start_remote(&ConnectionSettings { address: "127.0.0.1:1340" });
+
+        while !session.is_remote_connected() {
+            assert!(start.elapsed() < Duration::from_secs(10), "unable to connect to fake6502");
+            thread::sleep(Duration::from_millis(10));
+        }
+
+        session.action_break();
+
+        while !got_location {
+            assert!(start.elapsed() < Duration::from_secs(10), "no reply from fake6502");
+
+            session.update(&mut backend_plugins);
+
+            for event in session.reader.get_events() {
+                if event == EVENT_SET_EXCEPTION_LOCATION {
+                    got_location = session.reader.find_u16("address").is_ok();
+                }
+            }
+
+            thread::sleep(Duration::from_millis(1));
+        }
+    }
+    extern "C" {
+        fn pd_binary_writer_set_compression(writer: *mut CPDWriterAPI, min_size: u32);
+    }
+
+    // Replies to EVENT_GET_MEMORY with that many bytes of memory (compressed the same way as a remote target does)
+    fn memory_backend(_: *mut c_void, _: c_int, reader: *mut c_void, writer: *mut c_void) {
+        let reader = Reader::new(reader as *mut CPDReaderAPI, 0);
+        let mut writer = Writer { api: writer as *mut _ };
+
+        unsafe {
+            pd_binary_writer_set_compression(writer.api, 1024);
+        }
+
+        for event in reader.get_events() {
+            if event == EVENT_GET_MEMORY {
+                let size = reader.find_u32("size").unwrap_or(0) as usize;
+                let memory = (0..size).map(|i| ((i * 13) % 96) as u8).collect::<Vec<u8>>();
+
+                writer.event_begin(EVENT_SET_MEMORY as u16);
+                writer.write_u32("size", size as u32);
+                writer.write_data("data", &memory);
+                writer.event_end();
+            }
+        }
+    }
+
+    fn create_memory_sessions(sessions: &mut Sessions, count: usize) {
+        for _ in 0..count {
+            let handle = sessions.create_instance();
+            let session = sessions.get_session(handle).unwrap();
+
+            session.backend_thread = Some(BackendThread::start(ptr::null_mut(),
+                                                               memory_backend,
+                                                               Arc::new(Mutex::new(true)),
+                                                               session.stats.clone(),
+                                                               session.wakeup.clone()));
+        }
+    }
+
+    fn request_memory<F: Fn(usize) -> u32>(sessions: &mut Sessions, size: F) {
+        for (i, session) in sessions.instances.iter_mut().enumerate() {
+            let writer = session.get_current_writer();
+            writer.event_begin(EVENT_GET_MEMORY as u16);
+            writer.write_u32("size", size(i));
+            writer.event_end();
+        }
+    }
+
+    // Updates the sessions until all of them has got the memory. Returns the time spent in Sessions::update and
+    // reading the memory (what a memory view would do)
+    fn wait_for_memory(sessions: &mut Sessions, sizes: &mut [Option<u32>]) -> Duration {
+        let mut backend_plugins = BackendPlugins::new();
+        let mut time = Duration::new(0, 0);
+        let start = Instant::now();
+
+        while sizes.iter().any(|size| size.is_none()) {
+            assert!(start.elapsed() < Duration::from_secs(10));
+
+            let update_start = Instant::now();
+            sessions.update(&mut backend_plugins);
 
+            for (i, session) in sessions.instances.iter().enumerate() {
+                for event in session.reader.get_events() {
+                    if event == EVENT_SET_MEMORY {
+                        sizes[i] = session.reader.find_u32("size").ok();
+
+                        let data = session.reader.find_data("data").ok().unwrap_or(&[]);
+                        assert_eq!(Some(data.len() as u32), sizes[i]);
+                    }
+                }
+            }
+
+            time += update_start.elapsed();
+
+            // the same as the main loop does when there is nothing to show
+
+            if !sessions.has_new_events() {
+                sessions.get_wakeup().wait(Duration::from_millis(100));
+            }
+        }
+
+        time
+    }
+
+    // The views should only have something new when the backend has written anything or they wrote something else
+    // than the last time
+    #[test]
+    fn new_events() {
+        let mut backend_plugins = BackendPlugins::new();
+        let mut session = Session::new(SessionHandle(0));
+
+        session.update(&mut backend_plugins);
+        assert!(!session.has_new_events());
+
+        session.get_current_writer().event_begin(EVENT_GET_MEMORY as u16);
+        session.get_current_writer().event_end();
+        session.update(&mut backend_plugins);
+        assert!(session.has_new_events());
+
+        session.update(&mut backend_plugins);
+        assert!(!session.has_new_events());
+
+        // the same request again (as a view that requests its data every update)
+        session.get_current_writer().event_begin(EVENT_GET_MEMORY as u16);
+        session.get_current_writer().event_end();
+        session.update(&mut backend_plugins);
+        assert!(!session.has_new_events());
+
+        session.get_current_writer().event_begin(EVENT_GET_MEMORY as u16);
+        session.get_current_writer().write_u64("address_start", 0x1000);
+        session.get_current_writer().event_end();
+        session.update(&mut backend_plugins);
+        assert!(session.has_new_events());
+    }
+
+    // A stream from outside the process may flag a string as UTF-8 that isn't so the strings in it are validated
+    #[test]
+    fn untrusted_strings() {
+        let mut writer = WriterWrapper::create_writer();
+        writer.event_begin(EVENT_SET_MEMORY as u16);
+        writer.write_string("name", "abc");
+        writer.event_end();
 
+        let mut stream = WriterWrapper::get_stream(&writer).to_vec();
+        WriterWrapper::destroy_writer(writer);
+
+        let pos = stream.windows(3).position(|s| s == b"abc").unwrap();
+        stream[pos] = 0xff;
+
+        let mut reader = ReaderWrapper::create_reader();
+        let mut buffer = Vec::new();
+
+        ReaderWrapper::init_from_streams(&mut reader, Some(&stream[..]).into_iter(), &mut buffer);
+
+        assert_eq!(reader.get_event(), Some(EVENT_SET_MEMORY));
+        assert!(reader.find_string("name").is_err());
+
+        ReaderWrapper::destroy_reader(reader);
+    }
+
+    // Each session should get the reply from its own backend when they are updated in parallel
+    #[test]
+    fn parallel_sessions() {
+        let mut sessions = Sessions::with_pool(ThreadPool::new(4));
+        let mut sizes = [None; 8];
+
+        create_memory_sessions(&mut sessions, 8);
+
+        for round in 0..10 {
+            request_memory(&mut sessions, |i| (round * 100 + i) as u32);
+
+            for size in sizes.iter_mut() {
+                *size = None;
+            }
+
+            wait_for_memory(&mut sessions, &mut sizes);
+
+            for (i, &size) in sizes.iter().enumerate() {
+                assert_eq!(size, Some((round * 100 + i) as u32));
+            }
+        }
+    }
+
+    // Time it takes to give 1 MB of memory from a backend to the views in 16 sessions with different number of
+    // threads. Run with cargo test --release bench_parallel_sessions -- --ignored --nocapture
+    #[test]
+    #[ignore]
+    fn bench_parallel_sessions() {
+        const SESSIONS: usize = 16;
+        const ROUNDS: usize = 50;
+
+        for &threads in &[1, 2, 4, 8, 16] {
+            let mut sessions = Sessions::with_pool(ThreadPool::new(threads));
+            let mut time = Duration::new(0, 0);
+
+            create_memory_sessions(&mut sessions, SESSIONS);
+
+            for _ in 0..ROUNDS {
+                let mut sizes = [None; SESSIONS];
+                request_memory(&mut sessions, |_| 1 << 20);
+                time += wait_for_memory(&mut sessions, &mut sizes);
+            }
+
+            let ms = time.as_secs() as f64 * 1000.0 + time.subsec_nanos() as f64 / 1000000.0;
+            println!("{:2} threads: {:.2} ms per round", threads, ms / ROUNDS as f64);
+        }
+    }
+}
@@ -0,0 +1,298 @@
+use std::slice;
+
+///! Generational slot map used to store the sessions, views and backends.
+///!
+///! The values are stored packed in a Vec (in no particular order) so iterating over them is the same as iterating
+///! over a Vec and they can be handed out as a slice (see Sessions::update). Each key refers to a slot that holds the
+///! index of its value and a generation which is bumped when the value is removed so lookups are O(1) and a key for
+///! a removed value never finds a value inserted in the same slot later.
+///!
+///! Keys are u64 (slot index in the low 32 bits and generation in the high 32 bits) so they fit in the existing
+///! handle types and the dock handles saved in the workspace layouts. Keys from before generations were used (a plain
+///! counter) are valid keys with generation 0.
+///!
+
+// value index of a free slot
+const FREE: u32 = !0;
+
+#[derive(Clone, Copy)]
+struct Slot {
+    generation: u32,
+    value: u32,
+}
+
+pub struct SlotMap<T> {
+    values: Vec<T>,
+    // slot index for each value
+    value_slots: Vec<u32>,
+    slots: Vec<Slot>,
+    free_slots: Vec<u32>,
+}
+
+fn make_key(index: u32, generation: u32) -> u64 {
+    ((generation as u64) << 32) | index as u64
+}
+
+fn split_key(key: u64) -> (usize, u32) {
+    ((key & 0xffff_ffff) as usize, (key >> 32) as u32)
+}
+
+impl<T> SlotMap<T> {
+    pub fn new() -> SlotMap<T> {
+        SlotMap {
+            values: Vec::new(),
+            value_slots: Vec::new(),
+            slots: Vec::new(),
+            free_slots: Vec::new(),
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.values.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.values.is_empty()
+    }
+
+    /// Returns the key the next call to insert will use
+    pub fn next_key(&self) -> u64 {
+        match self.free_slots.last() {
+            Some(&index) => make_key(index, self.slots[index as usize].generation),
+            None => make_key(self.slots.len() as u32, 0),
+        }
+    }
+
+    pub fn insert(&mut self, value: T) -> u64 {
+        let key = self.next_key();
+        // the slot is free
+        let _ = self.insert_at(key, value);
+        key
+    }
+
+    /// Inserts the value with a key chosen by the caller (such as a handle from a saved layout or one that was
+    /// removed before a plugin reload). Gives the value back if the slot is in use.
+    pub fn insert_at(&mut self, key: u64, value: T) -> Result<(), T> {
+        let (index, generation) = split_key(key);
+
+        if index >= FREE as usize {
+            return Err(value);
+        }
+
+        while self.slots.len() <= index {
+            self.free_slots.push(self.slots.len() as u32);
+            self.slots.push(Slot {
+                generation: 0,
+                value: FREE,
+            });
+        }
+
+        if self.slots[index].value != FREE {
+            return Err(value);
+        }
+
+        // insert uses the last free slot so this is only a search when the key is picked by the caller
+
+        match self.free_slots.iter().rposition(|&free| free as usize == index) {
+            Some(pos) => {
+                self.free_slots.swap_remove(pos);
+            }
+            None => unreachable!(),
+        }
+
+        self.slots[index] = Slot {
+            generation: generation,
+            value: self.values.len() as u32,
+        };
+
+        self.values.push(value);
+        self.value_slots.push(index as u32);
+
+        Ok(())
+    }
+
+    pub fn remove(&mut self, key: u64) -> Option<T> {
+        let value_index = match self.value_index(key) {
+            Some(value_index) => value_index,
+            None => return None,
+        };
+
+        let (index, generation) = split_key(key);
+
+        self.slots[index] = Slot {
+            generation: generation.wrapping_add(1),
+            value: FREE,
+        };
+
+        self.free_slots.push(index as u32);
+
+        // the last value is moved into the hole
+
+        self.value_slots.swap_remove(value_index);
+
+        if let Some(&moved) = self.value_slots.get(value_index) {
+            self.slots[moved as usize].value = value_index as u32;
+        }
+
+        Some(self.values.swap_remove(value_index))
+    }
+
+    /// Removes the values where func returns false
+    pub fn retain<F: FnMut(&T) -> bool>(&mut self, mut func: F) {
+        for i in (0..self.values.len()).rev() {
+            if !func(&self.values[i]) {
+                let key = self.key_at(i);
+                self.remove(key);
+            }
+        }
+    }
+
+    pub fn contains_key(&self, key: u64) -> bool {
+        self.value_index(key).is_some()
+    }
+
+    pub fn get(&self, key: u64) -> Option<&T> {
+        match self.value_index(key) {
+            Some(value_index) => Some(&self.values[value_index]),
+            None => None,
+        }
+    }
+
+    pub fn get_mut(&mut self, key: u64) -> Option<&mut T> {
+        match self.value_index(key) {
+            Some(value_index) => Some(&mut self.values[value_index]),
+            None => None,
+        }
+    }
+
+    pub fn iter(&self) -> slice::Iter<T> {
+        self.values.iter()
+    }
+
+    pub fn iter_mut(&mut self) -> slice::IterMut<T> {
+        self.values.iter_mut()
+    }
+
+    /// All values (in no particular order)
+    pub fn values_mut(&mut self) -> &mut [T] {
+        &mut self.values
+    }
+
+    fn key_at(&self, value_index: usize) -> u64 {
+        let index = self.value_slots[value_index];
+        make_key(index, self.slots[index as usize].generation)
+    }
+
+    fn value_index(&self, key: u64) -> Option<usize> {
+        let (index, generation) = split_key(key);
+
+        match self.slots.get(index) {
+            Some(slot) if slot.value != FREE && slot.generation == generation => Some(slot.value as usize),
+            _ => None,
+        }
+    }
+}
+
+impl<'a, T> IntoIterator for &'a SlotMap<T> {
+    type Item = &'a T;
+    type IntoIter = slice::Iter<'a, T>;
+
+    fn into_iter(self) -> slice::Iter<'a, T> {
+        self.values.iter()
+    }
+}
+
+impl<'a, T> IntoIterator for &'a mut SlotMap<T> {
+    type Item = &'a mut T;
+    type IntoIter = slice::IterMut<'a, T>;
+
+    fn into_iter(self) -> slice::IterMut<'a, T> {
+        self.values.iter_mut()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn insert_remove() {
+        let mut map = SlotMap::new();
+        let keys = (0..100).map(|i| map.insert(i)).collect::<Vec<u64>>();
+
+        // first generation keys are the same as the old counters
+        assert_eq!(keys, (0..100).collect::<Vec<u64>>());
+
+        for key in keys.iter().filter(|&&key| key % 3 == 0) {
+            assert_eq!(map.remove(*key), Some(*key as i32));
+        }
+
+        assert_eq!(map.len(), 66);
+
+        for (i, key) in keys.iter().enumerate() {
+            assert_eq!(map.get(*key).cloned(), if i % 3 == 0 { None } else { Some(i as i32) });
+        }
+
+        let mut values = map.iter().cloned().collect::<Vec<i32>>();
+        values.sort();
+        assert_eq!(values, (0..100).filter(|i| i % 3 != 0).collect::<Vec<i32>>());
+    }
+
+    #[test]
+    fn stale_keys() {
+        let mut map = SlotMap::new();
+        let first = map.insert("first");
+        map.insert("other");
+
+        assert_eq!(map.remove(first), Some("first"));
+        assert_eq!(map.remove(first), None);
+
+        // the slot is reused with a new generation
+        let second = map.insert("second");
+        assert!(second != first);
+        assert_eq!(second & 0xffff_ffff, first & 0xffff_ffff);
+
+        assert_eq!(map.get(first), None);
+        assert_eq!(map.get(second), Some(&"second"));
+    }
+
+    #[test]
+    fn insert_at() {
+        let mut map = SlotMap::new();
+
+        // a saved layout with handles 2 and 5
+        assert!(map.insert_at(5, "five").is_ok());
+        assert!(map.insert_at(2, "two").is_ok());
+        assert_eq!(map.insert_at(5, "again"), Err("again"));
+
+        // new values use the slots in between
+        let mut keys = (0..5).map(|_| map.insert("new")).collect::<Vec<u64>>();
+        keys.sort();
+        assert_eq!(keys, vec![0, 1, 3, 4, 6]);
+
+        // a removed handle can be inserted again (changing the plugin of a view)
+        map.remove(2);
+        assert_eq!(map.get(2), None);
+        assert!(map.insert_at(2, "two again").is_ok());
+        assert_eq!(map.get(2), Some(&"two again"));
+        assert_eq!(map.get(5), Some(&"five"));
+    }
+
+    #[test]
+    fn retain() {
+        let mut map = SlotMap::new();
+        let keys = (0..10).map(|i| map.insert(i)).collect::<Vec<u64>>();
+
+        map.retain(|&value| value % 2 == 1);
+
+        for (i, key) in keys.iter().enumerate() {
+            assert_eq!(map.contains_key(*key), i % 2 == 1);
+        }
+
+        for value in &mut map {
+            *value *= 10;
+        }
+
+        assert_eq!(map.get(keys[3]), Some(&30));
+    }
+}
@@ -0,0 +1,144 @@
+use std::cell::UnsafeCell;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+///! Bounded lock-free queue with one producer and one consumer thread. Used to move data between the UI thread and
+///! the background threads (such as the network thread of a remote session) without any locks so a stalled thread
+///! never blocks the other one.
+///!
+///! The queue is shared with an Arc and it's up to the user to make sure that only one thread pushes and only one
+///! thread pops.
+///!
+pub struct SpscQueue<T> {
+    slots: Vec<UnsafeCell<Option<T>>>,
+    mask: usize,
+    // next slot to pop (only written by the consumer)
+    head: AtomicUsize,
+    // next slot to push (only written by the producer)
+    tail: AtomicUsize,
+}
+
+unsafe impl<T: Send> Send for SpscQueue<T> {}
+unsafe impl<T: Send> Sync for SpscQueue<T> {}
+
+impl<T> SpscQueue<T> {
+    /// Creates a queue that can hold at least capacity items (rounded up to a power of two)
+    pub fn new(capacity: usize) -> SpscQueue<T> {
+        let size = capacity.next_power_of_two();
+        let mut slots = Vec::with_capacity(size);
+
+        for _ in 0..size {
+            slots.push(UnsafeCell::new(None));
+        }
+
+        SpscQueue {
+            slots: slots,
+            mask: size - 1,
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+        }
+    }
+
+    /// Pushes an item (producer only). If the queue is full the item is given back.
+    pub fn push(&self, item: T) -> Result<(), T> {
+        let tail = self.tail.load(Ordering::Relaxed);
+
+        if tail.wrapping_sub(self.head.load(Ordering::Acquire)) > self.mask {
+            return Err(item);
+        }
+
+        unsafe {
+            *self.slots[tail & self.mask].get() = Some(item);
+        }
+
+        self.tail.store(tail.wrapping_add(1), Ordering::Release);
+
+        Ok(())
+    }
+
+    /// Pops the oldest item (consumer only)
+    pub fn pop(&self) -> Option<T> {
+        let head = self.head.load(Ordering::Relaxed);
+
+        if head == self.tail.load(Ordering::Acquire) {
+            return None;
+        }
+
+        let item = unsafe { (*self.slots[head & self.mask].get()).take() };
+
+        self.head.store(head.wrapping_add(1), Ordering::Release);
+
+        item
+    }
+
+    /// Number of items in the queue (only a hint if the other thread is pushing/popping at the same time)
+    pub fn len(&self) -> usize {
+        self.tail.load(Ordering::Acquire).wrapping_sub(self.head.load(Ordering::Acquire))
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::Arc;
+    use std::thread;
+
+    #[test]
+    fn push_pop_full() {
+        let queue = SpscQueue::new(3);
+
+        for i in 0..4 {
+            assert_eq!(queue.push(i), Ok(()));
+        }
+
+        assert_eq!(queue.push(4), Err(4));
+        assert_eq!(queue.len(), 4);
+
+        for i in 0..4 {
+            assert_eq!(queue.pop(), Some(i));
+        }
+
+        assert_eq!(queue.pop(), None);
+        assert!(queue.is_empty());
+    }
+
+    #[test]
+    fn two_threads() {
+        let queue = Arc::new(SpscQueue::new(16));
+        let producer_queue = queue.clone();
+        let count = 100000;
+
+        let producer = thread::spawn(move || {
+            for i in 0..count {
+                let mut item = vec![i];
+
+                loop {
+                    match producer_queue.push(item) {
+                        Ok(()) => break,
+                        Err(back) => {
+                            item = back;
+                            thread::yield_now();
+                        }
+                    }
+                }
+            }
+        });
+
+        let mut expected = 0;
+
+        while expected < count {
+            match queue.pop() {
+                Some(item) => {
+                    assert_eq!(item, vec![expected]);
+                    expected += 1;
+                }
+                None => thread::yield_now(),
+            }
+        }
+
+        producer.join().unwrap();
+    }
+}
@@ -0,0 +1,567 @@
+use std::collections::{BTreeMap, HashMap};
+use std::fmt::Write;
+use std::os::raw::{c_char, c_void};
+use std::ptr;
+use std::sync::{Arc, Mutex, Once, Weak};
+use std::time::{Duration, Instant};
+use prodbg_api::events::EVENT_REQUEST_SEQUENCE;
+use prodbg_api::session_stats::CSessionStatsFuncs1;
+use capture::Direction;
+
+///! Statistics of what goes between a session and its backend: how many events of each type and how large they are,
+///! how long the backend takes to update and how long remote requests take to get a reply. The stats of all
+///! sessions can be dumped as JSON through the "Session Stats 1" service so plugins (or a user looking at a slow
+///! session) can see which event types dominate.
+///!
+///! Everything is recorded from the finalized streams by only walking the event headers so keeping the stats on all
+///! the time is cheap.
+///!
+
+// PDReadType_Event and PDReadType_U32 (see ReadType in prodbg_api::read_write)
+const READ_TYPE_EVENT: u8 = 14;
+const READ_TYPE_U32: u8 = 6;
+// fields with 32-bit size (Data, Array, HeaderArray and TypedArray). The top bit is PDFieldFlag_Compressed
+const READ_TYPE_DATA: u8 = 13;
+const READ_TYPE_ARRAY: u8 = 15;
+const READ_TYPE_HEADER_ARRAY: u8 = 17;
+const READ_TYPE_TYPED_ARRAY: u8 = 18;
+const FIELD_FLAG_COMPRESSED: u8 = 1 << 7;
+// PDStreamFlag_LittleEndian
+const STREAM_FLAG_LITTLE_ENDIAN: u8 = 1 << 6;
+
+// requests that never gets a reply are forgotten when there are this many waiting
+const MAX_PENDING_REQUESTS: usize = 4096;
+
+// Values below 1 << (SUB_BUCKET_BITS + 1) have their own bucket, above that each power of two is split in
+// 1 << SUB_BUCKET_BITS buckets (so a value is within 25% of the bucket it's counted in)
+const SUB_BUCKET_BITS: u32 = 2;
+const SUB_BUCKETS: u64 = 1 << SUB_BUCKET_BITS;
+const LINEAR_BUCKETS: u64 = SUB_BUCKETS * 2;
+const BUCKET_COUNT: usize = (LINEAR_BUCKETS + (64 - SUB_BUCKET_BITS as u64 - 1) * SUB_BUCKETS) as usize;
+
+#[derive(Clone)]
+pub struct Histogram {
+    buckets: Vec<u64>,
+    count: u64,
+    sum: u64,
+    min: u64,
+    max: u64,
+}
+
+impl Histogram {
+    pub fn new() -> Histogram {
+        Histogram {
+            buckets: Vec::new(),
+            count: 0,
+            sum: 0,
+            min: 0,
+            max: 0,
+        }
+    }
+
+    pub fn record(&mut self, value: u64) {
+        if self.buckets.is_empty() {
+            self.buckets.resize(BUCKET_COUNT, 0);
+            self.min = value;
+        }
+
+        self.buckets[Self::bucket(value)] += 1;
+        self.count += 1;
+        self.sum = self.sum.saturating_add(value);
+        self.min = self.min.min(value);
+        self.max = self.max.max(value);
+    }
+
+    pub fn count(&self) -> u64 {
+        self.count
+    }
+
+    pub fn sum(&self) -> u64 {
+        self.sum
+    }
+
+    pub fn min(&self) -> u64 {
+        self.min
+    }
+
+    pub fn max(&self) -> u64 {
+        self.max
+    }
+
+    /// Returns the value that p (0 - 1) of the recorded values are less or equal to (rounded up to the bucket)
+    pub fn percentile(&self, p: f64) -> u64 {
+        let target = ((p * self.count as f64).ceil() as u64).max(1);
+        let mut total = 0;
+
+        for (index, &count) in self.buckets.iter().enumerate() {
+            total += count;
+
+            if total >= target {
+                return Self::bucket_max(index).min(self.max);
+            }
+        }
+
+        self.max
+    }
+
+    fn bucket(value: u64) -> usize {
+        if value < LINEAR_BUCKETS {
+            return value as usize;
+        }
+
+        let exponent = 63 - value.leading_zeros();
+        let sub = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+
+        (LINEAR_BUCKETS + (exponent - SUB_BUCKET_BITS - 1) as u64 * SUB_BUCKETS + sub) as usize
+    }
+
+    fn bucket_max(index: usize) -> u64 {
+        let index = index as u64;
+
+        if index < LINEAR_BUCKETS {
+            return index;
+        }
+
+        let exponent = (index - LINEAR_BUCKETS) / SUB_BUCKETS + SUB_BUCKET_BITS as u64 + 1;
+        let sub = (index - LINEAR_BUCKETS) % SUB_BUCKETS;
+        let shift = exponent - SUB_BUCKET_BITS as u64;
+
+        ((SUB_BUCKETS + sub) << shift).wrapping_add((1 << shift) - 1)
+    }
+
+    fn write_json(&self, out: &mut String) {
+        let mean = if self.count > 0 { self.sum / self.count } else { 0 };
+
+        let _ = write!(out,
+                       "{{\"count\": {}, \"sum\": {}, \"min\": {}, \"max\": {}, \"mean\": {}, \"p50\": {}, \
+                        \"p90\": {}, \"p99\": {}}}",
+                       self.count,
+                       self.sum,
+                       self.min,
+                       self.max,
+                       mean,
+                       self.percentile(0.5),
+                       self.percentile(0.9),
+                       self.percentile(0.99));
+    }
+}
+
+#[derive(Clone)]
+pub struct EventStats {
+    /// Sizes (in bytes, including the event header) of the events sent to the backend
+    pub to_backend: Histogram,
+    /// Sizes of the events sent by the backend
+    pub from_backend: Histogram,
+    /// Time from a remote request (with this event type) was sent until the reply arrived
+    pub latency_us: Histogram,
+}
+
+impl EventStats {
+    fn new() -> EventStats {
+        EventStats {
+            to_backend: Histogram::new(),
+            from_backend: Histogram::new(),
+            latency_us: Histogram::new(),
+        }
+    }
+}
+
+pub struct SessionStats {
+    session: u64,
+    pub backend_update_us: Histogram,
+    pub events: BTreeMap<u16, EventStats>,
+    pub frames_sent: u64,
+    pub frames_received: u64,
+    /// Frames that couldn't be sent as the remote connection had fallen behind
+    pub frames_dropped: u64,
+    // sequence id -> (time sent, event type of the request)
+    pending: HashMap<u32, (Instant, u16)>,
+}
+
+impl SessionStats {
+    /// Creates the stats for a session. They are included in dump_json for as long as the returned Arc is kept
+    pub fn register(session: u64) -> Arc<Mutex<SessionStats>> {
+        let stats = Arc::new(Mutex::new(SessionStats::new(session)));
+
+        let mut registry = registry().lock().unwrap();
+        registry.retain(|stats| stats.upgrade().is_some());
+        registry.push(Arc::downgrade(&stats));
+
+        stats
+    }
+
+    pub fn new(session: u64) -> SessionStats {
+        SessionStats {
+            session: session,
+            backend_update_us: Histogram::new(),
+            events: BTreeMap::new(),
+            frames_sent: 0,
+            frames_received: 0,
+            frames_dropped: 0,
+            pending: HashMap::new(),
+        }
+    }
+
+    pub fn reset(&mut self) {
+        *self = SessionStats::new(self.session);
+    }
+
+    pub fn record_backend_update(&mut self, time: Duration) {
+        self.backend_update_us.record(duration_us(time));
+    }
+
+    /// Records the events of a finalized stream. Streams to the backend that starts with a request sequence id
+    /// (see remote_requests) are remembered so the latency can be recorded when the reply with the same id arrives.
+    pub fn record_stream(&mut self, direction: Direction, stream: &[u8], now: Instant) {
+        let little_endian = stream.len() >= 4 && stream[0] & STREAM_FLAG_LITTLE_ENDIAN != 0;
+        let mut sequence = None;
+        let mut index = 0;
+
+        match direction {
+            Direction::ToBackend => self.frames_sent += 1,
+            Direction::FromBackend => self.frames_received += 1,
+        }
+
+        for (event_type, event) in StreamEvents::new(stream) {
+            let stats = self.events.entry(event_type).or_insert_with(EventStats::new);
+
+            match direction {
+                Direction::ToBackend => stats.to_backend.record(event.len() as u64),
+                Direction::FromBackend => stats.from_backend.record(event.len() as u64),
+            }
+
+            if index == 0 && event_type as i32 == EVENT_REQUEST_SEQUENCE {
+                sequence = find_u32(event, b"id", little_endian);
+            } else if index == 1 {
+                if let Some(id) = sequence {
+                    if direction == Direction::ToBackend {
+                        if self.pending.len() >= MAX_PENDING_REQUESTS {
+                            self.pending.clear();
+                        }
+
+                        self.pending.insert(id, (now, event_type));
+                    }
+                }
+            }
+
+            index += 1;
+        }
+
+        if direction == Direction::FromBackend {
+            if let Some((sent, event_type)) = sequence.and_then(|id| self.pending.remove(&id)) {
+                let stats = self.events.entry(event_type).or_insert_with(EventStats::new);
+                stats.latency_us.record(duration_us(now.duration_since(sent)));
+            }
+        }
+    }
+
+    /// Forgets the requests waiting for replies (such as when the connection to the target has been lost)
+    pub fn clear_pending(&mut self) {
+        self.pending.clear();
+    }
+
+    pub fn record_dropped(&mut self) {
+        self.frames_dropped += 1;
+    }
+
+    pub fn write_json(&self, out: &mut String) {
+        let _ = write!(out,
+                       "{{\"session\": {}, \"frames_sent\": {}, \"frames_received\": {}, \"frames_dropped\": {}, \
+                        \"backend_update_us\": ",
+                       self.session,
+                       self.frames_sent,
+                       self.frames_received,
+                       self.frames_dropped);
+
+        self.backend_update_us.write_json(out);
+        out.push_str(", \"events\": [");
+
+        for (i, (event_type, stats)) in self.events.iter().enumerate() {
+            if i > 0 {
+                out.push_str(", ");
+            }
+
+            let _ = write!(out, "{{\"type\": {}, \"to_backend_bytes\": ", event_type);
+            stats.to_backend.write_json(out);
+            out.push_str(", \"from_backend_bytes\": ");
+            stats.from_backend.write_json(out);
+            out.push_str(", \"latency_us\": ");
+            stats.latency_us.write_json(out);
+            out.push_str("}");
+        }
+
+        out.push_str("]}");
+    }
+}
+
+/// Returns the stats of all sessions as JSON: { "sessions": [ ... ] }
+pub fn dump_json() -> String {
+    let mut out = String::from("{\"sessions\": [");
+    let registry = registry().lock().unwrap();
+    let mut first = true;
+
+    for stats in registry.iter().filter_map(|stats| stats.upgrade()) {
+        if !first {
+            out.push_str(", ");
+        }
+
+        stats.lock().unwrap().write_json(&mut out);
+        first = false;
+    }
+
+    out.push_str("]}");
+    out
+}
+
+/// Clears the stats of all sessions
+pub fn reset_all() {
+    let registry = registry().lock().unwrap();
+
+    for stats in registry.iter().filter_map(|stats| stats.upgrade()) {
+        stats.lock().unwrap().reset();
+    }
+}
+
+fn registry() -> &'static Mutex<Vec<Weak<Mutex<SessionStats>>>> {
+    static INIT: Once = Once::new();
+    static mut REGISTRY: *const Mutex<Vec<Weak<Mutex<SessionStats>>>> = 0 as *const _;
+
+    unsafe {
+        INIT.call_once(|| REGISTRY = Box::into_raw(Box::new(Mutex::new(Vec::new()))));
+        &*REGISTRY
+    }
+}
+
+fn duration_us(time: Duration) -> u64 {
+    time.as_secs() * 1000000 + (time.subsec_nanos() / 1000) as u64
+}
+
+/// Iterates over the events in a finalized stream (type and the event data including the header)
+pub struct StreamEvents<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> StreamEvents<'a> {
+    pub fn new(stream: &'a [u8]) -> StreamEvents<'a> {
+        let size = if stream.len() >= 4 {
+            (((stream[0] & 0x3f) as usize) << 24) | ((stream[1] as usize) << 16) | ((stream[2] as usize) << 8) |
+            stream[3] as usize
+        } else {
+            0
+        };
+
+        StreamEvents {
+            data: &stream[..size.min(stream.len())],
+            pos: 4,
+        }
+    }
+}
+
+impl<'a> Iterator for StreamEvents<'a> {
+    type Item = (u16, &'a [u8]);
+
+    fn next(&mut self) -> Option<(u16, &'a [u8])> {
+        // zeros between the events are padding (same as the reader)
+
+        while self.pos < self.data.len() && self.data[self.pos] == 0 {
+            self.pos += 1;
+        }
+
+        let data = &self.data[self.pos.min(self.data.len())..];
+
+        if data.len() < 7 || data[0] != READ_TYPE_EVENT {
+            return None;
+        }
+
+        let size = get_u32(&data[3..]) as usize;
+
+        if size < 7 || size > data.len() {
+            return None;
+        }
+
+        self.pos += size;
+
+        Some((((data[1] as u16) << 8) | data[2] as u16, &data[..size]))
+    }
+}
+
+fn get_u32(data: &[u8]) -> u32 {
+    ((data[0] as u32) << 24) | ((data[1] as u32) << 16) | ((data[2] as u32) << 8) | data[3] as u32
+}
+
+// Finds a u32 field directly in an event (not inside arrays)
+fn find_u32(event: &[u8], id: &[u8], little_endian: bool) -> Option<u32> {
+    let mut pos = 7;
+
+    while pos + 3 < event.len() {
+        let field_type = event[pos] & !FIELD_FLAG_COMPRESSED;
+        let (size, id_start) = match field_type {
+            READ_TYPE_DATA | READ_TYPE_ARRAY | READ_TYPE_HEADER_ARRAY | READ_TYPE_TYPED_ARRAY => {
+                if pos + 5 > event.len() {
+                    return None;
+                }
+                (get_u32(&event[pos + 1..]) as usize, pos + 5)
+            }
+            _ => ((((event[pos + 1] as usize) << 8) | event[pos + 2] as usize), pos + 3),
+        };
+
+        if size == 0 || pos + size > event.len() {
+            return None;
+        }
+
+        let field = &event[id_start..pos + size];
+
+        if field_type == READ_TYPE_U32 && size >= 4 && field.starts_with(id) && field.get(id.len()) == Some(&0) {
+            let v = &event[pos + size - 4..pos + size];
+            let value = get_u32(v);
+            return Some(if little_endian { value.swap_bytes() } else { value });
+        }
+
+        pos += size;
+    }
+
+    None
+}
+
+extern "C" fn dump_json_c(dest: *mut c_char, size: u32) -> u32 {
+    let json = dump_json();
+
+    if !dest.is_null() && size > 0 {
+        let count = json.len().min(size as usize - 1);
+
+        unsafe {
+            ptr::copy_nonoverlapping(json.as_ptr() as *const c_char, dest, count);
+            *dest.offset(count as isize) = 0;
+        }
+    }
+
+    json.len() as u32
+}
+
+extern "C" fn reset_c() {
+    reset_all();
+}
+
+static SESSION_STATS_FUNCS: CSessionStatsFuncs1 = CSessionStatsFuncs1 {
+    dump_json: dump_json_c,
+    reset: reset_c,
+};
+
+pub fn get_session_stats_funcs() -> *mut c_void {
+    &SESSION_STATS_FUNCS as *const CSessionStatsFuncs1 as *mut c_void
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use prodbg_api::events::*;
+    use reader_wrapper::WriterWrapper;
+    use remote_requests;
+
+    #[test]
+    fn histogram_buckets() {
+        for value in 0..100000u64 {
+            let bucket = Histogram::bucket(value);
+            assert!(Histogram::bucket_max(bucket) >= value);
+            assert!(bucket == 0 || Histogram::bucket_max(bucket - 1) < value);
+        }
+
+        assert_eq!(Histogram::bucket(u64::max_value()), BUCKET_COUNT - 1);
+        assert_eq!(Histogram::bucket_max(BUCKET_COUNT - 1), u64::max_value());
+    }
+
+    #[test]
+    fn histogram_percentiles() {
+        let mut histogram = Histogram::new();
+
+        assert_eq!(histogram.percentile(0.5), 0);
+
+        for value in 1..101 {
+            histogram.record(value);
+        }
+
+        assert_eq!(histogram.count(), 100);
+        assert_eq!(histogram.sum(), 5050);
+        assert_eq!(histogram.min(), 1);
+        assert_eq!(histogram.max(), 100);
+
+        // within the bucket size (25%)
+        let p50 = histogram.percentile(0.5);
+        assert!(p50 >= 50 && p50 <= 63);
+        assert_eq!(histogram.percentile(1.0), 100);
+    }
+
+    fn write_request(id: Option<u32>, event: i32, size: u32) -> Vec<u8> {
+        let mut writer = WriterWrapper::create_writer();
+
+        if let Some(id) = id {
+            remote_requests::write_sequence(&mut writer, id);
+        }
+
+        writer.event_begin(event as u16);
+        writer.write_u32("size", size);
+        writer.event_end();
+
+        let stream = WriterWrapper::get_stream(&writer).to_vec();
+        WriterWrapper::destroy_writer(writer);
+        stream
+    }
+
+    #[test]
+    fn event_sizes_and_latency() {
+        let mut stats = SessionStats::new(0);
+        let start = Instant::now();
+
+        stats.record_stream(Direction::ToBackend, &write_request(Some(7), EVENT_GET_MEMORY, 256), start);
+        stats.record_stream(Direction::ToBackend, &write_request(None, EVENT_GET_REGISTERS, 0), start);
+        stats.record_stream(Direction::FromBackend,
+                            &write_request(Some(7), EVENT_SET_MEMORY, 0),
+                            start + Duration::from_millis(3));
+
+        // a reply that nothing is waiting for
+        stats.record_stream(Direction::FromBackend, &write_request(Some(8), EVENT_SET_MEMORY, 0), start);
+
+        assert_eq!(stats.frames_sent, 2);
+        assert_eq!(stats.frames_received, 2);
+
+        let memory = &stats.events[&(EVENT_GET_MEMORY as u16)];
+        assert_eq!(memory.to_backend.count(), 1);
+        assert_eq!(memory.latency_us.count(), 1);
+        assert_eq!(memory.latency_us.min(), 3000);
+
+        assert_eq!(stats.events[&(EVENT_REQUEST_SEQUENCE as u16)].to_backend.count(), 1);
+        assert_eq!(stats.events[&(EVENT_REQUEST_SEQUENCE as u16)].from_backend.count(), 2);
+        assert_eq!(stats.events[&(EVENT_GET_REGISTERS as u16)].latency_us.count(), 0);
+        assert_eq!(stats.events[&(EVENT_SET_MEMORY as u16)].from_backend.count(), 2);
+        assert!(stats.pending.is_empty());
+    }
+
+    #[test]
+    fn json() {
+        let stats = SessionStats::register(1234);
+
+        stats.lock().unwrap().record_stream(Direction::ToBackend,
+                                            &write_request(None, EVENT_GET_MEMORY, 0),
+                                            Instant::now());
+        stats.lock().unwrap().record_backend_update(Duration::from_millis(1));
+
+        let json = dump_json();
+        assert!(json.starts_with("{\"sessions\": ["));
+        assert!(json.contains("\"session\": 1234"));
+        assert!(json.contains(&format!("\"type\": {}, \"to_backend_bytes\": {{\"count\": 1", EVENT_GET_MEMORY)));
+        assert!(json.contains("\"backend_update_us\": {\"count\": 1, \"sum\": 1000"));
+
+        // the C service returns the full size and truncates to the buffer
+        let mut buffer = [0 as c_char; 16];
+        let size = dump_json_c(buffer.as_mut_ptr(), 16) as usize;
+        assert!(size >= json.len());
+        assert_eq!(buffer[15], 0);
+
+        reset_all();
+        assert_eq!(stats.lock().unwrap().frames_sent, 0);
+
+        drop(stats);
+        assert!(!dump_json().contains("\"session\": 1234"));
+    }
+}
@@ -0,0 +1,264 @@
+use std::collections::VecDeque;
+use std::mem;
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::{Arc, Condvar, Mutex};
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::thread::{self, JoinHandle};
+use num_cpus;
+
+///! Small work-stealing thread pool used to update the sessions in parallel (see Sessions::update).
+///!
+///! for_each gives each item to a job and spreads the jobs over one queue per thread. Threads take jobs from the front
+///! of their own queue and steal from the back of the others when it's empty so a slow item doesn't hold up the
+///! ones queued after it. The calling thread runs jobs as well and for_each returns when all of them are done which
+///! is why the jobs can borrow the items.
+///!
+pub struct ThreadPool {
+    shared: Arc<Shared>,
+    threads: Vec<JoinHandle<()>>,
+}
+
+type Job = Box<FnMut() + Send>;
+
+struct Shared {
+    // one queue per worker thread and the last one for the thread calling for_each
+    queues: Vec<Mutex<VecDeque<Job>>>,
+    // jobs in the queues
+    queued: AtomicUsize,
+    // jobs that hasn't finished
+    remaining: AtomicUsize,
+    panicked: AtomicBool,
+    // set when the pool is dropped. Held when waiting for (or signaling) the condition variables
+    stop: Mutex<bool>,
+    work_ready: Condvar,
+    work_done: Condvar,
+}
+
+impl ThreadPool {
+    /// Creates a pool where thread_count threads (including the one calling for_each) runs the jobs. With a count
+    /// of 1 (or 0) everything is run directly on the calling thread.
+    pub fn new(thread_count: usize) -> ThreadPool {
+        let worker_count = thread_count.max(1) - 1;
+
+        let shared = Arc::new(Shared {
+            queues: (0..worker_count + 1).map(|_| Mutex::new(VecDeque::new())).collect(),
+            queued: AtomicUsize::new(0),
+            remaining: AtomicUsize::new(0),
+            panicked: AtomicBool::new(false),
+            stop: Mutex::new(false),
+            work_ready: Condvar::new(),
+            work_done: Condvar::new(),
+        });
+
+        let threads = (0..worker_count)
+            .filter_map(|index| {
+                let shared = shared.clone();
+
+                thread::Builder::new()
+                    .name(format!("worker {}", index))
+                    .spawn(move || shared.run_worker(index))
+                    .ok()
+            })
+            .collect();
+
+        ThreadPool {
+            shared: shared,
+            threads: threads,
+        }
+    }
+
+    /// Creates a pool with one thread per core
+    pub fn with_cpu_count() -> ThreadPool {
+        Self::new(num_cpus::get())
+    }
+
+    /// Number of threads (including the calling one) that runs the jobs
+    pub fn thread_count(&self) -> usize {
+        self.threads.len() + 1
+    }
+
+    /// Calls func for each item (in parallel) and returns when all calls are done. If a call panics the other items
+    /// are still updated and the panic is raised here after that.
+    pub fn for_each<T, F>(&mut self, items: &mut [T], func: F)
+        where T: Send,
+              F: Fn(&mut T) + Sync
+    {
+        if self.threads.is_empty() || items.len() < 2 {
+            for item in items {
+                func(item);
+            }
+
+            return;
+        }
+
+        let shared = &*self.shared;
+        let func = &func;
+        let count = items.len();
+
+        shared.remaining.store(count, Ordering::SeqCst);
+
+        for (index, item) in items.iter_mut().enumerate() {
+            let job: Box<FnMut() + Send> = Box::new(move || func(item));
+
+            // for_each waits for all jobs to finish so the borrows outlive them
+            let job: Job = unsafe { mem::transmute(job) };
+
+            shared.queues[index % shared.queues.len()].lock().unwrap().push_back(job);
+        }
+
+        shared.queued.fetch_add(count, Ordering::SeqCst);
+
+        {
+            let _stop = shared.stop.lock().unwrap();
+            shared.work_ready.notify_all();
+        }
+
+        let own_queue = shared.queues.len() - 1;
+
+        while let Some(job) = shared.find_job(own_queue) {
+            shared.run_job(job);
+        }
+
+        {
+            let mut stop = shared.stop.lock().unwrap();
+
+            while shared.remaining.load(Ordering::SeqCst) != 0 {
+                stop = shared.work_done.wait(stop).unwrap();
+            }
+        }
+
+        if shared.panicked.swap(false, Ordering::SeqCst) {
+            panic!("thread pool job panicked");
+        }
+    }
+}
+
+impl Shared {
+    fn run_worker(&self, index: usize) {
+        loop {
+            if let Some(job) = self.find_job(index) {
+                self.run_job(job);
+                continue;
+            }
+
+            let stop = self.stop.lock().unwrap();
+
+            if *stop {
+                break;
+            }
+
+            if self.queued.load(Ordering::SeqCst) == 0 {
+                let _stop = self.work_ready.wait(stop).unwrap();
+            }
+        }
+    }
+
+    // Takes a job from the front of the own queue or steals one from the back of another
+    fn find_job(&self, index: usize) -> Option<Job> {
+        if self.queued.load(Ordering::SeqCst) == 0 {
+            return None;
+        }
+
+        let count = self.queues.len();
+
+        for i in 0..count {
+            let mut queue = self.queues[(index + i) % count].lock().unwrap();
+            let job = if i == 0 { queue.pop_front() } else { queue.pop_back() };
+
+            if job.is_some() {
+                self.queued.fetch_sub(1, Ordering::SeqCst);
+                return job;
+            }
+        }
+
+        None
+    }
+
+    fn run_job(&self, mut job: Job) {
+        if panic::catch_unwind(AssertUnwindSafe(|| job())).is_err() {
+            self.panicked.store(true, Ordering::SeqCst);
+        }
+
+        drop(job);
+
+        if self.remaining.fetch_sub(1, Ordering::SeqCst) == 1 {
+            let _stop = self.stop.lock().unwrap();
+            self.work_done.notify_all();
+        }
+    }
+}
+
+impl Drop for ThreadPool {
+    fn drop(&mut self) {
+        {
+            let mut stop = self.shared.stop.lock().unwrap();
+            *stop = true;
+            self.shared.work_ready.notify_all();
+        }
+
+        for thread in self.threads.drain(..) {
+            let _ = thread.join();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::time::Duration;
+
+    #[test]
+    fn for_each() {
+        let mut pool = ThreadPool::new(4);
+        let mut items = (0..1000).collect::<Vec<u64>>();
+
+        for _ in 0..10 {
+            pool.for_each(&mut items, |item| *item += 1);
+        }
+
+        assert_eq!(items, (10..1010).collect::<Vec<u64>>());
+    }
+
+    #[test]
+    fn runs_in_parallel() {
+        let mut pool = ThreadPool::new(4);
+        let mut items = vec![0; 4];
+        let running = AtomicUsize::new(0);
+        let max_running = Mutex::new(0);
+
+        pool.for_each(&mut items, |_| {
+            let count = running.fetch_add(1, Ordering::SeqCst) + 1;
+            {
+                let mut max_running = max_running.lock().unwrap();
+                *max_running = count.max(*max_running);
+            }
+            thread::sleep(Duration::from_millis(50));
+            running.fetch_sub(1, Ordering::SeqCst);
+        });
+
+        assert!(*max_running.lock().unwrap() > 1);
+    }
+
+    #[test]
+    fn panic_after_all_items() {
+        let mut pool = ThreadPool::new(3);
+        let mut items = (0..16).collect::<Vec<u32>>();
+
+        let result = panic::catch_unwind(AssertUnwindSafe(|| {
+            pool.for_each(&mut items, |item| {
+                if *item == 3 {
+                    panic!("item 3");
+                }
+
+                *item = 100;
+            });
+        }));
+
+        assert!(result.is_err());
+        assert_eq!(items.iter().filter(|&&item| item == 100).count(), 15);
+
+        // the pool can still be used
+        pool.for_each(&mut items, |item| *item = 0);
+        assert!(items.iter().all(|&item| item == 0));
+    }
+}
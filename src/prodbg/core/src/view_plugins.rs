@@ -8,6 +8,7 @@ use std::os::raw::{c_void};
 use prodbg_api::ui::Ui;
 use services;
 use plugin_io;
+use slot_map::SlotMap;
 
 #[derive(PartialEq, Eq, Clone, Copy, Debug)]
 pub struct ViewHandle(pub u64);
@@ -31,13 +32,14 @@ struct ReloadState {
     ui: Ui,
     handle: ViewHandle,
     session_handle: SessionHandle,
+    // written by save_state before the plugin was unloaded
+    plugin_data: Option<Vec<String>>,
 }
 
 pub struct ViewPlugins {
-    pub instances: Vec<ViewInstance>,
+    pub instances: SlotMap<ViewInstance>,
     plugin_types: Vec<Rc<Plugin>>,
     reload_state: Vec<ReloadState>,
-    handle_counter: ViewHandle,
 }
 
 impl PluginHandler for ViewPlugins {
@@ -52,20 +54,25 @@ impl PluginHandler for ViewPlugins {
 
     fn unload_plugin(&mut self, lib: &Rc<Lib>) {
         self.reload_state.clear();
-        for i in (0..self.instances.len()).rev() {
-            if &self.instances[i].plugin_type.lib == lib {
+        for instance in self.instances.iter() {
+            if &instance.plugin_type.lib == lib {
                 let state = ReloadState {
-                    ui: self.instances[i].ui.clone(),
-                    name: self.instances[i].plugin_type.name.clone(),
-                    handle: self.instances[i].handle,
-                    session_handle: self.instances[i].session_handle,
+                    ui: instance.ui.clone(),
+                    name: instance.plugin_type.name.clone(),
+                    handle: instance.handle,
+                    session_handle: instance.session_handle,
+                    plugin_data: instance.get_plugin_data().1,
                 };
 
                 self.reload_state.push(state);
-                self.instances.swap_remove(i);
+
+                // the code of the instance goes away with the lib
+                instance.destroy();
             }
         }
 
+        self.instances.retain(|instance| &instance.plugin_type.lib != lib);
+
         for i in (0..self.plugin_types.len()).rev() {
             if &self.plugin_types[i].lib == lib {
                 self.plugin_types.swap_remove(i);
@@ -79,7 +86,7 @@ impl PluginHandler for ViewPlugins {
             self.create_instance_with_handle(
                                   reload_plugin.ui.clone(),
                                   &reload_plugin.name,
-                                  &None, // TODO: Include saved data here
+                                  &reload_plugin.plugin_data,
                                   reload_plugin.session_handle,
                                   reload_plugin.handle);
         }
@@ -93,21 +100,14 @@ impl PluginHandler for ViewPlugins {
 impl ViewPlugins {
     pub fn new() -> ViewPlugins {
         ViewPlugins {
-            instances: Vec::new(),
+            instances: SlotMap::new(),
             plugin_types: Vec::new(),
             reload_state: Vec::new(),
-            handle_counter: ViewHandle(0),
         }
     }
 
     pub fn get_view(&mut self, view_handle: ViewHandle) -> Option<&mut ViewInstance> {
-        for i in 0..self.instances.len() {
-            if self.instances[i].handle == view_handle {
-                return Some(&mut self.instances[i]);
-            }
-        }
-
-        None
+        self.instances.get_mut(view_handle.0)
     }
 
     pub fn create_instance_from_index(&mut self,
@@ -116,25 +116,17 @@ impl ViewPlugins {
                                       session_handle: SessionHandle,
                                       view_handle: Option<ViewHandle>)
                                       -> Option<ViewHandle> {
+        let handle = view_handle.unwrap_or(ViewHandle(self.instances.next_key()));
+
+        if self.instances.contains_key(handle.0) {
+            return None;
+        }
+
         let plugin_data = unsafe {
             let callbacks = self.plugin_types[index].plugin_funcs as *mut CViewCallbacks;
             (*callbacks).create_instance.unwrap()(ui.api as *mut c_void, services::get_services)
         };
 
-        let handle = match view_handle {
-            Some(h) => {
-                if h.0 >= self.handle_counter.0 {
-                    self.handle_counter.0 = h.0 + 1
-                }
-                h
-            },
-            _ => {
-                let counter = self.handle_counter;
-                self.handle_counter.0 += 1;
-                counter
-            }
-        };
-
         let instance = ViewInstance {
             plugin_data: plugin_data,
             name: format!("Plugin {}", handle.0),
@@ -148,9 +140,10 @@ impl ViewPlugins {
             plugin_type: self.plugin_types[index].clone(),
         };
 
-        self.instances.push(instance);
-
-        Some(handle)
+        match self.instances.insert_at(handle.0, instance) {
+            Ok(()) => Some(handle),
+            Err(_) => None,
+        }
     }
 
     pub fn create_instance(&mut self,
@@ -196,12 +189,7 @@ impl ViewPlugins {
     }
 
     pub fn destroy_instance(&mut self, handle: ViewHandle) {
-        for i in (0..self.instances.len()).rev() {
-            if self.instances[i].handle.0 == handle.0 {
-                self.instances.swap_remove(i);
-                return;
-            }
-        }
+        self.instances.remove(handle.0);
     }
 
     // TODO: Would be nice to use something stack-base instead or return an iterator to interate
@@ -223,9 +211,7 @@ impl ViewInstance {
         unsafe {
             let callbacks = self.plugin_type.plugin_funcs as *mut CViewCallbacks;
             if let Some(save_state) = (*callbacks).save_state {
-                let mut writer_funcs = plugin_io::get_writer_funcs();
-                save_state(self.plugin_data, &mut writer_funcs);
-                plugin_data = Some(plugin_io::get_data(&mut writer_funcs));
+                plugin_data = Some(plugin_io::save_state(save_state, self.plugin_data));
             }
         };
         (self.plugin_type.name.clone(), plugin_data)
@@ -235,8 +221,16 @@ impl ViewInstance {
         unsafe {
             let callbacks = self.plugin_type.plugin_funcs as *mut CViewCallbacks;
             if let Some(load_state) = (*callbacks).load_state {
-                let mut loader_funcs = plugin_io::get_loader_funcs(data);
-                load_state(self.plugin_data, &mut loader_funcs);
+                plugin_io::load_state(load_state, self.plugin_data, data);
+            }
+        }
+    }
+
+    fn destroy(&self) {
+        unsafe {
+            let callbacks = self.plugin_type.plugin_funcs as *mut CViewCallbacks;
+            if let Some(destroy_instance) = (*callbacks).destroy_instance {
+                destroy_instance(self.plugin_data);
             }
         }
     }
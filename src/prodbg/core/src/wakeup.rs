@@ -0,0 +1,83 @@
+use std::sync::{Arc, Condvar, Mutex};
+use std::time::{Duration, Instant};
+
+///! Lets the main loop sleep until something happens. Threads that produce data for the UI (backend threads and
+///! remote connections) call notify when they have queued something and the main loop waits for that (or a timeout
+///! as window input and plugin reloads can only be polled).
+///!
+///! Clones share the same state.
+///!
+#[derive(Clone)]
+pub struct Wakeup {
+    shared: Arc<(Mutex<bool>, Condvar)>,
+}
+
+impl Wakeup {
+    pub fn new() -> Wakeup {
+        Wakeup { shared: Arc::new((Mutex::new(false), Condvar::new())) }
+    }
+
+    /// Wakes the waiting thread (or makes the next wait return directly)
+    pub fn notify(&self) {
+        let &(ref notified, ref cond) = &*self.shared;
+        *notified.lock().unwrap() = true;
+        cond.notify_one();
+    }
+
+    /// Waits until notify has been called (since the last wait) or the timeout has passed. Returns true if notified.
+    pub fn wait(&self, timeout: Duration) -> bool {
+        let &(ref notified, ref cond) = &*self.shared;
+        let end = Instant::now() + timeout;
+        let mut guard = notified.lock().unwrap();
+
+        while !*guard {
+            let now = Instant::now();
+
+            if now >= end {
+                return false;
+            }
+
+            guard = cond.wait_timeout(guard, end - now).unwrap().0;
+        }
+
+        *guard = false;
+        true
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::thread;
+
+    #[test]
+    fn notify_before_wait() {
+        let wakeup = Wakeup::new();
+
+        wakeup.notify();
+        wakeup.notify();
+
+        assert!(wakeup.wait(Duration::from_millis(0)));
+        assert!(!wakeup.wait(Duration::from_millis(10)));
+    }
+
+    #[test]
+    fn notify_from_thread() {
+        let wakeup = Wakeup::new();
+        let start = Instant::now();
+
+        let thread = {
+            let wakeup = wakeup.clone();
+
+            thread::spawn(move || {
+                thread::sleep(Duration::from_millis(20));
+                wakeup.notify();
+            })
+        };
+
+        assert!(wakeup.wait(Duration::from_secs(10)));
+        assert!(start.elapsed() < Duration::from_secs(5));
+
+        thread.join().unwrap();
+    }
+}
@@ -19,10 +19,17 @@ use core::view_plugins::{ViewPlugins};
 use core::backend_plugin::{BackendPlugins};
 use std::cell::RefCell;
 use std::rc::Rc;
-use std::time::Duration;
+use std::thread;
+use std::time::{Duration, Instant};
 
 use core::plugins::*;
 
+// min time between two rendered frames
+const FRAME_TIME_MS: u64 = 5;
+// Window input and plugin reloads can only be polled. This is how often that is done when there is nothing to show.
+// Backends wake the loop directly.
+const POLL_MS: u64 = 5;
+
 fn main() {
     let mut sessions = Sessions::new();
     let mut windows = Windows::new();
@@ -55,19 +62,42 @@ fn main() {
     windows.create_default(&settings);
     windows.load("data/user_layout.json", &mut view_plugins.borrow_mut());
 
+    let wakeup = sessions.get_wakeup().clone();
+    let mut first_frame = true;
+
     loop {
-        plugins.update(&mut lib_handler);
+        let frame_start = Instant::now();
+        let reloaded = plugins.update(&mut lib_handler);
+
         sessions.update(&mut backend_plugins.borrow_mut());
-        windows.update(&mut sessions,
-                       &mut view_plugins.borrow_mut(),
-                       &mut backend_plugins.borrow_mut());
+
+        // Only update (and render) the windows when something can have changed what they show
+
+        let input = windows.poll_input();
+        let rendered = first_frame || input || reloaded || sessions.has_new_events();
+
+        if rendered {
+            windows.update(&mut sessions,
+                           &mut view_plugins.borrow_mut(),
+                           &mut backend_plugins.borrow_mut());
+
+            first_frame = false;
+        }
 
         if windows.should_exit() {
             break;
         }
 
-        // TODO: Proper config and sleep timings
-        std::thread::sleep(Duration::from_millis(5));
+        if rendered {
+            let frame_time = Duration::from_millis(FRAME_TIME_MS);
+            let elapsed = frame_start.elapsed();
+
+            if elapsed < frame_time {
+                thread::sleep(frame_time - elapsed);
+            }
+        } else {
+            wakeup.wait(Duration::from_millis(POLL_MS));
+        }
     }
 
     //windows.save("data/user_layout.json", &mut view_plugins.borrow_mut());
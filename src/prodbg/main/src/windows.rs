@@ -54,6 +54,14 @@ impl MouseState {
     }
 }
 
+/// What the input looked like when it was last polled (see Window::poll_input)
+#[derive(PartialEq)]
+struct InputState {
+    mouse: (f32, f32),
+    buttons: (bool, bool, bool),
+    size: (usize, usize),
+}
+
 pub struct Window {
     /// minifb window
     pub win: minifb::Window,
@@ -74,6 +82,10 @@ pub struct Window {
     pub context_menu_data: Option<(DockHandle, (f32, f32))>,
 
     pub statusbar: Statusbar,
+
+    input: Option<InputState>,
+    // menu selected since the last update
+    pressed_menu: Option<usize>,
 }
 
 struct WindowState {
@@ -154,6 +166,8 @@ impl Windows {
             overlay: None,
             context_menu_data: None,
             statusbar: Statusbar::new(),
+            input: None,
+            pressed_menu: None,
         });
     }
 
@@ -174,6 +188,18 @@ impl Windows {
         Ok(window)
     }
 
+    /// Processes the input of all windows. Returns true if anything has changed (and the windows should be
+    /// updated) since the last poll.
+    pub fn poll_input(&mut self) -> bool {
+        let mut changed = false;
+
+        for win in &mut self.windows {
+            changed |= win.poll_input();
+        }
+
+        changed
+    }
+
     pub fn update(&mut self,
                   sessions: &mut Sessions,
                   view_plugins: &mut ViewPlugins,
@@ -335,11 +361,19 @@ impl Window {
                 }
             }
 
-            // Make sure we move the cursor to the start of the stream here
+            // Make sure we move the cursor to the start of the stream here. The events of the frame are only decoded
+            // once by the reader so this just rewinds it (and filters the events the view doesn't care about)
             ReaderWrapper::reset_reader(&mut session.reader);
 
             unsafe {
                 let plugin_funcs = instance.plugin_type.plugin_funcs as *mut CViewCallbacks;
+                let event_mask = match (*plugin_funcs).event_mask {
+                    Some(event_mask) => event_mask(instance.plugin_data),
+                    None => events::EVENT_MASK_ALL,
+                };
+
+                ReaderWrapper::set_event_mask(&mut session.reader, event_mask);
+
                 ((*plugin_funcs).update.unwrap())(instance.plugin_data,
                                                   ui.api as *mut c_void,
                                                   session.reader.api as *mut c_void,
@@ -551,7 +585,7 @@ impl Window {
                     backend_plugins: &mut BackendPlugins) {
         let current_session = sessions.get_current();
 
-        let menu_id = match Self::is_menu_pressed(&mut self.win) {
+        let menu_id = match self.pressed_menu.take() {
             Some(id) => id,
             None => return,
         };
@@ -578,6 +612,35 @@ impl Window {
         }
     }
 
+    /// Updates the minifb window and returns true if the input (or size) has changed since the last poll or if a
+    /// key or menu has been pressed
+    pub fn poll_input(&mut self) -> bool {
+        self.win.update();
+
+        let input = InputState {
+            mouse: self.win.get_mouse_pos(MouseMode::Clamp).unwrap_or((0.0, 0.0)),
+            buttons: (self.win.get_mouse_down(MouseButton::Left),
+                      self.win.get_mouse_down(MouseButton::Middle),
+                      self.win.get_mouse_down(MouseButton::Right)),
+            size: self.win.get_size(),
+        };
+
+        if self.pressed_menu.is_none() {
+            self.pressed_menu = Self::is_menu_pressed(&mut self.win);
+        }
+
+        // keys that are held down are repeated so they count as a change
+
+        let keys_down = self.win.get_keys().map_or(false, |keys| !keys.is_empty());
+
+        let changed = self.input.as_ref() != Some(&input) || keys_down || self.pressed_menu.is_some() ||
+                      self.win.get_scroll_wheel().is_some() || !self.win.is_open();
+
+        self.input = Some(input);
+
+        changed
+    }
+
     pub fn pre_update(&mut self) {
         let mouse = self.win.get_mouse_pos(MouseMode::Clamp).unwrap_or((0.0, 0.0));
         Imgui::set_mouse_pos(mouse);
@@ -603,7 +666,6 @@ impl Window {
             self.update_mouse_state(mouse);
         }
 
-        self.win.update();
         self.ws.update_rect(Rect::new(0.0, 0.0, win_size.0 as f32, win_size.1 as f32));
         self.update_key_state();
 
@@ -3,9 +3,12 @@
 #include <setjmp.h>
 #include <cmocka.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <pd_readwrite.h>
 #include <pd_backend.h> // For eventTypes
 #include "api/src/remote/pd_readwrite_private.h"
+#include "api/src/remote/pd_byte_swap.h"
 #include "core/log.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -128,6 +131,74 @@ void testWriteSingleString(void**) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+void testStringLength(void**) {
+    static const char* ids[] = { "name", 0 };
+    const char* res;
+    uint32_t length;
+    PDReaderIterator it, nameIt;
+    uint32_t rowCount;
+    int isUtf8;
+
+    PDBinaryWriter_reset(writer);
+
+    assert_true(PDWrite_event_begin(writer, 2) == PDWriteStatus_ok);
+    assert_true(PDWrite_string(writer, "ascii", "my_string") == PDWriteStatus_ok);
+    assert_true(PDWrite_string(writer, "latin1", "caf\xe9") == PDWriteStatus_ok);
+    assert_true(PDWrite_string(writer, "empty", "") == PDWriteStatus_ok);
+    assert_true(PDWrite_string_len(writer, "part", "part of a string", 4) == PDWriteStatus_ok);
+
+    assert_true(PDWrite_header_array_begin(writer, "table", ids) == PDWriteStatus_ok);
+    assert_true(PDWrite_string(writer, 0, "first") == PDWriteStatus_ok);
+    assert_true(PDWrite_string_len(writer, 0, "second row", 6) == PDWriteStatus_ok);
+    assert_true(PDWrite_header_array_end(writer) == PDWriteStatus_ok);
+
+    assert_true(PDWrite_event_end(writer) == PDWriteStatus_ok);
+
+    PDBinaryWriter_finalize(writer);
+
+    // the UTF-8 flag is only reported when the stream is known to come from this process
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+    assert_true(PDRead_get_event(reader) == 2);
+
+    assert_true(PDRead_find_string_len(reader, &res, &length, &isUtf8, "ascii", 0) == (PDReadStatus_Ok | PDReadType_String));
+    assert_true(length == 9 && !isUtf8 && !strcmp(res, "my_string"));
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+    pd_binary_reader_set_trust_utf8(reader, 1);
+    assert_true(PDRead_get_event(reader) == 2);
+
+    assert_true(PDRead_find_string_len(reader, &res, &length, &isUtf8, "ascii", 0) == (PDReadStatus_Ok | PDReadType_String));
+    assert_true(length == 9 && isUtf8 && !strcmp(res, "my_string"));
+
+    // not known to be UTF-8 as it's not plain ASCII and written without a length
+
+    assert_true(PDRead_find_string_len(reader, &res, &length, &isUtf8, "latin1", 0) == (PDReadStatus_Ok | PDReadType_String));
+    assert_true(length == 4 && !isUtf8 && !strcmp(res, "caf\xe9"));
+
+    assert_true(PDRead_find_string_len(reader, &res, &length, &isUtf8, "empty", 0) == (PDReadStatus_Ok | PDReadType_String));
+    assert_true(length == 0 && res[0] == 0);
+
+    // null terminator is always added
+
+    assert_true(PDRead_find_string(reader, &res, "part", 0) == (PDReadStatus_Ok | PDReadType_String));
+    assert_true(!strcmp(res, "part"));
+
+    assert_true(PDRead_find_string_len(reader, &res, &length, &isUtf8, "nope", 0) == PDReadStatus_NotFound);
+
+    assert_true(PDRead_find_header_array(reader, &it, &rowCount, "table", 0) == (PDReadStatus_Ok | PDReadType_HeaderArray));
+    assert_true(rowCount == 2);
+    assert_true(PDRead_header_array_column(reader, &nameIt, "name", it) == (PDReadStatus_Ok | PDReadType_String));
+
+    assert_true(PDRead_column_string_len(reader, &res, &length, &isUtf8, nameIt, 0) == (PDReadStatus_Ok | PDReadType_String));
+    assert_true(length == 5 && isUtf8 && !strcmp(res, "first"));
+
+    assert_true(PDRead_column_string_len(reader, &res, &length, &isUtf8, nameIt, 1) == (PDReadStatus_Ok | PDReadType_String));
+    assert_true(length == 6 && isUtf8 && !strcmp(res, "second"));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 /*
    static void testReadSingleString(void**)
    {
@@ -286,13 +357,573 @@ void testAllValueTypes(void**) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+void testDataReserve(void**) {
+    uint8_t* dest;
+    void* data;
+    uint64_t size;
+    uint32_t value;
+
+    PDBinaryWriter_reset(writer);
+
+    assert_true(PDWrite_data_commit(writer, 0) == PDWriteStatus_Fail); // no reserve
+
+    PDWrite_event_begin(writer, PDEventType_SetMemory);
+
+    // reserve more than used, the unused part should be dropped at commit
+
+    assert_true((dest = PDWrite_data_reserve(writer, "data", 256)) != 0);
+    assert_true(PDWrite_data_reserve(writer, "data2", 16) == 0); // must commit first
+
+    for (int i = 0; i < 100; ++i)
+        dest[i] = (uint8_t)i;
+
+    assert_true(PDWrite_event_end(writer) == PDWriteStatus_Fail); // must commit first
+    assert_true(PDWrite_data_commit(writer, 100) == PDWriteStatus_ok);
+
+    // writing something before commit keeps the whole reserved size but fails
+
+    assert_true((dest = PDWrite_data_reserve(writer, "data2", 8)) != 0);
+    memset(dest, 0xff, 8);
+    assert_true(PDWrite_u32(writer, "value", 1234) == PDWriteStatus_ok);
+    assert_true(PDWrite_data_commit(writer, 4) == PDWriteStatus_Fail);
+
+    assert_true(PDWrite_event_end(writer) == PDWriteStatus_ok);
+
+    PDBinaryWriter_finalize(writer);
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+
+    assert_true(PDRead_get_event(reader) == PDEventType_SetMemory);
+
+    assert_true(PDRead_find_data(reader, &data, &size, "data", 0) == (PDReadType_Data | PDReadStatus_Ok));
+    assert_true(size == 100);
+
+    for (int i = 0; i < 100; ++i)
+        assert_true(((uint8_t*)data)[i] == i);
+
+    assert_true(PDRead_find_data(reader, &data, &size, "data2", 0) == (PDReadType_Data | PDReadStatus_Ok));
+    assert_true(size == 8);
+
+    assert_true(PDRead_find_u32(reader, &value, "value", 0) == (PDReadType_U32 | PDReadStatus_Ok));
+    assert_true(value == 1234);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void testTypedArrays(void**) {
+    enum { AddressCount = 100 * 1000 };
+    static uint32_t addresses[AddressCount];
+    static const uint64_t values64[] = { 0x0102030405060708ULL, 0xffffffff00000000ULL, 42 };
+    static const float valuesF32[] = { 1.0f, -2.5f, 1024.0f, 0.0f };
+    const uint32_t* readAddresses;
+    const uint64_t* read64;
+    const float* readF32;
+    uint32_t count;
+    uint8_t* data;
+
+    for (int i = 0; i < AddressCount; ++i)
+        addresses[i] = 0x1000 + i * 4;
+
+    PDBinaryWriter_reset(writer);
+
+    PDWrite_event_begin(writer, PDEventType_SetBreakpoint);
+    assert_true(PDWrite_u8(writer, "pad", 1) == PDWriteStatus_ok); // make sure the arrays needs to be aligned
+    assert_true(PDWrite_u64_array(writer, "values64", values64, 3) == PDWriteStatus_ok);
+    assert_true(PDWrite_u32_array(writer, "addresses", addresses, AddressCount) == PDWriteStatus_ok);
+    assert_true(PDWrite_f32_array(writer, "floats", valuesF32, 4) == PDWriteStatus_ok);
+    assert_true(PDWrite_u32_array(writer, "empty", addresses, 0) == PDWriteStatus_ok);
+    PDWrite_event_end(writer);
+
+    PDBinaryWriter_finalize(writer);
+
+    data = PDBinaryWriter_getData(writer);
+    assert_true(PDBinaryWriter_getSize(writer) < AddressCount * 4 + 256);
+
+    PDBinaryReader_initStream(reader, data, PDBinaryWriter_getSize(writer));
+    assert_true(PDRead_get_event(reader) == PDEventType_SetBreakpoint);
+
+    assert_true(PDRead_find_u32_array(reader, &readAddresses, &count, "addresses", 0) ==
+                (PDReadType_TypedArray | PDReadStatus_Ok));
+    assert_true(count == AddressCount);
+    assert_true(((uintptr_t)readAddresses & 3) == 0);
+    assert_true(!memcmp(readAddresses, addresses, sizeof(addresses)));
+
+    assert_true(PDRead_find_u64_array(reader, &read64, &count, "values64", 0) ==
+                (PDReadType_TypedArray | PDReadStatus_Ok));
+    assert_true(count == 3);
+    assert_true(((uintptr_t)read64 & 7) == 0);
+    assert_true(read64[0] == values64[0] && read64[1] == values64[1] && read64[2] == values64[2]);
+
+    assert_true(PDRead_find_f32_array(reader, &readF32, &count, "floats", 0) ==
+                (PDReadType_TypedArray | PDReadStatus_Ok));
+    assert_true(count == 4);
+    assert_true(readF32[1] == -2.5f && readF32[2] == 1024.0f);
+
+    assert_true(PDRead_find_u32_array(reader, &readAddresses, &count, "empty", 0) ==
+                (PDReadType_TypedArray | PDReadStatus_Ok));
+    assert_true(count == 0);
+
+    // wrong element type and not an array
+
+    assert_true(PDRead_find_u64_array(reader, &read64, &count, "addresses", 0) ==
+                (PDReadType_TypedArray | PDReadStatus_IllegalType));
+    assert_true(PDRead_find_u32_array(reader, &readAddresses, &count, "pad", 0) ==
+                (PDReadType_U8 | PDReadStatus_IllegalType));
+
+    // fake a stream from a machine with another byte order by flipping the byte order flag and swapping the values.
+    // stream header (4) + event (7) + u8 field (8) + type (1) + size (4) + "values64\0" (9) + element type (1)
+
+    uint8_t* byteOrder = data + 4 + 7 + 8 + 1 + 4 + 9 + 1;
+    uint8_t* values = (uint8_t*)read64;
+
+    *byteOrder = !*byteOrder;
+
+    for (int i = 0; i < 3; ++i) {
+        for (int t = 0; t < 4; ++t) {
+            uint8_t temp = values[i * 8 + t];
+            values[i * 8 + t] = values[i * 8 + 7 - t];
+            values[i * 8 + 7 - t] = temp;
+        }
+    }
+
+    assert_true(PDRead_find_u64_array(reader, &read64, &count, "values64", 0) ==
+                (PDReadType_TypedArray | PDReadStatus_Ok));
+    assert_true(read64[0] == values64[0] && read64[1] == values64[1] && read64[2] == values64[2]);
+
+    // should only be swapped once
+
+    assert_true(PDRead_find_u64_array(reader, &read64, &count, "values64", 0) ==
+                (PDReadType_TypedArray | PDReadStatus_Ok));
+    assert_true(read64[0] == values64[0]);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The count of a typed array comes from the stream so a broken (or hostile) one must not make the reader swap or
+// return values outside of the field
+
+static void setArrayCount(uint8_t* data, uint32_t count) {
+    data[0] = (uint8_t)(count >> 24);
+    data[1] = (uint8_t)(count >> 16);
+    data[2] = (uint8_t)(count >> 8);
+    data[3] = (uint8_t)(count >> 0);
+}
+
+void testTypedArrayBadCount(void**) {
+    static const uint32_t ids[] = { 1, 2, 3, 4 };
+    const uint32_t* readIds;
+    uint32_t count;
+    uint8_t* data;
+
+    PDBinaryWriter_reset(writer);
+
+    PDWrite_event_begin(writer, PDEventType_CancelRequests);
+    assert_true(PDWrite_u32_array(writer, "ids", ids, 4) == PDWriteStatus_ok);
+    PDWrite_event_end(writer);
+
+    PDBinaryWriter_finalize(writer);
+
+    data = PDBinaryWriter_getData(writer);
+
+    PDBinaryReader_initStream(reader, data, PDBinaryWriter_getSize(writer));
+    assert_true(PDRead_get_event(reader) == PDEventType_CancelRequests);
+
+    // stream header (4) + event (7) + type (1) + size (4) + "ids\0" (4) + element type (1) + byte order (1)
+
+    uint8_t* byteOrder = data + 4 + 7 + 1 + 4 + 4 + 1;
+    uint8_t* countData = byteOrder + 1;
+
+    // fewer values than stored is fine
+
+    setArrayCount(countData, 3);
+    assert_true(PDRead_find_u32_array(reader, &readIds, &count, "ids", 0) == (PDReadType_TypedArray | PDReadStatus_Ok));
+    assert_true(count == 3);
+
+    // one value too many and a count that wraps around when multiplied by the element size
+
+    count = 0;
+
+    setArrayCount(countData, 5);
+    assert_true(PDRead_find_u32_array(reader, &readIds, &count, "ids", 0) ==
+                (PDReadType_TypedArray | PDReadStatus_Fail));
+
+    setArrayCount(countData, 0x40000001);
+    assert_true(PDRead_find_u32_array(reader, &readIds, &count, "ids", 0) ==
+                (PDReadType_TypedArray | PDReadStatus_Fail));
+
+    // other byte order: nothing is swapped
+
+    *byteOrder = !*byteOrder;
+
+    setArrayCount(countData, 0xffffffff);
+    assert_true(PDRead_find_u32_array(reader, &readIds, &count, "ids", 0) ==
+                (PDReadType_TypedArray | PDReadStatus_Fail));
+    assert_true(count == 0);
+
+    setArrayCount(countData, 4);
+    assert_true(PDRead_find_u32_array(reader, &readIds, &count, "ids", 0) == (PDReadType_TypedArray | PDReadStatus_Ok));
+    assert_true(count == 4);
+    assert_true(readIds[3] == 0x04000000);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void writeAllTypes(PDWriter* w) {
+    static const char* ids[] = { "address", "name", "offset", 0 };
+
+    PDWrite_event_begin(w, PDEventType_SetRegisters);
+    PDWrite_s8(w, "s8", -3);
+    PDWrite_u8(w, "u8", 0xfe);
+    PDWrite_s16(w, "s16", -1234);
+    PDWrite_u16(w, "u16", 0xbeef);
+    PDWrite_s32(w, "s32", -123456);
+    PDWrite_u32(w, "u32", 0xdeadbeef);
+    PDWrite_s64(w, "s64", -1234567890123LL);
+    PDWrite_u64(w, "u64", 0x0102030405060708ULL);
+    PDWrite_float(w, "float", 1.5f);
+    PDWrite_double(w, "double", -2.25);
+
+    PDWrite_header_array_begin(w, "table", ids);
+
+    for (int i = 0; i < 3; ++i) {
+        PDWrite_u32(w, "address", 0x8000 + i);
+        PDWrite_string(w, "name", i == 1 ? "second" : "row");
+        PDWrite_s16(w, "offset", (int16_t)-i);
+    }
+
+    PDWrite_header_array_end(w);
+    PDWrite_event_end(w);
+
+    PDBinaryWriter_finalize(w);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void readAllTypes(PDReader* r) {
+    int8_t s8; uint8_t u8; int16_t s16; uint16_t u16; int32_t s32; uint32_t u32;
+    int64_t s64; uint64_t u64; float f; double d;
+    PDReaderIterator it, addressIt, nameIt, offsetIt;
+    const char* name;
+    uint32_t rowCount;
+
+    assert_true(PDRead_get_event(r) == PDEventType_SetRegisters);
+
+    assert_true(PDRead_find_s8(r, &s8, "s8", 0) == (PDReadStatus_Ok | PDReadType_S8) && s8 == -3);
+    assert_true(PDRead_find_u8(r, &u8, "u8", 0) == (PDReadStatus_Ok | PDReadType_U8) && u8 == 0xfe);
+    assert_true(PDRead_find_s16(r, &s16, "s16", 0) == (PDReadStatus_Ok | PDReadType_S16) && s16 == -1234);
+    assert_true(PDRead_find_u16(r, &u16, "u16", 0) == (PDReadStatus_Ok | PDReadType_U16) && u16 == 0xbeef);
+    assert_true(PDRead_find_s32(r, &s32, "s32", 0) == (PDReadStatus_Ok | PDReadType_S32) && s32 == -123456);
+    assert_true(PDRead_find_u32(r, &u32, "u32", 0) == (PDReadStatus_Ok | PDReadType_U32) && u32 == 0xdeadbeef);
+    assert_true(PDRead_find_s64(r, &s64, "s64", 0) == (PDReadStatus_Ok | PDReadType_S64) && s64 == -1234567890123LL);
+    assert_true(PDRead_find_u64(r, &u64, "u64", 0) == (PDReadStatus_Ok | PDReadType_U64) && u64 == 0x0102030405060708ULL);
+    assert_true(PDRead_find_float(r, &f, "float", 0) == (PDReadStatus_Ok | PDReadType_Float) && f == 1.5f);
+    assert_true(PDRead_find_double(r, &d, "double", 0) == (PDReadStatus_Ok | PDReadType_Double) && d == -2.25);
+
+    // converted reads
+
+    assert_true((PDRead_find_u64(r, &u64, "u16", 0) & PDReadStatus_Converted) && u64 == 0xbeef);
+    assert_true((PDRead_find_u64(r, &u64, "u32", 0) & PDReadStatus_Converted) && u64 == 0xdeadbeef);
+
+    assert_true(PDRead_find_header_array(r, &it, &rowCount, "table", 0) == (PDReadStatus_Ok | PDReadType_HeaderArray));
+    assert_true(rowCount == 3);
+    assert_true(PDRead_header_array_column(r, &addressIt, "address", it) == (PDReadStatus_Ok | PDReadType_U32));
+    assert_true(PDRead_header_array_column(r, &nameIt, "name", it) == (PDReadStatus_Ok | PDReadType_String));
+    assert_true(PDRead_header_array_column(r, &offsetIt, "offset", it) == (PDReadStatus_Ok | PDReadType_S16));
+
+    for (uint32_t i = 0; i < rowCount; ++i) {
+        uint64_t address;
+        double offset;
+
+        assert_true(PDRead_column_u64(r, &address, addressIt, i) & PDReadStatus_Converted);
+        assert_true(address == 0x8000 + i);
+        assert_true(PDRead_column_string(r, &name, nameIt, i) == (PDReadStatus_Ok | PDReadType_String));
+        assert_true(!strcmp(name, i == 1 ? "second" : "row"));
+        assert_true(PDRead_column_double(r, &offset, offsetIt, i) & PDReadStatus_Converted);
+        assert_true(offset == -(double)i);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void testNativeByteOrder(void**) {
+    const uint16_t one = 1;
+    const int littleEndian = *(const uint8_t*)&one;
+    unsigned char* data;
+    unsigned int size;
+    uint32_t u32;
+
+    // default is big endian
+
+    PDBinaryWriter_reset(writer);
+    writeAllTypes(writer);
+
+    data = PDBinaryWriter_getData(writer);
+    assert_true((data[0] & PDStreamFlag_LittleEndian) == 0);
+
+    PDBinaryReader_initStream(reader, data, PDBinaryWriter_getSize(writer));
+    readAllTypes(reader);
+
+    // raw value of the first u32 should be stored as big endian: "u32\0" follows type (1) + size (2)
+
+    for (size = 4 + 7; memcmp(data + size + 3, "u32", 4); size += (data[size + 1] << 8) | data[size + 2]);
+    assert_true(data[size + 7] == 0xde && data[size + 10] == 0xef);
+
+    // native order is kept across resets and the flag is set in the stream header even before finalize
+
+    pd_binary_writer_set_native_order(writer, 1);
+    PDBinaryWriter_reset(writer);
+
+    data = PDBinaryWriter_getData(writer);
+    assert_true(!!(data[0] & PDStreamFlag_LittleEndian) == littleEndian);
+
+    writeAllTypes(writer);
+
+    data = PDBinaryWriter_getData(writer);
+    assert_true(!!(data[0] & PDStreamFlag_LittleEndian) == littleEndian);
+
+    memcpy(&u32, data + size + 7, sizeof(u32));
+    assert_true(u32 == 0xdeadbeef);
+
+    PDBinaryReader_initStream(reader, data, PDBinaryWriter_getSize(writer));
+    readAllTypes(reader);
+
+    pd_binary_writer_set_native_order(writer, 0);
+    PDBinaryWriter_reset(writer);
+    assert_true((PDBinaryWriter_getData(writer)[0] & PDStreamFlag_LittleEndian) == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Compares the old byte by byte swapping with the vectorized version used for typed arrays
+
+void testByteSwapBenchmark(void**) {
+    enum { Count = 64 * 1024, Loops = 1024 };   // small enough to stay in cache
+    static uint32_t values[Count];
+    static uint32_t scalarValues[Count];
+    double scalarTime, swapTime;
+    double bytes = (double)Count * sizeof(uint32_t) * Loops;
+    clock_t start;
+
+    for (int i = 0; i < Count; ++i)
+        values[i] = scalarValues[i] = (uint32_t)i * 0x01030507;
+
+    start = clock();
+
+    for (int l = 0; l < Loops; ++l) {
+        uint8_t* data = (uint8_t*)scalarValues;
+
+        for (int i = 0; i < Count; ++i, data += 4) {
+            uint8_t t0 = data[0], t1 = data[1];
+            data[0] = data[3];
+            data[1] = data[2];
+            data[2] = t1;
+            data[3] = t0;
+        }
+    }
+
+    scalarTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+
+    for (int l = 0; l < Loops; ++l)
+        pd_byte_swap_32(values, Count);
+
+    swapTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    assert_true(!memcmp(values, scalarValues, sizeof(values)));
+
+    pd_byte_swap_32(values, Count - 1);   // odd count to hit the tail
+    assert_true(values[0] == pd_bswap32(scalarValues[0]));
+    assert_true(values[Count - 2] == pd_bswap32(scalarValues[Count - 2]));
+    assert_true(values[Count - 1] == scalarValues[Count - 1]);
+
+    printf("byte swap u32: scalar %.2f GB/s, pd_byte_swap_32 %.2f GB/s\n",
+           (bytes / 1e9) / (scalarTime > 0.0 ? scalarTime : 1e-9),
+           (bytes / 1e9) / (swapTime > 0.0 ? swapTime : 1e-9));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 void testHeaderArray(void**) {
+    static const char* ids[] = { "address", "line", "size", "offset", 0 };
+    enum { RowCount = 1000 };
+    char line[64];
+    unsigned char* data;
+    unsigned int size, arraySize;
+    uint32_t rowCount;
+    PDReaderIterator it, addressIt, lineIt, sizeIt, offsetIt;
+
     PDBinaryWriter_reset(writer);
 
-    // Not implemented so expect it to always fail
+    assert_true(PDWrite_header_array_end(writer) == PDWriteStatus_Fail); // no begin
+
+    // write the same data as a regular array to compare the size
+
+    PDWrite_event_begin(writer, PDEventType_SetDisassembly);
+    PDWrite_array_begin(writer, "disassembly");
+
+    for (int i = 0; i < RowCount; ++i) {
+        sprintf(line, "lda $%04x", i);
+        PDWrite_array_entry_begin(writer);
+        PDWrite_u64(writer, "address", 0x1000 + i);
+        PDWrite_string(writer, "line", line);
+        PDWrite_u8(writer, "size", (uint8_t)(i & 3));
+        PDWrite_s16(writer, "offset", (int16_t)-i);
+        PDWrite_entry_end(writer);
+    }
+
+    PDWrite_array_end(writer);
+    PDWrite_event_end(writer);
+
+    PDBinaryWriter_finalize(writer);
+    arraySize = PDBinaryWriter_getSize(writer);
+
+    PDBinaryWriter_reset(writer);
+
+    assert_true(PDWrite_event_begin(writer, PDEventType_SetDisassembly) == PDWriteStatus_ok);
+    assert_true(PDWrite_header_array_begin(writer, "disassembly", ids) == PDWriteStatus_ok);
+    assert_true(PDWrite_header_array_begin(writer, "disassembly", ids) == PDWriteStatus_Fail); // no nesting
+
+    for (int i = 0; i < RowCount; ++i) {
+        sprintf(line, "lda $%04x", i);
+        assert_true(PDWrite_u64(writer, 0, 0x1000 + i) == PDWriteStatus_ok);
+        assert_true(PDWrite_string(writer, 0, line) == PDWriteStatus_ok);
+        assert_true(PDWrite_u8(writer, 0, (uint8_t)(i & 3)) == PDWriteStatus_ok);
+        assert_true(PDWrite_s16(writer, 0, (int16_t)-i) == PDWriteStatus_ok);
+    }
+
+    assert_true(PDWrite_data(writer, 0, s_data, sizeof(s_data)) == PDWriteStatus_Fail);
+    assert_true(PDWrite_event_end(writer) == PDWriteStatus_Fail); // header array still open
+
+    assert_true(PDWrite_header_array_end(writer) == PDWriteStatus_ok);
+    assert_true(PDWrite_u32(writer, "after", 42) == PDWriteStatus_ok);
+    assert_true(PDWrite_event_end(writer) == PDWriteStatus_ok);
+
+    PDBinaryWriter_finalize(writer);
+
+    data = PDBinaryWriter_getData(writer);
+    size = PDBinaryWriter_getSize(writer);
+
+    printf("%d rows: array %d bytes, header array %d bytes\n", RowCount, arraySize, size);
+
+    assert_true(size < arraySize / 2);
+
+    PDBinaryReader_initStream(reader, data, size);
+    assert_true(PDRead_get_event(reader) == PDEventType_SetDisassembly);
+
+    assert_true(PDRead_find_header_array(reader, &it, &rowCount, "disassembly", 0) ==
+                (PDReadType_HeaderArray | PDReadStatus_Ok));
+    assert_true(rowCount == RowCount);
+
+    assert_true(PDRead_header_array_column(reader, &addressIt, "address", it) == (PDReadType_U64 | PDReadStatus_Ok));
+    assert_true(PDRead_header_array_column(reader, &lineIt, "line", it) == (PDReadType_String | PDReadStatus_Ok));
+    assert_true(PDRead_header_array_column(reader, &sizeIt, "size", it) == (PDReadType_U8 | PDReadStatus_Ok));
+    assert_true(PDRead_header_array_column(reader, &offsetIt, "offset", it) == (PDReadType_S16 | PDReadStatus_Ok));
+    assert_true(PDRead_header_array_column(reader, &offsetIt, "foo", it) == PDReadStatus_NotFound);
+
+    for (uint32_t i = 0; i < rowCount; ++i) {
+        uint64_t address, lineSize, offset;
+        double doubleAddress;
+        const char* lineText;
+
+        sprintf(line, "lda $%04x", i);
+
+        assert_true(PDRead_column_u64(reader, &address, addressIt, i) == (PDReadType_U64 | PDReadStatus_Ok));
+        assert_true(PDRead_column_string(reader, &lineText, lineIt, i) == (PDReadType_String | PDReadStatus_Ok));
+        assert_true(PDRead_column_u64(reader, &lineSize, sizeIt, i) == (PDReadType_U8 | PDReadStatus_Converted));
+        assert_true(PDRead_column_u64(reader, &offset, offsetIt, i) == (PDReadType_S16 | PDReadStatus_Converted));
+        assert_true(PDRead_column_double(reader, &doubleAddress, addressIt, i) ==
+                    (PDReadType_U64 | PDReadStatus_Converted));
+
+        assert_true(address == 0x1000 + i);
+        assert_true(!strcmp(lineText, line));
+        assert_true(lineSize == (i & 3));
+        assert_true((int64_t)offset == -(int64_t)i);
+        assert_true(doubleAddress == (double)(0x1000 + i));
+    }
+
+    uint64_t value;
+    const char* text;
+
+    assert_true(PDRead_column_u64(reader, &value, addressIt, rowCount) == PDReadStatus_NotFound);
+    assert_true(PDRead_column_string(reader, &text, addressIt, 0) == (PDReadType_U64 | PDReadStatus_IllegalType));
+
+    uint32_t after;
+    assert_true(PDRead_find_u32(reader, &after, "after", 0) == (PDReadType_U32 | PDReadStatus_Ok));
+    assert_true(after == 42);
+
+    // an incomplete last row gets padded with zeros and fails
+
+    PDBinaryWriter_reset(writer);
+
+    PDWrite_event_begin(writer, PDEventType_SetDisassembly);
+    PDWrite_header_array_begin(writer, "disassembly", ids);
+    PDWrite_u64(writer, 0, 0x1000);
+    assert_true(PDWrite_header_array_end(writer) == PDWriteStatus_Fail);
+    PDWrite_event_end(writer);
+
+    PDBinaryWriter_finalize(writer);
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+    assert_true(PDRead_get_event(reader) == PDEventType_SetDisassembly);
+    assert_true(PDRead_find_header_array(reader, &it, &rowCount, "disassembly", 0) ==
+                (PDReadType_HeaderArray | PDReadStatus_Ok));
+    assert_true(rowCount == 1);
+
+    // a value of the wrong type is stored as zero (or an empty string) so the rest of the row stays in the right
+    // columns but the whole table fails
+
+    PDBinaryWriter_reset(writer);
+
+    PDWrite_event_begin(writer, PDEventType_SetDisassembly);
+    PDWrite_header_array_begin(writer, "disassembly", ids);
+
+    for (int i = 0; i < 2; ++i) {
+        assert_true(PDWrite_u64(writer, 0, 0x1000 + i) == PDWriteStatus_ok);
+
+        if (i == 1)
+            assert_true(PDWrite_u32(writer, 0, 1) == PDWriteStatus_Fail); // wrong type for the line column
+        else
+            assert_true(PDWrite_string(writer, 0, "nop") == PDWriteStatus_ok);
+
+        assert_true(PDWrite_u8(writer, 0, 2) == PDWriteStatus_ok);
+        assert_true(PDWrite_s16(writer, 0, (int16_t)-i) == PDWriteStatus_ok);
+    }
 
-    assert_true(PDWrite_header_array_begin(writer, 0) == PDWriteStatus_Fail);
     assert_true(PDWrite_header_array_end(writer) == PDWriteStatus_Fail);
+    PDWrite_event_end(writer);
+
+    PDBinaryWriter_finalize(writer);
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+    assert_true(PDRead_get_event(reader) == PDEventType_SetDisassembly);
+    assert_true(PDRead_find_header_array(reader, &it, &rowCount, "disassembly", 0) ==
+                (PDReadType_HeaderArray | PDReadStatus_Ok));
+    assert_true(rowCount == 2);
+
+    assert_true(PDRead_header_array_column(reader, &lineIt, "line", it) == (PDReadType_String | PDReadStatus_Ok));
+    assert_true(PDRead_header_array_column(reader, &sizeIt, "size", it) == (PDReadType_U8 | PDReadStatus_Ok));
+    assert_true(PDRead_header_array_column(reader, &offsetIt, "offset", it) == (PDReadType_S16 | PDReadStatus_Ok));
+
+    const char* lineText;
+    uint64_t lineSize, offset;
+
+    assert_true(PDRead_column_string(reader, &lineText, lineIt, 1) == (PDReadType_String | PDReadStatus_Ok));
+    assert_true(!strcmp(lineText, ""));
+    assert_true(PDRead_column_u64(reader, &lineSize, sizeIt, 1) == (PDReadType_U8 | PDReadStatus_Converted));
+    assert_true(lineSize == 2);
+    assert_true(PDRead_column_u64(reader, &offset, offsetIt, 1) == (PDReadType_S16 | PDReadStatus_Converted));
+    assert_true((int64_t)offset == -1);
+
+    // and the next header array starts over
+
+    PDBinaryWriter_reset(writer);
+
+    PDWrite_event_begin(writer, PDEventType_SetDisassembly);
+    PDWrite_header_array_begin(writer, "disassembly", ids);
+    PDWrite_u64(writer, 0, 0x1000);
+    PDWrite_string(writer, 0, "nop");
+    PDWrite_u8(writer, 0, 2);
+    PDWrite_s16(writer, 0, 0);
+    assert_true(PDWrite_header_array_end(writer) == PDWriteStatus_ok);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -520,6 +1151,517 @@ void testArrayRead(void**) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+struct TestAllocator {
+    size_t allocated;
+    int allocCount;
+    int freeCount;
+};
+
+static void* testAlloc(void* userData, void* ptr, size_t oldSize, size_t newSize) {
+    TestAllocator* allocator = (TestAllocator*)userData;
+
+    allocator->allocated += newSize - oldSize;
+
+    if (newSize == 0) {
+        if (ptr)
+            allocator->freeCount++;
+        free(ptr);
+        return 0;
+    }
+
+    if (!ptr)
+        allocator->allocCount++;
+
+    return realloc(ptr, newSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void testWriterGrow(void**) {
+    enum { MemorySize = 8 * 1024 * 1024, EntryCount = 100 * 1000 };
+    TestAllocator allocator = { 0, 0, 0 };
+    PDWriterAllocator writerAllocator = { testAlloc, &allocator };
+    PDWriter growWriterData;
+    PDWriter* growWriter = &growWriterData;
+    PDReaderIterator it;
+    uint8_t* memory = (uint8_t*)malloc(MemorySize);
+    char* longString = (char*)malloc(70 * 1024);
+    void* readMemory;
+    uint64_t readSize;
+    int count = 0;
+
+    for (int i = 0; i < MemorySize; ++i)
+        memory[i] = (uint8_t)(i * 7);
+
+    memset(longString, 'a', 70 * 1024 - 1);
+    longString[70 * 1024 - 1] = 0;
+
+    pd_binary_writer_init_with_allocator(growWriter, &writerAllocator);
+
+    // a small update should only need the initial buffer
+
+    PDWrite_event_begin(growWriter, PDEventType_SetRegisters);
+    PDWrite_u16(growWriter, "pc", 0x1000);
+    PDWrite_event_end(growWriter);
+
+    assert_true(allocator.allocCount == 1);
+    assert_true(allocator.allocated < 64 * 1024);
+
+    pd_binary_writer_reset(growWriter);
+
+    // strings longer than 64k doesn't fit in a regular field
+
+    PDWrite_event_begin(growWriter, PDEventType_SetMemory);
+    assert_true(PDWrite_string(growWriter, "text", longString) == PDWriteStatus_Fail);
+
+    // neither does an id that long and data larger than a stream can hold is rejected before anything is written
+
+    unsigned int sizeBefore = pd_binary_writer_get_size(growWriter);
+
+    assert_true(PDWrite_data(growWriter, longString, memory, 16) == PDWriteStatus_Fail);
+    assert_true(PDWrite_data(growWriter, "huge", memory, 0xfffffff0u) == PDWriteStatus_Fail);
+    assert_true(pd_binary_writer_get_size(growWriter) == sizeBefore);
+
+    assert_true(PDWrite_data(growWriter, "data", memory, MemorySize) == PDWriteStatus_ok);
+    assert_true(PDWrite_array_begin(growWriter, "entries") == PDWriteStatus_ok);
+
+    for (int i = 0; i < EntryCount; ++i) {
+        PDWrite_array_entry_begin(growWriter);
+        PDWrite_u32(growWriter, "address", (uint32_t)i);
+        PDWrite_entry_end(growWriter);
+    }
+
+    assert_true(PDWrite_array_end(growWriter) == PDWriteStatus_ok);
+    assert_true(PDWrite_event_end(growWriter) == PDWriteStatus_ok);
+
+    pd_binary_writer_finalize(growWriter);
+
+    assert_true(pd_binary_writer_get_size(growWriter) > MemorySize);
+
+    PDBinaryReader_initStream(reader, pd_binary_writer_get_data(growWriter), pd_binary_writer_get_size(growWriter));
+    assert_true(PDRead_get_event(reader) == PDEventType_SetMemory);
+    assert_true(PDRead_find_data(reader, &readMemory, &readSize, "data", 0) == (PDReadType_Data | PDReadStatus_Ok));
+    assert_true(readSize == MemorySize);
+    assert_true(!memcmp(readMemory, memory, MemorySize));
+
+    assert_true(PDRead_find_array(reader, &it, "entries", 0) == (PDReadType_Array | PDReadStatus_Ok));
+
+    while (PDRead_get_next_entry(reader, &it) > 0) {
+        uint32_t address = 0;
+        PDRead_find_u32(reader, &address, "address", it);
+        assert_true(address == (uint32_t)count);
+        count++;
+    }
+
+    assert_true(count == EntryCount);
+
+    PDBinaryReader_reset(reader);
+
+    pd_binary_writer_destroy(growWriter);
+
+    assert_true(allocator.allocated == 0);
+    assert_true(allocator.allocCount == allocator.freeCount);
+
+    free(longString);
+    free(memory);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const int s_benchEntryCount = 10000;
+static const int s_benchRegCount = 32;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes an array where each entry looks like the register set for a 32 register CPU
+
+static void writeBenchArray(char regIds[][8]) {
+    PDBinaryWriter_reset(writer);
+
+    PDWrite_event_begin(writer, 6);
+    PDWrite_array_begin(writer, "entries");
+
+    for (int i = 0; i < s_benchEntryCount; ++i) {
+        PDWrite_array_entry_begin(writer);
+
+        for (int k = 0; k < s_benchRegCount; ++k)
+            PDWrite_u32(writer, regIds[k], (uint32_t)(i + k));
+
+        PDWrite_entry_end(writer);
+    }
+
+    PDWrite_array_end(writer);
+    PDWrite_event_end(writer);
+
+    PDBinaryWriter_finalize(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reads all fields (in reverse order of how they were written to get worst case for linear search) in all entries
+
+static double findBenchArray(char regIds[][8]) {
+    PDReaderIterator arrayIter;
+    clock_t start;
+    int entry = 0;
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+
+    assert_true(PDRead_get_event(reader) == 6);
+
+    start = clock();
+
+    assert_true(PDRead_find_array(reader, &arrayIter, "entries", 0) == (PDReadStatus_Ok | PDReadType_Array));
+
+    while (PDRead_get_next_entry(reader, &arrayIter) > 0) {
+        uint32_t value;
+
+        for (int k = s_benchRegCount - 1; k >= 0; --k) {
+            assert_true(PDRead_find_u32(reader, &value, regIds[k], arrayIter) == (PDReadStatus_Ok | PDReadType_U32));
+            assert_true(value == (uint32_t)(entry + k));
+        }
+
+        entry++;
+    }
+
+    assert_int_equal(entry, s_benchEntryCount);
+
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void testFindBenchmark(void**) {
+    char regIds[s_benchRegCount][8];
+    double linearTime;
+    double indexTime;
+    double findCount = (double)s_benchEntryCount * s_benchRegCount;
+
+    for (int i = 0; i < s_benchRegCount; ++i)
+        sprintf(regIds[i], "r%d", i);
+
+    writeBenchArray(regIds);
+
+    pd_binary_reader_set_key_index(reader, 0);
+    linearTime = findBenchArray(regIds);
+
+    pd_binary_reader_set_key_index(reader, 1);
+    indexTime = findBenchArray(regIds);
+
+    printf("find in %d entries: linear %.2f Mfinds/s, indexed %.2f Mfinds/s\n", s_benchEntryCount,
+           (findCount / 1e6) / (linearTime > 0.0 ? linearTime : 1e-9),
+           (findCount / 1e6) / (indexTime > 0.0 ? indexTime : 1e-9));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void testFindIndexDuplicateKeys(void**) {
+    uint32_t value = 0;
+    char id[32];
+
+    PDBinaryWriter_reset(writer);
+
+    // large enough for the event to be indexed. The first value for a key should always be returned
+
+    PDWrite_event_begin(writer, 7);
+
+    for (int i = 0; i < 64; ++i) {
+        sprintf(id, "key_%d", i);
+        PDWrite_u32(writer, id, (uint32_t)i);
+    }
+
+    PDWrite_u32(writer, "key_10", 1000);
+    PDWrite_event_end(writer);
+
+    PDBinaryWriter_finalize(writer);
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+    assert_true(PDRead_get_event(reader) == 7);
+
+    assert_true(PDRead_find_u32(reader, &value, "key_10", 0) == (PDReadStatus_Ok | PDReadType_U32));
+    assert_true(value == 10);
+
+    assert_true(PDRead_find_u32(reader, &value, "key_63", 0) == (PDReadStatus_Ok | PDReadType_U32));
+    assert_true(value == 63);
+
+    assert_true(PDRead_find_u32(reader, &value, "key_64", 0) == PDReadStatus_NotFound);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t fnv1a(const char* id) {
+    uint32_t hash = 2166136261u;
+
+    while (*id) {
+        hash ^= (uint8_t)*id++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void testFindKey(void**) {
+    uint64_t u64 = 0;
+    uint32_t u32 = 0;
+    double d = 0.0;
+    char id[32];
+
+    PDBinaryWriter_reset(writer);
+
+    // large enough for the key index to be used
+
+    PDWrite_event_begin(writer, 7);
+
+    for (int i = 0; i < 64; ++i) {
+        sprintf(id, "key_%d", i);
+        PDWrite_u32(writer, id, (uint32_t)i);
+    }
+
+    PDWrite_double(writer, "double", 1.5);
+    PDWrite_event_end(writer);
+
+    PDBinaryWriter_finalize(writer);
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+    assert_true(PDRead_get_event(reader) == 7);
+
+    assert_true(PDRead_find_key(reader, &u32, PDReadType_U32, "key_42", fnv1a("key_42"), 0) == (PDReadStatus_Ok | PDReadType_U32));
+    assert_true(u32 == 42);
+
+    assert_true(PDRead_find_key(reader, &u64, PDReadType_U64, "key_7", fnv1a("key_7"), 0) == (PDReadStatus_Converted | PDReadType_U32));
+    assert_true(u64 == 7);
+
+    assert_true(PDRead_find_key(reader, &d, PDReadType_Double, "double", fnv1a("double"), 0) == (PDReadStatus_Ok | PDReadType_Double));
+    assert_true(d == 1.5);
+
+    // 0 hash means that the reader calculates it
+
+    assert_true(PDRead_find_key(reader, &u32, PDReadType_U32, "key_63", 0, 0) == (PDReadStatus_Ok | PDReadType_U32));
+    assert_true(u32 == 63);
+
+    assert_true(PDRead_find_key(reader, &u32, PDReadType_U32, "key_64", fnv1a("key_64"), 0) == PDReadStatus_NotFound);
+    assert_true(PDRead_find_key(reader, &u32, PDReadType_String, "key_1", fnv1a("key_1"), 0) == PDReadStatus_Fail);
+
+    // same result without the index
+
+    pd_binary_reader_set_key_index(reader, 0);
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+    assert_true(PDRead_get_event(reader) == 7);
+
+    assert_true(PDRead_find_key(reader, &u32, PDReadType_U32, "key_42", fnv1a("key_42"), 0) == (PDReadStatus_Ok | PDReadType_U32));
+    assert_true(u32 == 42);
+
+    pd_binary_reader_set_key_index(reader, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void writeIndexedEvent(int event, int count) {
+    char id[32];
+
+    PDWrite_event_begin(writer, (uint16_t)event);
+
+    for (int i = 0; i < count; ++i) {
+        sprintf(id, "key_%d", i);
+        PDWrite_u32(writer, id, (uint32_t)(event * 1000 + i));
+    }
+
+    PDWrite_event_end(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void readIndexedEvent(int event) {
+    uint32_t value = 0;
+
+    assert_true(PDRead_get_event(reader) == (uint32_t)event);
+    assert_true(PDRead_find_u32(reader, &value, "key_0", 0) == (PDReadStatus_Ok | PDReadType_U32));
+    assert_true(value == (uint32_t)(event * 1000));
+    assert_true(PDRead_find_u32(reader, &value, "key_40", 0) == (PDReadStatus_Ok | PDReadType_U32));
+    assert_true(value == (uint32_t)(event * 1000 + 40));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void testEventIndex(void**) {
+    uint32_t value = 0;
+
+    PDBinaryWriter_reset(writer);
+
+    writeIndexedEvent(PDEventType_SetRegisters, 64);
+    writeIndexedEvent(PDEventType_SetMemory, 64);
+    writeIndexedEvent(PDEventType_SetExceptionLocation, 1);
+    writeIndexedEvent(PDEventType_Custom + 1, 64);
+
+    PDBinaryWriter_finalize(writer);
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+
+    // several passes over the same stream (as done for each view) should give the same result every time
+
+    for (int pass = 0; pass < 3; ++pass) {
+        PDBinaryReader_reset(reader);
+
+        readIndexedEvent(PDEventType_SetRegisters);
+        readIndexedEvent(PDEventType_SetMemory);
+
+        assert_true(PDRead_get_event(reader) == PDEventType_SetExceptionLocation);
+        assert_true(PDRead_find_u32(reader, &value, "key_0", 0) == (PDReadStatus_Ok | PDReadType_U32));
+        assert_true(value == PDEventType_SetExceptionLocation * 1000);
+        assert_true(PDRead_find_u32(reader, &value, "key_40", 0) == PDReadStatus_NotFound);
+
+        readIndexedEvent(PDEventType_Custom + 1);
+
+        assert_true(PDRead_get_event(reader) == 0);
+    }
+
+    // only events in the mask should be returned and the mask should be kept on reset
+
+    pd_binary_reader_set_event_mask(reader, PD_EVENT_MASK(PDEventType_SetMemory) | PD_EVENT_MASK(PDEventType_Custom));
+
+    for (int pass = 0; pass < 2; ++pass) {
+        PDBinaryReader_reset(reader);
+
+        readIndexedEvent(PDEventType_SetMemory);
+        readIndexedEvent(PDEventType_Custom + 1);
+
+        assert_true(PDRead_get_event(reader) == 0);
+    }
+
+    pd_binary_reader_set_event_mask(reader, 0);
+    PDBinaryReader_reset(reader);
+    assert_true(PDRead_get_event(reader) == 0);
+
+    // and init_stream should go back to all events
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+
+    readIndexedEvent(PDEventType_SetRegisters);
+    readIndexedEvent(PDEventType_SetMemory);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void testDataCompression(void**) {
+    enum { MemorySize = 64 * 1024 };
+    static uint8_t memory[MemorySize];
+    static uint8_t noise[4096];
+    uint32_t seed = 1234;
+    uint8_t* dest;
+    void* data;
+    void* data2;
+    uint64_t size;
+    uint32_t value;
+
+    // memory like data (code with repeating patterns and cleared areas) and data that doesn't compress
+
+    for (int i = 0; i < MemorySize; ++i)
+        memory[i] = i < MemorySize / 2 ? (uint8_t)((i * 13) % 96) : 0;
+
+    for (int i = 0; i < (int)sizeof(noise); ++i) {
+        seed = seed * 1103515245 + 12345;
+        noise[i] = (uint8_t)(seed >> 16);
+    }
+
+    PDBinaryWriter_reset(writer);
+    pd_binary_writer_set_compression(writer, 1024);
+
+    PDWrite_event_begin(writer, PDEventType_SetMemory);
+    assert_true(PDWrite_data(writer, "data", memory, MemorySize) == PDWriteStatus_ok);
+    assert_true(PDWrite_data(writer, "small", s_data, sizeof(s_data)) == PDWriteStatus_ok);
+    assert_true(PDWrite_data(writer, "noise", noise, sizeof(noise)) == PDWriteStatus_ok);
+
+    assert_true((dest = PDWrite_data_reserve(writer, "reserved", MemorySize)) != 0);
+    memcpy(dest, memory, MemorySize / 2);
+    assert_true(PDWrite_data_commit(writer, MemorySize / 2) == PDWriteStatus_ok);
+
+    assert_true(PDWrite_u32(writer, "value", 1234) == PDWriteStatus_ok);
+    assert_true(PDWrite_event_end(writer) == PDWriteStatus_ok);
+
+    PDBinaryWriter_finalize(writer);
+
+    // the compressed fields should be a fraction of the size (noise is stored as is)
+
+    assert_true(PDBinaryWriter_getSize(writer) < MemorySize / 2);
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+
+    assert_true(PDRead_get_event(reader) == PDEventType_SetMemory);
+
+    assert_true(PDRead_find_data(reader, &data, &size, "data", 0) == (PDReadType_Data | PDReadStatus_Ok));
+    assert_true(size == MemorySize);
+    assert_true(!memcmp(data, memory, MemorySize));
+
+    // pointers to decompressed data stay valid when other fields are read and finding it again gives the same data
+
+    assert_true(PDRead_find_data(reader, &data2, &size, "reserved", 0) == (PDReadType_Data | PDReadStatus_Ok));
+    assert_true(size == MemorySize / 2);
+    assert_true(!memcmp(data2, memory, MemorySize / 2));
+    assert_true(!memcmp(data, memory, MemorySize));
+
+    assert_true(PDRead_find_data(reader, &data2, &size, "data", 0) == (PDReadType_Data | PDReadStatus_Ok));
+    assert_true(data2 == data);
+
+    assert_true(PDRead_find_data(reader, &data, &size, "small", 0) == (PDReadType_Data | PDReadStatus_Ok));
+    assert_true(size == sizeof(s_data));
+    assert_true(!memcmp(data, s_data, sizeof(s_data)));
+
+    assert_true(PDRead_find_data(reader, &data, &size, "noise", 0) == (PDReadType_Data | PDReadStatus_Ok));
+    assert_true(size == sizeof(noise));
+    assert_true(!memcmp(data, noise, sizeof(noise)));
+
+    assert_true(PDRead_find_u32(reader, &value, "value", 0) == (PDReadType_U32 | PDReadStatus_Ok));
+    assert_true(value == 1234);
+
+    // other types used on a compressed field should report the real type
+
+    assert_true(PDRead_find_u32(reader, &value, "data", 0) == (PDReadType_Data | PDReadStatus_IllegalType));
+
+    // the same when the stream has been prepared (decompressed up front) before it's read
+
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+    pd_binary_reader_prepare(reader);
+
+    assert_true(PDRead_get_event(reader) == PDEventType_SetMemory);
+    assert_true(PDRead_find_data(reader, &data, &size, "data", 0) == (PDReadType_Data | PDReadStatus_Ok));
+    assert_true(size == MemorySize);
+    assert_true(!memcmp(data, memory, MemorySize));
+    assert_true(PDRead_find_data(reader, &data, &size, "reserved", 0) == (PDReadType_Data | PDReadStatus_Ok));
+    assert_true(!memcmp(data, memory, MemorySize / 2));
+    assert_true(PDRead_find_u32(reader, &value, "value", 0) == (PDReadType_U32 | PDReadStatus_Ok));
+    assert_true(value == 1234);
+    assert_true(PDRead_get_event(reader) == 0);
+
+    // an uncompressed size the data can't hold (or that is too large to allocate) is rejected
+
+    uint8_t* sizeData = PDBinaryWriter_getData(writer) + 4 + 7 + 5 + 5;
+    uint8_t oldSize[4];
+
+    memcpy(oldSize, sizeData, 4);
+
+    static const uint8_t badSizes[][4] = { { 0xff, 0xff, 0xff, 0xff }, { 0x00, 0xff, 0xff, 0xff } };
+
+    for (int i = 0; i < 2; ++i) {
+        memcpy(sizeData, badSizes[i], 4);
+        PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+        assert_true(PDRead_get_event(reader) == PDEventType_SetMemory);
+        assert_true(PDRead_find_data(reader, &data, &size, "data", 0) == (PDReadType_Data | PDReadStatus_Fail));
+    }
+
+    memcpy(sizeData, oldSize, 4);
+
+    // corrupt data is reported as a failure
+
+    memset(PDBinaryWriter_getData(writer) + 4 + 7 + 5 + 5 + 4, 0xff, 64);
+    PDBinaryReader_initStream(reader, PDBinaryWriter_getData(writer), PDBinaryWriter_getSize(writer));
+    assert_true(PDRead_get_event(reader) == PDEventType_SetMemory);
+    assert_true(PDRead_find_data(reader, &data, &size, "data", 0) == (PDReadType_Data | PDReadStatus_Fail));
+
+    pd_binary_writer_set_compression(writer, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 int main() {
     log_set_level(LOG_ERROR);
 
@@ -528,13 +1670,25 @@ int main() {
         unit_test(testWriteReadEvent),
         unit_test(testDataReadWrite),
         unit_test(testWriteSingleString),
+        unit_test(testStringLength),
         unit_test(testWriteReadAction),
         unit_test(testArrayWriteBreakage),
         unit_test(testAllValueTypes),
         unit_test(testFind),
         unit_test(testArray),
         unit_test(testArrayRead),
+        unit_test(testDataReserve),
+        unit_test(testTypedArrays),
+        unit_test(testTypedArrayBadCount),
+        unit_test(testNativeByteOrder),
+        unit_test(testByteSwapBenchmark),
         unit_test(testHeaderArray),
+        unit_test(testFindIndexDuplicateKeys),
+        unit_test(testFindKey),
+        unit_test(testEventIndex),
+        unit_test(testFindBenchmark),
+        unit_test(testWriterGrow),
+        unit_test(testDataCompression),
     };
 
     reader = &readerData;
@@ -3,13 +3,22 @@
 #include <setjmp.h>
 #include <cmocka.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <pd_backend.h>
+#include <pd_remote.h>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "core/time.h"
 #include "core/process.h"
 #include "session/session.h"
+#include "api/src/remote/remote_connection.h"
+#include "api/src/remote/pd_readwrite_private.h"
 
 struct Session* Session_createRemote(const char* target, int port);
 
@@ -25,14 +34,967 @@ void test_remote_session(void**) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static int s_idleUpdateCount;
+
+static void* idleCreateInstance(ServiceFunc*) {
+    return &s_idleUpdateCount;
+}
+
+static void idleDestroyInstance(void*) {
+}
+
+static PDDebugState idleUpdate(void*, PDAction, PDReader*, PDWriter* writer) {
+    s_idleUpdateCount++;
+
+    PDWrite_event_begin(writer, PDEventType_SetExceptionLocation);
+    PDWrite_u64(writer, "address", 0x1000);
+    PDWrite_event_end(writer);
+
+    return PDDebugState_Running;
+}
+
+static PDBackendPlugin s_idlePlugin = {
+    "IdleTest",
+    idleCreateInstance,
+    idleDestroyInstance,
+    0,
+    idleUpdate,
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cost of PDRemote_update when no debugger is connected (which is what most targets will see most of the time)
+
+void test_remote_idle_update(void**) {
+    enum { UpdateCount = 1000 * 1000 };
+
+    assert_true(PDRemote_create(&s_idlePlugin, 0) == 1);
+
+    clock_t start = clock();
+
+    for (int i = 0; i < UpdateCount; ++i)
+        PDRemote_update(0);
+
+    double time = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("idle PDRemote_update: %.1f ns/call\n", (time * 1e9) / UpdateCount);
+
+    // nothing is connected so the plugin should never be updated
+
+    assert_true(s_idleUpdateCount == 0);
+    assert_true(!PDRemote_isConnected());
+
+    PDRemote_destroy();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Sending a large stream should only queue what doesn't fit in the socket buffer (and not block until the other
+// side has read it) and it should arrive intact when sent in pieces by later flushes
+
+void test_remote_large_stream(void**) {
+    enum { StreamSize = 32 * 1024 * 1024, Port = 1341 };
+
+    unsigned char* stream = (unsigned char*)malloc(StreamSize);
+    unsigned char* recvStream = (unsigned char*)malloc(StreamSize);
+    int received = 0;
+
+    for (int i = 4; i < StreamSize; ++i)
+        stream[i] = (unsigned char)((i * 13) ^ (i >> 8));
+
+    stream[0] = (StreamSize >> 24) & 0x3f;
+    stream[1] = (StreamSize >> 16) & 0xff;
+    stream[2] = (StreamSize >> 8) & 0xff;
+    stream[3] = (StreamSize >> 0) & 0xff;
+
+    RemoteConnection* listener = RemoteConnection_create(RemoteConnectionType_Listener, Port);
+    RemoteConnection* client = RemoteConnection_create(RemoteConnectionType_Connect, 0);
+
+    assert_true(listener);
+    assert_true(client);
+    assert_true(RemoteConnection_connect(client, "127.0.0.1", Port));
+
+    for (int i = 0; i < 1000 && !RemoteConnection_isConnected(listener); ++i)
+        RemoteConnection_wait(listener, 1);
+
+    assert_true(RemoteConnection_isConnected(listener));
+
+    clock_t start = clock();
+
+    assert_true(RemoteConnection_sendStream(listener, stream) == StreamSize);
+
+    double time = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("sendStream of %d MB returned after %.2f ms (%d bytes queued)\n", StreamSize / (1024 * 1024),
+           time * 1000.0, RemoteConnection_flush(listener));
+
+    while (received < StreamSize) {
+        RemoteConnection_flush(listener);
+
+        if (RemoteConnection_pollRead(client))
+            received += RemoteConnection_recv(client, (char*)recvStream + received, StreamSize - received, 0);
+
+        assert_true(RemoteConnection_isConnected(client));
+    }
+
+    assert_true(RemoteConnection_flush(listener) == 0);
+    assert_true(memcmp(stream, recvStream, StreamSize) == 0);
+
+    RemoteConnection_destroy(client);
+    RemoteConnection_destroy(listener);
+
+    free(recvStream);
+    free(stream);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Pumps a lot of random sized frames (mixed with actions) through a connection. As the sender pushes as much as the
+// socket takes the frames arrive split at random points and several frames are received at once
+
+enum { StressFrameCount = 10000 };
+
+static int stressFrameSize(int index) {
+    int r = rand();
+
+    if (index % 7 == 0)
+        return 4;   // action
+
+    switch (r % 100) {
+        case 0: return 4 + (rand() % (1024 * 1024));
+        case 1: case 2: case 3: case 4: return 4 + (rand() % (64 * 1024));
+        default: return 4 + (rand() % 2048);
+    }
+}
+
+static void stressFrameFill(unsigned char* frame, int index, int size) {
+    if (index % 7 == 0) {
+        frame[0] = 1 << 7;
+        frame[1] = 0;
+        frame[2] = (index >> 8) & 0xff;
+        frame[3] = (index >> 0) & 0xff;
+        return;
+    }
+
+    frame[0] = (size >> 24) & 0x3f;
+    frame[1] = (size >> 16) & 0xff;
+    frame[2] = (size >> 8) & 0xff;
+    frame[3] = (size >> 0) & 0xff;
+
+    for (int i = 4; i < size; ++i)
+        frame[i] = (unsigned char)(index * 31 + i * 7);
+}
+
+void test_remote_frame_stress(void**) {
+    enum { Port = 1342, MaxQueued = 1024 * 1024 };
+
+    static int sizes[StressFrameCount];
+    unsigned char* frame = (unsigned char*)malloc(2 * 1024 * 1024);
+    unsigned char* expected = (unsigned char*)malloc(2 * 1024 * 1024);
+    int sentCount = 0;
+    int recvCount = 0;
+
+    srand(1234);
+
+    for (int i = 0; i < StressFrameCount; ++i)
+        sizes[i] = stressFrameSize(i);
+
+    RemoteConnection* listener = RemoteConnection_create(RemoteConnectionType_Listener, Port);
+    RemoteConnection* client = RemoteConnection_create(RemoteConnectionType_Connect, 0);
+
+    assert_true(listener);
+    assert_true(client);
+    assert_true(RemoteConnection_connect(client, "127.0.0.1", Port));
+
+    for (int i = 0; i < 1000 && !RemoteConnection_isConnected(listener); ++i)
+        RemoteConnection_wait(listener, 1);
+
+    assert_true(RemoteConnection_isConnected(listener));
+
+    while (recvCount < StressFrameCount) {
+        const unsigned char* data;
+        int size = 0;
+
+        // keep flushing after the last frame has been queued, nothing else sends the rest of the queue
+
+        int queued = RemoteConnection_flush(client);
+
+        while (sentCount < StressFrameCount && queued < MaxQueued) {
+            stressFrameFill(frame, sentCount, sizes[sentCount]);
+            assert_true(RemoteConnection_send(client, frame, sizes[sentCount], 0) == sizes[sentCount]);
+            sentCount++;
+            queued = RemoteConnection_flush(client);
+        }
+
+        while ((data = RemoteConnection_recvFrame(listener, &size)) != 0) {
+            assert_true(recvCount < StressFrameCount);
+            assert_true(size == sizes[recvCount]);
+
+            stressFrameFill(expected, recvCount, size);
+            assert_true(memcmp(data, expected, size) == 0);
+
+            recvCount++;
+        }
+
+        assert_true(RemoteConnection_isConnected(listener));
+        assert_true(RemoteConnection_isConnected(client));
+    }
+
+    RemoteConnection_destroy(client);
+    RemoteConnection_destroy(listener);
+
+    free(expected);
+    free(frame);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Replies to memory requests with the requested address so the replies can be checked
+
+static void* pipelineCreateInstance(ServiceFunc*) {
+    return 0;
+}
+
+static void pipelineDestroyInstance(void*) {
+}
+
+static PDDebugState pipelineUpdate(void*, PDAction, PDReader* reader, PDWriter* writer) {
+    uint32_t event;
+
+    while ((event = PDRead_get_event(reader)) != 0) {
+        uint64_t address = 0;
+
+        // the remote protocol events should never be seen by the backend
+
+        assert_true(event != PDEventType_RequestSequence && event != PDEventType_CancelRequests);
+
+        if (event != PDEventType_GetMemory)
+            continue;
+
+        PDRead_find_u64(reader, &address, "address_start", 0);
+
+        PDWrite_event_begin(writer, PDEventType_SetMemory);
+        PDWrite_u64(writer, "address", address);
+        PDWrite_event_end(writer);
+    }
+
+    return PDDebugState_Running;
+}
+
+static PDBackendPlugin s_pipelinePlugin = {
+    "PipelineTest",
+    pipelineCreateInstance,
+    pipelineDestroyInstance,
+    0,
+    pipelineUpdate,
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sendRequest(RemoteConnection* conn, PDWriter* writer, uint32_t sequence, uint64_t address) {
+    pd_binary_writer_reset(writer);
+
+    PDWrite_event_begin(writer, PDEventType_RequestSequence);
+    PDWrite_u32(writer, "id", sequence);
+    PDWrite_event_end(writer);
+
+    PDWrite_event_begin(writer, PDEventType_GetMemory);
+    PDWrite_u64(writer, "address_start", address);
+    PDWrite_u64(writer, "size", 256);
+    PDWrite_event_end(writer);
+
+    pd_binary_writer_finalize(writer);
+
+    assert_true(RemoteConnection_sendStream(conn, (unsigned char*)pd_binary_writer_get_data(writer)) > 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Several requests are sent without waiting for the replies and one of them is cancelled before the target has
+// processed it. Each reply should start with the id of the request it belongs to.
+
+void test_remote_pipelined_requests(void**) {
+    uint64_t replyAddress[4] = { 0 };
+    int replyCancelled[4] = { 0 };
+    int replyCount = 0;
+    uint32_t cancelIds[] = { 2 };
+
+    PDWriter writerData;
+    PDWriter* writer = &writerData;
+    PDReader* reader = pd_binary_reader_create();
+
+    pd_binary_writer_init(writer);
+
+    assert_true(PDRemote_create(&s_pipelinePlugin, 0) == 1);
+
+    RemoteConnection* client = RemoteConnection_create(RemoteConnectionType_Connect, 0);
+
+    assert_true(client);
+    assert_true(RemoteConnection_connect(client, "127.0.0.1", 1340));
+
+    sendRequest(client, writer, 1, 0x1000);
+    sendRequest(client, writer, 2, 0x2000);
+    sendRequest(client, writer, 3, 0x3000);
+
+    pd_binary_writer_reset(writer);
+    PDWrite_event_begin(writer, PDEventType_CancelRequests);
+    PDWrite_u32_array(writer, "ids", cancelIds, 1);
+    PDWrite_event_end(writer);
+    pd_binary_writer_finalize(writer);
+
+    assert_true(RemoteConnection_sendStream(client, (unsigned char*)pd_binary_writer_get_data(writer)) > 0);
+
+    for (int i = 0; i < 1000 && replyCount < 3; ++i) {
+        const unsigned char* frame;
+        int size = 0;
+
+        PDRemote_update(1);
+
+        while ((frame = RemoteConnection_recvFrame(client, &size)) != 0) {
+            uint32_t id = 0;
+            uint8_t cancelled = 0;
+
+            pd_binary_reader_init_stream(reader, (uint8_t*)frame, (unsigned int)size);
+
+            assert_true(PDRead_get_event(reader) == PDEventType_RequestSequence);
+            assert_true(PDRead_find_u32(reader, &id, "id", 0) & PDReadStatus_Ok);
+            assert_true(id >= 1 && id <= 3);
+
+            PDRead_find_u8(reader, &cancelled, "cancelled", 0);
+            replyCancelled[id] = cancelled;
+
+            if (PDRead_get_event(reader) == PDEventType_SetMemory)
+                PDRead_find_u64(reader, &replyAddress[id], "address", 0);
+
+            replyCount++;
+        }
+    }
+
+    assert_true(replyCount == 3);
+
+    assert_true(!replyCancelled[1] && replyAddress[1] == 0x1000);
+    assert_true(replyCancelled[2] && replyAddress[2] == 0);
+    assert_true(!replyCancelled[3] && replyAddress[3] == 0x3000);
+
+    RemoteConnection_destroy(client);
+    PDRemote_destroy();
+
+    pd_binary_reader_destroy(reader);
+    pd_binary_writer_destroy(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PDAction s_lastAction;
+
+static PDDebugState actionUpdate(void* userData, PDAction action, PDReader* reader, PDWriter* writer) {
+    if (action != PDAction_None)
+        s_lastAction = action;
+
+    return pipelineUpdate(userData, action, reader, writer);
+}
+
+static PDBackendPlugin s_actionPlugin = {
+    "ActionTest",
+    pipelineCreateInstance,
+    pipelineDestroyInstance,
+    0,
+    actionUpdate,
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// An action that arrives after a request in the same update has no stream to go with and should be sent to the
+// plugin on its own
+
+void test_remote_trailing_action(void**) {
+    unsigned char action[4] = { 1 << 7, 0, 0, PDAction_Break };
+    int replyCount = 0;
+
+    PDWriter writerData;
+    PDWriter* writer = &writerData;
+
+    pd_binary_writer_init(writer);
+
+    assert_true(PDRemote_create(&s_actionPlugin, 0) == 1);
+
+    RemoteConnection* client = RemoteConnection_create(RemoteConnectionType_Connect, 0);
+
+    assert_true(client);
+    assert_true(RemoteConnection_connect(client, "127.0.0.1", 1340));
+
+    // both are queued before the target is updated so they are handled in the same update
+
+    sendRequest(client, writer, 1, 0x1000);
+    assert_true(RemoteConnection_send(client, action, sizeof(action), 0) == sizeof(action));
+
+    RemoteConnection_flush(client);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    for (int i = 0; i < 1000 && (replyCount == 0 || s_lastAction == PDAction_None); ++i) {
+        int size = 0;
+
+        PDRemote_update(1);
+
+        while (RemoteConnection_recvFrame(client, &size) != 0)
+            replyCount++;
+    }
+
+    assert_true(replyCount > 0);
+    assert_true(s_lastAction == PDAction_Break);
+
+    RemoteConnection_destroy(client);
+    PDRemote_destroy();
+
+    pd_binary_writer_destroy(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The debugger sends an action right before a request and the next request cancels it. The action should still
+// reach the plugin (with the request after it). A direct connection hands out the frames after an action frame in the
+// next update (they aren't 8 byte aligned) so this uses the service thread which queues all of them together.
+
+// Copies the finalized stream of the writer to dest and returns the size of it
+
+static int appendStream(unsigned char* dest, PDWriter* writer) {
+    const unsigned char* data = pd_binary_writer_get_data(writer);
+    int size = ((data[0] & 0x3f) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+
+    memcpy(dest, data, size);
+
+    return size;
+}
+
+void test_remote_action_before_cancelled(void**) {
+    enum { Port = 1350 };
+
+    unsigned char action[4] = { 1 << 7, 0, 0, PDAction_Step };
+    uint32_t cancelIds[] = { 1 };
+    int replyCount = 0;
+
+    PDWriter writerData;
+    PDWriter* writer = &writerData;
+
+    pd_binary_writer_init(writer);
+
+    s_lastAction = PDAction_None;
+
+    PDRemoteInstance* instance = PDRemote_createInstance(&s_actionPlugin, Port);
+
+    assert_true(instance);
+    assert_true(PDRemote_startInstanceThread(instance));
+
+    RemoteConnection* client = RemoteConnection_create(RemoteConnectionType_Connect, 0);
+
+    assert_true(client);
+    assert_true(RemoteConnection_connect(client, "127.0.0.1", Port));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    unsigned char frames[1024];
+    int size = sizeof(action);
+
+    memcpy(frames, action, sizeof(action));
+
+    pd_binary_writer_reset(writer);
+    PDWrite_event_begin(writer, PDEventType_RequestSequence);
+    PDWrite_u32(writer, "id", 1);
+    PDWrite_event_end(writer);
+    PDWrite_event_begin(writer, PDEventType_GetMemory);
+    PDWrite_u64(writer, "address_start", 0x1000);
+    PDWrite_event_end(writer);
+    pd_binary_writer_finalize(writer);
+
+    size += appendStream(frames + size, writer);
+
+    pd_binary_writer_reset(writer);
+    PDWrite_event_begin(writer, PDEventType_RequestSequence);
+    PDWrite_u32(writer, "id", 2);
+    PDWrite_event_end(writer);
+    PDWrite_event_begin(writer, PDEventType_CancelRequests);
+    PDWrite_u32_array(writer, "ids", cancelIds, 1);
+    PDWrite_event_end(writer);
+    pd_binary_writer_finalize(writer);
+
+    size += appendStream(frames + size, writer);
+
+    assert_true(RemoteConnection_send(client, frames, size, 0) == size);
+
+    RemoteConnection_flush(client);
+
+    // give the service thread time to queue all the frames before the target takes them
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    for (int i = 0; i < 1000 && replyCount < 2; ++i) {
+        PDRemote_updateInstance(instance, 1);
+
+        while (RemoteConnection_recvFrame(client, &size) != 0)
+            replyCount++;
+    }
+
+    assert_true(replyCount == 2);
+    assert_true(s_lastAction == PDAction_Step);
+
+    RemoteConnection_destroy(client);
+    PDRemote_destroyInstance(instance);
+
+    pd_binary_writer_destroy(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Several targets in one process, each with its own port and updated from its own thread. Every client should only
+// get the replies from the instance it's connected to.
+
+void test_remote_instances(void**) {
+    enum { InstanceCount = 4, RequestCount = 100, BasePort = 1343 };
+
+    PDRemoteInstance* instances[InstanceCount];
+    RemoteConnection* clients[InstanceCount];
+    std::thread threads[InstanceCount];
+    std::atomic<int> running(1);
+    int replyCount[InstanceCount] = { 0 };
+    int totalReplies = 0;
+
+    PDWriter writerData;
+    PDWriter* writer = &writerData;
+    PDReader* reader = pd_binary_reader_create();
+
+    pd_binary_writer_init(writer);
+
+    for (int i = 0; i < InstanceCount; ++i) {
+        instances[i] = PDRemote_createInstance(&s_pipelinePlugin, BasePort + i);
+        assert_true(instances[i]);
+
+        PDRemoteInstance* instance = instances[i];
+
+        threads[i] = std::thread([instance, &running]() {
+            while (running)
+                PDRemote_updateInstance(instance, 1);
+        });
+    }
+
+    for (int i = 0; i < InstanceCount; ++i) {
+        clients[i] = RemoteConnection_create(RemoteConnectionType_Connect, 0);
+        assert_true(clients[i]);
+        assert_true(RemoteConnection_connect(clients[i], "127.0.0.1", BasePort + i));
+
+        // the address tells which instance the request was sent to
+
+        for (int r = 0; r < RequestCount; ++r)
+            sendRequest(clients[i], writer, (uint32_t)r + 1, ((uint64_t)i << 32) | (uint64_t)r);
+    }
+
+    for (int t = 0; t < 10000 && totalReplies < InstanceCount * RequestCount; ++t) {
+        for (int i = 0; i < InstanceCount; ++i) {
+            const unsigned char* frame;
+            int size = 0;
+
+            RemoteConnection_wait(clients[i], 0);
+
+            while ((frame = RemoteConnection_recvFrame(clients[i], &size)) != 0) {
+                uint32_t id = 0;
+                uint64_t address = ~0ULL;
+
+                pd_binary_reader_init_stream(reader, (uint8_t*)frame, (unsigned int)size);
+
+                assert_true(PDRead_get_event(reader) == PDEventType_RequestSequence);
+                assert_true(PDRead_find_u32(reader, &id, "id", 0) & PDReadStatus_Ok);
+                assert_true(PDRead_get_event(reader) == PDEventType_SetMemory);
+                assert_true(PDRead_find_u64(reader, &address, "address", 0) & PDReadStatus_Ok);
+
+                assert_true(address == (((uint64_t)i << 32) | (uint64_t)(id - 1)));
+
+                replyCount[i]++;
+                totalReplies++;
+            }
+        }
+
+        Time_sleepMs(1);
+    }
+
+    running = 0;
+
+    for (int i = 0; i < InstanceCount; ++i) {
+        threads[i].join();
+
+        assert_true(replyCount[i] == RequestCount);
+
+        RemoteConnection_destroy(clients[i]);
+        PDRemote_destroyInstance(instances[i]);
+    }
+
+    pd_binary_reader_destroy(reader);
+    pd_binary_writer_destroy(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The connection is handled by the service thread and the target only checks the pending flag in its execution loop.
+// The target should only be updated when requests have arrived and every request should get its reply.
+
+void test_remote_service_thread(void**) {
+    enum { Port = 1348, RequestCount = 200 };
+
+    std::atomic<int> running(1);
+    std::atomic<int> updateCount(0);
+    int replyCount = 0;
+
+    PDWriter writerData;
+    PDWriter* writer = &writerData;
+    PDReader* reader = pd_binary_reader_create();
+
+    pd_binary_writer_init(writer);
+
+    PDRemoteInstance* instance = PDRemote_createInstance(&s_pipelinePlugin, Port);
+
+    assert_true(instance);
+    assert_true(PDRemote_getInstancePendingFlag(instance) == 0);
+    assert_true(PDRemote_startInstanceThread(instance));
+
+    const volatile int* pending = PDRemote_getInstancePendingFlag(instance);
+
+    assert_true(pending);
+
+    std::thread target([instance, pending, &running, &updateCount]() {
+        for (uint32_t i = 0; running; ++i) {
+            if (PDRemote_isPending(pending)) {
+                PDRemote_updateInstance(instance, 0);
+                updateCount++;
+            }
+
+            if ((i & 4095) == 0)
+                std::this_thread::yield();
+        }
+    });
+
+    RemoteConnection* client = RemoteConnection_create(RemoteConnectionType_Connect, 0);
+
+    assert_true(client);
+    assert_true(RemoteConnection_connect(client, "127.0.0.1", Port));
+
+    for (int r = 0; r < RequestCount; ++r)
+        sendRequest(client, writer, (uint32_t)r + 1, 0x1000 + (uint64_t)r);
+
+    for (int t = 0; t < 10000 && replyCount < RequestCount; ++t) {
+        const unsigned char* frame;
+        int size = 0;
+
+        RemoteConnection_wait(client, 1);
+
+        while ((frame = RemoteConnection_recvFrame(client, &size)) != 0) {
+            uint32_t id = 0;
+            uint64_t address = 0;
+
+            pd_binary_reader_init_stream(reader, (uint8_t*)frame, (unsigned int)size);
+
+            assert_true(PDRead_get_event(reader) == PDEventType_RequestSequence);
+            assert_true(PDRead_find_u32(reader, &id, "id", 0) & PDReadStatus_Ok);
+            assert_true(PDRead_get_event(reader) == PDEventType_SetMemory);
+            assert_true(PDRead_find_u64(reader, &address, "address", 0) & PDReadStatus_Ok);
+            assert_true(address == 0x1000 + (uint64_t)(id - 1));
+
+            replyCount++;
+        }
+    }
+
+    running = 0;
+    target.join();
+
+    assert_true(replyCount == RequestCount);
+    assert_true(updateCount > 0 && updateCount <= RequestCount);
+    assert_true(PDRemote_isInstanceConnected(instance));
+
+    RemoteConnection_destroy(client);
+    PDRemote_destroyInstance(instance);
+
+    pd_binary_reader_destroy(reader);
+    pd_binary_writer_destroy(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Replies to memory requests with memory like data (which compresses well)
+
+enum { CompressMemorySize = 64 * 1024 };
+
+static uint8_t s_compressMemory[CompressMemorySize];
+
+static PDDebugState compressUpdate(void*, PDAction, PDReader* reader, PDWriter* writer) {
+    uint32_t event;
+
+    while ((event = PDRead_get_event(reader)) != 0) {
+        assert_true(event != PDEventType_RemoteCapabilities);
+
+        if (event != PDEventType_GetMemory)
+            continue;
+
+        PDWrite_event_begin(writer, PDEventType_SetMemory);
+        PDWrite_data(writer, "data", s_compressMemory, CompressMemorySize);
+        PDWrite_event_end(writer);
+    }
+
+    return PDDebugState_Running;
+}
+
+static PDBackendPlugin s_compressPlugin = {
+    "CompressTest",
+    pipelineCreateInstance,
+    pipelineDestroyInstance,
+    0,
+    compressUpdate,
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sends a memory request and returns the size of the reply stream (after checking the data in it)
+
+static int compressRequest(PDRemoteInstance* instance, RemoteConnection* client, PDWriter* writer, PDReader* reader,
+                           uint32_t* compression) {
+    int replySize = 0;
+
+    sendRequest(client, writer, 1, 0x1000);
+
+    for (int i = 0; i < 1000 && replySize == 0; ++i) {
+        const unsigned char* frame;
+        int size = 0;
+
+        PDRemote_updateInstance(instance, 1);
+
+        while ((frame = RemoteConnection_recvFrame(client, &size)) != 0) {
+            uint32_t event;
+
+            pd_binary_reader_init_stream(reader, (uint8_t*)frame, (unsigned int)size);
+
+            while ((event = PDRead_get_event(reader)) != 0) {
+                void* data = 0;
+                uint64_t dataSize = 0;
+
+                if (event == PDEventType_RemoteCapabilities)
+                    assert_true(PDRead_find_u32(reader, compression, "compression", 0) & PDReadStatus_Ok);
+
+                if (event != PDEventType_SetMemory)
+                    continue;
+
+                assert_true(PDRead_find_data(reader, &data, &dataSize, "data", 0) == (PDReadType_Data | PDReadStatus_Ok));
+                assert_true(dataSize == CompressMemorySize);
+                assert_true(!memcmp(data, s_compressMemory, CompressMemorySize));
+
+                replySize = size;
+            }
+        }
+    }
+
+    assert_true(replySize != 0);
+
+    return replySize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Large data is only compressed after the debugger has told that it supports it and only for that connection
+
+void test_remote_compression(void**) {
+    enum { Port = 1349 };
+
+    uint32_t compression = 0;
+
+    PDWriter writerData;
+    PDWriter* writer = &writerData;
+    PDReader* reader = pd_binary_reader_create();
+
+    pd_binary_writer_init(writer);
+
+    for (int i = 0; i < CompressMemorySize; ++i)
+        s_compressMemory[i] = i < CompressMemorySize / 2 ? (uint8_t)((i * 7) % 64) : 0xea;
+
+    PDRemoteInstance* instance = PDRemote_createInstance(&s_compressPlugin, Port);
+
+    assert_true(instance);
+
+    for (int c = 0; c < 2; ++c) {
+        RemoteConnection* client = RemoteConnection_create(RemoteConnectionType_Connect, 0);
+
+        assert_true(client);
+        assert_true(RemoteConnection_connect(client, "127.0.0.1", Port));
+
+        assert_true(compressRequest(instance, client, writer, reader, &compression) > CompressMemorySize);
+
+        if (c == 0) {
+            pd_binary_writer_reset(writer);
+            PDWrite_event_begin(writer, PDEventType_RemoteCapabilities);
+            PDWrite_u32(writer, "compression", PDRemoteCompression_Lz | (1 << 16));  // unknown methods are ignored
+            PDWrite_event_end(writer);
+            pd_binary_writer_finalize(writer);
+
+            assert_true(RemoteConnection_sendStream(client, (unsigned char*)pd_binary_writer_get_data(writer)) > 0);
+
+            assert_true(compressRequest(instance, client, writer, reader, &compression) < CompressMemorySize / 4);
+            assert_true(compression == PDRemoteCompression_Lz);
+        }
+
+        // the next connection has to ask for compression again
+
+        RemoteConnection_destroy(client);
+
+        for (int i = 0; i < 100 && PDRemote_isInstanceConnected(instance); ++i)
+            PDRemote_updateInstance(instance, 1);
+    }
+
+    PDRemote_destroyInstance(instance);
+
+    pd_binary_reader_destroy(reader);
+    pd_binary_writer_destroy(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Compares the transports for a target on the same machine. The target side runs on its own thread and first
+// receives a batch of large frames (throughput) and then echoes small frames back (latency)
+
+enum {
+    BenchFrameSize = 1024 * 1024,
+    BenchFrameCount = 128,
+    BenchPingSize = 64,
+    BenchPingCount = 10000,
+    BenchMaxQueued = 4 * 1024 * 1024,
+};
+
+static void setFrameSize(unsigned char* frame, int size) {
+    frame[0] = (size >> 24) & 0x3f;
+    frame[1] = (size >> 16) & 0xff;
+    frame[2] = (size >> 8) & 0xff;
+    frame[3] = (size >> 0) & 0xff;
+}
+
+static void benchmarkTarget(RemoteConnection* listener) {
+    static const unsigned char ack[4] = { 1 << 7, 0, 0, 0 };
+    int received = 0;
+    int echoed = 0;
+
+    while (echoed < BenchPingCount) {
+        const unsigned char* frame;
+        int size = 0;
+
+        RemoteConnection_wait(listener, 1);
+
+        while ((frame = RemoteConnection_recvFrame(listener, &size)) != 0) {
+            if (received < BenchFrameCount) {
+                assert_true(size == BenchFrameSize);
+
+                if (++received == BenchFrameCount)
+                    RemoteConnection_send(listener, ack, sizeof(ack), 0);
+            } else {
+                assert_true(size == BenchPingSize);
+                RemoteConnection_send(listener, frame, size, 0);
+                echoed++;
+            }
+        }
+    }
+
+    // make sure the last reply has been sent before the connection is destroyed
+
+    while (RemoteConnection_flush(listener) != 0)
+        RemoteConnection_wait(listener, 1);
+}
+
+static const unsigned char* benchmarkRecv(RemoteConnection* client, int* size) {
+    const unsigned char* frame;
+
+    while ((frame = RemoteConnection_recvFrame(client, size)) == 0) {
+        assert_true(RemoteConnection_isConnected(client));
+        RemoteConnection_wait(client, 1);
+    }
+
+    return frame;
+}
+
+static void benchmarkTransport(const char* name, const char* listenAddress, const char* connectAddress) {
+    RemoteConnection* listener = RemoteConnection_createAddress(RemoteConnectionType_Listener, listenAddress);
+
+    if (!listener) {
+        printf("%s: not supported, skipped\n", name);
+        return;
+    }
+
+    RemoteConnection* client = RemoteConnection_create(RemoteConnectionType_Connect, 0);
+    unsigned char* frame = (unsigned char*)calloc(1, BenchFrameSize);
+    int size = 0;
+
+    assert_true(client);
+    assert_true(RemoteConnection_connectAddress(client, connectAddress));
+
+    std::thread target(benchmarkTarget, listener);
+
+    auto start = std::chrono::steady_clock::now();
+
+    setFrameSize(frame, BenchFrameSize);
+
+    for (int sent = 0; sent < BenchFrameCount; ) {
+        if (RemoteConnection_flush(client) < BenchMaxQueued) {
+            assert_true(RemoteConnection_send(client, frame, BenchFrameSize, 0) == BenchFrameSize);
+            sent++;
+        } else {
+            RemoteConnection_wait(client, 1);
+        }
+    }
+
+    benchmarkRecv(client, &size);
+    assert_true(size == 4);
+
+    std::chrono::duration<double> throughputTime = std::chrono::steady_clock::now() - start;
+
+    setFrameSize(frame, BenchPingSize);
+
+    start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < BenchPingCount; ++i) {
+        assert_true(RemoteConnection_send(client, frame, BenchPingSize, 0) == BenchPingSize);
+        benchmarkRecv(client, &size);
+        assert_true(size == BenchPingSize);
+    }
+
+    std::chrono::duration<double> latencyTime = std::chrono::steady_clock::now() - start;
+
+    target.join();
+
+    printf("%s: %.1f MB/s, %.1f us round trip\n", name,
+           (double)BenchFrameCount * BenchFrameSize / (1024.0 * 1024.0) / throughputTime.count(),
+           latencyTime.count() * 1000000.0 / BenchPingCount);
+
+    RemoteConnection_destroy(client);
+    RemoteConnection_destroy(listener);
+
+    free(frame);
+}
+
+void test_remote_transport_benchmark(void**) {
+    benchmarkTransport("tcp", "tcp:1347", "tcp:127.0.0.1:1347");
+    benchmarkTransport("unix", "unix:/tmp/prodbg_remote_bench.sock", "unix:/tmp/prodbg_remote_bench.sock");
+    benchmarkTransport("shm", "shm:prodbg_remote_bench", "shm:prodbg_remote_bench");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 int main() {
     int ret = 0;
 
+    const UnitTest idleTests[] =
+    {
+        unit_test(test_remote_idle_update),
+        unit_test(test_remote_large_stream),
+        unit_test(test_remote_frame_stress),
+        unit_test(test_remote_pipelined_requests),
+        unit_test(test_remote_trailing_action),
+        unit_test(test_remote_action_before_cancelled),
+        unit_test(test_remote_instances),
+        unit_test(test_remote_service_thread),
+        unit_test(test_remote_compression),
+        unit_test(test_remote_transport_benchmark),
+    };
+
     const UnitTest tests[] =
     {
         unit_test(test_remote_session),
     };
 
+    // has to be done before starting fake6502 as it listens on the same port
+
+    if ((ret = run_tests(idleTests)) != 0)
+        return ret;
+
     static const char* fake_exe = OBJECT_DIR "/fake6502";
     static const char* argv[] = {fake_exe, "examples/fake_6502/test.bin", 0};
 
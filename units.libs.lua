@@ -249,6 +249,7 @@ StaticLibrary {
 
     Sources = {
             "api/src/remote/remote_connection.c",
+            "api/src/remote/remote_shm.c",
     },
 
 	IdeGenerationHints = { Msvc = { SolutionFolder = "Libs" } },
@@ -31,7 +31,10 @@ Program {
         },
     },
 
-    Libs = { { "wsock32.lib", "kernel32.lib" ; Config = { "win32-*-*", "win64-*-*" } } },
+    Libs = {
+        { "wsock32.lib", "kernel32.lib" ; Config = { "win32-*-*", "win64-*-*" } },
+        { "rt", "pthread" ; Config = { "linux-*-*" } },
+    },
 
     Depends = { "remote_api" },
 